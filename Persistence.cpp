@@ -37,11 +37,35 @@
  *  C H A N G E  L O G :
  *  ==========================================================================
  *  P0001 - Initial release 
+ *  P0002 - RAM resident name index for area lookups
+ *  P0003 - Handle based area access
+ *  P0004 - Cached memory layout descriptor
+ *  P0005 - Block level EEPROM reads
+ *  P0006 - Differential write engine with write statistics
+ *  P0007 - Pluggable storage backends, host builds
+ *  P0009 - Write-back cache with dirty range tracking
+ *  P0011 - Free cell coalescing, best fit allocation from a RAM free list
+ *  P0012 - Complete an interrupted compaction when loading the layout
+ *  P0013 - Superblock, area chain starts after it in a formatted store
+ *  P0014 - Per area checksums, optional write verification
+ *  P0015 - Ranged reads and writes
+ *  P0017 - Version byte in the header of registered areas
+ *  P0018 - Name hash in the area header, compared first by the chain walk
+ *  P0019 - Compact area headers, walks only read the next and data fields
+ *  P0022 - Reads see the asynchronous write queue, writes drain it first
+ *  P0023 - Mount, the chain walk checks the headers and reports
+ *  P0025 - Resizing an area in place, relocating it as a last resort
+ *  P0026 - Batched allocation, names checked and headers written per batch
  *  ==========================================================================
  *
  *--------------------------------------------------------------------------*/
 #include <Persistence.h>
 
+//
+//  Size of the RAM buffer used when scanning persistent memory in blocks
+//
+#define PERSISTENT_SCAN_CHUNK        32
+
 /**-----------------------------------------------------------------------------
  *
  *  Compare two strings, addr is the EEPROM address of a a string,
@@ -82,13 +106,26 @@ int16_t persistentStrCmp(uint32_t s1, char *s2) {
 /*--------------------------------------------------------------------------------------------------
  *
  *  Returns true if the persistence store is virgin, i.e. not written in before.
+ *  A formatted store is not virgin, which only takes reading the superblock.
+ *  Any other store is scanned entirely.
  *
  *------------------------------------------------------------------------------------------------*/
 bool isPersistentStorageVirgin() {
 
-   for (int i = 0; i < EEPROM_SIZE; i++) {
-      if (EEPROM.read(i) != 0xff)
-        return false;
+   if (persistentIsFormatted())
+      return false;
+
+   unsigned char chunk[PERSISTENT_SCAN_CHUNK];
+   uint32_t size = EEPROM_SIZE;
+
+   for (uint32_t addr = 0; addr < size; addr += sizeof(chunk)) {
+      uint16_t n = (size - addr < sizeof(chunk)) ? size - addr : sizeof(chunk);
+      persistentRead(addr, (char*)chunk, n);
+
+      for (uint16_t i = 0; i < n; i++) {
+         if (chunk[i] != 0xff)
+           return false;
+      }
    }
 
    return true;
@@ -96,38 +133,148 @@ bool isPersistentStorageVirgin() {
 
 /**-------------------------------------------------------------------------------------------------
  *
- *  Store EEPROM data persistently
+ *  Bytes compared, skipped and programmed by the write engine.
+ *
+ *------------------------------------------------------------------------------------------------*/
+static struct persistentWriteStats persistentWriteCounters;
+
+/**-------------------------------------------------------------------------------------------------
+ *
+ *  The write engine, all writes to persistent memory go through here.
+ *  Programming an EEPROM byte is slow (about 3.3 ms on AVR) and wears the
+ *  cell, so only the bytes that differ are programmed. The persistent memory
+ *  is compared a chunk at a time, using block reads. Each run of differing
+ *  bytes is passed to the backend in one write. A chunk in which bytes
+ *  were programmed is read back once to verify it, unless
+ *  PERSISTENT_VERIFY_WRITES is 0.
  *
  *  @param addr      Address of the persistent memory where the data is to be stored
- *  @param data      data to be stored
+ *  @param data      data to be stored, or 0 to store the fill value in every byte
+ *  @param fill      The value stored if data is 0
  *  @param size      The size of the data in bytes
- *  @return  > 0 store succeeded. The positive number represents the bytes written
- *           < 0 Error code
- *           -1 - Write error. Read back was not equal to byte value written.
+ *  @return  >= 0 The number of bytes stored, which equals size
+ *           <  0 Write error, the offset of the failing byte is -1 - return value.
  *
  *------------------------------------------------------------------------------------------------*/
-int32_t persistentStore(uint32_t addr, char* data, uint16_t size) {
+static int32_t persistentWriteBlock(uint32_t addr, const char* data,
+		                            unsigned char fill, uint16_t size) {
+
+   const struct persistentBackend* backend = persistentGetBackend();
+   unsigned char chunk[PERSISTENT_SCAN_CHUNK];
+
+#if PERSISTENT_ASYNC_QUEUE > 0
+   //
+   //  Queued bytes are programmed first, so a queued byte never
+   //  overwrites the byte written here.
+   //
+   if (persistentAsyncPending())
+     persistentAsyncFlush();
+#endif
+
+   for (uint16_t done = 0; done < size; ) {
+     uint16_t left = size - done;
+     uint16_t n    = (left < sizeof(chunk)) ? left : sizeof(chunk);
 
-   for (unsigned long i = 0; i < size; i++) {
      //
-     // Only write if data differs from what has already bee stored
+     //  Read what is stored and program the bytes that differ
      //
-     if (EEPROM.read(addr) != data) {
-       EEPROM.write((int)addr, *data);
+     persistentRead(addr + done, (char*)chunk, n);
+
+     uint16_t programmed = 0;
+     for (uint16_t i = 0; i < n; ) {
 
        //
-       //  Check if the the byte value written is equal to the value read back
+       //  Find the next run of bytes that differ,
+       //  replacing the stored values by the values to write.
        //
+       uint16_t run = i;
+       while (run < n) {
+         unsigned char c = data ? (unsigned char)data[done + run] : fill;
+         if (chunk[run] == c)
+           break;
+         chunk[run++] = c;
+       }
+
+       if (run > i) {
+         backend->write(backend->device, addr + done + i, (char*)chunk + i, run - i);
+         programmed += run - i;
+         i = run;
+       }
+       else {
+         i++;
+       }
+     }
 
-       if ((unsigned char)EEPROM.read((int)addr) != (unsigned char)*data)
-    	   return -1;
+     persistentWriteCounters.compared   += n;
+     persistentWriteCounters.skipped    += n - programmed;
+     persistentWriteCounters.programmed += programmed;
 
-       //
-       //  Successfully written, succeed to next byte
-       //
-       addr++;
-       data++;
+#if PERSISTENT_VERIFY_WRITES
+     //
+     //  Verify the chunk if anything was programmed
+     //
+     if (programmed) {
+       persistentRead(addr + done, (char*)chunk, n);
+       for (uint16_t i = 0; i < n; i++) {
+         unsigned char c = data ? (unsigned char)data[done + i] : fill;
+         if (chunk[i] != c)
+           return -1 - (int32_t)(done + i);
+       }
      }
+#endif
+
+     done += n;
+   }
+
+   return size;
+}
+
+/**-------------------------------------------------------------------------------------------------
+ *
+ *  Returns the write engine statistics gathered since the last reset.
+ *
+ *  @param stats     The struct to copy the statistics into
+ *
+ *------------------------------------------------------------------------------------------------*/
+void persistentGetWriteStats(struct persistentWriteStats* stats) {
+   *stats = persistentWriteCounters;
+}
+
+/**-------------------------------------------------------------------------------------------------
+ *
+ *  Resets the write engine statistics.
+ *
+ *------------------------------------------------------------------------------------------------*/
+void persistentResetWriteStats() {
+   memset(&persistentWriteCounters, 0, sizeof(persistentWriteCounters));
+}
+
+/**-------------------------------------------------------------------------------------------------
+ *
+ *  Store EEPROM data persistently
+ *
+ *  @param addr      Address of the persistent memory where the data is to be stored
+ *  @param data      data to be stored
+ *  @param size      The size of the data in bytes
+ *  @return  > 0 store succeeded. The positive number represents the bytes written
+ *           < 0 Error code
+ *           -1 - Write error. Read back was not equal to byte value written.
+ *
+ *------------------------------------------------------------------------------------------------*/
+int32_t persistentStore(uint32_t addr, char* data, uint16_t size) {
+
+   //
+   // Only bytes that differ from what has already been stored are written
+   //
+   if (persistentWriteBlock(addr, data, 0, size) < 0)
+	   return -1;
+
+   //
+   //  If the calibration data sizes were written, the layout has changed
+   //
+   if (addr < EPR16_TFT_CALIBR_Y_S + sizeof(uint16_t) &&
+	   addr + size > EPR16_TFT_CALIBR_X_S) {
+	   persistentLoadLayout();
    }
 
    //
@@ -140,6 +287,8 @@ int32_t persistentStore(uint32_t addr, char* data, uint16_t size) {
 /*--------------------------------------------------------------------------------------------------
  *
  *  Read persisted data
+ *  All reads end up here and are passed as one block to the backend, which
+ *  uses the fastest block read it has (see PersistentBackend.cpp).
  *
  *  addr      Address of the persistent memory where the data is stored
  *  data      memory area the persisted data must be copied into
@@ -149,11 +298,15 @@ int32_t persistentStore(uint32_t addr, char* data, uint16_t size) {
 
 void persistentRead(uint32_t addr, char* data, uint16_t size) {
 
-   for (unsigned long i = 0; i < size; i++) {
-     *data = EEPROM.read((int)addr++);
-     data++;
-   }
-
+#if PERSISTENT_ASYNC_QUEUE > 0
+   //
+   //  Bytes that are still queued are read from the queue
+   //
+   persistentAsyncRead(addr, data, size);
+#else
+   const struct persistentBackend* backend = persistentGetBackend();
+   backend->read(backend->device, addr, data, size);
+#endif
 }
 
 /**----------------------------------------------------------------------------
@@ -170,10 +323,7 @@ void persistentRead(uint32_t addr, char* data, uint16_t size) {
 
 char* persistentRead(uint32_t addr, uint16_t dataSize, char* data) {
 
-	uint16_t  i = 0;
-	while (i++ < dataSize) {
-		*data++ = EEPROM[addr++];
-	}
+	persistentRead(addr, data, dataSize);
 
 	return data;
 }
@@ -193,26 +343,12 @@ char* persistentRead(uint32_t addr, uint16_t dataSize, char* data) {
  *---------------------------------------------------------------------------*/
 int32_t persistentClear(uint32_t addr, unsigned char clearWith, uint16_t size) {
 
-   uint32_t addrWr = addr;
-   for (unsigned long i = 0; i < size; i++) {
-     //
-     // Only write if data differs from what has already bee stored
-     //
-     if ((unsigned char)EEPROM.read(addrWr) != clearWith) {
-       EEPROM.write((int)addrWr, (unsigned char)clearWith);
-
-       //
-       //  Check if the the byte value written is equal to the value read back
-       //
-       if ((unsigned char)EEPROM.read((int)addrWr) != clearWith)
-    	   return -(addrWr - addr);
-
-       //
-       //  Successfully written, succeed to next byte
-       //
-       addrWr++;
-     }
-   }
+   //
+   // Only bytes that differ from clearWith are written
+   //
+   int32_t rv = persistentWriteBlock(addr, 0, clearWith, size);
+   if (rv < 0)
+	   return rv + 1;   // Minus the offset of the failing byte
 
    //
    //  Returns the size of the stored data,
@@ -222,637 +358,2541 @@ int32_t persistentClear(uint32_t addr, unsigned char clearWith, uint16_t size) {
 }
 
 
+//=============================================================================
+//
+//  R A M   N A M E   I N D E X
+//
+//=============================================================================
+
 /**----------------------------------------------------------------------------
  *
- * Returns the EEPROM address of a persistent area.
+ *  Calculates the hash of an area name (32 bit FNV-1a).
+ *  Like persistentStrCmp() it takes at most PERSISTENT_AREA_NAME_SIZE
+ *  characters into consideration, so it can be used on the name field
+ *  of a header, which is not '\0' terminated if the name is 16 long.
  *
- * @param name     The name of memory area
+ *  @param name  The area name
  *
- * @return   >0 The memory area EEPROM address
- *            0 Area was not found.
+ *  @return      The hash value of the name
  *
  *---------------------------------------------------------------------------*/
-uint32_t getPersistentAreaAddress(char* name) {
+uint32_t persistentNameHash(char* name) {
 
-  //
-  //  For as long as there is initialized EEPROM memory,
-  //  search for the area name specified.
-  //
-  for (uint32_t addr = EPR_START_FREE; addr < EPR_END_FREE; addr += EEPROM_RD_INT(addr)) {
-    if (addr == 0xffff) // If uninitialized EEPROM, then end of used EEPROM
-	  return 0;
-
-    if (! persistentStrCmp(addr+2*sizeof(uint16_t), name)) {
-	  return (uint32_t)addr + PERSISTENT_AREA_PREFIX_SIZE;
+	uint32_t hash = 2166136261UL;
+	for (int i = 0; i < PERSISTENT_AREA_NAME_SIZE && name[i]; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619UL;
 	}
-  }
 
-  return 0;
+	return hash;
 }
 
 /**----------------------------------------------------------------------------
  *
- *  Returns the EEPROM address of the area header.
- *
- *  NOTE: This DIFFERS from the address returned by getPersistentAreaAddress(),
- *        which is the address of the data part of an area!!!!
+ *  Calculates the 8 bit name hash kept in the high byte of the data field
+ *  of an area header. It folds persistentNameHash() into a byte, 0 is
+ *  mapped onto 1 because 0 marks a header without a hash.
  *
- * @param name  The name of the memory area
+ *  @param name  The area name
  *
- * @return  > 0  The header address of the memory area
- *            0  Error, area with that name was unknown.
+ *  @return      The hash value of the name, 1 - 255
  *
  *---------------------------------------------------------------------------*/
-uint32_t getPersistentHeaderAddress(char* name) {
+uint8_t persistentHeaderHash(char* name) {
 
-  //
-  //  For as long as there is initialized EEPROM memory,
-  //  search for the area name specified.
-  //
-  for (uint32_t addr = EPR_START_FREE; addr < EPR_END_FREE; addr += EEPROM_RD_INT(addr)) {
-    if (addr == 0xffff) { // If uninitialized EEPROM, then end of used EEPROM
-	  return 0;
-    }
-
-    if (! persistentStrCmp(addr+2*sizeof(uint16_t), name)) {
-	  return (uint32_t)addr;
-	}
-  }
+	uint32_t hash = persistentNameHash(name);
+	hash ^= hash >> 16;
+	hash ^= hash >> 8;
 
-  return 0;
+	return (uint8_t)hash ? (uint8_t)hash : 1;
 }
 
 /**----------------------------------------------------------------------------
  *
- *  Returns true if the persistent data area exists, otherwise false.
- *
- * @param name  The name of the desired persistent data area.
- * @return      True if data area exists, otherwise false.
+ *  Returns the length of an area name as it is stored in a header,
+ *  at most PERSISTENT_AREA_NAME_SIZE.
  *
  *---------------------------------------------------------------------------*/
-bool hasPersistentArea(char* name) {
-	//
-	//  If the area exists, then return true.
-	//
-	if (getPersistentHeaderAddress(name))
-		return true;
+static uint8_t persistentNameLength(char* name) {
 
-	//
-	// Otherwise return false.
-	//
-	return false;
+	uint8_t len = 0;
+	while (len < PERSISTENT_AREA_NAME_SIZE && name[len])
+		len++;
+
+	return len;
 }
 
 /**----------------------------------------------------------------------------
  *
- *  Allocates a free header by writing the persistent Area Header:
- *  *next 16 bit offset to the next header area
- *  *data 16 bit offset to the data
- *  *name max 15 bytes + 1 '\0' for the area name
- *
- * @param name  The name of the header, which must be unique
- * @param addr  The address from getNewPersistentHeader(uint16_t size);
- * @param size  The size of the application data to be stored
- * @return      > 0 if allocation succeeded, i.e. the size of the area
- *              < 0 if allocation failed, i.e. the error code
- *              -1 -> Area name already in use (error code is not used here)
- *              -2 -> Passed area address is already in use
- *              -3 -> write error
- *              -4 -> Passed area for reuse, but too small
+ *  Returns the size of the header a new area with the specified name gets.
  *
  *---------------------------------------------------------------------------*/
-int16_t newPersistentHeader(char *name, uint32_t addr, uint16_t size) {
+static uint8_t persistentNewHeaderSize(char* name) {
 
-  //
-  //  Correct the data area address to point at the start of the header
-  //
-  addr = addr - PERSISTENT_AREA_PREFIX_SIZE;
+	if (persistentIsCompact())
+		return PERSISTENT_COMPACT_PREFIX_SIZE + persistentNameLength(name);
 
-  //
-  // Check that the area is not in use.
-  // For that the *data pointer contains 0xffff if it is not in use.
-  // If not, then this data area is in use, so return -2
-  //
-  if (((uint16_t)EEPROM_RD_INT( (uint16_t)(addr + sizeof(uint16_t)) ) & 0xffff) != 0xffff)
-	  return -2;
+	return PERSISTENT_AREA_PREFIX_SIZE;
+}
 
-  //
-  //  If the area found is not virgin, then check if it is big enough
-  uint16_t next = (uint16_t)EEPROM_RD_INT( (uint16_t)(addr + sizeof(uint16_t)) );
-  if (next != 0xffff || next < size + PERSISTENT_AREA_PREFIX_SIZE) {
-	  return -4;
-  }
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the size of the header of a free cell, which is also the
+ *  smallest free cell there can be.
+ *
+ *---------------------------------------------------------------------------*/
+uint8_t persistentFreeHeaderSize() {
 
-  //
-  //  If next does not contain 0xffff the area is reused
-  //
-  bool reuse = (next != 0xffff);
+	if (persistentIsCompact())
+		return PERSISTENT_CELL_LINK_SIZE;
 
+	return PERSISTENT_AREA_PREFIX_SIZE;
+}
 
-  //
-  //  Initialize the persistent area prefix header
-  //
-  struct persistentAreaHeader header;
-  //
-  // Only touch the next field if this area is not reused.
-  // If reused, then leave it alone, as it it part of a linked list
-  // with allocated/allocatable memory cells.
-  //
-  if (!reuse) {
-    header.next = PERSISTENT_AREA_PREFIX_SIZE + size;
-  }
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the size of the header of an allocated area. Only a compact
+ *  header is read, for the length of its name.
+ *
+ * @param header  The header address of the area
+ *
+ *---------------------------------------------------------------------------*/
+uint8_t persistentHeaderSize(uint32_t header) {
 
-  //
-  //  Get rid of the 0xffff in the data field by assigning it
-  //  an offset pointing to the data area.
-  //
-  header.data = PERSISTENT_AREA_PREFIX_SIZE;
+	if (!persistentIsCompact())
+		return PERSISTENT_AREA_PREFIX_SIZE;
 
-  //
-  //  Copy the area name into the header.
-  //
-  strncpy(header.name, name, PERSISTENT_AREA_NAME_SIZE);
+	uint8_t len;
+	persistentRead(header + PERSISTENT_CELL_LINK_SIZE, (char*)&len, 1);
 
-  //
-  //  Persist the header, if return value is negative then there was a write error.
-  //
-  uint32_t rv = persistentStore(addr, (char *)&header, sizeof(header));
-  if (rv < 0) {
-    return -3;
-  }
+	return PERSISTENT_COMPACT_PREFIX_SIZE + len;
+}
 
-  //
-  //  Return the allocated size
-  //
-  return size;
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the size of the checksum of an area, which sits between its
+ *  header and its data.
+ *
+ * @param header  The header address of the area
+ * @param data    The data address of the area
+ *
+ * @return   PERSISTENT_CHECK_NONE, PERSISTENT_CHECK_CRC16 or _CRC32
+ *
+ *---------------------------------------------------------------------------*/
+uint8_t persistentCheckSize(uint32_t header, uint32_t data) {
+	return (uint8_t)(data - header - persistentHeaderSize(header));
 }
 
 /**----------------------------------------------------------------------------
  *
- *  Reads a header into a persistentAreaHeader using the data area address.
+ *  Reads a header of either format into a persistentAreaHeader. The name
+ *  of a compact header is padded with '\0', that of a free cell reads 0xff.
  *
- * @param addr   The data address (Not the actual header address!!!!)
- * @param data   The header data.
- * @return
+ * @param addr    The header address
+ * @param header  Returns the header
+ *
+ * @return   The number of header bytes read
  *
  *---------------------------------------------------------------------------*/
-uint32_t persistentReadHeader(
-		          uint32_t addr,
-				  struct persistentAreaHeader* header) {
+uint8_t persistentLoadHeader(uint32_t addr, struct persistentAreaHeader* header) {
 
-	//
-	//  Check that the address range is valid
-	//
-	if (addr < EPR_START_FREE || addr >= EPR_END_FREE)
-		return 0;
+	if (!persistentIsCompact()) {
+		persistentRead(addr, (char*)header, PERSISTENT_AREA_PREFIX_SIZE);
+		return PERSISTENT_AREA_PREFIX_SIZE;
+	}
 
-	//
-	//  Read the header into the designated header data buffer
-	//
-	persistentRead(addr - PERSISTENT_AREA_PREFIX_SIZE,
-			      (uint16_t) PERSISTENT_AREA_PREFIX_SIZE,
-				  (char*) header);
+	uint8_t raw[PERSISTENT_COMPACT_PREFIX_SIZE];
+	persistentRead(addr, (char*)raw, PERSISTENT_COMPACT_PREFIX_SIZE);
+	memcpy(header, raw, PERSISTENT_CELL_LINK_SIZE);
 
-	//
-	//  Return the address of the header read
-	//
-	return addr;
+	if (header->next == 0xffff || header->data == 0xffff) {
+		memset(header->name, 0xff, PERSISTENT_AREA_NAME_SIZE);
+		return PERSISTENT_COMPACT_PREFIX_SIZE;
+	}
+
+	uint8_t len = raw[PERSISTENT_CELL_LINK_SIZE];
+	if (len > PERSISTENT_AREA_NAME_SIZE)
+		len = PERSISTENT_AREA_NAME_SIZE;
+
+	memset(header->name, 0, PERSISTENT_AREA_NAME_SIZE);
+	persistentRead(addr + PERSISTENT_COMPACT_PREFIX_SIZE, header->name, len);
+
+	return PERSISTENT_COMPACT_PREFIX_SIZE + len;
 }
 
 /**----------------------------------------------------------------------------
  *
- *  Reads a header into the provided data area.
+ *  Compares the name in an allocated header of either format with a name.
  *
- * @param addr      The address of the header to read.
- * @param header    The struct to read the header data into
+ * @param addr  The header address
+ * @param name  The name to compare with
  *
- * @return      > 0 The EEPROM address of the header read
- *                0 Invalid address.
+ * @return   0 The names are equal
+ *          !0 The names differ
  *
- ----------------------------------------------------------------------------*/
-uint32_t persistentReadHeader(
-		       char *name,
-		       struct persistentAreaHeader* header) {
+ *---------------------------------------------------------------------------*/
+static int16_t persistentHeaderNameCmp(uint32_t addr, char* name) {
 
-	//
-	//  Get the header address
-	//
-	uint32_t addr = getPersistentHeaderAddress(name);
+	if (!persistentIsCompact())
+		return persistentStrCmp(addr + PERSISTENT_CELL_LINK_SIZE, name);
 
-	//
-	//  Read the data into the header struct
-	//  and return the EEPROM address.
-	//
-	return persistentReadHeader(addr + PERSISTENT_AREA_PREFIX_SIZE, header);
+	uint8_t len;
+	persistentRead(addr + PERSISTENT_CELL_LINK_SIZE, (char*)&len, 1);
+	if (len != persistentNameLength(name))
+		return 1;
 
+	char stored[PERSISTENT_AREA_NAME_SIZE];
+	persistentRead(addr + PERSISTENT_COMPACT_PREFIX_SIZE, stored, len);
+
+	return memcmp(stored, name, len);
 }
 
+#if PERSISTENT_INDEX_SIZE > 0
+
+#define PERSISTENT_INDEX_EMPTY       0   // Slot was never used
+#define PERSISTENT_INDEX_DELETED     1   // Slot was freed, probing must continue
+
+#define PERSISTENT_INDEX_UNBUILT     0   // Index must be built before use
+#define PERSISTENT_INDEX_COMPLETE    1   // Every allocated area is in the index
+#define PERSISTENT_INDEX_PARTIAL     2   // Index overflowed, misses must walk EEPROM
 
-//=============================================================================
 //
-//  E X T E R N A L   P E R S I S T E N C E   F U N C T I O N S
+//  Maximum number of areas in the index, keeps the probe sequences short.
+//
+#define PERSISTENT_INDEX_MAX_USED    (PERSISTENT_INDEX_SIZE - PERSISTENT_INDEX_SIZE / 4)
+
+//
+//  The high byte of the name hash an entry keeps. A hit is confirmed against
+//  the name in EEPROM, so the byte only has to rule out most other areas
+//  that probe the same slots.
+//
+#define PERSISTENT_INDEX_TAG(hash)   ((uint8_t)((hash) >> 24))
+
+struct persistentIndexEntry {
+	uint16_t header;       // EEPROM address of the area header, or EMPTY/DELETED
+	uint16_t size;         // Size of the data part in bytes
+	uint8_t  hash;         // PERSISTENT_INDEX_TAG() of the area name hash
+	uint8_t  data     : 7; // Offset of the data part relative to the header
+	uint8_t  verified : 1; // Set once the data was checked against its checksum
+};
+
+static_assert(PERSISTENT_AREA_PREFIX_SIZE + PERSISTENT_CHECK_CRC32 < 128,
+		      "The data offset must fit the 7 bits of an index entry");
+
+static struct persistentIndexEntry persistentIndex[PERSISTENT_INDEX_SIZE];
+static uint8_t  persistentIndexState = PERSISTENT_INDEX_UNBUILT;
+static uint16_t persistentIndexUsed  = 0;
+
+/**----------------------------------------------------------------------------
+ *
+ *  Adds an area to the index, using linear probing.
+ *  If the index is too full to take it the index is marked partial,
+ *  so lookups that miss will fall back to walking the EEPROM chain.
+ *
+ * @param hash    Hash of the area name
+ * @param header  EEPROM address of the area header
+ * @param size    Size of the data part
+ * @param data    Offset of the data part relative to the header
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentIndexAdd(uint32_t hash, uint32_t header, uint16_t size, uint8_t data) {
+
+	if (persistentIndexUsed >= PERSISTENT_INDEX_MAX_USED) {
+		persistentIndexState = PERSISTENT_INDEX_PARTIAL;
+		return;
+	}
+
+	uint16_t slot = hash % PERSISTENT_INDEX_SIZE;
+	while (persistentIndex[slot].header > PERSISTENT_INDEX_DELETED) {
+		if (++slot == PERSISTENT_INDEX_SIZE)
+			slot = 0;
+	}
+
+	persistentIndex[slot].hash   = PERSISTENT_INDEX_TAG(hash);
+	persistentIndex[slot].header = (uint16_t)header;
+	persistentIndex[slot].size   = size;
+	persistentIndex[slot].data   = data;
+	persistentIndex[slot].verified = 0;
+	persistentIndexUsed++;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Looks up an area in the index.
+ *  An entry with the hash byte of the name has its name compared with the
+ *  name in EEPROM, so an area with a colliding hash is never taken for it.
+ *  A hit reads the name of one header, more only if areas share the byte.
+ *
+ * @param name    The name of the area
+ *
+ * @return   != 0 The index entry of the area
+ *              0 The area is not in the index
+ *
+ *---------------------------------------------------------------------------*/
+static struct persistentIndexEntry* persistentIndexLookup(char* name) {
+
+	uint32_t hash = persistentNameHash(name);
+	uint8_t  tag  = PERSISTENT_INDEX_TAG(hash);
+
+	uint16_t slot = hash % PERSISTENT_INDEX_SIZE;
+	for (uint16_t n = 0; n < PERSISTENT_INDEX_SIZE; n++) {
+
+		struct persistentIndexEntry* entry = &persistentIndex[slot];
+		if (++slot == PERSISTENT_INDEX_SIZE)
+			slot = 0;
+
+		if (entry->header == PERSISTENT_INDEX_EMPTY)
+			break;
+
+		if (entry->header == PERSISTENT_INDEX_DELETED || entry->hash != tag)
+			continue;
+
+		if (! persistentHeaderNameCmp(entry->header, name))
+			return entry;
+	}
+
+	return 0;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Removes an area from the index.
+ *
+ * @param header  The EEPROM header address of the area
+ * @param hash    The hash of the area name
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentIndexRemove(uint32_t header, uint32_t hash) {
+
+	uint16_t slot = hash % PERSISTENT_INDEX_SIZE;
+	for (uint16_t n = 0; n < PERSISTENT_INDEX_SIZE; n++) {
+
+		struct persistentIndexEntry* entry = &persistentIndex[slot];
+		if (++slot == PERSISTENT_INDEX_SIZE)
+			slot = 0;
+
+		if (entry->header == PERSISTENT_INDEX_EMPTY)
+			return;
+
+		if (entry->header == header) {
+			//
+			//  If the next slot ends the probe sequence anyway,
+			//  this slot can become empty instead of deleted.
+			//
+			entry->header = persistentIndex[slot].header == PERSISTENT_INDEX_EMPTY
+					      ? PERSISTENT_INDEX_EMPTY : PERSISTENT_INDEX_DELETED;
+			persistentIndexUsed--;
+			return;
+		}
+	}
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the index entry of an area by its header address.
+ *
+ * @param header  The EEPROM header address of the area
+ *
+ * @return   != 0 The index entry of the area
+ *              0 The area is not in the index
+ *
+ *---------------------------------------------------------------------------*/
+static struct persistentIndexEntry* persistentIndexFindHeader(uint32_t header) {
+
+	for (uint16_t slot = 0; slot < PERSISTENT_INDEX_SIZE; slot++) {
+		if (persistentIndex[slot].header == header)
+			return &persistentIndex[slot];
+	}
+
+	return 0;
+}
+
+#endif
+
+
+//=============================================================================
+//
+//  R A M   F R E E   L I S T
 //
 //=============================================================================
 
+#if PERSISTENT_FREE_LIST_SIZE > 0
+
+#define PERSISTENT_FREE_UNBUILT      0   // List must be built before use
+#define PERSISTENT_FREE_COMPLETE     1   // Every freed cell is in the list
+#define PERSISTENT_FREE_PARTIAL      2   // List overflowed, allocation must walk EEPROM
+
+struct persistentFreeCell {
+	uint16_t header;   // EEPROM address of the header of the freed cell
+	uint16_t size;     // Size of the cell including its header, i.e. its next field
+};
+
+static struct persistentFreeCell persistentFreeList[PERSISTENT_FREE_LIST_SIZE];
+static uint8_t  persistentFreeState = PERSISTENT_FREE_UNBUILT;
+static uint8_t  persistentFreeUsed  = 0;
+static uint32_t persistentChainEnd  = 0;   // Header address of the virgin end of the chain
+
 /**----------------------------------------------------------------------------
  *
- *  Returns the size in bytes of available persistent memory if available.
+ *  Adds a freed cell to the free list.
+ *  If the list is full it is marked partial.
  *
- *  @return  the persistent memory size in bytes
+ * @param header  EEPROM address of the header of the cell
+ * @param size    Size of the cell including its header
  *
  *---------------------------------------------------------------------------*/
-uint16_t hasPersistentStorage() {
-   return EEPROM_SIZE;
+static void persistentFreeListAdd(uint32_t header, uint16_t size) {
+
+	if (persistentFreeUsed == PERSISTENT_FREE_LIST_SIZE) {
+		persistentFreeState = PERSISTENT_FREE_PARTIAL;
+		return;
+	}
+
+	persistentFreeList[persistentFreeUsed].header = (uint16_t)header;
+	persistentFreeList[persistentFreeUsed].size   = size;
+	persistentFreeUsed++;
 }
 
 /**----------------------------------------------------------------------------
  *
- *  Returns the persistent memory address of the first byte that is allocatable.
- *  Note that with every allocation some extra bytes are consumed due to
- *  bookkeeping of allocated memory size and memory area name.
+ *  Finds a cell in the free list.
  *
- *  @return  byte address where allocatable memory starts
+ * @param header  EEPROM address of the header of the cell
+ *
+ * @return   != 0 The free list entry of the cell
+ *              0 The cell is not in the list
  *
  *---------------------------------------------------------------------------*/
-uint32_t getFreeStorageAreaStart() {
-  return EPR_START_FREE;
+static struct persistentFreeCell* persistentFreeListFind(uint32_t header) {
+
+	for (uint8_t i = 0; i < persistentFreeUsed; i++)
+		if (persistentFreeList[i].header == header)
+			return &persistentFreeList[i];
+
+	return 0;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Removes an entry from the free list.
+ *
+ * @param cell  The free list entry to remove
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentFreeListRemove(struct persistentFreeCell* cell) {
+
+	*cell = persistentFreeList[--persistentFreeUsed];
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Updates the free list after (part of) a free cell has been allocated.
+ *
+ * @param header   EEPROM address of the header of the allocated cell
+ * @param oldSize  Size of the free cell, 0xffff if it was the end of the chain
+ * @param size     Size of the allocated cell, the rest is a new free cell
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentFreeListTake(uint32_t header, uint16_t oldSize, uint16_t size) {
+
+	if (oldSize == 0xffff) {
+		persistentChainEnd = header + size;
+		return;
+	}
+
+	struct persistentFreeCell* cell = persistentFreeListFind(header);
+	if (oldSize == size) {
+		if (cell)
+			persistentFreeListRemove(cell);
+		return;
+	}
+
+	if (cell) {
+		cell->header = (uint16_t)(header + size);
+		cell->size   = oldSize - size;
+	}
+	else
+		persistentFreeListAdd(header + size, oldSize - size);
+}
+
+#endif
+
+/**----------------------------------------------------------------------------
+ *
+ *  Builds the name index and the free list with a single walk of the
+ *  area chain, checking every header on the way. If a header is bad the
+ *  walk stops there and the index and free list are marked partial, so
+ *  lookups that miss and allocations walk the chain in EEPROM as before.
+ *
+ * @param stats  Returns what the walk found, see persistentMount()
+ *
+ * @return  Same as persistentMount(stats)
+ *
+ *---------------------------------------------------------------------------*/
+static int16_t persistentScanChain(struct persistentMountStats* stats) {
+
+	memset(stats, 0, sizeof(*stats));
+
+#if PERSISTENT_INDEX_SIZE > 0
+	memset(persistentIndex, 0, sizeof(persistentIndex));
+	persistentIndexUsed  = 0;
+	persistentIndexState = PERSISTENT_INDEX_COMPLETE;
+#endif
+
+#if PERSISTENT_FREE_LIST_SIZE > 0
+	persistentFreeUsed  = 0;
+	persistentFreeState = PERSISTENT_FREE_COMPLETE;
+#endif
+
+	int16_t  rv      = 0;
+	uint32_t endFree = EPR_END_FREE;
+	uint32_t addr;
+	struct persistentAreaHeader header;
+	for (addr = EPR_START_FREE; addr < endFree; addr += header.next) {
+
+		uint8_t size = persistentLoadHeader(addr, &header);
+		stats->bytesRead += size;
+
+		//
+		//  Virgin memory marks the end of the chain
+		//
+		if (header.next == 0xffff)
+			break;
+
+		//
+		//  Next offsets only go forward, so the chain can only loop on a
+		//  zero offset. A cell must also end within the allocatable memory.
+		//
+		if (header.next == 0) {
+			rv = -2;
+			break;
+		}
+		if (header.next < PERSISTENT_CELL_LINK_SIZE || addr + header.next > endFree) {
+			rv = -1;
+			break;
+		}
+
+		//
+		//  Freed cells go into the free list, the others into the index
+		//
+		if (header.data == 0xffff) {
+			stats->freeCells++;
+			stats->freeBytes += header.next;
+#if PERSISTENT_FREE_LIST_SIZE > 0
+			persistentFreeListAdd(addr, header.next);
+#endif
+			continue;
+		}
+
+		//
+		//  The data must follow the header and its checksum within the cell
+		//
+		uint8_t data = PERSISTENT_DATA_OFFSET(header.data);
+		if (data < size || data > header.next ||
+			(data - size != PERSISTENT_CHECK_NONE  &&
+			 data - size != PERSISTENT_CHECK_CRC16 &&
+			 data - size != PERSISTENT_CHECK_CRC32)) {
+			rv = -3;
+			break;
+		}
+
+		stats->areas++;
+#if PERSISTENT_INDEX_SIZE > 0
+		persistentIndexAdd(persistentNameHash(header.name), addr, header.next - data, data);
+#endif
+	}
+
+	if (rv < 0) {
+		stats->badHeader = addr;
+#if PERSISTENT_INDEX_SIZE > 0
+		persistentIndexState = PERSISTENT_INDEX_PARTIAL;
+#endif
+#if PERSISTENT_FREE_LIST_SIZE > 0
+		persistentFreeState  = PERSISTENT_FREE_PARTIAL;
+#endif
+	}
+
+#if PERSISTENT_INDEX_SIZE > 0
+	stats->indexed = persistentIndexUsed;
+#endif
+
+#if PERSISTENT_FREE_LIST_SIZE > 0
+	//
+	//  A cell running past the allocatable memory, e.g. into the journal on
+	//  a store written before it was reserved, puts the end of the chain
+	//  beyond endFree. So do other bad headers, beyond them the end is not
+	//  known. Merging, resizing in place and batches then leave the chain
+	//  alone, as they do when walking it without the free list.
+	//
+	persistentChainEnd = rv == -1 ? addr + header.next :
+			             rv <  0  ? endFree + 1        : addr;
+#endif
+	stats->chainEnd = addr;
+
+	return rv < 0 ? rv : (int16_t)stats->areas;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Builds the name index and the free list with a single walk of the
+ *  area chain.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentScanChain() {
+
+	struct persistentMountStats stats;
+	persistentScanChain(&stats);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Mounts the persistent memory: walks the area chain once, checks every
+ *  header and builds the name index and the free list from it. Call it in
+ *  setup(), before the first area is used. Later lookups are then served
+ *  from the index and only read the name of the header found, unless the
+ *  index holds fewer areas than the chain, see PERSISTENT_INDEX_SIZE.
+ *  Without a mount the same walk is done on first use, without reporting.
+ *
+ * @param stats  Returns what was found, how many bytes were read and how
+ *               long it took
+ *
+ * @return  >= 0 The number of allocated areas
+ *            -1 A cell does not end within the allocatable memory
+ *            -2 A next offset of 0, the chain loops
+ *            -3 The data offset of an area does not fit its header and cell
+ *               On an error stats->badHeader is the address of the header.
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentMount(struct persistentMountStats* stats) {
+
+#if defined(ARDUINO)
+	uint32_t start = micros();
+#endif
+
+	int16_t rv = persistentScanChain(stats);
+
+#if defined(ARDUINO)
+	stats->timeUs = micros() - start;
+#endif
+
+	return rv;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Discards the RAM index and free list, so they are rebuilt from EEPROM
+ *  on the next use. Call this after the EEPROM has been modified without
+ *  using the area functions, e.g. by persistentStore() on an area header.
+ *
+ *---------------------------------------------------------------------------*/
+void persistentIndexReset() {
+#if PERSISTENT_INDEX_SIZE > 0
+	persistentIndexState = PERSISTENT_INDEX_UNBUILT;
+#endif
+#if PERSISTENT_FREE_LIST_SIZE > 0
+	persistentFreeState  = PERSISTENT_FREE_UNBUILT;
+#endif
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Walks the area chain in EEPROM searching for an area name.
+ *  Only the next field and the name hash of a header are read to decide
+ *  whether the name needs to be compared. Headers holding another name
+ *  hash are skipped, a header without a hash has its name compared.
+ *
+ * @param name     The name of memory area
+ *
+ * @return   >0 The header address of the memory area
+ *            0 Area was not found.
+ *
+ *---------------------------------------------------------------------------*/
+static uint32_t persistentWalkHeaderAddress(char* name) {
+
+  uint8_t  hash    = persistentHeaderHash(name);
+  uint32_t endFree = EPR_END_FREE;
+  uint16_t next;
+  uint8_t  stored;
+
+  //
+  //  For as long as there is initialized EEPROM memory,
+  //  search for the area name specified.
+  //
+  for (uint32_t addr = EPR_START_FREE; addr < endFree; addr += next) {
+    persistentRead(addr, (char*)&next, sizeof(next));
+    if (next == 0xffff || next == 0) { // If uninitialized EEPROM, then end of used EEPROM
+	  return 0;
+    }
+
+    //
+    //  Only the high byte of the data field, the hash, is read.
+    //  A freed cell reads 0xff there, its cleared name never matches.
+    //
+    persistentRead(addr + offsetof(persistentAreaHeader, data) + 1, (char*)&stored, 1);
+    if (stored && stored != hash) {
+      continue;
+    }
+
+    if (! persistentHeaderNameCmp(addr, name)) {
+	  return (uint32_t)addr;
+	}
+  }
+
+  return 0;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Adds the name hash to the area headers written before the hash was kept
+ *  in the header. Only the high byte of their data field is written, a single
+ *  byte per header, so every header stays valid if a reset interrupts the
+ *  migration. Headers that already have a hash are skipped, which makes it
+ *  safe to call it again, or on every start.
+ *
+ * @return  >= 0 The number of headers migrated
+ *            -1 Write error
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentMigrateHeaders() {
+
+	int16_t  migrated = 0;
+	uint32_t endFree  = EPR_END_FREE;
+	struct persistentAreaHeader header;
+	for (uint32_t addr = EPR_START_FREE; addr < endFree; addr += header.next) {
+
+		persistentLoadHeader(addr, &header);
+		if (header.next == 0xffff || header.next == 0)
+			break;
+
+		if (header.data == 0xffff || PERSISTENT_DATA_HASH(header.data))
+			continue;
+
+		//
+		//  The data field is little endian, its high byte is the second one
+		//
+		uint8_t hash = persistentHeaderHash(header.name);
+		if (persistentStore(addr + offsetof(persistentAreaHeader, data) + 1, (char*)&hash, 1) < 0)
+			return -1;
+
+		migrated++;
+	}
+
+	return migrated;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Finds an area, using the RAM index if it is enabled.
+ *
+ * @param name      The name of memory area
+ * @param dataAddr  Returns the EEPROM address of the data part
+ * @param dataSize  Returns the size of the data part
+ *
+ * @return   >0 The header address of the memory area
+ *            0 Area was not found.
+ *
+ *---------------------------------------------------------------------------*/
+static uint32_t persistentFindArea(char* name,
+		                           uint32_t* dataAddr, uint16_t* dataSize) {
+
+#if PERSISTENT_INDEX_SIZE > 0
+	if (persistentIndexState == PERSISTENT_INDEX_UNBUILT)
+		persistentScanChain();
+
+	struct persistentIndexEntry* entry = persistentIndexLookup(name);
+	if (entry) {
+		*dataAddr = entry->header + entry->data;
+		*dataSize = entry->size;
+		return entry->header;
+	}
+
+	//
+	//  If all areas are indexed, a miss is final
+	//
+	if (persistentIndexState == PERSISTENT_INDEX_COMPLETE)
+		return 0;
+#endif
+
+	uint32_t addr = persistentWalkHeaderAddress(name);
+	if (addr) {
+		struct persistentAreaHeader header;
+		persistentRead(addr, PERSISTENT_CELL_LINK_SIZE, (char*)&header);
+		*dataAddr = addr + PERSISTENT_DATA_OFFSET(header.data);
+		*dataSize = header.next - PERSISTENT_DATA_OFFSET(header.data);
+	}
+
+	return addr;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ * Returns the EEPROM address of a persistent area.
+ *
+ * @param name     The name of memory area
+ *
+ * @return   >0 The memory area EEPROM address
+ *            0 Area was not found.
+ *
+ *---------------------------------------------------------------------------*/
+uint32_t getPersistentAreaAddress(char* name) {
+
+  uint32_t dataAddr;
+  uint16_t dataSize;
+  if (persistentFindArea(name, &dataAddr, &dataSize))
+	  return dataAddr;
+
+  return 0;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the EEPROM address of the area header.
+ *
+ *  NOTE: This DIFFERS from the address returned by getPersistentAreaAddress(),
+ *        which is the address of the data part of an area!!!!
+ *
+ * @param name  The name of the memory area
+ *
+ * @return  > 0  The header address of the memory area
+ *            0  Error, area with that name was unknown.
+ *
+ *---------------------------------------------------------------------------*/
+uint32_t getPersistentHeaderAddress(char* name) {
+
+  uint32_t dataAddr;
+  uint16_t dataSize;
+  return persistentFindArea(name, &dataAddr, &dataSize);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns true if the persistent data area exists, otherwise false.
+ *
+ * @param name  The name of the desired persistent data area.
+ * @return      True if data area exists, otherwise false.
+ *
+ *---------------------------------------------------------------------------*/
+bool hasPersistentArea(char* name) {
+	//
+	//  If the area exists, then return true.
+	//
+	if (getPersistentHeaderAddress(name))
+		return true;
+
+	//
+	// Otherwise return false.
+	//
+	return false;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns true if a free cell can hold a cell of the specified size.
+ *  A bigger cell must leave room for the header of the free cell split off,
+ *  otherwise the allocated area would get a data size other than requested.
+ *
+ * @param cellSize  Size of the free cell including its header
+ * @param size      Size of the cell to allocate including its header
+ *
+ *---------------------------------------------------------------------------*/
+static bool persistentFitsFreeCell(uint16_t cellSize, uint16_t size) {
+	return cellSize == size || cellSize >= size + persistentFreeHeaderSize();
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the free cell directly preceding a cell.
+ *  If the free list is complete it is used, otherwise the chain is walked.
+ *
+ * @param addr  The EEPROM header address of the cell
+ *
+ * @return   > 0 The header address of the preceding free cell
+ *             0 The preceding cell is not free
+ *
+ *---------------------------------------------------------------------------*/
+static uint32_t persistentPreviousFree(uint32_t addr) {
+
+#if PERSISTENT_FREE_LIST_SIZE > 0
+	if (persistentFreeState == PERSISTENT_FREE_COMPLETE) {
+		for (uint8_t i = 0; i < persistentFreeUsed; i++)
+			if ((uint32_t)persistentFreeList[i].header + persistentFreeList[i].size == addr)
+				return persistentFreeList[i].header;
+		return 0;
+	}
+#endif
+
+	struct persistentAreaHeader header;
+	for (uint32_t prev = EPR_START_FREE; prev < addr; prev += header.next) {
+
+		persistentRead(prev, PERSISTENT_CELL_LINK_SIZE, (char*)&header);
+		if (header.next == 0xffff || header.next == 0)
+			return 0;
+
+		if (prev + header.next == addr)
+			return header.data == 0xffff ? prev : 0;
+	}
+
+	return 0;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Encodes the header of a new area as it is stored, in either format.
+ *
+ * @param raw      Returns the header, room for PERSISTENT_COMPACT_PREFIX_SIZE
+ *                 plus PERSISTENT_AREA_NAME_SIZE bytes
+ * @param name     The name of the area
+ * @param cell     The size of the cell including the header
+ * @param check    The size of the checksum
+ * @param version  The version of a registered area, 0 if none
+ *
+ * @return   The size of the header, see persistentNewHeaderSize()
+ *
+ *---------------------------------------------------------------------------*/
+static uint8_t persistentEncodeHeader(char* raw, char* name, uint16_t cell,
+		                              uint8_t check, uint8_t version) {
+
+  bool    compact = persistentIsCompact();
+  uint8_t prefix  = persistentNewHeaderSize(name);
+
+  //
+  //  Initialize the persistent area prefix header
+  //
+  struct persistentAreaHeader header;
+  header.next = cell;
+
+  //
+  //  Copy the area name into the header, padded with '\0'. A name of
+  //  PERSISTENT_AREA_NAME_SIZE characters has no terminating '\0'.
+  //
+  memset(header.name, 0, PERSISTENT_AREA_NAME_SIZE);
+  memcpy(header.name, name, persistentNameLength(name));
+  if (version && !compact)
+	  header.name[PERSISTENT_AREA_NAME_SIZE - 1] = (char)version;
+
+  //
+  //  Get rid of the 0xffff in the data field by assigning it
+  //  an offset pointing to the data area, after the checksum.
+  //  The hash of the name goes into its high byte.
+  //
+  header.data = ((uint16_t)persistentHeaderHash(header.name) << 8) | (prefix + check);
+
+  //
+  //  A compact header stores the length of the name instead of its padding
+  //
+  memcpy(raw, &header, PERSISTENT_CELL_LINK_SIZE);
+  if (compact) {
+	  raw[PERSISTENT_CELL_LINK_SIZE] = (char)(prefix - PERSISTENT_COMPACT_PREFIX_SIZE);
+	  memcpy(raw + PERSISTENT_COMPACT_PREFIX_SIZE, header.name, prefix - PERSISTENT_COMPACT_PREFIX_SIZE);
+  }
+  else
+	  memcpy(raw + PERSISTENT_CELL_LINK_SIZE, header.name, PERSISTENT_AREA_NAME_SIZE);
+
+  return prefix;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Allocates a free header for an area with a checksum, which is stored
+ *  between the header and the data. The address from findNewPersistentArea()
+ *  must be found for the size of the data plus the checksum.
+ *  A registered area keeps its version in the last byte of the name field,
+ *  its name is at most PERSISTENT_AREA_NAME_SIZE - 2 long then.
+ *  In a store with compact headers the header is shorter, the data then
+ *  starts before addr and a version is not kept.
+ *
+ * @param name     The name of the header, which must be unique
+ * @param addr     The address from getNewPersistentHeader(uint16_t size);
+ * @param size     The size of the application data to be stored
+ * @param check    The size of the checksum, see PERSISTENT_CHECK_CRC16
+ * @param version  The version of a registered area, 0 if none
+ * @return         Same as newPersistentHeader(name, addr, size)
+ *
+ *---------------------------------------------------------------------------*/
+int16_t newPersistentHeader(char *name, uint32_t addr, uint16_t size, uint8_t check, uint8_t version) {
+
+  //
+  //  Correct the data area address to point at the start of the header
+  //
+  addr = addr - PERSISTENT_AREA_PREFIX_SIZE;
+
+  uint8_t prefix = persistentNewHeaderSize(name);
+
+  struct persistentAreaHeader header;
+  persistentRead(addr, PERSISTENT_CELL_LINK_SIZE, (char*)&header);
+
+  //
+  // Check that the area is not in use.
+  // For that the *data pointer contains 0xffff if it is not in use.
+  // If not, then this data area is in use, so return -2
+  //
+  if (header.data != 0xffff)
+	  return -2;
+
+  //
+  //  If next does not contain 0xffff the area is reused.
+  //  Then check if it is big enough.
+  //
+  uint16_t cell  = prefix + check + size;
+  uint16_t next  = header.next;
+  bool     reuse = (next != 0xffff);
+  if (reuse && !persistentFitsFreeCell(next, cell)) {
+	  return -4;
+  }
+
+  //
+  //  Allocating at the end of the chain, the header after it must be virgin.
+  //  persistentFormat() leaves the old contents, so it is cleared here.
+  //
+  uint32_t endFree = EPR_END_FREE;
+  if (!reuse && addr + cell < endFree) {
+	  uint32_t last  = addr + cell + PERSISTENT_AREA_PREFIX_SIZE;
+	  uint16_t clear = (last <= endFree) ? PERSISTENT_AREA_PREFIX_SIZE : endFree - addr - cell;
+	  if (persistentClear(addr + cell, 0xff, clear) < 0)
+		  return -3;
+  }
+
+  //
+  //  A reused cell that is bigger than needed is split. The rest gets its own
+  //  free header first, it only becomes part of the chain once the next
+  //  field of the allocated header is written.
+  //
+  if (reuse && next != cell) {
+	  struct persistentAreaHeader rest;
+	  rest.next = next - cell;
+	  rest.data = 0xffff;
+	  memset(rest.name, 0xff, PERSISTENT_AREA_NAME_SIZE);
+	  if (persistentStore(addr + cell, (char*)&rest, persistentFreeHeaderSize()) < 0)
+		  return -3;
+  }
+
+  //
+  //  A checksum that was never written reads as all ones
+  //
+  if (check && persistentClear(addr + prefix, 0xff, check) < 0)
+	  return -3;
+
+  //
+  //  Persist the header, if return value is negative then there was a write error.
+  //
+  char raw[PERSISTENT_COMPACT_PREFIX_SIZE + PERSISTENT_AREA_NAME_SIZE];
+  persistentEncodeHeader(raw, name, cell, check, version);
+
+  int32_t rv = persistentStore(addr, raw, prefix);
+  if (rv < 0) {
+    return -3;
+  }
+
+#if PERSISTENT_FREE_LIST_SIZE > 0
+  if (persistentFreeState != PERSISTENT_FREE_UNBUILT)
+	  persistentFreeListTake(addr, next, cell);
+#endif
+
+  //
+  //  Return the allocated size
+  //
+  return size;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Allocates a free header by writing the persistent Area Header:
+ *  *next 16 bit offset to the next header area
+ *  *data 16 bit offset to the data
+ *  *name max 15 bytes + 1 '\0' for the area name
+ *
+ * @param name  The name of the header, which must be unique
+ * @param addr  The address from getNewPersistentHeader(uint16_t size);
+ * @param size  The size of the application data to be stored
+ * @return      > 0 if allocation succeeded, i.e. the size of the area
+ *              < 0 if allocation failed, i.e. the error code
+ *              -1 -> Area name already in use (error code is not used here)
+ *              -2 -> Passed area address is already in use
+ *              -3 -> write error
+ *              -4 -> Passed area for reuse, but too small
+ *
+ *---------------------------------------------------------------------------*/
+int16_t newPersistentHeader(char *name, uint32_t addr, uint16_t size) {
+	return newPersistentHeader(name, addr, size, PERSISTENT_CHECK_NONE, 0);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Reads a header into a persistentAreaHeader using the data area address.
+ *
+ * @param addr   The data address (Not the actual header address!!!!)
+ *               With compact headers it is the header address plus
+ *               PERSISTENT_AREA_PREFIX_SIZE, as for newPersistentHeader()
+ * @param data   The header data.
+ * @return
+ *
+ *---------------------------------------------------------------------------*/
+uint32_t persistentReadHeader(
+		          uint32_t addr,
+				  struct persistentAreaHeader* header) {
+
+	//
+	//  Check that the address range is valid
+	//
+	if (addr < EPR_START_FREE || addr >= EPR_END_FREE)
+		return 0;
+
+	//
+	//  Read the header into the designated header data buffer
+	//
+	persistentLoadHeader(addr - PERSISTENT_AREA_PREFIX_SIZE, header);
+
+	//
+	//  Return the address of the header read
+	//
+	return addr;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Reads a header into the provided data area.
+ *
+ * @param addr      The address of the header to read.
+ * @param header    The struct to read the header data into
+ *
+ * @return      > 0 The EEPROM address of the header read
+ *                0 Invalid address.
+ *
+ ----------------------------------------------------------------------------*/
+uint32_t persistentReadHeader(
+		       char *name,
+		       struct persistentAreaHeader* header) {
+
+	//
+	//  Get the header address
+	//
+	uint32_t addr = getPersistentHeaderAddress(name);
+
+	//
+	//  Read the data into the header struct
+	//  and return the EEPROM address.
+	//
+	return persistentReadHeader(addr + PERSISTENT_AREA_PREFIX_SIZE, header);
+
+}
+
+
+//=============================================================================
+//
+//  E X T E R N A L   P E R S I S T E N C E   F U N C T I O N S
+//
+//=============================================================================
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the size in bytes of available persistent memory if available.
+ *
+ *  @return  the persistent memory size in bytes
+ *
+ *---------------------------------------------------------------------------*/
+uint16_t hasPersistentStorage() {
+   return EEPROM_SIZE;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Layout of the fixed and variable size regions, see persistentGetLayout().
+ *
+ *---------------------------------------------------------------------------*/
+struct persistentLayout persistentMemoryLayout;
+
+/**----------------------------------------------------------------------------
+ *
+ *  Calculates the boundaries of the fixed and variable size regions from the
+ *  calibration data sizes in EEPROM and stores them in the layout descriptor.
+ *  Calibration sizes that were never written (0xffff), or that do not fit in
+ *  the persistent memory, are considered to be 0.
+ *
+ *---------------------------------------------------------------------------*/
+void persistentLoadLayout() {
+
+	struct persistentLayout* layout = &persistentMemoryLayout;
+
+	//
+	//  On a reload the allocatable region may have changed
+	//
+	if (layout->loaded)
+		persistentIndexReset();
+
+	layout->size      = EEPROM_SIZE;
+	layout->startFree = persistentLoadSuperblock();
+
+	//
+	//  Only a formatted store has a journal. The chain of a store that was
+	//  never formatted may run up to the variable size data.
+	//
+	uint32_t journalSize = (layout->startFree != EPR_SUPERBLOCK) ? PERSISTENT_JOURNAL_SIZE : 0;
+
+	uint32_t xSize = (uint16_t)EEPROM_RD_INT(EPR16_TFT_CALIBR_X_S) * sizeof(uint16_t);
+	uint32_t ySize = (uint16_t)EEPROM_RD_INT(EPR16_TFT_CALIBR_Y_S) * sizeof(uint16_t);
+	if (layout->size < layout->startFree + xSize + ySize + journalSize) {
+		xSize = 0;
+		ySize = 0;
+	}
+
+	layout->calibrX = layout->size    - xSize;
+	layout->calibrY = layout->calibrX - ySize;
+	layout->endFree = layout->calibrY - journalSize;
+	layout->journal = journalSize ? layout->endFree : 0;
+	layout->loaded  = true;
+
+	//
+	//  Complete a compaction that was interrupted by a reset
+	//
+	persistentCompactRecover();
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Stores the sizes of the calibration data and updates the layout.
+ *  Note that this moves EPR_END_FREE, areas beyond it are lost.
+ *
+ * @param xSize  Number of 16 bit calibration values for the X-axis
+ * @param ySize  Number of 16 bit calibration values for the Y-axis
+ *
+ * @return  > 0 The number of bytes stored
+ *          < 0 Write error
+ *
+ *---------------------------------------------------------------------------*/
+int32_t persistentSetCalibrationSizes(uint16_t xSize, uint16_t ySize) {
+
+	uint16_t sizes[2] = { xSize, ySize };
+
+	//
+	//  persistentStore() reloads the layout, since the sizes are part of it
+	//
+	return persistentStore(EPR16_TFT_CALIBR_X_S, (char*)sizes, sizeof(sizes));
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the persistent memory address of the first byte that is allocatable.
+ *  Note that with every allocation some extra bytes are consumed due to
+ *  bookkeeping of allocated memory size and memory area name.
+ *
+ *  @return  byte address where allocatable memory starts
+ *
+ *---------------------------------------------------------------------------*/
+uint32_t getFreeStorageAreaStart() {
+  return EPR_START_FREE;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *
+ *   Returns the first byte address of not allocatable persistent memory.
+ *
+ *   @return  first byte address outside the persistent memory.
+ *
+ *---------------------------------------------------------------------------*/
+uint32_t getFreeStorageAreaEnd() {
+  return EPR_END_FREE;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Finds a free cell for an area, either a freed cell or the end of the chain.
+ *
+ * @param size  Size of the cell including its header
+ *
+ * @return  > 0 The header address of the cell
+ *            0 No allocatable persistent memory left
+ *
+ *---------------------------------------------------------------------------*/
+static uint32_t persistentFindCell(uint16_t size) {
+
+	uint32_t endFree = EPR_END_FREE;
+
+#if PERSISTENT_FREE_LIST_SIZE > 0
+	if (persistentFreeState == PERSISTENT_FREE_UNBUILT)
+		persistentScanChain();
+
+	//
+	//  With a complete free list no EEPROM needs to be read.
+	//  Take the smallest freed cell that fits, else the end of the chain.
+	//
+	if (persistentFreeState == PERSISTENT_FREE_COMPLETE) {
+		struct persistentFreeCell* best = 0;
+		for (uint8_t i = 0; i < persistentFreeUsed; i++) {
+			struct persistentFreeCell* cell = &persistentFreeList[i];
+			if (persistentFitsFreeCell(cell->size, size) && (!best || cell->size < best->size))
+				best = cell;
+		}
+
+		if (best)
+			return best->header;
+
+		if (persistentChainEnd + size <= endFree)
+			return persistentChainEnd;
+
+		return 0;
+	}
+#endif
+
+	//
+	//  Otherwise walk the chain, remembering the smallest freed cell that fits
+	//
+	uint32_t best     = 0;
+	uint16_t bestSize = 0xffff;
+	struct persistentAreaHeader header;
+	for (uint32_t addr = EPR_START_FREE; addr < endFree; addr += header.next) {
+
+		//
+		//  Read in the header
+		//
+		persistentRead(addr, PERSISTENT_CELL_LINK_SIZE, (char*)&header);
+
+		//
+		//  If the next contains 0xffff, then this is the end of the linked list.
+		//  That memory can be allocated if no freed cell fits, provided the
+		//  requested size does not get past the END of the allocatable space.
+		//
+		if (header.next == 0xffff || header.next == 0) {
+			if (!best && (addr + size) <= endFree)
+				return addr;
+			break;
+		}
+
+		//
+		//  A data field containing 0xffff marks a freed cell
+		//
+		if (header.data == 0xffff && persistentFitsFreeCell(header.next, size) &&
+			header.next < bestSize) {
+			best     = addr;
+			bestSize = header.next;
+		}
+	}
+
+	if (best)
+		return best;
+
+	//
+	//  Otherwise return 0, which indicates no free EEPROM memory was found.
+	//
+	return 0;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Finds the next free persistent area.
+ *  It merely find it and returns the data address for it.
+ *  It does not write anything in the area found.
+ *  So it is ready for use but its header needs to be initialized.
+ *  You can use the newPersistentHeader() function to do that.
+ *  Or use the function newPersistenceArea() which does it all in one go.
+ *
+ * @return  > 0 The persistent area data address
+ *            0 No allocatable persistent memory left
+ *
+ *---------------------------------------------------------------------------*/
+uint32_t findNewPersistentArea(uint16_t dataSize) {
+
+	//
+	//  Calculate the size of the entire memory cell going to be allocated,
+	//  which includes a header for bookkeeping purposes
+	//
+	uint32_t addr = persistentFindCell(PERSISTENT_AREA_PREFIX_SIZE + dataSize);
+	if (addr == 0)
+		return 0;
+
+	return addr + PERSISTENT_AREA_PREFIX_SIZE;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Searches for the next free persistent memory address.
+ *
+ * @param size  Size in bytes of the area to allocate
+ *
+ * @return      >  0 The data address of the free memory.
+ *              <= 0 Error getting the new memory
+ *                 0 No free memory available.
+ *                -1 -> Area name is already in use.
+ *                -2 -> Passed area address is already in use
+ *                -3 -> write error
+ *                -4 -> Passed area for reuse, but too small
+ *
+ ----------------------------------------------------------------------------*/
+uint32_t newPersistentArea(char* name, uint16_t dataSize) {
+
+	struct persistentAreaHandle handle;
+	return newPersistentArea(name, dataSize, &handle);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Allocates a new persistent area and opens a handle on it.
+ *
+ * @param name      Name of the area
+ * @param dataSize  Size in bytes of the area to allocate
+ * @param handle    The handle to open on the new area
+ *
+ * @return      Same as newPersistentArea(name, dataSize)
+ *
+ ----------------------------------------------------------------------------*/
+uint32_t newPersistentArea(char* name, uint16_t dataSize, struct persistentAreaHandle* handle) {
+	return newPersistentArea(name, dataSize, handle, PERSISTENT_AREA_CHECK);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Allocates a new persistent area with a checksum of its data and opens
+ *  a handle on it.
+ *
+ * @param name      Name of the area
+ * @param dataSize  Size in bytes of the area to allocate
+ * @param handle    The handle to open on the new area
+ * @param check     The checksum, PERSISTENT_CHECK_NONE, _CRC16 or _CRC32
+ *
+ * @return      Same as newPersistentArea(name, dataSize)
+ *
+ ----------------------------------------------------------------------------*/
+uint32_t newPersistentArea(char* name, uint16_t dataSize,
+		                   struct persistentAreaHandle* handle, uint8_t check) {
+
+	handle->header = 0;
+
+	//
+	// Check if the area name does not already exist.
+	// If so return the proper error code.
+	//
+	uint32_t existData;
+	uint16_t existSize;
+	uint32_t existAddr = persistentFindArea(name, &existData, &existSize);
+
+	if (existAddr) {
+	  return -1;
+	}
+
+	//
+	//  Find a new area which fits the requested dataSize
+	//
+	uint8_t  prefix = persistentNewHeaderSize(name);
+	uint32_t addr   = persistentFindCell(prefix + check + dataSize);
+
+	//
+	//  If nothing found, then return
+	//
+	if (addr == 0) {
+	  return 0;
+	}
+
+	//
+	//  For as long as there is initialized EEPROM memory,
+	//
+	int16_t size = newPersistentHeader(name, addr + PERSISTENT_AREA_PREFIX_SIZE, dataSize, check, 0);
+	if (size == dataSize) {
+#if PERSISTENT_INDEX_SIZE > 0
+	  if (persistentIndexState != PERSISTENT_INDEX_UNBUILT)
+		  persistentIndexAdd(persistentNameHash(name), addr, dataSize, prefix + check);
+#endif
+	  persistentCountArea(1);
+	  handle->header = addr;
+	  handle->data   = addr + prefix + check;
+	  handle->size   = dataSize;
+	  return handle->data;
+	}
+
+	//
+	//  Otherwise return 0, which indicates no free EEPROM memory was found.
+	//
+	return 0;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Opens a handle on an existing area. The handle caches the data address
+ *  and size of the area, so reading and writing through it needs no lookup.
+ *  The handle is no longer valid once the area is freed.
+ *
+ * @param name    Name of the area
+ * @param handle  The handle to open
+ *
+ * @return          A return code.
+ *                   1  Success
+ *                  -1  The area with the specified name was not found
+ *
+ *---------------------------------------------------------------------------*/
+int16_t openPersistentArea(char* name, struct persistentAreaHandle* handle) {
+
+	handle->header = persistentFindArea(name, &handle->data, &handle->size);
+	if (handle->header == 0)
+		return -1;
+
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns true if the data of an area need not be checked against its
+ *  checksum, because it has none or it was checked since the index was built.
+ *  Areas that are not in the index are checked on every read.
+ *
+ * @param handle  The handle of the area
+ *
+ *---------------------------------------------------------------------------*/
+static bool persistentAreaChecked(struct persistentAreaHandle* handle) {
+
+	if (persistentCheckSize(handle->header, handle->data) == PERSISTENT_CHECK_NONE)
+		return true;
+
+#if PERSISTENT_INDEX_SIZE > 0
+	struct persistentIndexEntry* entry = persistentIndexFindHeader(handle->header);
+	if (entry)
+		return entry->verified;
+#endif
+
+	return false;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Remembers that the data of an area matched its checksum.
+ *
+ * @param handle  The handle of the area
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentSetAreaChecked(struct persistentAreaHandle* handle) {
+
+#if PERSISTENT_INDEX_SIZE > 0
+	struct persistentIndexEntry* entry = persistentIndexFindHeader(handle->header);
+	if (entry)
+		entry->verified = 1;
+#else
+	(void)handle;
+#endif
+}
+
+/**---------------------------------------------------------------------------
+ *
+ * Read the data for the named area from the corresponding EEPROM area.
+ *
+ * @param name      Name of the area
+ * @param dataSize  The size of the data area in bytes
+ * @param data      The persisted area data
+ *
+ * @return          A return code.
+ *                   1  Success
+ *                   0  Not used
+ *                  -1  The area with the specified name was not found
+ *                  -2  The requested data size differs from the area
+ *                      its actual data size.
+ *                  -3  The data read does not match the checksum of the area
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentReadArea(char* name, uint16_t dataSize, char* data) {
+
+  //
+  //  Find the EEPROM address and size of the data area.
+  //
+  struct persistentAreaHandle handle;
+  if (openPersistentArea(name, &handle) < 0) {
+	  return -1;
+  }
+
+  return persistentReadArea(&handle, dataSize, data);
+}
+
+/**---------------------------------------------------------------------------
+ *
+ * Read the data of an opened area.
+ *
+ * @param handle    The handle of the area
+ * @param dataSize  The size of the data area in bytes
+ * @param data      The persisted area data
+ *
+ * @return          Same as persistentReadArea(name, dataSize, data)
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentReadArea(struct persistentAreaHandle* handle, uint16_t dataSize, char* data) {
+
+  //
+  // A handle that is not open refers to no area.
+  //
+  if (handle->header == 0) {
+	  return -1;
+  }
+
+  //
+  // Check if the requested data size corresponds to the stored data size
+  //
+  if (handle->size != dataSize) {
+	  return -2;
+  }
+
+#if PERSISTENT_CACHE_SIZE > 0
+  //
+  // A cached area is read from RAM
+  //
+  if (persistentCacheRead(handle->header, 0, dataSize, data))
+	  return 1;
+#endif
+
+  //
+  // For an existing area, read its contents and return it
+  //
+  persistentRead(handle->data, dataSize, data);
+
+  //
+  // Check the data against its checksum, only once if the area is indexed
+  //
+  if (persistentAreaChecked(handle))
+	  return 1;
+
+  if (persistentCheckData(handle->header, handle->data, data, dataSize) < 0)
+	  return -3;
+
+  persistentSetAreaChecked(handle);
+  return 1;
+}
+
+/**---------------------------------------------------------------------------
+ *
+ * Read a range of the data of the named area.
+ *
+ * @param name      Name of the area
+ * @param offset    Offset of the range in the data
+ * @param len       The size of the range in bytes
+ * @param data      The buffer to read the range into
+ *
+ * @return          A return code.
+ *                   1  Success
+ *                  -1  The area with the specified name was not found
+ *                  -2  The range does not fit in the data of the area
+ *                  -3  The data does not match the checksum of the area
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentReadAreaRange(char* name, uint16_t offset, uint16_t len, char* data) {
+
+  struct persistentAreaHandle handle;
+  if (openPersistentArea(name, &handle) < 0) {
+	  return -1;
+  }
+
+  return persistentReadAreaRange(&handle, offset, len, data);
+}
+
+/**---------------------------------------------------------------------------
+ *
+ * Read a range of the data of an opened area. If the area has a checksum
+ * that was not checked yet, all of its data is checked first.
+ *
+ * @param handle    The handle of the area
+ * @param offset    Offset of the range in the data
+ * @param len       The size of the range in bytes
+ * @param data      The buffer to read the range into
+ *
+ * @return          Same as persistentReadAreaRange(name, offset, len, data)
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentReadAreaRange(struct persistentAreaHandle* handle,
+		                        uint16_t offset, uint16_t len, char* data) {
+
+  if (handle->header == 0) {
+	  return -1;
+  }
+
+  if (offset > handle->size || len > handle->size - offset) {
+	  return -2;
+  }
+
+#if PERSISTENT_CACHE_SIZE > 0
+  if (persistentCacheRead(handle->header, offset, len, data))
+	  return 1;
+#endif
+
+  if (!persistentAreaChecked(handle)) {
+	  if (persistentVerifyArea(handle) < 0)
+		  return -3;
+	  persistentSetAreaChecked(handle);
+  }
+
+  persistentRead(handle->data + offset, data, len);
+  return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Writes data from a data buffer to persistent memory.
+ *  If succesfully written the size returned is equal to the dataSize.
+ *  If tha is not the case, then an error occurred while writing and
+ *  the persistent memory is then corrupted.
+ *
+ * @param addr      The EEPROM address of the persistent memory
+ * @param dataSize  The size of the data to be written
+ * @param data      The address of the data buffer
+ * @return          > 0 The amount of bytes that were successfully written.
+ *                    0 Nothing is written, because it was the wrong data area.
+ *                  < 0 The number of bytes not written after a write error.
+ *                      -1 also if the checksum of the area was not written.
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentWriteArea(char *name, uint16_t dataSize, char* data) {
+
+	//
+	//  Find the EEPROM address and size of the data area.
+	//
+	struct persistentAreaHandle handle;
+	if (openPersistentArea(name, &handle) < 0)
+		return 0;
+
+	return persistentWriteArea(&handle, dataSize, data);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Writes data from a data buffer to the data part of an opened area.
+ *
+ * @param handle    The handle of the area
+ * @param dataSize  The size of the data to be written
+ * @param data      The address of the data buffer
+ * @return          Same as persistentWriteArea(name, dataSize, data)
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentWriteArea(struct persistentAreaHandle* handle, uint16_t dataSize, char* data) {
+
+	//
+	//  If the handle is not open or the dataSize is unequal
+	//  to the available memory, then nothing is written.
+	//
+	if (handle->header == 0 || dataSize != handle->size) {
+        return 0;
+	}
+
+#if PERSISTENT_CACHE_SIZE > 0
+	//
+	//  A cached area is written to RAM, the cache commits it later.
+	//
+	if (persistentCacheWrite(handle->header, 0, dataSize, data))
+		return dataSize;
+#endif
+
+	//
+	//  Write the data buffer too EEPROM
+	//
+	int32_t rv = persistentWriteBlock(handle->data, data, 0, dataSize);
+	if (rv < 0)
+		return (-1 - rv) - dataSize;  // bytes not written
+
+	//
+	//  Followed by its checksum, if the area has one
+	//
+	if (persistentStoreChecksum(handle->header, handle->data, data, dataSize) < 0)
+		return -1;
+
+	return dataSize; // Return the number of bytes successfully written
+
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Writes a range of the data of the named area.
+ *
+ * @param name      Name of the area
+ * @param offset    Offset of the range in the data
+ * @param len       The size of the range in bytes
+ * @param data      The data of the range
+ * @return          > 0 The amount of bytes that were successfully written.
+ *                    0 Nothing is written, the area was not found or the
+ *                      range does not fit in its data.
+ *                  < 0 The number of bytes not written after a write error.
+ *                      -1 also if the checksum of the area was not written.
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentWriteAreaRange(char* name, uint16_t offset, uint16_t len, char* data) {
+
+	struct persistentAreaHandle handle;
+	if (openPersistentArea(name, &handle) < 0)
+		return 0;
+
+	return persistentWriteAreaRange(&handle, offset, len, data);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Writes a range of the data of an opened area. The checksum of the area,
+ *  if any, is patched using just the old bytes of the range.
+ *
+ * @param handle    The handle of the area
+ * @param offset    Offset of the range in the data
+ * @param len       The size of the range in bytes
+ * @param data      The data of the range
+ * @return          Same as persistentWriteAreaRange(name, offset, len, data)
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentWriteAreaRange(struct persistentAreaHandle* handle,
+		                         uint16_t offset, uint16_t len, char* data) {
+
+	if (handle->header == 0 || offset > handle->size || len > handle->size - offset) {
+		return 0;
+	}
+
+#if PERSISTENT_CACHE_SIZE > 0
+	if (persistentCacheWrite(handle->header, offset, len, data))
+		return len;
+#endif
+
+	//
+	//  The new checksum is calculated before the old bytes are overwritten
+	//
+	uint32_t crc;
+	uint8_t  check = persistentPatchChecksum(handle->header, handle->data, handle->size,
+			                                 offset, data, len, &crc);
+
+	int32_t rv = persistentWriteBlock(handle->data + offset, data, 0, len);
+	if (rv < 0)
+		return (-1 - rv) - len;  // bytes not written
+
+	if (check && persistentStore(handle->data - check, (char*)&crc, check) < 0)
+		return -1;
+
+	return len;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the header address of the virgin end of the chain. It lies
+ *  beyond EPR_END_FREE if the last cell runs past it or the chain is broken.
+ *
+ *---------------------------------------------------------------------------*/
+static uint32_t persistentGetChainEnd() {
+
+#if PERSISTENT_FREE_LIST_SIZE > 0
+	if (persistentFreeState == PERSISTENT_FREE_UNBUILT)
+		persistentScanChain();
+
+	return persistentChainEnd;
+#else
+	uint32_t endFree = EPR_END_FREE;
+	uint32_t addr;
+	struct persistentAreaHeader header;
+	for (addr = EPR_START_FREE; addr < endFree; addr += header.next) {
+		persistentRead(addr, PERSISTENT_CELL_LINK_SIZE, (char*)&header);
+		if (header.next == 0)
+			return endFree + 1;
+		if (header.next == 0xffff)
+			break;
+	}
+
+	return addr;
+#endif
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Merges a freed cell with the free cells next to it, so they can be
+ *  allocated as one. A freed cell at the end of the chain is returned to
+ *  the virgin memory.
+ *
+ *  Growing the next field of a cell is not safe against power loss, a
+ *  partly written offset breaks the chain. So the merge is done as a
+ *  journaled move of 0 bytes, see persistentJournaledMove(). Returning
+ *  cells to the virgin memory only clears headers, from the last one to
+ *  the first, which leaves a valid chain at every step. A store that was
+ *  not formatted has no journal, its cells are only returned to the
+ *  virgin memory.
+ *
+ * @param addr  The EEPROM header address of the freed cell
+ *
+ * @return   1 Success
+ *          <0 Write error
+ *
+ *---------------------------------------------------------------------------*/
+static int16_t persistentCoalesce(uint32_t addr) {
+
+	uint32_t endFree = EPR_END_FREE;
+
+	//
+	//  A broken chain may run beyond its end, then the cells are not merged.
+	//  Neither are they on a store that was not formatted, it has no journal.
+	//
+	if (persistentGetChainEnd() > endFree)
+		return 1;
+
+	bool journal = persistentGetLayout()->journal != 0;
+
+	struct persistentAreaHeader header;
+	struct persistentAreaHeader nextHeader;
+	persistentRead(addr, PERSISTENT_CELL_LINK_SIZE, (char*)&header);
+
+	//
+	//  Find the end of the free memory starting at the cell
+	//
+	uint32_t end = addr + header.next;
+	nextHeader.next = 0xffff;
+	if (end + PERSISTENT_CELL_LINK_SIZE <= endFree)
+		persistentRead(end, PERSISTENT_CELL_LINK_SIZE, (char*)&nextHeader);
+
+	bool virgin = (nextHeader.next == 0xffff);
+	if (!virgin && journal && nextHeader.data == 0xffff) {
+#if PERSISTENT_FREE_LIST_SIZE > 0
+		struct persistentFreeCell* cell = persistentFreeListFind(end);
+		if (cell)
+			persistentFreeListRemove(cell);
+#endif
+		end += nextHeader.next;
+	}
+
+	//
+	//  And its start
+	//
+	uint32_t prev  = (virgin || journal) ? persistentPreviousFree(addr) : 0;
+	uint32_t start = prev ? prev : addr;
+
+	if (virgin) {
+		if (persistentClear(addr, 0xff, PERSISTENT_AREA_PREFIX_SIZE) < 0)
+			return -1;
+
+		if (prev && persistentClear(prev, 0xff, PERSISTENT_AREA_PREFIX_SIZE) < 0)
+			return -1;
+	}
+	else if (start != addr || end != addr + header.next) {
+		if (persistentJournaledMove(end, start, 0) < 0)
+			return -1;
+	}
+
+#if PERSISTENT_FREE_LIST_SIZE > 0
+	struct persistentFreeCell* cell = persistentFreeListFind(start);
+	if (virgin) {
+		if (cell)
+			persistentFreeListRemove(cell);
+		persistentChainEnd = start;
+	}
+	else if (cell)
+		cell->size = end - start;
+	else
+		persistentFreeListAdd(start, end - start);
+#endif
+
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Frees the persistent memory area with the specified header address.
+ *
+ * @param addr  The EEPROM header address of the area to free
+ *
+ * @return      Same as freePersistentArea(name)
+ *
+ *---------------------------------------------------------------------------*/
+static int16_t persistentFreeHeader(uint32_t addr) {
+
+	//
+	// Read in the persistentAreaHeader
+	//
+	struct persistentAreaHeader header;
+	persistentLoadHeader(addr, &header);
+
+	//
+	// Check if the area has already been freed.
+	//
+	if ((uint16_t)header.data == 0xffff) {
+		return 2;
+	}
+
+	//
+	//  Clear the data field, indicating that there is no data in use.
+	//  The name hash is taken before the name is cleared.
+	//  The next field is left for what it is, merging with
+	//  the neighbouring cells is done afterwards.
+	//
+#if PERSISTENT_INDEX_SIZE > 0
+	uint32_t hash     = persistentNameHash(header.name);
+#endif
+	uint8_t  free     = persistentFreeHeaderSize();
+	uint32_t addrData = addr + free;   // Including the rest of a compact header and a checksum
+	uint32_t addrNext = addr + header.next;
+	header.data = 0xffff;           // Always clear the data field.
+
+	//
+	//  And clear the area name with '\0'. This prevents a false match
+	//  if we are searching for a header with a specific name.
+	//
+	for (int i = 0; i < PERSISTENT_AREA_NAME_SIZE; i++)  // Clear the entire name
+	  header.name[i] = (char)0xFF;  // Clear each byte of the name[] array
+
+	//
+	//  Store the modified header, thereby persisting it in memory.
+	//
+	int32_t clearedBytes = persistentStore(addr, (char*)&header, free);
+	if (clearedBytes != free) {
+		return (int16_t)0x8001;   // Write error in header
+	}
+
+	persistentCountArea(-1);
+
+#if PERSISTENT_INDEX_SIZE > 0
+	persistentIndexRemove(addr, hash);
+#endif
+
+#if PERSISTENT_CACHE_SIZE > 0
+	persistentCacheDrop(addr);
+#endif
+
+	//
+	//  Clear the data area, merged free cells must read 0xff beyond their header.
+	//
+	uint16_t dataSize = addrNext - addrData;
+	clearedBytes = persistentClear(addrData, 0xff, dataSize);
+	if (clearedBytes != dataSize)
+		return (clearedBytes | 0xC000); // highest two bits set.
+
+	//
+	//  Merge with free neighbours
+	//
+	if (persistentCoalesce(addr) < 0)
+		return (int16_t)0x8000;
+
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Frees the allocated persistent memory area
+ *
+ * @param name  Name of the memory area to free
+ *
+ * @return      >0     if the memory was freed successfully
+ *               1     memory is freed
+ *               2     Is already freed
+ *               0     Unused
+ *              -1     Area name was not found
+ *              <0     if the memory was not freed (completely)
+ *                     rc == 0x8000 -> write error merging with free neighbours
+ *                     rc & 0xC000 -> 0x8001 - 0xBFFF is write error in header
+ *                     rc & 0xC000 -> 0xC000 - 0xFFFE is write error in data
+ *
+ *---------------------------------------------------------------------------*/
+int16_t freePersistentArea(char* name) {
+
+	uint32_t areaData;
+	uint16_t areaSize;
+	uint32_t addr = persistentFindArea(name, &areaData, &areaSize);
+
+	if (addr == 0) {
+		return -1;
+	}
+
+	return persistentFreeHeader(addr);
 }
 
 /**----------------------------------------------------------------------------
  *
+ *  Frees the area of an opened handle and closes the handle.
  *
- *   Returns the first byte address of not allocatable persistent memory.
+ * @param handle  The handle of the area to free
  *
- *   @return  first byte address outside the persistent memory.
+ * @return      Same as freePersistentArea(name)
  *
  *---------------------------------------------------------------------------*/
-uint32_t getFreeStorageAreaEnd() {
-  return EPR_END_FREE;
+int16_t freePersistentArea(struct persistentAreaHandle* handle) {
+
+	if (handle->header == 0) {
+		return -1;
+	}
+
+	int16_t rc = persistentFreeHeader(handle->header);
+	handle->header = 0;
+
+	return rc;
 }
 
+
+
+
+
+
 /**----------------------------------------------------------------------------
  *
- *  Finds the next free persistent area.
- *  It merely find it and returns the data address for it.
- *  It does not write anything in the area found.
- *  So it is ready for use but its header needs to be initialized.
- *  You can use the newPersistentHeader() function to do that.
- *  Or use the function newPersistenceArea() which does it all in one go.
+ *  Resizes the area with the specified header address, keeping its data.
  *
- * @return  > 0 The persistent area data address
- *            0 No allocatable persistent memory left
+ *  If the cell behind the area is free, or the area ends the chain, the next
+ *  field of the area is changed in place, journaled by
+ *  persistentJournaledResize(). The data is not copied then, only the bytes
+ *  that change between a header and data are written. A shrink splits off a
+ *  free cell, merged with a free cell behind it. If there is no room in
+ *  place, or a shrink leaves too little for a free cell, the area is
+ *  relocated. Its data is copied a chunk at a time to a new cell, which
+ *  only then gets its header, and the old cell is freed. That is journaled
+ *  by persistentRelocateBegin(), so a power loss leaves the area in the
+ *  old cell or in the new one. A store that was not formatted has no
+ *  journal, its areas are not resized.
+ *
+ *  Bytes added to the area read 0xff. A checksum that was written is
+ *  updated, the data is verified against it first.
+ *
+ * @param addr     The EEPROM header address of the area
+ * @param newSize  The new size of the data of the area
+ * @param handle   Returns the handle of the resized area
+ *
+ * @return   Same as resizePersistentArea(name, newSize)
  *
  *---------------------------------------------------------------------------*/
-uint32_t findNewPersistentArea(uint16_t dataSize) {
+static int16_t persistentResizeHeader(uint32_t addr, uint16_t newSize,
+		                              struct persistentAreaHandle* handle) {
 
-	//
-	//  Calculate the size of the entire memory cell going to be allocated,
-	//  which includes a header for bookkeeping purposes
-	//
-	uint16_t size = PERSISTENT_AREA_PREFIX_SIZE + dataSize;
-
-	//
-	//  For as long as there is allocatable EEPROM memory,
-	//
 	struct persistentAreaHeader header;
-	for (uint32_t addr = EPR_START_FREE; addr < EPR_END_FREE; addr += header.next) {
+	persistentLoadHeader(addr, &header);
 
-		//
-		//  Read in the header
-		//
-		persistentReadHeader(addr + PERSISTENT_AREA_PREFIX_SIZE, &header);
+	uint8_t  offset  = PERSISTENT_DATA_OFFSET(header.data);
+	uint16_t oldSize = header.next - offset;
+	uint32_t cell    = (uint32_t)offset + newSize;
+	uint32_t endFree = EPR_END_FREE;
+	uint8_t  free    = persistentFreeHeaderSize();
 
+	handle->header = addr;
+	handle->data   = addr + offset;
+	handle->size   = oldSize;
 
-		//
-		//  Check that the data field contains 0xffff,
-		//  If not then the cell is occupied.
-		//  So skip to the next cell.
-		//
+	if (newSize == oldSize)
+		return 1;
 
-		if ( header.data != 0xffff) {
-			continue;
-		}
+	if (cell >= 0xffff)
+		return -2;
 
-		//
-		//  We have a potential candidate...
-		//  So read the next field of the header.
-		//  which contains the total size of the cell
-		//  which includes the data + the header (i.e. prefix) size.
-		//
+	//
+	//  Resizing needs the journal, a store that was not formatted has none
+	//
+	if (!persistentGetLayout()->journal)
+		return -5;
 
-		//
-		//  If the next contains 0xffff, then this is the end of the linked list.
-		//  So that memory can be allocated, provided the requested size does
-		//  not get past the END of the allocatable persistent memory space.
-		//
-		if (header.next == 0xffff) {
-			if ( (header.next + PERSISTENT_AREA_PREFIX_SIZE + dataSize) < EPR_END_FREE )  {
-		      return addr + PERSISTENT_AREA_PREFIX_SIZE; // Uasable, return it.
-			}
-		}
-		else {
-		  //
-		  //  If it contains something else as 0xffff, then this is a freed,
-		  //  hence allocatable, memory cell.
-		  //  For that the total size of the cell needs to be big enough.
-		  //  That is it needs to be greater or equal the requested dataSize
-		  //  plus the size of the header (i.e. prefix).
-		  //
-		  if (header.next >= (PERSISTENT_AREA_PREFIX_SIZE + dataSize) ) {
-
-		    return addr + PERSISTENT_AREA_PREFIX_SIZE;  // Useable, so return it.
-
-		  }
+	//
+	//  The data must be right before it is kept, the cached and queued
+	//  writes of the area are in persistent memory then.
+	//
+	int16_t checked = persistentVerifyArea(handle);
+	if (checked < 0)
+		return -3;
+
+	if (persistentUncacheArea(handle) < 0)
+		return -4;
+
+	//
+	//  Find out what is behind the area. A broken chain may run beyond its
+	//  end, then the area is not resized in place.
+	//
+	uint32_t end = addr + header.next;
+	struct persistentAreaHeader nextHeader;
+	nextHeader.next = 0xffff;
+	if (end + PERSISTENT_CELL_LINK_SIZE <= endFree)
+		persistentRead(end, PERSISTENT_CELL_LINK_SIZE, (char*)&nextHeader);
+
+	bool     virgin = (nextHeader.next == 0xffff);
+	bool     merge  = !virgin && nextHeader.next != 0 && nextHeader.data == 0xffff;
+	uint32_t room   = virgin ? endFree - addr : header.next + (merge ? nextHeader.next : 0);
+	uint16_t rest   = virgin ? 0xffff : (uint16_t)(room - cell);
+
+	bool inPlace = persistentGetChainEnd() <= endFree &&
+			       (cell == room || cell + (virgin ? 0 : free) <= room);
+
+	if (inPlace) {
+		if (persistentJournaledResize(addr, cell, rest, header.next, checked > 0) < 0)
+			return -4;
+
+#if PERSISTENT_FREE_LIST_SIZE > 0
+		if (persistentFreeState != PERSISTENT_FREE_UNBUILT) {
+			struct persistentFreeCell* freeCell = merge ? persistentFreeListFind(end) : 0;
+			if (freeCell)
+				persistentFreeListRemove(freeCell);
+
+			if (virgin)
+				persistentChainEnd = addr + cell;
+			else if (rest)
+				persistentFreeListAdd(addr + cell, rest);
 		}
+#endif
 
-		//
-		//  If we are here, then we need to go to the next cell.
-		//
+#if PERSISTENT_INDEX_SIZE > 0
+		struct persistentIndexEntry* entry = persistentIndexFindHeader(addr);
+		if (entry)
+			entry->size = newSize;
+#endif
 
+		handle->size = newSize;
+		return 1;
 	}
 
 	//
-	//  Otherwise return -, which indicates no free EEPROM mmory was found.
+	//  Otherwise the area is relocated, under the same name and version.
+	//  The new cell is prepared and gets the data before its header is
+	//  written, until then it is not part of the chain.
 	//
-	return 0;
-}
+	uint8_t check  = persistentCheckSize(addr, addr + offset);
+	uint8_t prefix = offset - check;
 
-/**----------------------------------------------------------------------------
- *
- *  Searches for the next free persistent memory address.
- *
- * @param size  Size in bytes of the area to allocate
- *
- * @return      >  0 The data address of the free memory.
- *              <= 0 Error getting the new memory
- *                 0 No free memory available.
- *                -1 -> Area name is already in use.
- *                -2 -> Passed area address is already in use
- *                -3 -> write error
- *                -4 -> Passed area for reuse, but too small
- *
- ----------------------------------------------------------------------------*/
-uint32_t newPersistentArea(char* name, uint16_t dataSize) {
+	uint32_t to = persistentFindCell(cell);
+	if (to == 0)
+		return -2;
+
+	struct persistentAreaHeader target;
+	persistentRead(to, PERSISTENT_CELL_LINK_SIZE, (char*)&target);
+	bool reuse = (target.next != 0xffff);
+	if (reuse && target.data != 0xffff)
+		return -4;
+
+	if (persistentRelocateBegin(addr, to, cell, header.data) < 0)
+		return -4;
 
 	//
-	// Check if the area name does not already exist.
-	// If so return the proper error code.
+	//  At the end of the chain the header after the new cell must be virgin,
+	//  a freed cell that is bigger than needed is split
 	//
-	uint32_t existAddr = getPersistentHeaderAddress(name);
+	if (!reuse && to + cell < endFree) {
+		uint16_t clear = (to + cell + PERSISTENT_AREA_PREFIX_SIZE <= endFree)
+				       ? PERSISTENT_AREA_PREFIX_SIZE : endFree - to - cell;
+		if (persistentClear(to + cell, 0xff, clear) < 0)
+			return -4;
+	}
 
-	if (existAddr) {
-	  return -1;
+	if (reuse && target.next != cell) {
+		struct persistentAreaHeader rest;
+		rest.next = target.next - cell;
+		rest.data = 0xffff;
+		memset(rest.name, 0xff, PERSISTENT_AREA_NAME_SIZE);
+		if (persistentStore(to + cell, (char*)&rest, free) < 0)
+			return -4;
 	}
 
-	//
-	//  Find a new area which fits the requested dataSize
-	//
-	uint32_t addr = findNewPersistentArea(dataSize);
+	uint32_t data = to + offset;
+	uint16_t keep = (newSize < oldSize) ? newSize : oldSize;
+	char     chunk[PERSISTENT_SCAN_CHUNK];
+	for (uint16_t done = 0; done < keep; ) {
+		uint16_t n = keep - done;
+		if (n > sizeof(chunk))
+			n = sizeof(chunk);
+
+		persistentRead(addr + offset + done, chunk, n);
+		if (persistentStore(data + done, chunk, n) < 0)
+			return -4;
+		done += n;
+	}
+
+	if (newSize > keep && persistentClear(data + keep, 0xff, newSize - keep) < 0)
+		return -4;
 
 	//
-	//  If nothing found, then return
+	//  A checksum that was never written reads as all ones
 	//
-	if (addr <= 0) {
-	  return 0;
+	if (checked) {
+		if (persistentWriteChecksum(data, newSize, check) < 0)
+			return -4;
 	}
+	else if (check && persistentClear(to + prefix, 0xff, check) < 0)
+		return -4;
+
+	if (persistentRelocateCommit(addr, to, cell, header.data) < 0)
+		return -4;
+
+#if PERSISTENT_FREE_LIST_SIZE > 0
+	if (persistentFreeState != PERSISTENT_FREE_UNBUILT)
+		persistentFreeListTake(to, target.next, cell);
+#endif
+
+#if PERSISTENT_INDEX_SIZE > 0
+	uint32_t hash = persistentNameHash(header.name);
+	persistentIndexRemove(addr, hash);
+	if (persistentIndexState != PERSISTENT_INDEX_UNBUILT)
+		persistentIndexAdd(hash, to, newSize, offset);
+#endif
+
+#if PERSISTENT_CACHE_SIZE > 0
+	persistentCacheDrop(addr);
+#endif
+
+	handle->header = to;
+	handle->data   = data;
+	handle->size   = newSize;
 
 	//
-	//  For as long as there is initialized EEPROM memory,
+	//  The old cell is free now, merge it with its neighbours
 	//
-	int16_t size = newPersistentHeader(name, addr, dataSize);
-	if (size == dataSize) {
-	  return addr;
+	if (persistentCoalesce(addr) < 0)
+		return -4;
+
+	return 2;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Resizes an area, keeping its data up to the smaller of both sizes.
+ *  The area is resized in place if the cell behind it is free or it ends
+ *  the chain, a shrink splits a free cell off. Only otherwise the area is
+ *  relocated. Handles opened on the area must be opened again afterwards,
+ *  or use resizePersistentArea(handle, newSize). A cached area is
+ *  committed and removed from the cache. Both are journaled, so the store
+ *  must be formatted.
+ *
+ * @param name     Name of the area
+ * @param newSize  The new size of the data in bytes
+ *
+ * @return   1 The area was resized in place
+ *           2 The area was relocated
+ *          -1 The area with the specified name was not found
+ *          -2 No free memory to hold the new size
+ *          -3 The data does not match its checksum, it is not resized
+ *          -4 Write error
+ *          -5 The store was not formatted, it has no journal. See
+ *             persistentUpgrade().
+ *
+ *---------------------------------------------------------------------------*/
+int16_t resizePersistentArea(char* name, uint16_t newSize) {
+
+	uint32_t areaData;
+	uint16_t areaSize;
+	uint32_t addr = persistentFindArea(name, &areaData, &areaSize);
+
+	if (addr == 0) {
+		return -1;
 	}
 
-	//
-	//  Otherwise return 0, which indicates no free EEPROM memory was found.
-	//
-	return 0;
+	struct persistentAreaHandle handle;
+	return persistentResizeHeader(addr, newSize, &handle);
 }
 
-/**---------------------------------------------------------------------------
+/**----------------------------------------------------------------------------
  *
- * Read the data for the named area from the corresponding EEPROM area.
+ *  Resizes the area of an opened handle, the handle is updated.
  *
- * @param name      Name of the area
- * @param dataSize  The size of the data area in bytes
- * @param data      The persisted area data
+ * @param handle   The handle of the area
+ * @param newSize  The new size of the data in bytes
  *
- * @return          A return code.
- *                   1  Success
- *                   0  Not used
- *                  -1  The area with the specified name was not found
- *                  -2  The requested data size differs from the area
- *                      its actual data size.
+ * @return   Same as resizePersistentArea(name, newSize)
  *
  *---------------------------------------------------------------------------*/
-int16_t persistentReadArea(char* name, uint16_t dataSize, char* data) {
-
-  //
-  //  Read in the area header & return the EEPROM address of the data area.
-  //
-  struct persistentAreaHeader header;
-  uint32_t addr = persistentReadHeader(name, &header);
-
-  //
-  // If addres 0 is returned, then the area doesn't exist.
-  //
-  if (addr == 0) {
-	  return -1;
-  }
+int16_t resizePersistentArea(struct persistentAreaHandle* handle, uint16_t newSize) {
 
-  //
-  // Check if the requested data size corresponds to the stored data size
-  //
-  uint16_t areaDataSize = header.next - header.data;
-  if (areaDataSize != dataSize) {
-	  return -2;
-  }
+	if (handle->header == 0) {
+		return -1;
+	}
 
-  //
-  // For an existing area, read its contents and return it
-  //
-  persistentRead(addr, dataSize, data);
-  return 1;
+	return persistentResizeHeader(handle->header, newSize, handle);
 }
 
 /**----------------------------------------------------------------------------
  *
- *  Writes data from a data buffer to persistent memory.
- *  If succesfully written the size returned is equal to the dataSize.
- *  If tha is not the case, then an error occurred while writing and
- *  the persistent memory is then corrupted.
+ *  Marks the requests of a batch whose name is already in use.
+ *  With a complete index no EEPROM is read, other than to compare names
+ *  that share a hash. Otherwise the chain is walked once for every
+ *  PERSISTENT_BATCH_NAMES requests, only reading the next field and the
+ *  name hash of a header to decide whether its name must be compared.
  *
- * @param addr      The EEPROM address of the persistent memory
- * @param dataSize  The size of the data to be written
- * @param data      The address of the data buffer
- * @return          > 0 The amount of bytes that were successfully written.
- *                    0 Nothing is written, because it was the wrong data area.
- *                  < 0 The number of bytes not written after a write error.
+ * @param areas  The requests, a result of 0 is still to be checked
+ * @param count  The number of requests
+ *
+ * @return   > 0 The header address of the end of the chain, if it was walked.
+ *               It lies beyond EPR_END_FREE if the chain is broken.
+ *             0 The chain was not walked
  *
  *---------------------------------------------------------------------------*/
-int16_t persistentWriteArea(char *name, uint16_t dataSize, char* data) {
+static uint32_t persistentCheckNames(struct persistentAreaRequest* areas, uint8_t count) {
 
-	//
-	//  Read in the area header.
-	//
-	struct persistentAreaHeader header;
-	uint32_t addr = persistentReadHeader(name, &header);
+#if PERSISTENT_INDEX_SIZE > 0
+	if (persistentIndexState == PERSISTENT_INDEX_UNBUILT)
+		persistentScanChain();
 
-	if (!addr)
+	if (persistentIndexState == PERSISTENT_INDEX_COMPLETE) {
+		for (uint8_t i = 0; i < count; i++)
+			if (areas[i].result == 0 && persistentIndexLookup(areas[i].name))
+				areas[i].result = -1;
 		return 0;
-	//
-	//  calculate data addresses
-	//
-	uint32_t start  = addr;
-	uint32_t end    = start + dataSize;
-
-	//
-	//  If the dataSize is unequal to the available memory,
-	//  then return the -1 error code
-	//
-	if (dataSize != (end - start)) {
-        return 0;
 	}
+#endif
 
-	//
-	//  Write the data buffer too EEPROM
-	//
-	uint32_t addrWr = start;
-	while (addrWr < end) {
+	uint32_t endFree = EPR_END_FREE;
+	uint32_t addr    = EPR_START_FREE;
+	uint8_t  hash[PERSISTENT_BATCH_NAMES];
+	struct persistentAreaHeader header;
 
-		//
-		//  If data is unequal to value to be written,
-		//  then we have to modify the EEPROM
-		//
-	    if (EEPROM.read(addrWr) != *data) {
+	for (uint16_t first = 0; first < count; first += PERSISTENT_BATCH_NAMES) {
 
-	      //
-	      //  Write the byte to EEPROM
-	      //
-	      EEPROM.write((int)addrWr, *data);
+		uint8_t n = (count - first < PERSISTENT_BATCH_NAMES) ? count - first : PERSISTENT_BATCH_NAMES;
+		for (uint8_t i = 0; i < n; i++)
+			hash[i] = persistentHeaderHash(areas[first + i].name);
 
-		  //
-		  //  Read the value in the byte just written back
-		  //  It should be equal to the data buffer byte
-		  //  If not we have a write error.
-		  //
-		  char c = EEPROM.read(addrWr);
-		  if (c != *data)
-			return (addrWr - start) - dataSize;  // bytes not written
-	    }
+		for (addr = EPR_START_FREE; addr < endFree; addr += header.next) {
 
-		data++;    // Next data buffer byte.
-		addrWr++;  // Next EEPROM address to write to.
-	}
+			persistentRead(addr, PERSISTENT_CELL_LINK_SIZE, (char*)&header);
+			if (header.next == 0xffff)
+				break;
+
+			//
+			//  Beyond a zero offset the end of the chain is not known,
+			//  as in persistentGetChainEnd() no area is placed there.
+			//
+			if (header.next == 0) {
+				addr = endFree + 1;
+				break;
+			}
 
-	return addrWr - start; // Return the number of bytes successfully written
+			if (header.data == 0xffff)
+				continue;
+
+			//
+			//  A header without a hash has its name compared
+			//
+			uint8_t stored = PERSISTENT_DATA_HASH(header.data);
+			for (uint8_t i = 0; i < n; i++) {
+				struct persistentAreaRequest* area = &areas[first + i];
+				if (area->result == 0 && (!stored || stored == hash[i]) &&
+					!persistentHeaderNameCmp(addr, area->name))
+					area->result = -1;
+			}
+		}
+	}
 
+	return addr;
 }
 
 /**----------------------------------------------------------------------------
  *
- *  Frees the allocated persistent memory area
+ *  Allocates a batch of areas, e.g. all areas of an application at its
+ *  first start. Allocating them one by one checks every name and finds a
+ *  cell for every area separately. Here the names are checked in a single
+ *  walk of the chain, or not at all with a complete index. The areas are
+ *  placed one after the other at the end of the chain and their headers
+ *  are written from the last to the first. The next field of the first
+ *  header is written last, it links all of them into the chain at once.
+ *  The area count in the superblock is written once.
  *
- * @param name  Name of the memory area to free
+ *  Areas that do not fit at the end of the chain are allocated as by
+ *  newPersistentArea(), in a freed cell if one fits.
  *
- * @return      >0     if the memory was freed successfully
- *               1     memory is freed
- *               2     Is already freed
- *               0     Unused
- *              -1     Area name was not found
- *              <0     if the memory was not freed (completely)
- *                     rc & 0xC000 -> 0x8001 - 0xBFFF is write error in header
- *                     rc & 0xC000 -> 0xC000 - 0xFFFE is write error in data
+ * @param areas  The requests, see persistentAreaRequest, each returns its
+ *               result and a handle on its area
+ * @param count  The number of requests
+ *
+ * @return   The number of areas allocated
  *
  *---------------------------------------------------------------------------*/
-int16_t freePersistentArea(char* name) {
-
-	uint32_t addr = getPersistentHeaderAddress(name);
-	uint32_t addrNext = 0;
-
-	if (addr == 0) {
-		return -1;
-	}
+int16_t newPersistentAreas(struct persistentAreaRequest* areas, uint8_t count) {
 
 	//
-	// Read in the persistentAreaHeader
+	//  A name that appears twice in the batch is only allocated once
 	//
-	struct persistentAreaHeader header;
-	persistentReadHeader(name, &header);
+	for (uint8_t i = 0; i < count; i++) {
+		areas[i].result        = 0;
+		areas[i].handle.header = 0;
+		for (uint8_t j = 0; j < i; j++)
+			if (!strncmp(areas[i].name, areas[j].name, PERSISTENT_AREA_NAME_SIZE))
+				areas[i].result = -1;
+	}
+
+	if (count == 0)
+		return 0;
+
+	uint32_t start = persistentCheckNames(areas, count);
+	if (start == 0)
+		start = persistentGetChainEnd();
 
 	//
-	// Check if the area has already been freed.
+	//  Lay out the areas that fit at the end of the chain, in batch order
 	//
-	if ((uint16_t)header.data == 0xffff) {
-		return 2;
+	uint32_t endFree = EPR_END_FREE;
+	uint32_t end     = start;
+	uint8_t  last    = 0;
+	for (uint8_t i = 0; i < count; i++) {
+		struct persistentAreaRequest* area = &areas[i];
+		uint32_t cell = (uint32_t)persistentNewHeaderSize(area->name) + area->check + area->size;
+		if (area->result != 0 || end + cell > endFree || cell >= 0xffff)
+			continue;
+
+		area->handle.header = end;
+		area->handle.data   = end + cell - area->size;
+		area->handle.size   = area->size;
+		end += cell;
+		last = i + 1;
 	}
 
 	//
-	// Clear the data and the name part of the header.
-	// Optionally clear the next if the data field next of the next
-	// block contains 0xffff. This means we free the last area in the chain.
-	// The last block can be completely erased without consequences.
-	// With a next alloc it can be allocated with a different size without
-	// any side effects.
-	// Otherwise we leave the next for what it is, since it is part of
-	// the chain and has a next block.
+	//  The header after the last area must be virgin,
+	//  persistentFormat() leaves the old contents.
 	//
-	struct persistentAreaHeader nextHeader;
+	bool failed = false;
+	if (end != start && end < endFree) {
+		uint16_t clear = (end + PERSISTENT_AREA_PREFIX_SIZE <= endFree)
+				       ? PERSISTENT_AREA_PREFIX_SIZE : endFree - end;
+		failed = persistentClear(end, 0xff, clear) < 0;
+	}
 
 	//
-	// Read in the next header
+	//  Write the headers from the last area to the first,
+	//  each with a checksum that reads as never written.
 	//
-	addrNext = addr + header.next;
-	persistentRead((uint32_t)(addrNext),
-			        PERSISTENT_AREA_PREFIX_SIZE,
-					(char*)&nextHeader);
+	char raw[PERSISTENT_COMPACT_PREFIX_SIZE + PERSISTENT_AREA_NAME_SIZE];
+	for (uint8_t i = last; i-- > 0 && !failed; ) {
+		struct persistentAreaRequest* area = &areas[i];
+		if (area->handle.header == 0)
+			continue;
 
-	//
-	//  Clear the data field, indicating that there is no data in use.
-	//
-	uint32_t addrData = addr + header.data;
-	header.data = 0xffff;           // Always clear the data field.
+		uint32_t header = area->handle.header;
+		uint16_t cell   = area->handle.data + area->size - header;
+		uint8_t  prefix = persistentEncodeHeader(raw, area->name, cell, area->check, 0);
 
-	//
-	//  And clear the area name with '\0'. This prevents a false match
-	//  if we are searching for a header with a specific name.
-	//
-	for (int i = 0; i < PERSISTENT_AREA_NAME_SIZE; i++)  // Clear the entire name
-	  header.name[i] = (char)0xFF;  // Clear each byte of the name[] array
+		//
+		//  The next field of the first header links the areas into the chain,
+		//  it is written after the rest of the header.
+		//
+		uint8_t link = (header == start) ? sizeof(uint16_t) : 0;
+		if ((area->check && persistentClear(header + prefix, 0xff, area->check) < 0) ||
+			persistentStore(header + link, raw + link, prefix - link) < 0 ||
+			(link && persistentStore(header, raw, link) < 0))
+			failed = true;
+	}
 
-	//
-	// If the next header contains 0xffff in the next field,
-	// then this is untouched persistent memory.
-	// The implication of that is that "header" is the last
-	// allocated area of persistent memory.
-	// Therefore we can clear the header.next of the area to be freed
-	// indicating that this is now virgin memory.
-	//
-	if (nextHeader.next == 0xffff) // Is header the last header in the chain?
-		header.next = 0xffff;      // Yes, then we can clear the next field.
+	int16_t allocated = 0;
+	for (uint8_t i = 0; i < last; i++) {
+		struct persistentAreaRequest* area = &areas[i];
+		if (area->handle.header == 0)
+			continue;
 
-	//
-	//  Store the modified header, thereby persisting it in memory.
-	//
-	int32_t clearedBytes = persistentStore(addr, (char*)&header, (uint16_t)sizeof(header));
-	if (clearedBytes != sizeof(header)) {
-    	return -clearedBytes;
+		if (failed) {
+			area->result        = -3;
+			area->handle.header = 0;
+			continue;
+		}
+
+#if PERSISTENT_INDEX_SIZE > 0
+		if (persistentIndexState != PERSISTENT_INDEX_UNBUILT)
+			persistentIndexAdd(persistentNameHash(area->name), area->handle.header, area->size,
+					           area->handle.data - area->handle.header);
+#endif
+		area->result = 1;
+		allocated++;
 	}
 
 	//
-	//  Optionally clear the data area
-	//  Modify this to "#if 1" -> clears the entire data area
+	//  Only areas placed at the virgin end of the chain move it
 	//
-#if 1
-	uint16_t dataSize = addrNext - addrData;
-	clearedBytes = persistentClear(addrData, 0xff, dataSize);
-    if (clearedBytes != dataSize)
-    	return (clearedBytes | 0xC000); // highest two bits set.
+#if PERSISTENT_FREE_LIST_SIZE > 0
+	if (!failed && end != start && persistentFreeState != PERSISTENT_FREE_UNBUILT)
+		persistentChainEnd = end;
 #endif
 
-	return 1;
-}
+	for (int16_t n = allocated; n > 0; n -= 127)
+		persistentCountArea((int8_t)(n > 127 ? 127 : n));
 
+	//
+	//  The rest one by one
+	//
+	for (uint8_t i = 0; i < count; i++) {
+		struct persistentAreaRequest* area = &areas[i];
+		if (area->result != 0)
+			continue;
 
+		uint32_t data = newPersistentArea(area->name, area->size, &area->handle, area->check);
+		if (data == (uint32_t)-1)
+			area->result = -1;
+		else if (data) {
+			area->result = 1;
+			allocated++;
+		}
+	}
 
+	return allocated;
+}
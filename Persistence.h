@@ -37,17 +37,56 @@
  *  C H A N G E  L O G :
  *  ==========================================================================
  *  P0001 - Initial release 
+ *  P0002 - RAM resident name index for area lookups
+ *  P0003 - Handle based area access
+ *  P0004 - Cached memory layout descriptor
+ *  P0005 - Block level EEPROM reads
+ *  P0006 - Differential write engine with write statistics
+ *  P0007 - Pluggable storage backends, host builds
+ *  P0008 - Simulated EEPROM backend, see PersistentBackend.h
+ *  P0009 - Write-back cache with dirty range tracking
+ *  P0010 - Wear leveled areas
+ *  P0011 - Free cell coalescing, best fit allocation from a RAM free list
+ *  P0012 - Restartable compaction
+ *  P0013 - Superblock and fast format
+ *  P0014 - Per area checksums, optional write verification
+ *  P0015 - Ranged reads and writes, field access
+ *  P0016 - Typed areas, see PersistentArea.h
+ *  P0017 - Compile time area registry
+ *  P0018 - Name hash in the area header
+ *  P0019 - Compact area headers
+ *  P0020 - Log structured key value stores
+ *  P0021 - Ring buffer areas
+ *  P0022 - Asynchronous write queue
+ *  P0023 - Mount, builds and validates the area directory at boot
+ *  P0024 - Area cursor, listing and dumps
+ *  P0025 - Resizing an area
+ *  P0026 - Batched allocation of areas
  *  ==========================================================================
  *
  *--------------------------------------------------------------------------*/
+#if defined(ARDUINO)
 #include <Arduino.h>
 #include <EEPROM.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#endif
 
 #ifndef PERSISTENCE_h
 #define PERSISTENCE_h
 
+#include <PersistentBackend.h>
+
 /*================================================================================================*/
-#if defined(TEENSYDUINO)
+#if !defined(ARDUINO)
+
+    //  --------------- Host -------------------
+
+    #define BOARD "Host"
+
+#elif defined(TEENSYDUINO)
 
     //  --------------- Teensy -----------------
 
@@ -131,33 +170,29 @@
 
 #endif
 
-#define EEPROM_SIZE    EEPROM.length()   // The number of bytes available in EEPROM
-
-#ifdef ARDUINO_AVR_MEGA2560
+#define EEPROM_SIZE    (persistentGetBackend()->size(persistentGetBackend()->device))
 
 /*================================================================================================*/
-
-
-  #define EEPROM_RD_BYTE(addr) ((unsigned char)(EEPROM.read(addr)))
-  #define EEPROM_RD_INT(addr)  ((unsigned int)((EEPROM.read(addr+1) << 8) + EEPROM.read(addr)))
-  #define EEPROM_RD_LONG(addr) ((unsigned long)((EEPROM.RD_INT(addr+2) << 16) + EEPROM.RD_INT(addr)))
-
-  #define EEPROM_WR_BYTE(addr, v)   EEPROM.write(addr, (unsigned char)(v & 0xff))
-  #define EEPROM_WR_INT(addr, v)  \
-                                    EEPROM_WR_BYTE(addr+1,   (unsigned char) ((v & 0xff00) >> 8) ); \
-                                    EEPROM_WR_BYTE(addr,     (unsigned char) ((v & 0x00ff)     ) )
-  #define EEPROM_WR_LONG(addr, v) \
-                                    EEPROM_WR_INT(addr+2,    (unsigned int) ((v & 0xffff0000) >> 16) ); \
-                                    EEPROM_WR_INT(addr,      (unsigned int) ((v & 0x0000ffff)      ) )
-
+//
+//  Access of little endian values in persistent memory. They go through the
+//  storage backend, so they are available on every platform.
+//
 /*================================================================================================*/
 
-#else      // Otherwise platform unknown
+  extern uint8_t  persistentReadByte (uint32_t addr);
+  extern uint16_t persistentReadInt  (uint32_t addr);
+  extern uint32_t persistentReadLong (uint32_t addr);
+  extern void     persistentWriteByte(uint32_t addr, uint8_t  v);
+  extern void     persistentWriteInt (uint32_t addr, uint16_t v);
+  extern void     persistentWriteLong(uint32_t addr, uint32_t v);
 
-/*================================================================================================*/
-  #define EEPROM_SIZE    0      // For MEGA 2560.
+  #define EEPROM_RD_BYTE(addr)      persistentReadByte(addr)
+  #define EEPROM_RD_INT(addr)       persistentReadInt (addr)
+  #define EEPROM_RD_LONG(addr)      persistentReadLong(addr)
 
-#endif
+  #define EEPROM_WR_BYTE(addr, v)   persistentWriteByte(addr, (uint8_t) ((v) & 0xff))
+  #define EEPROM_WR_INT(addr, v)    persistentWriteInt (addr, (uint16_t)((v) & 0xffff))
+  #define EEPROM_WR_LONG(addr, v)   persistentWriteLong(addr, (uint32_t)(v))
 
 
 //
@@ -169,6 +204,8 @@
 //          |      size     |
 //          |      data     |
 //          |               |
+//          +---------------+- EPR_SUPERBLOCK
+//          |   Superblock  |
 //          +---------------+- EEPROM_START_FREE
 //          |       |       |
 //          |       V grows |
@@ -178,6 +215,8 @@
 //          |       A grows |
 //          |       |       |
 //          +---------------+- EEPROM_END_FREE
+//          |    Journal    |  Only if formatted
+//          +---------------+
 //          |               |
 //          |    Variable   |
 //          :      size     :
@@ -197,21 +236,53 @@
 #define EPR16_TFT_CALIBR_X_S   6      // Calibration data size in bytes for the X-axis 
 #define EPR16_TFT_CALIBR_Y_S   8      // Calibration data size in bytes for the Y axis
 
-#define EPR_START_FREE         10     // Current free EEPROM
+#define EPR_SUPERBLOCK         10     // Superblock, see persistentFormat()
+
+//
+//  Descriptor of the fixed and variable size regions of the EEPROM memory map.
+//  The start of the variable size data depends on the calibration data sizes
+//  stored in EPR16_TFT_CALIBR_X_S and EPR16_TFT_CALIBR_Y_S. Rather than reading
+//  those on every use, the boundaries are calculated once and kept in RAM.
+//
+struct persistentLayout {
+	uint32_t size;         // EEPROM_SIZE, the total size of persistent memory
+	uint32_t startFree;    // EPR_START_FREE, end of the fixed size data and superblock
+	uint32_t endFree;      // EPR_END_FREE, end of the allocatable memory
+	uint32_t journal;      // Compaction journal, up to the variable size data, 0 if not formatted
+	uint32_t calibrX;      // ADR_TFT_CALIBR_X, X-axis calibration data
+	uint32_t calibrY;      // ADR_TFT_CALIBR_Y, Y-axis calibration data
+	bool     loaded;       // True if the descriptor has been loaded
+};
+
+extern struct persistentLayout persistentMemoryLayout;
+
+extern void     persistentLoadLayout ();  // (Re)loads the layout from EEPROM
+extern int32_t  persistentSetCalibrationSizes(uint16_t xSize, uint16_t ySize);
+
+//
+//  Returns the layout descriptor, loading it on first use.
+//
+inline const struct persistentLayout* persistentGetLayout() {
+	if (!persistentMemoryLayout.loaded)
+		persistentLoadLayout();
+
+	return &persistentMemoryLayout;
+}
 
 //
 //  The following are are EEPROM memory areas that depend on the variable length data
 //  Each of those memory areas are stored in a fixed order.
 //  Since their size is dynamically specified, these macro's only provide sensible addresses
 //  if the length of those areas is stored in their assigned EEPROM address.
+//  If the EEPROM memory holding those lengths is modified directly, instead of through
+//  persistentSetCalibrationSizes() or persistentStore(), call persistentLoadLayout().
 //
-#define ADR_TFT_CALIBR_X          ((uint32_t)(EEPROM_SIZE - \
-                                                   (EEPROM_RD_INT(EPR16_TFT_CALIBR_X_S) * sizeof(uint16_t)) ) )
-#define ADR_TFT_CALIBR_Y          ((uint32_t)((ADR_TFT_CALIBR_X) - \
-                                                   (EEPROM_RD_INT(EPR16_TFT_CALIBR_Y_S) * sizeof(uint16_t)) ) )
+#define ADR_TFT_CALIBR_X          (persistentGetLayout()->calibrX)
+#define ADR_TFT_CALIBR_Y          (persistentGetLayout()->calibrY)
 
 
-#define EPR_END_FREE ADR_TFT_CALIBR_Y  // The width calibration data is the first chuck of variable data
+#define EPR_START_FREE            (persistentGetLayout()->startFree)
+#define EPR_END_FREE              (persistentGetLayout()->endFree)
 
 extern uint16_t hasPersistentStorage();
 extern uint32_t getFreeStorageAreaStart();
@@ -220,9 +291,23 @@ extern uint32_t getFreeStorageAreaEnd();
 extern bool     isPersistentStorageVirgin();
 extern int32_t  persistentStore(uint32_t addr, char* data, uint16_t size);
 extern void     persistentRead( uint32_t addr, char* data, uint16_t size);
+extern int32_t  persistentClear(uint32_t addr, unsigned char clearWith, uint16_t size);
 extern void     persistentDump( uint32_t addr, uint16_t size);
 extern void     persistentDumpRAM(uint32_t addr, uint16_t size);
 
+//
+//  Statistics of the write engine, all writes to persistent memory go through it.
+//  Only bytes that differ from what is stored get programmed, the others are skipped.
+//
+struct persistentWriteStats {
+	uint32_t compared;     // Bytes compared with persistent memory
+	uint32_t skipped;      // Bytes that already held the value to write
+	uint32_t programmed;   // Bytes that were actually programmed
+};
+
+extern void     persistentGetWriteStats  (struct persistentWriteStats* stats);
+extern void     persistentResetWriteStats();
+
 //
 //  External functions for EEPROM memory allocation
 //
@@ -249,6 +334,52 @@ extern uint32_t persistentReadHeader(
 #define PERSISTENT_AREA_NAME_SIZE    16   // Size of the name in the area header
 #define PERSISTENT_AREA_PREFIX_SIZE  (sizeof(persistentAreaHeader))  // Size of area header
 
+//
+//  RAM resident name index, mapping the hash of an area name onto its header.
+//  It is built with a single walk of the area chain on first use and kept in
+//  sync by newPersistentArea() and freePersistentArea().
+//  PERSISTENT_INDEX_SIZE is the number of index slots (6 bytes RAM each).
+//  At most three quarters of the slots are used, so to index N areas take
+//  at least 4 * N / 3 slots. The default of 56 indexes 42 areas in 336 bytes.
+//  Define it as 0 to disable the index and always walk the EEPROM chain.
+//
+#ifndef PERSISTENT_INDEX_SIZE
+#define PERSISTENT_INDEX_SIZE        56
+#endif
+
+//
+//  RAM resident list of freed cells, built by the same walk as the name index.
+//  Allocation takes the best fitting freed cell from it, splitting off what
+//  is left, and freeing merges a cell with its free neighbours.
+//  PERSISTENT_FREE_LIST_SIZE is the number of listed cells (4 bytes RAM each).
+//  If more cells are free, allocation falls back to walking the EEPROM chain.
+//  Define it as 0 to disable the list.
+//
+#ifndef PERSISTENT_FREE_LIST_SIZE
+#define PERSISTENT_FREE_LIST_SIZE    8
+#endif
+
+extern uint32_t persistentNameHash   (char* name); // Hash of an area name
+extern void     persistentIndexReset ();           // Rebuild index and free list on next use
+
+//
+//  Result of persistentMount(), which builds the name index and the free
+//  list at boot with a single walk of the area chain, checking every header
+//  on the way.
+//
+struct persistentMountStats {
+	uint16_t areas;        // Allocated areas in the chain
+	uint16_t indexed;      // Areas in the name index, lookups of others walk the chain
+	uint16_t freeCells;    // Freed cells in the chain
+	uint16_t freeBytes;    // Bytes in the freed cells, headers included
+	uint32_t chainEnd;     // Header address of the virgin end of the chain
+	uint32_t bytesRead;    // Bytes read by the walk
+	uint32_t timeUs;       // Duration of the walk in us, 0 on hosts
+	uint32_t badHeader;    // Header address of the first bad header, 0 if none
+};
+
+extern int16_t  persistentMount      (struct persistentMountStats* stats);
+
 
 
 struct persistentAreaHeader {
@@ -272,6 +403,9 @@ struct persistentAreaHeader {
 	//
 	//  Offset to the data of the area. This typically points right
 	//  after the address containing the terminating '\0' of the name.
+	//  An area with a checksum has it stored there, its data follows it.
+	//  The offset is in the low byte, the high byte holds an 8 bit hash
+	//  of the name, which is 0 in headers written before it existed.
 	//
 	uint16_t data;    // Offset of data calculated from &bext
 
@@ -281,4 +415,439 @@ struct persistentAreaHeader {
 	char     name[PERSISTENT_AREA_NAME_SIZE];      // Array with area name
 };
 
+//
+//  Access to the two parts of the data field of an allocated area header.
+//  The chain walk compares the name hash first and only reads the name
+//  of a header with a matching hash, or one without a hash.
+//
+#define PERSISTENT_DATA_OFFSET(data)  ((uint8_t)(data))
+#define PERSISTENT_DATA_HASH(data)    ((uint8_t)((data) >> 8))
+
+extern uint8_t  persistentHeaderHash     (char* name); // 8 bit name hash, never 0
+extern int16_t  persistentMigrateHeaders ();           // Adds the hash to old headers
+
+//
+//  A store formatted with PERSISTENT_FEATURE_COMPACT has compact headers.
+//  After the data field they hold the length of the name and then the name
+//  itself, without a terminating '\0'. A free cell only has the next and
+//  data fields, its other bytes read 0xff. An area named "volume" then
+//  takes 11 bytes of header instead of PERSISTENT_AREA_PREFIX_SIZE.
+//
+#define PERSISTENT_CELL_LINK_SIZE       (2*sizeof(uint16_t))  // next and data
+#define PERSISTENT_COMPACT_PREFIX_SIZE  5    // next, data and the name length
+
+extern uint8_t  persistentHeaderSize     (uint32_t header);    // Size of an allocated header
+extern uint8_t  persistentCheckSize      (uint32_t header, uint32_t data);
+extern uint8_t  persistentFreeHeaderSize ();                   // Size of a free cell header
+extern uint8_t  persistentLoadHeader     (uint32_t addr, struct persistentAreaHeader* header);
+
+//
+//  Handle of an opened area. It caches the data address and size of the area,
+//  so reading, writing and freeing through a handle needs no name lookup.
+//  A handle is no longer valid once its area has been freed.
+//
+struct persistentAreaHandle {
+	uint32_t header;   // EEPROM address of the area header, 0 if not open
+	uint32_t data;     // EEPROM address of the data part
+	uint16_t size;     // Size of the data part in bytes
+};
+
+//
+//  External functions for handle based access of EEPROM memory areas
+//
+extern int16_t  openPersistentArea   (char* name, struct persistentAreaHandle* handle);
+extern uint32_t newPersistentArea    (char* name, uint16_t dataSize,
+		                              struct persistentAreaHandle* handle);
+extern uint32_t newPersistentArea    (char* name, uint16_t dataSize,
+		                              struct persistentAreaHandle* handle, uint8_t check);
+extern int16_t  persistentReadArea   (struct persistentAreaHandle* handle, uint16_t dataSize, char* data);
+extern int16_t  persistentWriteArea  (struct persistentAreaHandle* handle, uint16_t dataSize, char* data);
+extern int16_t  freePersistentArea   (struct persistentAreaHandle* handle);
+
+//
+//  Resizing an area keeps its data, up to the smaller of both sizes. It is
+//  resized in place if the cell behind it is free or it ends the chain, a
+//  shrink splits a free cell off. Only otherwise it is relocated. Both are
+//  journaled, so the store must be formatted.
+//
+extern int16_t  resizePersistentArea (char* name, uint16_t newSize);
+extern int16_t  resizePersistentArea (struct persistentAreaHandle* handle, uint16_t newSize);
+
+//
+//  Allocating a batch of areas, e.g. at first boot. The names are checked in
+//  a single walk of the chain, PERSISTENT_BATCH_NAMES names per walk. The
+//  areas are placed one after the other at the end of the chain. An area
+//  that does not fit there is allocated as by newPersistentArea().
+//  The result of each area is returned in its request:
+//     1  Allocated, its handle is open
+//     0  No memory left
+//    -1  The name is already in use, or appears twice in the batch
+//    -3  Write error
+//
+#ifndef PERSISTENT_BATCH_NAMES
+#define PERSISTENT_BATCH_NAMES       32
+#endif
+
+struct persistentAreaRequest {
+	char*    name;      // Name of the area
+	uint16_t size;      // Size of its data
+	uint8_t  check;     // Checksum, see PERSISTENT_CHECK_CRC16
+	int16_t  result;    // Returns the result for the area
+	struct persistentAreaHandle handle;   // Returns the handle on the area
+};
+
+extern int16_t  newPersistentAreas   (struct persistentAreaRequest* areas, uint8_t count);
+
+//
+//  Reading and writing a range of the data of an area, offset is relative
+//  to the start of the data part. Only the bytes of the range are accessed.
+//
+extern int16_t  persistentReadAreaRange (char* name, uint16_t offset, uint16_t len, char* data);
+extern int16_t  persistentReadAreaRange (struct persistentAreaHandle* handle,
+		                                 uint16_t offset, uint16_t len, char* data);
+extern int16_t  persistentWriteAreaRange(char* name, uint16_t offset, uint16_t len, char* data);
+extern int16_t  persistentWriteAreaRange(struct persistentAreaHandle* handle,
+		                                 uint16_t offset, uint16_t len, char* data);
+
+//
+//  Reads or writes one field of a struct stored in an area, by name or handle.
+//  E.g. persistentWriteField(&handle, struct settings, volume, &volume);
+//
+#define persistentReadField(area, type, field, data)                     \
+		persistentReadAreaRange(area, offsetof(type, field),             \
+				                sizeof(((type*)0)->field), (char*)(data))
+#define persistentWriteField(area, type, field, data)                    \
+		persistentWriteAreaRange(area, offsetof(type, field),            \
+				                 sizeof(((type*)0)->field), (char*)(data))
+
+//
+//  Area checksums, see PersistentCrc.cpp.
+//  An area can be allocated with a CRC of its data, stored between its header
+//  and its data. persistentWriteArea() updates it and persistentReadArea()
+//  verifies it on the first read of the area after a reset, or of the index.
+//  persistentVerifyArea() verifies it on request.
+//
+//  PERSISTENT_AREA_CHECK     Checksum of areas allocated without specifying one.
+//  PERSISTENT_VERIFY_WRITES  Read back every chunk programmed, 0 relies on the checksums.
+//
+#define PERSISTENT_CHECK_NONE        0    // No checksum
+#define PERSISTENT_CHECK_CRC16       2    // CRC-16/CCITT, 2 bytes
+#define PERSISTENT_CHECK_CRC32       4    // CRC-32, 4 bytes
+
+#ifndef PERSISTENT_AREA_CHECK
+#define PERSISTENT_AREA_CHECK        PERSISTENT_CHECK_NONE
+#endif
+#ifndef PERSISTENT_VERIFY_WRITES
+#define PERSISTENT_VERIFY_WRITES     1
+#endif
+
+extern int16_t  persistentVerifyArea  (struct persistentAreaHandle* handle);
+extern uint32_t persistentChecksum    (const char* data, uint16_t size, uint8_t check);
+extern uint32_t persistentCrcInit     (uint8_t check);
+extern uint32_t persistentCrcUpdate   (uint32_t crc, const char* data, uint16_t size, uint8_t check);
+extern uint32_t persistentCrcFinal    (uint32_t crc, uint8_t check);
+
+//
+//  Used by the area functions and the cache to keep the checksums current
+//
+extern int32_t  persistentStoreChecksum(uint32_t header, uint32_t addr, const char* data, uint16_t size);
+extern int32_t  persistentUpdateChecksum(uint32_t header, uint32_t addr, uint16_t size);
+extern int32_t  persistentWriteChecksum(uint32_t addr, uint16_t size, uint8_t check);
+extern int16_t  persistentCheckData    (uint32_t header, uint32_t addr, const char* data, uint16_t size);
+extern int16_t  newPersistentHeader    (char *name, uint32_t addr, uint16_t size,
+		                                uint8_t check, uint8_t version);
+extern uint8_t  persistentPatchChecksum(uint32_t header, uint32_t addr, uint16_t size,
+		                               uint16_t offset, const char* data, uint16_t len, uint32_t* crc);
+
+//
+//  Write-back cache, see PersistentCache.cpp.
+//  The data of areas selected with persistentCacheArea() is kept in RAM.
+//  Writing such an area only updates RAM and marks the changed byte ranges
+//  dirty. persistentCommit() writes just the dirty ranges to persistent memory.
+//
+//  PERSISTENT_CACHE_SIZE       RAM pool in bytes for cached area data, 0 disables the cache.
+//  PERSISTENT_CACHE_AREAS      Maximum number of cached areas.
+//  PERSISTENT_CACHE_RANGES     Maximum number of dirty ranges per area, more are merged.
+//  PERSISTENT_CACHE_DIRTY_MAX  Number of dirty bytes that triggers a commit, 0 never.
+//
+#ifndef PERSISTENT_CACHE_SIZE
+#define PERSISTENT_CACHE_SIZE        64
+#endif
+#ifndef PERSISTENT_CACHE_AREAS
+#define PERSISTENT_CACHE_AREAS       2
+#endif
+#ifndef PERSISTENT_CACHE_RANGES
+#define PERSISTENT_CACHE_RANGES      4
+#endif
+#ifndef PERSISTENT_CACHE_DIRTY_MAX
+#define PERSISTENT_CACHE_DIRTY_MAX   32
+#endif
+
+extern int16_t  persistentCacheArea   (struct persistentAreaHandle* handle);
+extern int32_t  persistentUncacheArea (struct persistentAreaHandle* handle);
+extern int32_t  persistentCommit      ();
+extern int32_t  persistentCommitPoll  (uint32_t now);
+extern void     persistentSetCommitInterval(uint32_t interval);
+extern uint16_t persistentDirtyBytes  ();
+
+//
+//  Used by the area functions to let cached areas go through the cache
+//
+extern int16_t  persistentCacheRead   (uint32_t header, uint16_t offset, uint16_t size, char* data);
+extern int16_t  persistentCacheWrite  (uint32_t header, uint16_t offset, uint16_t size, const char* data);
+extern void     persistentCacheDrop   (uint32_t header);
+extern void     persistentCacheMove   (uint32_t oldHeader, uint32_t newHeader);
+extern void     persistentCacheReset  ();
+
+//
+//  Compaction, see PersistentCompact.cpp.
+//  Slides the allocated areas down over the freed cells, leaving all free
+//  memory as one block at the end of the chain. Every move is journaled in
+//  the PERSISTENT_JOURNAL_SIZE bytes reserved between EPR_END_FREE and the
+//  variable size data, and an interrupted move is completed when the layout
+//  is loaded after a reset. Merging freed cells uses the same journal.
+//  Only a formatted store reserves the journal, see persistentFormat().
+//  persistentUpgrade() formats a store that was not formatted keeping its
+//  areas, so it can be compacted from then on.
+//
+//  The callback, if not 0, is called for every area moved. Handles opened
+//  on it can be updated with persistentMoveHandle().
+//
+typedef void (*persistentMoveCallback)(char* name, uint32_t oldData, uint32_t newData);
+
+#define PERSISTENT_JOURNAL_SIZE  22
+
+extern int32_t  persistentCompact        (persistentMoveCallback moved);
+extern void     persistentMoveHandle     (struct persistentAreaHandle* handle,
+		                                  uint32_t oldData, uint32_t newData);
+extern void     persistentCompactRecover ();
+extern int16_t  persistentJournaledMove  (uint32_t src, uint32_t dst, uint16_t size);
+extern int16_t  persistentJournaledResize(uint32_t header, uint16_t cell, uint16_t rest,
+		                                  uint16_t old, bool checked);
+extern int16_t  persistentRelocateBegin  (uint32_t src, uint32_t dst, uint16_t cell, uint16_t data);
+extern int16_t  persistentRelocateCommit (uint32_t src, uint32_t dst, uint16_t cell, uint16_t data);
+extern int16_t  persistentJournaledUpgrade(uint32_t keep, uint32_t to, uint16_t first, uint16_t areas);
+
+//
+//  Superblock, see PersistentFormat.cpp.
+//  persistentFormat() writes it at EPR_SUPERBLOCK and the allocatable memory
+//  then starts right after it. Without a valid superblock the store is
+//  unformatted and its allocatable memory starts at EPR_SUPERBLOCK, as it
+//  always did. The area count is kept next to its complement, outside the
+//  checked fields, so a partly written count is recounted rather than
+//  invalidating the superblock.
+//
+#define PERSISTENT_SUPERBLOCK_MAGIC  0x53504254   // "TBPS"
+#define PERSISTENT_FORMAT_VERSION    1
+#define PERSISTENT_FORMAT_START      30           // EPR_START_FREE of a formatted store
+
+#define PERSISTENT_FEATURE_COMPACT   0x01         // Compact area headers
+
+struct persistentSuperblock {
+	uint32_t magic;        // PERSISTENT_SUPERBLOCK_MAGIC
+	uint8_t  version;      // PERSISTENT_FORMAT_VERSION that formatted the store
+	uint8_t  features;     // Format options, PERSISTENT_FEATURE_...
+	uint16_t startFree;    // EPR_START_FREE of the store
+	uint32_t size;         // EEPROM_SIZE when formatted
+	uint16_t journalSize;  // PERSISTENT_JOURNAL_SIZE when formatted
+	uint16_t check;        // Checksum of the fields above
+	uint16_t areas;        // Number of allocated areas
+	uint16_t areasCheck;   // ~areas
+};
+
+static_assert(PERSISTENT_FORMAT_START == EPR_SUPERBLOCK + sizeof(struct persistentSuperblock),
+		      "PERSISTENT_FORMAT_START must follow the superblock");
+
+extern int16_t  persistentFormat         ();
+extern int16_t  persistentFormat         (uint8_t features);
+extern int16_t  persistentUpgrade        ();
+extern bool     persistentIsFormatted    ();
+extern bool     persistentIsCompact      ();
+extern int16_t  persistentAreaCount      ();
+
+//
+//  Used by the layout and the area functions to keep the superblock current
+//
+extern uint32_t persistentLoadSuperblock ();
+extern int16_t  persistentStoreSuperblock(uint8_t features, uint16_t areas);
+extern void     persistentCountArea      (int8_t delta);
+
+//
+//  Wear leveled areas, see PersistentWear.cpp.
+//  A wear leveled area holds a number of slots for the same data. Every write
+//  goes to the next slot round robin, tagged with an increasing sequence number,
+//  so each slot is programmed only once every "slots" writes.
+//
+#define PERSISTENT_WEAR_SLOT_PREFIX  5    // Sequence number (4) + check byte (1)
+
+struct persistentWearHandle {
+	struct persistentAreaHandle area;   // The area holding the slots
+	uint16_t recordSize;                // Size of the data in a slot
+	uint8_t  slots;                     // Number of slots
+	uint8_t  newest;                    // Slot holding the newest data
+	uint32_t sequence;                  // Sequence number of the newest data
+	bool     empty;                     // True if no data was written yet
+};
+
+extern uint32_t newPersistentWearArea   (char* name, uint16_t dataSize, uint8_t slots,
+		                                 struct persistentWearHandle* handle);
+extern int16_t  openPersistentWearArea  (char* name, uint16_t dataSize,
+		                                 struct persistentWearHandle* handle);
+extern int16_t  persistentReadWearArea  (struct persistentWearHandle* handle, uint16_t dataSize, char* data);
+extern int16_t  persistentWriteWearArea (struct persistentWearHandle* handle, uint16_t dataSize, char* data);
+extern uint32_t persistentWearCycles    (struct persistentWearHandle* handle);
+
+//
+//  Log structured key value stores, see PersistentKv.cpp.
+//  A store is an area split into two halves. persistentKvPut() appends a
+//  record to the active half and persistentKvGet() finds the newest record
+//  of a key through the RAM index in the handle. When the active half is
+//  full its live records are copied to the other half, which then becomes
+//  the active one. persistentKvCollect() does that ahead of time, e.g. when
+//  the application is idle.
+//  PERSISTENT_KV_KEYS is the number of keys a store can hold (5 bytes RAM each).
+//  PERSISTENT_KV_COLLECT_LEVEL is the percentage of the active half that
+//  must be in use before persistentKvCollect() copies the live records.
+//
+#ifndef PERSISTENT_KV_KEYS
+#define PERSISTENT_KV_KEYS           16
+#endif
+
+#ifndef PERSISTENT_KV_COLLECT_LEVEL
+#define PERSISTENT_KV_COLLECT_LEVEL  75
+#endif
+
+#define PERSISTENT_KV_SEGMENT_PREFIX 4    // Generation (2) + check (2)
+#define PERSISTENT_KV_RECORD_PREFIX  5    // Key (2) + value length (1) + CRC16 (2)
+#define PERSISTENT_KV_NO_KEY         0xffff
+
+struct persistentKvEntry {
+	uint16_t key;                       // The key
+	uint16_t offset;                    // Offset of its newest record in the active half
+	uint8_t  len;                       // Length of its value
+};
+
+struct persistentKvHandle {
+	struct persistentAreaHandle area;   // The area holding both halves
+	uint16_t half;                      // Size of a half
+	uint8_t  active;                    // The active half, 0 or 1
+	uint16_t generation;                // Generation of the active half
+	uint16_t end;                       // Offset of the end of the log in the active half
+	uint16_t live;                      // Bytes taken by the newest records of the keys
+	uint8_t  keys;                      // Number of keys in the index
+	struct persistentKvEntry index[PERSISTENT_KV_KEYS];
+};
+
+extern uint32_t newPersistentKvStore   (char* name, uint16_t size, struct persistentKvHandle* handle);
+extern int16_t  openPersistentKvStore  (char* name, struct persistentKvHandle* handle);
+extern int16_t  persistentKvPut        (struct persistentKvHandle* handle, uint16_t key,
+		                                const char* value, uint8_t len);
+extern int16_t  persistentKvGet        (struct persistentKvHandle* handle, uint16_t key,
+		                                char* value, uint8_t size);
+extern int16_t  persistentKvRemove     (struct persistentKvHandle* handle, uint16_t key);
+extern int16_t  persistentKvCollect    (struct persistentKvHandle* handle);
+
+//
+//  Ring buffer areas, see PersistentRing.cpp.
+//  A ring buffer area holds a number of slots for records. Every append goes
+//  to the slot after the newest record, tagged with the next sequence number,
+//  so once the ring is full the oldest record is overwritten. Opening the
+//  area finds the newest record from the sequence numbers, no head pointer
+//  is stored.
+//
+#define PERSISTENT_RING_SLOT_PREFIX  3    // Sequence number (2) + check byte (1)
+
+struct persistentRingHandle {
+	struct persistentAreaHandle area;   // The area holding the slots
+	uint16_t recordSize;                // Size of a record
+	uint16_t slots;                     // Number of slots
+	uint16_t newest;                    // Slot holding the newest record
+	uint16_t sequence;                  // Sequence number of the newest record
+	uint16_t count;                     // Number of records held
+};
+
+extern uint32_t newPersistentRingArea  (char* name, uint16_t recordSize, uint16_t slots,
+		                                struct persistentRingHandle* handle);
+extern int16_t  openPersistentRingArea (char* name, uint16_t recordSize,
+		                                struct persistentRingHandle* handle);
+extern int16_t  persistentRingAppend   (struct persistentRingHandle* handle, uint16_t recordSize, char* record);
+extern int16_t  persistentRingRead     (struct persistentRingHandle* handle, uint16_t index,
+		                                uint16_t recordSize, char* record);
+extern uint16_t persistentRingCount    (struct persistentRingHandle* handle);
+extern int16_t  persistentRingDiscard  (struct persistentRingHandle* handle, uint16_t count);
+
+//
+//  Asynchronous writes, see PersistentAsync.cpp.
+//  persistentWriteAreaAsync() puts the bytes that change in a queue and
+//  returns at once. The queue is drained a byte at a time whenever the
+//  device is ready, by the EEPROM ready interrupt on AVR or by calling
+//  persistentPoll() from the main loop. Reads see the queued bytes, every
+//  other write first waits until the queue is empty.
+//
+//  PERSISTENT_ASYNC_QUEUE  Number of bytes the queue holds (max 255), 0 disables it.
+//  PERSISTENT_ASYNC_ISR    1 drains the queue from the EE_READY interrupt (AVR only).
+//
+#ifndef PERSISTENT_ASYNC_QUEUE
+#define PERSISTENT_ASYNC_QUEUE       32
+#endif
+#ifndef PERSISTENT_ASYNC_ISR
+#if defined(__AVR__)
+#define PERSISTENT_ASYNC_ISR         1
+#else
+#define PERSISTENT_ASYNC_ISR         0
+#endif
+#endif
+
+struct persistentAsyncStats {
+	uint32_t queued;       // Bytes put in the queue
+	uint32_t programmed;   // Bytes programmed from the queue
+	uint32_t failed;       // Bytes that did not read back as written
+	uint32_t failedAddr;   // Address of the last byte that failed
+	uint16_t pending;      // Bytes still in the queue
+};
+
+extern int16_t  persistentWriteAreaAsync(char* name, uint16_t dataSize, char* data);
+extern int16_t  persistentWriteAreaAsync(struct persistentAreaHandle* handle, uint16_t dataSize, char* data);
+extern uint16_t persistentPoll          ();
+extern uint16_t persistentAsyncPending  ();
+extern int32_t  persistentAsyncFlush    ();
+extern void     persistentGetAsyncStats (struct persistentAsyncStats* stats);
+extern void     persistentResetAsyncStats();
+
+//
+//  Used by the read and write engine to keep the queue coherent
+//
+extern void     persistentAsyncRead     (uint32_t addr, char* data, uint16_t size);
+
+//
+//  Area enumeration and dumps, see PersistentDump.cpp.
+//  A cursor walks the area chain a cell at a time, reading every header
+//  with a single read. The listing and the dumps use it and write their
+//  output a line at a time to a Print, Serial by default. On hosts the
+//  output goes to stdout.
+//
+#define PERSISTENT_DUMP_LINE         16   // Bytes per line of a hex dump
+
+struct persistentAreaCursor {
+	uint32_t header;      // Header address of the cell, the chain end when done
+	uint32_t data;        // Data address of an area, 0 for a freed cell
+	uint16_t cellSize;    // Size of the cell including its header
+	uint16_t size;        // Size of the data of an area
+	uint8_t  check;       // Size of the checksum of an area, see PERSISTENT_CHECK_NONE
+	uint8_t  hash;        // Name hash in the header, 0 if none
+	bool     free;        // True for a freed cell
+	char     name[PERSISTENT_AREA_NAME_SIZE + 1];   // The name, '\0' terminated
+};
+
+extern int16_t  persistentAreaFirst     (struct persistentAreaCursor* cursor);
+extern int16_t  persistentAreaNext      (struct persistentAreaCursor* cursor);
+
+#if defined(ARDUINO)
+extern void     listPersistentAreas     (Print& out);
+extern int16_t  dumpHeader              (char* name, Print& out);
+extern void     dumpDataArea            (uint32_t addr, Print& out);
+extern void     persistentDump          (uint32_t addr, uint16_t size, Print& out);
+extern void     persistentDumpRAM       (uint32_t addr, uint16_t size, Print& out);
+#endif
+
 #endif
@@ -0,0 +1,221 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <PersistentArea.h> - Type safe access of persistent areas.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0016 - Initial release, typed areas
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+#ifndef PERSISTENTAREA_h
+#define PERSISTENTAREA_h
+
+#include <Persistence.h>
+
+//
+//  Type helpers, the standard library is not available on every board
+//
+template <typename A, typename B> struct persistentSameType       { enum { value = 0 }; };
+template <typename A>             struct persistentSameType<A, A> { enum { value = 1 }; };
+
+template <typename A>             struct persistentIdentity       { typedef A type; };
+
+//
+//  Binds an area name to a struct type T, e.g.
+//
+//    struct settings { uint8_t volume; uint16_t boots; };
+//    PersistentArea<struct settings> settings("settings");
+//
+//  The size of T and the length of the name are checked at compile time.
+//  The area is looked up once, by begin() or the first access, and its
+//  handle is kept. Freeing the area through another handle or by name
+//  leaves that handle stale, use remove() instead.
+//
+//  T must be trivially copyable, it is stored as a plain copy of its bytes,
+//  and default constructible.
+//  Check selects the checksum of the area when it is created.
+//
+template <typename T, uint8_t Check = PERSISTENT_AREA_CHECK>
+class PersistentArea {
+
+#if defined(__GNUC__) && (__GNUC__ >= 5)
+	static_assert(__is_trivially_copyable(T), "T must be trivially copyable");
+#endif
+	static_assert(sizeof(T) <= 0xffff - PERSISTENT_AREA_PREFIX_SIZE - PERSISTENT_CHECK_CRC32,
+			      "T does not fit in a persistent area");
+	static_assert(Check == PERSISTENT_CHECK_NONE || Check == PERSISTENT_CHECK_CRC16 ||
+			      Check == PERSISTENT_CHECK_CRC32, "Check must be a PERSISTENT_CHECK_ value");
+
+public:
+	//
+	//  The name must be a string literal of at most PERSISTENT_AREA_NAME_SIZE characters
+	//
+	template <size_t N>
+	explicit PersistentArea(const char (&name)[N]) : areaName(name) {
+		static_assert(N > 1 && N <= PERSISTENT_AREA_NAME_SIZE + 1,
+				      "Area name must have 1 to PERSISTENT_AREA_NAME_SIZE characters");
+		area.header = 0;
+	}
+
+	//
+	//  Opens the area, creating it if it does not exist.
+	//
+	//  @return   1 Opened
+	//            2 Created
+	//            0 No persistent memory left
+	//           -2 The area exists with another size than T
+	//
+	int16_t begin() {
+		if (area.header)
+			return 1;
+
+		if (openPersistentArea((char*)areaName, &area) == 1) {
+			if (area.size == sizeof(T))
+				return 1;
+
+			area.header = 0;
+			return -2;
+		}
+
+		return newPersistentArea((char*)areaName, sizeof(T), &area, Check) ? 2 : 0;
+	}
+
+	//
+	//  Returns true if the area exists, opening it.
+	//
+	bool exists() {
+		if (!area.header && openPersistentArea((char*)areaName, &area) < 0)
+			return false;
+
+		if (area.size != sizeof(T)) {
+			area.header = 0;
+			return false;
+		}
+
+		return true;
+	}
+
+	//
+	//  Reads the area into value.
+	//  Returns the same as persistentReadArea(), -1 if the area does not exist.
+	//
+	int16_t load(T& value) {
+		if (!exists())
+			return -1;
+
+		return persistentReadArea(&area, sizeof(T), (char*)&value);
+	}
+
+	//
+	//  Writes value to the area, creating it if needed.
+	//  Returns the same as persistentWriteArea(), 0 if it could not be created.
+	//
+	int16_t store(const T& value) {
+		if (begin() <= 0)
+			return 0;
+
+		return persistentWriteArea(&area, sizeof(T), (char*)&value);
+	}
+
+	//
+	//  Reads a single member, e.g. settings.read(&settings::boots, boots).
+	//  Returns the same as persistentReadAreaRange().
+	//
+	template <typename C, typename M>
+	int16_t read(M C::*member, M& value) {
+		static_assert(persistentSameType<C, T>::value, "member must be a member of T");
+		if (!exists())
+			return -1;
+
+		return persistentReadAreaRange(&area, offsetOf(member), sizeof(M), (char*)&value);
+	}
+
+	//
+	//  Writes a single member, e.g. settings.update(&settings::boots, boots).
+	//  Only that member is compared and programmed.
+	//  Returns the same as persistentWriteAreaRange().
+	//
+	template <typename C, typename M>
+	int16_t update(M C::*member, const typename persistentIdentity<M>::type& value) {
+		static_assert(persistentSameType<C, T>::value, "member must be a member of T");
+		if (!exists())
+			return 0;
+
+		return persistentWriteAreaRange(&area, offsetOf(member), sizeof(M), (char*)&value);
+	}
+
+	//
+	//  Frees the area.
+	//  Returns the same as freePersistentArea(), -1 if it does not exist.
+	//
+	int16_t remove() {
+		if (!exists())
+			return -1;
+
+		return freePersistentArea(&area);
+	}
+
+	//
+	//  The handle of the area, for the handle based functions
+	//
+	struct persistentAreaHandle* handle() {
+		return exists() ? &area : 0;
+	}
+
+	const char* name() const {
+		return areaName;
+	}
+
+private:
+	const char*                 areaName;
+	struct persistentAreaHandle area;
+
+	//
+	//  Offset of a member in T, taken from a local T. Only addresses are
+	//  used, so the compiler folds it into a constant and no T is kept on
+	//  the stack.
+	//
+	template <typename C, typename M>
+	uint16_t offsetOf(M C::*member) const {
+		T probe;
+		return (uint16_t)(reinterpret_cast<const char*>(&(probe.*member)) -
+				          reinterpret_cast<const char*>(&probe));
+	}
+};
+
+#endif
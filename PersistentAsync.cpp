@@ -0,0 +1,450 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <PersistentAsync.cpp> - Asynchronous write queue.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0022 - Initial release, asynchronous write queue
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+#include <Persistence.h>
+
+#if defined(__AVR__) && PERSISTENT_ASYNC_QUEUE > 0 && PERSISTENT_ASYNC_ISR
+#include <avr/interrupt.h>
+#endif
+
+#if PERSISTENT_ASYNC_QUEUE > 255
+#error PERSISTENT_ASYNC_QUEUE can hold at most 255 bytes
+#endif
+
+#if PERSISTENT_ASYNC_QUEUE > 0
+
+//
+//  A queued byte. The queue is a ring of PERSISTENT_ASYNC_QUEUE + 1 entries,
+//  filled at the head by the main program and drained at the tail by the
+//  EEPROM ready interrupt or persistentPoll(). Both indexes are single bytes,
+//  so either side reads them atomically.
+//
+struct persistentAsyncEntry {
+	uint16_t addr;    // Address to program
+	uint8_t  value;   // Value to program
+};
+
+#define PERSISTENT_ASYNC_RING   (PERSISTENT_ASYNC_QUEUE + 1)
+
+static struct persistentAsyncEntry persistentAsyncQueue[PERSISTENT_ASYNC_RING];
+static volatile uint8_t  persistentAsyncHead = 0;
+static volatile uint8_t  persistentAsyncTail = 0;
+
+static volatile struct persistentAsyncStats persistentAsyncCounters;
+
+#if PERSISTENT_VERIFY_WRITES
+static volatile bool     persistentAsyncVerify = false;  // Last programmed byte not yet verified
+static struct persistentAsyncEntry persistentAsyncLast;  // Last programmed byte
+#endif
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the number of bytes in the queue.
+ *
+ *---------------------------------------------------------------------------*/
+static uint8_t persistentAsyncCount() {
+	return (uint8_t)((persistentAsyncHead + PERSISTENT_ASYNC_RING - persistentAsyncTail) % PERSISTENT_ASYNC_RING);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Keeps the EEPROM ready interrupt from draining the queue,
+ *  while the main program reads or updates it.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentAsyncLock() {
+#if defined(__AVR__) && PERSISTENT_ASYNC_ISR
+	EECR &= ~_BV(EERIE);
+#endif
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Lets the EEPROM ready interrupt drain the queue again, if it is not empty.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentAsyncUnlock() {
+#if defined(__AVR__) && PERSISTENT_ASYNC_ISR
+	if (persistentAsyncHead != persistentAsyncTail)
+		EECR |= _BV(EERIE);
+#endif
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Programs the byte at the tail of the queue, if the device is ready.
+ *  With PERSISTENT_VERIFY_WRITES the previous byte is read back first,
+ *  which is possible now its programming has completed.
+ *
+ * @return  true if the device was ready and there was work to do
+ *
+ *---------------------------------------------------------------------------*/
+static bool persistentAsyncStep() {
+
+	const struct persistentBackend* backend = persistentGetBackend();
+	if (backend->ready && !backend->ready(backend->device))
+		return false;
+
+#if PERSISTENT_VERIFY_WRITES
+	if (persistentAsyncVerify) {
+		uint8_t stored;
+		backend->read(backend->device, persistentAsyncLast.addr, (char*)&stored, 1);
+		if (stored != persistentAsyncLast.value) {
+			persistentAsyncCounters.failed++;
+			persistentAsyncCounters.failedAddr = persistentAsyncLast.addr;
+		}
+		persistentAsyncVerify = false;
+	}
+#endif
+
+	uint8_t tail = persistentAsyncTail;
+	if (tail == persistentAsyncHead)
+		return false;
+
+	struct persistentAsyncEntry* entry = &persistentAsyncQueue[tail];
+	backend->write(backend->device, entry->addr, (char*)&entry->value, 1);
+
+#if PERSISTENT_VERIFY_WRITES
+	persistentAsyncLast   = *entry;
+	persistentAsyncVerify = true;
+#endif
+
+	persistentAsyncTail = (uint8_t)((tail + 1) % PERSISTENT_ASYNC_RING);
+	persistentAsyncCounters.programmed++;
+
+	return true;
+}
+
+#if defined(__AVR__) && PERSISTENT_ASYNC_ISR
+/**----------------------------------------------------------------------------
+ *
+ *  The EEPROM is ready, program the next queued byte.
+ *  The interrupt disables itself when the queue is empty.
+ *
+ *---------------------------------------------------------------------------*/
+ISR(EE_READY_vect) {
+
+	persistentAsyncStep();
+
+	if (persistentAsyncHead == persistentAsyncTail
+#if PERSISTENT_VERIFY_WRITES
+		&& !persistentAsyncVerify
+#endif
+	   )
+		EECR &= ~_BV(EERIE);
+}
+#endif
+
+/**----------------------------------------------------------------------------
+ *
+ *  Adds the bytes of a range that differ from what is stored, or queued,
+ *  behind the head of the queue without publishing them.
+ *
+ * @param head  The index to add the next byte at, updated
+ * @param addr  The persistent address of the range
+ * @param data  The new data of the range
+ * @param size  The size of the range
+ *
+ * @return  false if the queue is full
+ *
+ *---------------------------------------------------------------------------*/
+static bool persistentAsyncAdd(uint8_t* head, uint32_t addr, const char* data, uint16_t size) {
+
+	char chunk[16];
+
+	for (uint16_t done = 0; done < size; ) {
+		uint16_t n = (size - done < (uint16_t)sizeof(chunk)) ? size - done : sizeof(chunk);
+		persistentRead(addr + done, chunk, n);
+
+		for (uint16_t i = 0; i < n; i++) {
+			if (chunk[i] == data[done + i])
+				continue;
+
+			uint8_t next = (uint8_t)((*head + 1) % PERSISTENT_ASYNC_RING);
+			if (next == persistentAsyncTail)
+				return false;
+
+			persistentAsyncQueue[*head].addr  = (uint16_t)(addr + done + i);
+			persistentAsyncQueue[*head].value = (uint8_t)data[done + i];
+			*head = next;
+		}
+
+		done += n;
+	}
+
+	return true;
+}
+
+#endif
+
+/**----------------------------------------------------------------------------
+ *
+ *  Writes data to the named area without waiting for the device.
+ *
+ * @param name      Name of the area
+ * @param dataSize  The size of the data to be written
+ * @param data      The address of the data buffer
+ *
+ * @return  Same as persistentWriteAreaAsync(handle, dataSize, data)
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentWriteAreaAsync(char* name, uint16_t dataSize, char* data) {
+
+	struct persistentAreaHandle handle;
+	if (openPersistentArea(name, &handle) < 0)
+		return 0;
+
+	return persistentWriteAreaAsync(&handle, dataSize, data);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Writes data to the data part of an opened area without waiting for the
+ *  device. The bytes that differ from the stored data, followed by the
+ *  changed bytes of the checksum, are put in the queue as a whole or not
+ *  at all. The write is complete once persistentAsyncPending() returns 0.
+ *  Without a queue, PERSISTENT_ASYNC_QUEUE 0, the data is written at once.
+ *
+ * @param handle    The handle of the area
+ * @param dataSize  The size of the data to be written
+ * @param data      The address of the data buffer
+ *
+ * @return  > 0 The data is queued, or held by the cache.
+ *            0 Nothing is queued, because it was the wrong data area.
+ *           -2 The changed bytes do not fit in the queue right now,
+ *              nothing is queued. Call persistentPoll() and try again.
+ *           -3 The changed bytes do not fit in an empty queue either,
+ *              use persistentWriteArea() instead.
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentWriteAreaAsync(struct persistentAreaHandle* handle, uint16_t dataSize, char* data) {
+
+#if PERSISTENT_ASYNC_QUEUE > 0
+
+	if (handle->header == 0 || dataSize != handle->size)
+		return 0;
+
+#if PERSISTENT_CACHE_SIZE > 0
+	//
+	//  A cached area is written to RAM anyway
+	//
+	if (persistentCacheWrite(handle->header, 0, dataSize, data))
+		return dataSize;
+#endif
+
+	//
+	//  Queue the data and then its checksum, so they are programmed in the
+	//  same order as persistentWriteArea() does. The head is only published
+	//  once everything fits, the interrupt only ever moves the tail.
+	//
+	bool    empty = persistentAsyncHead == persistentAsyncTail;
+	uint8_t head  = persistentAsyncHead;
+	bool    fits  = persistentAsyncAdd(&head, handle->data, data, dataSize);
+
+	uint8_t check = persistentCheckSize(handle->header, handle->data);
+	if (fits && (check == PERSISTENT_CHECK_CRC16 || check == PERSISTENT_CHECK_CRC32)) {
+		uint32_t crc = persistentChecksum(data, dataSize, check);
+		fits = persistentAsyncAdd(&head, handle->data - check, (char*)&crc, check);
+	}
+
+	if (!fits)
+		return empty ? -3 : -2;
+
+	persistentAsyncCounters.queued += (uint8_t)((head + PERSISTENT_ASYNC_RING - persistentAsyncHead) % PERSISTENT_ASYNC_RING);
+	persistentAsyncHead = head;
+	persistentAsyncUnlock();
+
+#if !PERSISTENT_ASYNC_ISR
+	//
+	//  Start programming the first byte if the device is idle
+	//
+	persistentPoll();
+#endif
+
+	return dataSize;
+
+#else
+	return persistentWriteArea(handle, dataSize, data);
+#endif
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Programs queued bytes for as long as the device is ready. Call it from
+ *  the main loop when the queue is not drained by the EEPROM ready interrupt.
+ *  It never waits for the device.
+ *
+ * @return  The number of bytes still in the queue
+ *
+ *---------------------------------------------------------------------------*/
+uint16_t persistentPoll() {
+
+#if PERSISTENT_ASYNC_QUEUE > 0
+	persistentAsyncLock();
+	while (persistentAsyncStep())
+		;
+	persistentAsyncUnlock();
+
+	return persistentAsyncCount();
+#else
+	return 0;
+#endif
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the number of bytes in the queue that are not programmed yet.
+ *
+ *---------------------------------------------------------------------------*/
+uint16_t persistentAsyncPending() {
+
+#if PERSISTENT_ASYNC_QUEUE > 0
+	return persistentAsyncCount();
+#else
+	return 0;
+#endif
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Waits until all queued bytes are programmed. Every write other than
+ *  persistentWriteAreaAsync() calls it first, so bytes are never programmed
+ *  out of order.
+ *
+ * @return  >= 0 The number of bytes programmed while waiting
+ *            -1 A byte programmed from the queue did not read back as
+ *               written, see persistentGetAsyncStats()
+ *
+ *---------------------------------------------------------------------------*/
+int32_t persistentAsyncFlush() {
+
+#if PERSISTENT_ASYNC_QUEUE > 0
+	uint32_t programmed = persistentAsyncCounters.programmed;
+	uint32_t failed     = persistentAsyncCounters.failed;
+
+	persistentAsyncLock();
+	while (persistentAsyncHead != persistentAsyncTail
+#if PERSISTENT_VERIFY_WRITES
+		   || persistentAsyncVerify
+#endif
+		  )
+		persistentAsyncStep();
+	persistentAsyncUnlock();
+
+	if (persistentAsyncCounters.failed != failed)
+		return -1;
+
+	return persistentAsyncCounters.programmed - programmed;
+#else
+	return 0;
+#endif
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Reads persistent memory as it will be once the queue is drained.
+ *  Later bytes in the queue override earlier ones for the same address.
+ *
+ * @param addr  The persistent address to read
+ * @param data  The buffer to read into
+ * @param size  The number of bytes to read
+ *
+ *---------------------------------------------------------------------------*/
+void persistentAsyncRead(uint32_t addr, char* data, uint16_t size) {
+
+	const struct persistentBackend* backend = persistentGetBackend();
+
+#if PERSISTENT_ASYNC_QUEUE > 0
+	persistentAsyncLock();
+	backend->read(backend->device, addr, data, size);
+
+	for (uint8_t i = persistentAsyncTail; i != persistentAsyncHead; i = (uint8_t)((i + 1) % PERSISTENT_ASYNC_RING)) {
+		uint32_t a = persistentAsyncQueue[i].addr;
+		if (a >= addr && a < addr + size)
+			data[a - addr] = (char)persistentAsyncQueue[i].value;
+	}
+	persistentAsyncUnlock();
+#else
+	backend->read(backend->device, addr, data, size);
+#endif
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the statistics of the queue gathered since the last reset.
+ *
+ *  @param stats     The struct to copy the statistics into
+ *
+ *---------------------------------------------------------------------------*/
+void persistentGetAsyncStats(struct persistentAsyncStats* stats) {
+
+#if PERSISTENT_ASYNC_QUEUE > 0
+	persistentAsyncLock();
+	stats->queued     = persistentAsyncCounters.queued;
+	stats->programmed = persistentAsyncCounters.programmed;
+	stats->failed     = persistentAsyncCounters.failed;
+	stats->failedAddr = persistentAsyncCounters.failedAddr;
+	stats->pending    = persistentAsyncCount();
+	persistentAsyncUnlock();
+#else
+	memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Resets the statistics of the queue.
+ *
+ *---------------------------------------------------------------------------*/
+void persistentResetAsyncStats() {
+
+#if PERSISTENT_ASYNC_QUEUE > 0
+	persistentAsyncLock();
+	persistentAsyncCounters.queued     = 0;
+	persistentAsyncCounters.programmed = 0;
+	persistentAsyncCounters.failed     = 0;
+	persistentAsyncCounters.failedAddr = 0;
+	persistentAsyncUnlock();
+#endif
+}
@@ -0,0 +1,592 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <PersistentBackend.cpp> - Storage backends for persistent memory.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0007 - Initial release, storage backends
+ *  P0008 - Simulated EEPROM backend with timing and wear model
+ *  P0022 - Ready state of the device, busy model of the simulated EEPROM
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <Persistence.h>
+
+#if defined(__AVR__)
+#include <avr/eeprom.h>
+#endif
+
+#if !defined(ARDUINO) && defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//=============================================================================
+//
+//  E E P R O M   B A C K E N D
+//
+//=============================================================================
+
+#if defined(ARDUINO)
+
+/**----------------------------------------------------------------------------
+ *
+ *  Reads a block of EEPROM, using the fastest block read of the platform:
+ *  - AVR uses eeprom_read_block() from avr-libc.
+ *  - Platforms emulating EEPROM in flash keep a RAM copy, which is copied.
+ *  - Otherwise it falls back to reading byte by byte through EEPROM.
+ *
+ * @param device  Not used
+ * @param addr    Address of the EEPROM where the data is stored
+ * @param data    memory area the EEPROM data must be copied into
+ * @param size    The size of the data in bytes
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentEepromRead(void* device, uint32_t addr, char* data, uint16_t size) {
+
+#if defined(__AVR__)
+
+   eeprom_read_block((void*)data, (const void*)(uintptr_t)addr, size);
+
+#elif defined(ESP8266) || defined(ESP32) || defined(ARDUINO_ARCH_RP2040)
+
+   memcpy(data, EEPROM.getDataPtr() + addr, size);
+
+#else
+
+   for (unsigned long i = 0; i < size; i++) {
+     *data = EEPROM.read((int)addr++);
+     data++;
+   }
+
+#endif
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Programs a block of EEPROM.
+ *
+ * @param device  Not used
+ * @param addr    Address of the EEPROM to program
+ * @param data    The data to be programmed
+ * @param size    The size of the data in bytes
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentEepromWrite(void* device, uint32_t addr, const char* data, uint16_t size) {
+
+   for (uint16_t i = 0; i < size; i++) {
+     EEPROM.write((int)(addr + i), (unsigned char)data[i]);
+   }
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the size of the EEPROM in bytes.
+ *
+ *---------------------------------------------------------------------------*/
+static uint32_t persistentEepromSize(void* device) {
+   return EEPROM.length();
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Commits the RAM copy on platforms emulating EEPROM in flash.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentEepromSync(void* device) {
+#if defined(ESP8266) || defined(ESP32) || defined(ARDUINO_ARCH_RP2040)
+   EEPROM.commit();
+#endif
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns 1 if the EEPROM is not programming a byte. Only AVR can tell,
+ *  elsewhere EEPROM.write() does not return before the byte is written.
+ *
+ *---------------------------------------------------------------------------*/
+static uint8_t persistentEepromReady(void* device) {
+#if defined(__AVR__)
+   return eeprom_is_ready() ? 1 : 0;
+#else
+   return 1;
+#endif
+}
+
+const struct persistentBackend persistentEepromBackend = {
+   persistentEepromRead,
+   persistentEepromWrite,
+   persistentEepromSize,
+   persistentEepromSync,
+   0,
+   persistentEepromReady
+};
+
+#endif
+
+//=============================================================================
+//
+//  R A M   B A C K E N D
+//
+//=============================================================================
+
+/**----------------------------------------------------------------------------
+ *
+ *  Reads a block of RAM device memory.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentRamRead(void* device, uint32_t addr, char* data, uint16_t size) {
+   memcpy(data, ((struct persistentRamDevice*)device)->memory + addr, size);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Writes a block of RAM device memory.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentRamWrite(void* device, uint32_t addr, const char* data, uint16_t size) {
+   memcpy(((struct persistentRamDevice*)device)->memory + addr, data, size);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the size of the RAM device in bytes.
+ *
+ *---------------------------------------------------------------------------*/
+static uint32_t persistentRamSize(void* device) {
+   return ((struct persistentRamDevice*)device)->size;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Initialises a backend that keeps the persistent data in a block of RAM.
+ *  The memory is used as is, fill it with 0xff to get a virgin device.
+ *
+ * @param backend  The backend to initialise
+ * @param device   The RAM device the backend uses
+ * @param memory   The RAM holding the persistent data
+ * @param size     The size of the RAM in bytes
+ *
+ *---------------------------------------------------------------------------*/
+void persistentInitRamBackend(struct persistentBackend* backend,
+		                      struct persistentRamDevice* device,
+		                      uint8_t* memory, uint32_t size) {
+
+   device->memory = memory;
+   device->size   = size;
+
+   backend->read   = persistentRamRead;
+   backend->write  = persistentRamWrite;
+   backend->size   = persistentRamSize;
+   backend->sync   = 0;
+   backend->device = device;
+   backend->ready  = 0;
+}
+
+//=============================================================================
+//
+//  S I M U L A T E D   E E P R O M   B A C K E N D
+//
+//=============================================================================
+
+/**----------------------------------------------------------------------------
+ *
+ *  Reads a block of simulated EEPROM, charging the read latency.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentSimRead(void* device, uint32_t addr, char* data, uint16_t size) {
+
+   struct persistentSimDevice* sim = (struct persistentSimDevice*)device;
+
+   persistentRamRead(&sim->ram, addr, data, size);
+
+   sim->stats.reads++;
+   sim->stats.bytesRead += size;
+   sim->stats.timeNs    += (uint64_t)sim->readNs * size;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Programs a block of simulated EEPROM, charging the program latency
+ *  and counting a program cycle for every cell.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentSimWrite(void* device, uint32_t addr, const char* data, uint16_t size) {
+
+   struct persistentSimDevice* sim = (struct persistentSimDevice*)device;
+
+   persistentRamWrite(&sim->ram, addr, data, size);
+
+   for (uint16_t i = 0; i < size; i++)
+	   sim->wear[addr + i]++;
+
+   sim->stats.writes++;
+   sim->stats.bytesProgrammed += size;
+   sim->stats.timeNs          += (uint64_t)sim->programNs * size;
+
+   //
+   //  Like EEPROM.write(), the caller waits until the device is ready for
+   //  every byte, but not for the last byte to complete.
+   //
+   if (sim->nowNs < sim->readyNs)
+	   sim->nowNs = sim->readyNs;
+   sim->nowNs  += (uint64_t)sim->programNs * (size - 1);
+   sim->readyNs = sim->nowNs + sim->programNs;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns 1 if the simulated EEPROM completed programming. Polling takes
+ *  the read latency of a byte.
+ *
+ *---------------------------------------------------------------------------*/
+static uint8_t persistentSimReady(void* device) {
+
+   struct persistentSimDevice* sim = (struct persistentSimDevice*)device;
+
+   if (sim->nowNs >= sim->readyNs)
+	   return 1;
+
+   sim->nowNs += sim->readNs;
+   return 0;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Initialises a backend that simulates EEPROM in a block of RAM.
+ *  The memory is used as is, fill it with 0xff to get a virgin device.
+ *  The wear counters are reset.
+ *
+ * @param backend    The backend to initialise
+ * @param device     The simulated device the backend uses
+ * @param memory     The RAM holding the persistent data
+ * @param wear       The RAM holding a program cycle counter for every byte
+ * @param size       The size of the memory in bytes
+ * @param readNs     Read latency per byte in ns, e.g. PERSISTENT_SIM_READ_NS
+ * @param programNs  Program latency per byte in ns, e.g. PERSISTENT_SIM_PROGRAM_NS
+ *
+ *---------------------------------------------------------------------------*/
+void persistentInitSimBackend(struct persistentBackend* backend,
+		                      struct persistentSimDevice* device,
+		                      uint8_t* memory, uint32_t* wear, uint32_t size,
+		                      uint32_t readNs, uint32_t programNs) {
+
+   persistentInitRamBackend(backend, &device->ram, memory, size);
+   backend->read   = persistentSimRead;
+   backend->write  = persistentSimWrite;
+   backend->ready  = persistentSimReady;
+   backend->device = device;
+
+   device->wear      = wear;
+   device->readNs    = readNs;
+   device->programNs = programNs;
+   device->nowNs     = 0;
+   device->readyNs   = 0;
+   persistentResetSimStats(device);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the statistics of a simulated device, including its most
+ *  worn cell.
+ *
+ * @param device  The simulated device
+ * @param stats   The struct to copy the statistics into
+ *
+ *---------------------------------------------------------------------------*/
+void persistentGetSimStats(struct persistentSimDevice* device,
+		                   struct persistentSimStats* stats) {
+
+   device->stats.hottestCell = 0;
+   device->stats.hottestWear = 0;
+   for (uint32_t addr = 0; addr < device->ram.size; addr++) {
+	   if (device->wear[addr] > device->stats.hottestWear) {
+		   device->stats.hottestCell = addr;
+		   device->stats.hottestWear = device->wear[addr];
+	   }
+   }
+
+   *stats = device->stats;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Resets the statistics and wear counters of a simulated device.
+ *
+ * @param device  The simulated device
+ *
+ *---------------------------------------------------------------------------*/
+void persistentResetSimStats(struct persistentSimDevice* device) {
+
+   memset(&device->stats, 0, sizeof(device->stats));
+   memset(device->wear, 0, device->ram.size * sizeof(uint32_t));
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Moves the clock of the caller of a simulated device forward, as if the
+ *  caller spent that time doing other work.
+ *
+ * @param device  The simulated device
+ * @param ns      The time passed in ns
+ *
+ *---------------------------------------------------------------------------*/
+void persistentSimAdvance(struct persistentSimDevice* device, uint32_t ns) {
+   device->nowNs += ns;
+}
+
+//=============================================================================
+//
+//  F I L E   B A C K E N D
+//
+//=============================================================================
+
+#if !defined(ARDUINO) && defined(__linux__)
+
+/**----------------------------------------------------------------------------
+ *
+ *  Flushes the mapped file to disk.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentFileSync(void* device) {
+   struct persistentRamDevice* ram = &((struct persistentFileDevice*)device)->ram;
+   msync(ram->memory, ram->size, MS_SYNC);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Initialises a backend that keeps the persistent data in a memory mapped
+ *  file. If the file is smaller than size, it is extended with 0xff bytes.
+ *
+ * @param backend  The backend to initialise
+ * @param device   The file device the backend uses
+ * @param path     The path of the file
+ * @param size     The size of the persistent memory in bytes
+ *
+ * @return   1 Success
+ *          -1 The file could not be opened
+ *          -2 The file could not be extended
+ *          -3 The file could not be mapped
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentOpenFileBackend(struct persistentBackend* backend,
+		                          struct persistentFileDevice* device,
+		                          const char* path, uint32_t size) {
+
+   int fd = open(path, O_RDWR | O_CREAT, 0644);
+   if (fd < 0)
+	   return -1;
+
+   //
+   //  Extend the file like virgin EEPROM
+   //
+   struct stat st;
+   if (fstat(fd, &st) < 0) {
+	   close(fd);
+	   return -2;
+   }
+
+   unsigned char virgin[256];
+   memset(virgin, 0xff, sizeof(virgin));
+   for (uint32_t pos = st.st_size; pos < size; ) {
+	   uint32_t n = (size - pos < sizeof(virgin)) ? size - pos : sizeof(virgin);
+	   if (pwrite(fd, virgin, n, pos) != (ssize_t)n) {
+		   close(fd);
+		   return -2;
+	   }
+	   pos += n;
+   }
+
+   void* memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if (memory == MAP_FAILED) {
+	   close(fd);
+	   return -3;
+   }
+
+   persistentInitRamBackend(backend, &device->ram, (uint8_t*)memory, size);
+   backend->sync   = persistentFileSync;
+   backend->device = device;
+   device->fd      = fd;
+
+   return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Flushes and unmaps the file of a file backend.
+ *  Deselect the backend before closing it.
+ *
+ * @param device   The file device of the backend
+ *
+ *---------------------------------------------------------------------------*/
+void persistentCloseFileBackend(struct persistentFileDevice* device) {
+
+   persistentFileSync(device);
+   munmap(device->ram.memory, device->ram.size);
+   close(device->fd);
+}
+
+#endif
+
+//=============================================================================
+//
+//  B A C K E N D   S E L E C T I O N
+//
+//=============================================================================
+
+static const struct persistentBackend* persistentCurrentBackend = 0;
+
+#if !defined(ARDUINO)
+static uint8_t                    persistentHostMemory[PERSISTENT_HOST_SIZE];
+static struct persistentRamDevice persistentHostDevice;
+static struct persistentBackend   persistentHostBackend;
+#endif
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the current backend. If none was selected it is the EEPROM on
+ *  Arduino platforms, and a virgin block of RAM on hosts.
+ *
+ *---------------------------------------------------------------------------*/
+const struct persistentBackend* persistentGetBackend() {
+
+   if (!persistentCurrentBackend) {
+#if defined(ARDUINO)
+	   persistentCurrentBackend = &persistentEepromBackend;
+#else
+	   if (!persistentHostBackend.read) {
+		   memset(persistentHostMemory, 0xff, sizeof(persistentHostMemory));
+		   persistentInitRamBackend(&persistentHostBackend, &persistentHostDevice,
+				                    persistentHostMemory, sizeof(persistentHostMemory));
+	   }
+	   persistentCurrentBackend = &persistentHostBackend;
+#endif
+   }
+
+   return persistentCurrentBackend;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Selects the backend used for all persistent memory access.
+ *  The memory layout and the name index are reloaded from the new backend.
+ *
+ * @param backend  The backend to use, 0 selects the default backend
+ *
+ *---------------------------------------------------------------------------*/
+void persistentSetBackend(const struct persistentBackend* backend) {
+
+   persistentCurrentBackend = backend;
+   persistentMemoryLayout.loaded = false;
+   persistentIndexReset();
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Flushes written data to the device, if the backend needs that.
+ *
+ *---------------------------------------------------------------------------*/
+void persistentSync() {
+
+   const struct persistentBackend* backend = persistentGetBackend();
+   if (backend->sync)
+	   backend->sync(backend->device);
+}
+
+//=============================================================================
+//
+//  V A L U E   A C C E S S
+//
+//=============================================================================
+
+/**----------------------------------------------------------------------------
+ *
+ *  Reads an 8, 16 or 32 bit value from persistent memory.
+ *  Multi byte values are stored little endian.
+ *
+ * @param addr  The persistent memory address of the value
+ *
+ * @return      The value read
+ *
+ *---------------------------------------------------------------------------*/
+uint8_t persistentReadByte(uint32_t addr) {
+
+   uint8_t v;
+   persistentRead(addr, (char*)&v, sizeof(v));
+   return v;
+}
+
+uint16_t persistentReadInt(uint32_t addr) {
+
+   uint8_t v[2];
+   persistentRead(addr, (char*)v, sizeof(v));
+   return (uint16_t)v[0] | ((uint16_t)v[1] << 8);
+}
+
+uint32_t persistentReadLong(uint32_t addr) {
+
+   uint8_t v[4];
+   persistentRead(addr, (char*)v, sizeof(v));
+   return  (uint32_t)v[0]        | ((uint32_t)v[1] << 8) |
+		  ((uint32_t)v[2] << 16) | ((uint32_t)v[3] << 24);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Writes an 8, 16 or 32 bit value to persistent memory.
+ *  Multi byte values are stored little endian.
+ *
+ * @param addr  The persistent memory address of the value
+ * @param v     The value to write
+ *
+ *---------------------------------------------------------------------------*/
+void persistentWriteByte(uint32_t addr, uint8_t v) {
+   persistentStore(addr, (char*)&v, sizeof(v));
+}
+
+void persistentWriteInt(uint32_t addr, uint16_t v) {
+
+   uint8_t b[2] = { (uint8_t)v, (uint8_t)(v >> 8) };
+   persistentStore(addr, (char*)b, sizeof(b));
+}
+
+void persistentWriteLong(uint32_t addr, uint32_t v) {
+
+   uint8_t b[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+   persistentStore(addr, (char*)b, sizeof(b));
+}
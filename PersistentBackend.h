@@ -0,0 +1,185 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <PersistentBackend.h> - Storage backends for persistent memory.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0007 - Initial release, storage backends
+ *  P0008 - Simulated EEPROM backend with timing and wear model
+ *  P0022 - Ready state of the device, busy model of the simulated EEPROM
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+#ifndef PERSISTENTBACKEND_h
+#define PERSISTENTBACKEND_h
+
+#include <stdint.h>
+
+//
+//  A storage backend provides the persistent memory the library manages.
+//  All reads and writes of the library go through the backend that is
+//  currently selected, so the same library code runs on the EEPROM of an
+//  Arduino, on a block of RAM or on a memory mapped file.
+//
+//  Devices are limited to 64 KB, since area headers use 16 bit offsets.
+//
+struct persistentBackend {
+	//
+	//  Copies size bytes at persistent address addr into data.
+	//
+	void     (*read) (void* device, uint32_t addr, char* data, uint16_t size);
+
+	//
+	//  Programs size bytes from data at persistent address addr.
+	//  The library only passes bytes that actually differ.
+	//
+	void     (*write)(void* device, uint32_t addr, const char* data, uint16_t size);
+
+	//
+	//  Returns the size of the persistent memory in bytes.
+	//
+	uint32_t (*size) (void* device);
+
+	//
+	//  Optional, 0 if not needed. Flushes written data to the device.
+	//
+	void     (*sync) (void* device);
+
+	//
+	//  Device specific data passed to the functions above.
+	//
+	void*    device;
+
+	//
+	//  Optional, 0 if the device is never busy. Returns 1 if a byte can be
+	//  programmed without waiting for the previous one to complete.
+	//  It comes last, so backends initialised without it leave it 0.
+	//
+	uint8_t  (*ready)(void* device);
+};
+
+extern const struct persistentBackend* persistentGetBackend();
+extern void     persistentSetBackend(const struct persistentBackend* backend);
+extern void     persistentSync();
+
+#if defined(ARDUINO)
+//
+//  The EEPROM of the Arduino, the default backend on Arduino platforms.
+//  On platforms emulating EEPROM in flash, EEPROM.begin() must be called
+//  before use and persistentSync() commits the written data.
+//
+extern const struct persistentBackend persistentEepromBackend;
+#endif
+
+//
+//  A block of RAM, the default backend on hosts, where it is a block of
+//  PERSISTENT_HOST_SIZE bytes.
+//
+#ifndef PERSISTENT_HOST_SIZE
+#define PERSISTENT_HOST_SIZE         4096
+#endif
+
+struct persistentRamDevice {
+	uint8_t* memory;   // The RAM holding the persistent data
+	uint32_t size;     // The size of the RAM in bytes
+};
+
+extern void     persistentInitRamBackend(struct persistentBackend* backend,
+		                                 struct persistentRamDevice* device,
+		                                 uint8_t* memory, uint32_t size);
+
+//
+//  A block of RAM that simulates EEPROM timing and wear. Every byte read
+//  and programmed is charged a configurable latency, and the number of
+//  program cycles of every cell is counted, so performance changes can be
+//  measured natively against the behaviour of the real device.
+//
+//  The device is busy for programNs after a byte is programmed. The clock of
+//  the caller, nowNs, is moved forward with persistentSimAdvance(). Like on
+//  AVR, a write waits until the device is ready for each of its bytes, but
+//  returns while the last byte is still being programmed. Every time the
+//  ready state is polled readNs passes, so a caller waiting for the device
+//  sees it become ready.
+//
+#define PERSISTENT_SIM_READ_NS       500UL       // Default read latency per byte
+#define PERSISTENT_SIM_PROGRAM_NS    3300000UL   // Default program latency per byte (3.3 ms)
+
+struct persistentSimStats {
+	uint64_t timeNs;           // Simulated time spent in the device
+	uint32_t reads;            // Number of block reads
+	uint32_t writes;           // Number of block writes
+	uint32_t bytesRead;        // Number of bytes read
+	uint32_t bytesProgrammed;  // Number of bytes programmed
+	uint32_t hottestCell;      // Address of the most programmed cell
+	uint32_t hottestWear;      // Program cycles of the most programmed cell
+};
+
+struct persistentSimDevice {
+	struct persistentRamDevice ram;   // The simulated memory
+	uint32_t* wear;                   // Program cycles per cell, one per byte
+	uint32_t  readNs;                 // Read latency per byte in ns
+	uint32_t  programNs;              // Program latency per byte in ns
+	struct persistentSimStats stats;  // Statistics, see persistentGetSimStats()
+	uint64_t  nowNs;                  // Simulated time of the caller
+	uint64_t  readyNs;                // Simulated time programming completes
+};
+
+extern void     persistentInitSimBackend (struct persistentBackend* backend,
+		                                  struct persistentSimDevice* device,
+		                                  uint8_t* memory, uint32_t* wear, uint32_t size,
+		                                  uint32_t readNs, uint32_t programNs);
+extern void     persistentGetSimStats    (struct persistentSimDevice* device,
+		                                  struct persistentSimStats* stats);
+extern void     persistentResetSimStats  (struct persistentSimDevice* device);
+extern void     persistentSimAdvance     (struct persistentSimDevice* device, uint32_t ns);
+
+#if !defined(ARDUINO) && defined(__linux__)
+//
+//  A memory mapped file on a Linux host. A new file, or the part of the file
+//  beyond its current size, is filled with 0xff like virgin EEPROM.
+//
+struct persistentFileDevice {
+	struct persistentRamDevice ram;   // The mapped file
+	int      fd;                      // File descriptor of the file
+};
+
+extern int16_t  persistentOpenFileBackend (struct persistentBackend* backend,
+		                                   struct persistentFileDevice* device,
+		                                   const char* path, uint32_t size);
+extern void     persistentCloseFileBackend(struct persistentFileDevice* device);
+#endif
+
+#endif
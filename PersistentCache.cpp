@@ -0,0 +1,518 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <PersistentCache.cpp> - Write-back cache for persistent areas.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0009 - Initial release, write-back cache
+ *  P0012 - Follow areas moved by compaction
+ *  P0013 - Reset on format
+ *  P0014 - Update area checksums on commit
+ *  P0015 - Ranged reads and writes
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <Persistence.h>
+
+#if PERSISTENT_CACHE_SIZE > 0
+
+//
+//  A cached area. Its data lives in the pool at the given offset.
+//  The dirty ranges are kept sorted and never overlap or touch.
+//
+struct persistentCacheEntry {
+	uint16_t header;                             // Header address, 0 if unused
+	uint16_t data;                               // Data address in persistent memory
+	uint16_t size;                               // Size of the data
+	uint16_t offset;                             // Offset of the data in the pool
+	uint16_t dirtyFrom[PERSISTENT_CACHE_RANGES]; // First dirty byte of each range
+	uint16_t dirtyTo  [PERSISTENT_CACHE_RANGES]; // Byte after each range
+	uint8_t  ranges;                             // Number of dirty ranges
+};
+
+static uint8_t  persistentCachePool[PERSISTENT_CACHE_SIZE];
+static uint16_t persistentCachePoolUsed = 0;
+static struct persistentCacheEntry persistentCacheEntries[PERSISTENT_CACHE_AREAS];
+
+static uint32_t persistentCommitInterval = 0;  // Max age of dirty data, 0 never
+static uint32_t persistentDirtySince     = 0;  // Time dirty data was first seen
+static bool     persistentDirtySeen      = false;
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the cache entry of an area, or 0 if it is not cached.
+ *
+ * @param header  The header address of the area
+ *
+ *---------------------------------------------------------------------------*/
+static struct persistentCacheEntry* persistentCacheFind(uint32_t header) {
+
+	for (uint8_t i = 0; i < PERSISTENT_CACHE_AREAS; i++) {
+		if (persistentCacheEntries[i].header == header)
+			return &persistentCacheEntries[i];
+	}
+
+	return 0;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Marks a byte range of a cached area dirty.
+ *  The range is merged with the ranges it overlaps or touches. If no range
+ *  is left, it is merged with the nearest range instead. That costs nothing
+ *  in programming, since the write engine skips the bytes that are unchanged.
+ *
+ * @param entry  The cache entry
+ * @param from   First dirty byte
+ * @param to     Byte after the last dirty byte
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentCacheMarkDirty(struct persistentCacheEntry* entry,
+		                             uint16_t from, uint16_t to) {
+
+	//
+	//  If there is no room for another range, widen the range to
+	//  include the nearest range, so it is absorbed below.
+	//
+	if (entry->ranges == PERSISTENT_CACHE_RANGES) {
+		uint8_t  nearest = 0;
+		uint16_t gap     = 0xffff;
+		for (uint8_t i = 0; i < entry->ranges; i++) {
+			uint16_t d = (entry->dirtyTo[i] < from) ? from - entry->dirtyTo[i]
+					   : (entry->dirtyFrom[i] > to) ? entry->dirtyFrom[i] - to : 0;
+			if (d < gap) {
+				gap     = d;
+				nearest = i;
+			}
+		}
+		if (entry->dirtyFrom[nearest] < from) from = entry->dirtyFrom[nearest];
+		if (entry->dirtyTo[nearest]   > to)   to   = entry->dirtyTo[nearest];
+	}
+
+	//
+	//  Absorb the ranges that overlap or touch, and find the insert position
+	//
+	uint8_t n   = 0;
+	uint8_t pos = 0;
+	for (uint8_t i = 0; i < entry->ranges; i++) {
+		if (entry->dirtyTo[i] >= from && entry->dirtyFrom[i] <= to) {
+			if (entry->dirtyFrom[i] < from) from = entry->dirtyFrom[i];
+			if (entry->dirtyTo[i]   > to)   to   = entry->dirtyTo[i];
+			continue;
+		}
+		if (entry->dirtyTo[i] < from)
+			pos = n + 1;
+		entry->dirtyFrom[n] = entry->dirtyFrom[i];
+		entry->dirtyTo[n]   = entry->dirtyTo[i];
+		n++;
+	}
+
+	for (uint8_t i = n; i > pos; i--) {
+		entry->dirtyFrom[i] = entry->dirtyFrom[i - 1];
+		entry->dirtyTo[i]   = entry->dirtyTo[i - 1];
+	}
+	entry->dirtyFrom[pos] = from;
+	entry->dirtyTo[pos]   = to;
+	entry->ranges         = n + 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Writes the dirty ranges of a cached area to persistent memory.
+ *
+ * @param entry  The cache entry
+ *
+ * @return  >= 0 The number of dirty bytes written
+ *           < 0 Write error, the area stays dirty
+ *
+ *---------------------------------------------------------------------------*/
+static int32_t persistentCacheFlush(struct persistentCacheEntry* entry) {
+
+	int32_t flushed = 0;
+	for (uint8_t i = 0; i < entry->ranges; i++) {
+		uint16_t from = entry->dirtyFrom[i];
+		uint16_t size = entry->dirtyTo[i] - from;
+
+		if (persistentStore(entry->data + from,
+				            (char*)persistentCachePool + entry->offset + from, size) < 0)
+			return -1;
+
+		flushed += size;
+	}
+
+	//
+	//  The checksum covers the whole area, which is all in RAM
+	//
+	if (entry->ranges &&
+		persistentStoreChecksum(entry->header, entry->data,
+				                (char*)persistentCachePool + entry->offset, entry->size) < 0)
+		return -1;
+
+	entry->ranges = 0;
+	return flushed;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Removes an area from the cache and returns its RAM to the pool.
+ *
+ * @param entry  The cache entry
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentCacheRelease(struct persistentCacheEntry* entry) {
+
+	//
+	//  Move the data of the areas behind it down, keeping the pool compact
+	//
+	uint16_t end = entry->offset + entry->size;
+	memmove(persistentCachePool + entry->offset, persistentCachePool + end,
+			persistentCachePoolUsed - end);
+
+	for (uint8_t i = 0; i < PERSISTENT_CACHE_AREAS; i++) {
+		if (persistentCacheEntries[i].header && persistentCacheEntries[i].offset >= end)
+			persistentCacheEntries[i].offset -= entry->size;
+	}
+
+	persistentCachePoolUsed -= entry->size;
+	entry->header = 0;
+	entry->ranges = 0;
+}
+
+#endif
+
+/**----------------------------------------------------------------------------
+ *
+ *  Keeps the data of an opened area in the write-back cache.
+ *  The data is read from persistent memory once. From then on reads are
+ *  served from RAM and writes only mark the changed bytes dirty, until
+ *  they are committed.
+ *
+ * @param handle  The handle of the area
+ *
+ * @return   1 The area is cached
+ *          -1 Not enough room in the cache pool
+ *          -2 Too many cached areas
+ *          -3 The handle is not open or the cache is disabled
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentCacheArea(struct persistentAreaHandle* handle) {
+
+#if PERSISTENT_CACHE_SIZE > 0
+	if (handle->header == 0)
+		return -3;
+
+	if (persistentCacheFind(handle->header))
+		return 1;
+
+	if (PERSISTENT_CACHE_SIZE - persistentCachePoolUsed < handle->size)
+		return -1;
+
+	struct persistentCacheEntry* entry = persistentCacheFind(0);
+	if (!entry)
+		return -2;
+
+	entry->header = handle->header;
+	entry->data   = handle->data;
+	entry->size   = handle->size;
+	entry->offset = persistentCachePoolUsed;
+	entry->ranges = 0;
+	persistentCachePoolUsed += handle->size;
+
+	persistentRead(entry->data, (char*)persistentCachePool + entry->offset, entry->size);
+	return 1;
+#else
+	(void)handle;
+	return -3;
+#endif
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Commits the dirty data of a cached area and removes it from the cache.
+ *
+ * @param handle  The handle of the area
+ *
+ * @return  >= 0 The number of dirty bytes written
+ *           < 0 Write error, the area stays cached
+ *
+ *---------------------------------------------------------------------------*/
+int32_t persistentUncacheArea(struct persistentAreaHandle* handle) {
+
+#if PERSISTENT_CACHE_SIZE > 0
+	struct persistentCacheEntry* entry = persistentCacheFind(handle->header);
+	if (!entry || handle->header == 0)
+		return 0;
+
+	int32_t flushed = persistentCacheFlush(entry);
+	if (flushed >= 0)
+		persistentCacheRelease(entry);
+
+	return flushed;
+#else
+	(void)handle;
+	return 0;
+#endif
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Writes the dirty ranges of all cached areas to persistent memory.
+ *
+ * @return  >= 0 The number of dirty bytes written
+ *           < 0 Write error, the areas that failed stay dirty
+ *
+ *---------------------------------------------------------------------------*/
+int32_t persistentCommit() {
+
+	int32_t flushed = 0;
+
+#if PERSISTENT_CACHE_SIZE > 0
+	bool failed = false;
+	for (uint8_t i = 0; i < PERSISTENT_CACHE_AREAS; i++) {
+		if (persistentCacheEntries[i].header == 0)
+			continue;
+
+		int32_t rv = persistentCacheFlush(&persistentCacheEntries[i]);
+		if (rv < 0)
+			failed = true;
+		else
+			flushed += rv;
+	}
+
+	if (failed)
+		return -1;
+
+	persistentDirtySeen = false;
+#endif
+
+	return flushed;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Sets the maximum age of dirty data, see persistentCommitPoll().
+ *
+ * @param interval  The maximum age, in the unit passed to persistentCommitPoll().
+ *                  0 disables committing on age.
+ *
+ *---------------------------------------------------------------------------*/
+void persistentSetCommitInterval(uint32_t interval) {
+#if PERSISTENT_CACHE_SIZE > 0
+	persistentCommitInterval = interval;
+#else
+	(void)interval;
+#endif
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Commits the cache if its dirty data is older than the commit interval.
+ *  Call it regularly, e.g. from loop() with persistentCommitPoll(millis()).
+ *
+ * @param now  The current time
+ *
+ * @return  >  0 The number of dirty bytes written
+ *             0 Nothing to commit yet
+ *          <  0 Write error
+ *
+ *---------------------------------------------------------------------------*/
+int32_t persistentCommitPoll(uint32_t now) {
+
+#if PERSISTENT_CACHE_SIZE > 0
+	if (persistentCommitInterval == 0 || persistentDirtyBytes() == 0)
+		return 0;
+
+	if (!persistentDirtySeen) {
+		persistentDirtySeen  = true;
+		persistentDirtySince = now;
+	}
+
+	if (now - persistentDirtySince >= persistentCommitInterval)
+		return persistentCommit();
+#else
+	(void)now;
+#endif
+
+	return 0;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the number of dirty bytes in the cache.
+ *
+ *---------------------------------------------------------------------------*/
+uint16_t persistentDirtyBytes() {
+
+	uint16_t dirty = 0;
+
+#if PERSISTENT_CACHE_SIZE > 0
+	for (uint8_t i = 0; i < PERSISTENT_CACHE_AREAS; i++) {
+		struct persistentCacheEntry* entry = &persistentCacheEntries[i];
+		if (entry->header == 0)
+			continue;
+
+		for (uint8_t r = 0; r < entry->ranges; r++)
+			dirty += entry->dirtyTo[r] - entry->dirtyFrom[r];
+	}
+#endif
+
+	return dirty;
+}
+
+#if PERSISTENT_CACHE_SIZE > 0
+
+/**----------------------------------------------------------------------------
+ *
+ *  Reads the data of a cached area from RAM.
+ *
+ * @param header  The header address of the area
+ * @param offset  Offset of the first byte to read in the data
+ * @param size    Number of bytes to read, within the area
+ * @param data    The buffer to copy the data into
+ *
+ * @return  1 The data was read from the cache
+ *          0 The area is not cached
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentCacheRead(uint32_t header, uint16_t offset, uint16_t size, char* data) {
+
+	struct persistentCacheEntry* entry = persistentCacheFind(header);
+	if (!entry || header == 0)
+		return 0;
+
+	memcpy(data, persistentCachePool + entry->offset + offset, size);
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Writes the data of a cached area to RAM and marks the bytes that
+ *  changed dirty. If the cache holds PERSISTENT_CACHE_DIRTY_MAX dirty
+ *  bytes it is committed. If that fails the data stays dirty, so the
+ *  next commit retries it.
+ *
+ * @param header  The header address of the area
+ * @param offset  Offset of the first byte to write in the data
+ * @param size    Number of bytes to write, within the area
+ * @param data    The data to write
+ *
+ * @return  1 The data was written to the cache
+ *          0 The area is not cached
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentCacheWrite(uint32_t header, uint16_t offset, uint16_t size, const char* data) {
+
+	struct persistentCacheEntry* entry = persistentCacheFind(header);
+	if (!entry || header == 0)
+		return 0;
+
+	uint8_t* cached = persistentCachePool + entry->offset;
+	uint16_t end    = offset + size;
+	for (uint16_t i = offset; i < end; ) {
+
+		if (cached[i] == (uint8_t)data[i - offset]) {
+			i++;
+			continue;
+		}
+
+		//
+		//  Copy the run of changed bytes and mark it dirty
+		//
+		uint16_t from = i;
+		while (i < end && cached[i] != (uint8_t)data[i - offset]) {
+			cached[i] = (uint8_t)data[i - offset];
+			i++;
+		}
+		persistentCacheMarkDirty(entry, from, i);
+	}
+
+	if (PERSISTENT_CACHE_DIRTY_MAX && persistentDirtyBytes() >= PERSISTENT_CACHE_DIRTY_MAX)
+		persistentCommit();
+
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Discards a cached area without committing it, used when it is freed.
+ *
+ * @param header  The header address of the area
+ *
+ *---------------------------------------------------------------------------*/
+void persistentCacheDrop(uint32_t header) {
+
+	struct persistentCacheEntry* entry = persistentCacheFind(header);
+	if (entry && header)
+		persistentCacheRelease(entry);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Updates a cached area that was moved by compaction, so its dirty data
+ *  is committed to the new location.
+ *
+ * @param oldHeader  The header address of the area before the move
+ * @param newHeader  The header address of the area after the move
+ *
+ *---------------------------------------------------------------------------*/
+void persistentCacheMove(uint32_t oldHeader, uint32_t newHeader) {
+
+	struct persistentCacheEntry* entry = persistentCacheFind(oldHeader);
+	if (!entry || oldHeader == 0)
+		return;
+
+	entry->data   = (uint16_t)(entry->data - oldHeader + newHeader);
+	entry->header = (uint16_t)newHeader;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Discards all cached areas without committing them, used when the
+ *  persistent memory is formatted.
+ *
+ *---------------------------------------------------------------------------*/
+void persistentCacheReset() {
+
+	for (uint8_t i = 0; i < PERSISTENT_CACHE_AREAS; i++) {
+		persistentCacheEntries[i].header = 0;
+		persistentCacheEntries[i].ranges = 0;
+	}
+
+	persistentCachePoolUsed = 0;
+	persistentDirtySeen     = false;
+}
+
+#endif
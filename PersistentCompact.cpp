@@ -0,0 +1,851 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <PersistentCompact.cpp> - Restartable compaction of persistent memory.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0012 - Initial release, restartable compaction
+ *  P0018 - Data offset masked from the name hash in the data field
+ *  P0019 - Compact area headers
+ *  P0025 - Journaled resize of an area, in place or relocated
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <Persistence.h>
+
+//
+//  Journal of the move in progress, kept in the PERSISTENT_JOURNAL_SIZE bytes
+//  between EPR_END_FREE and the variable size data. Only a formatted store
+//  reserves them, on a store that was not formatted the chain may use that
+//  memory and the layout has no journal.
+//  Every field is followed by its one's complement, so a field that was only
+//  partly written when the power failed reads as invalid, or as its old or
+//  its new value. The progress is written alternately to two fields, so when
+//  one of them is invalid the other still holds the progress of the previous
+//  chunk. The magic is written last to activate the journal and cleared first
+//  to deactivate it.
+//
+//  A resize in place uses the same record with its own magic. Then src is the
+//  header address of the area, dst its old cell size, size its new cell size,
+//  done[0] the size of the free cell split off behind it, 0 if none or 0xffff
+//  if the area ends the chain, and done[1] 1 if its checksum is updated.
+//
+//  So does a relocation. Then src is the header address of the area, dst that
+//  of its new cell, size the new cell size, done[0] the data field of the
+//  area and done[1] 1 once its data was copied to the new cell.
+//
+//  The commit of persistentUpgrade() uses it on a store that is not formatted
+//  yet. Then src is the first header the formatted chain keeps, dst that of
+//  the areas copied behind the chain and size the next field of the first
+//  copy, 0xffff if there are none. done[0] is the number of areas.
+//
+#define PERSISTENT_JOURNAL_MAGIC    0x4a43   // "CJ"
+#define PERSISTENT_JOURNAL_RESIZE   0x4a52   // "RJ"
+#define PERSISTENT_JOURNAL_RELOCATE 0x4a4c   // "LJ"
+#define PERSISTENT_JOURNAL_UPGRADE  0x4a55   // "UJ"
+
+struct persistentJournalField {
+	uint16_t value;
+	uint16_t check;       // ~value
+};
+
+struct persistentJournal {
+	struct persistentJournalField src;       // Header address of the cell being moved
+	struct persistentJournalField dst;       // Header address the cell is moved to
+	struct persistentJournalField size;      // Size of the cell including its header
+	struct persistentJournalField done[2];   // Number of bytes copied so far
+	uint16_t magic;                          // PERSISTENT_JOURNAL_MAGIC if a move is in progress
+};
+
+#define PERSISTENT_COMPACT_CHUNK  32   // Bytes copied per journal update
+
+/**----------------------------------------------------------------------------
+ *
+ *  Stores a journal field, a 16 bit value followed by its complement.
+ *
+ * @param addr   The persistent address of the field
+ * @param value  The value
+ *
+ * @return   > 0 Success
+ *           < 0 Write error
+ *
+ *---------------------------------------------------------------------------*/
+static int32_t persistentJournalStore(uint32_t addr, uint16_t value) {
+
+	struct persistentJournalField field = { value, (uint16_t)~value };
+	return persistentStore(addr, (char*)&field, sizeof(field));
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns true if a journal field was completely written.
+ *
+ *---------------------------------------------------------------------------*/
+static bool persistentJournalValid(struct persistentJournalField* field) {
+	return (uint16_t)(field->value ^ field->check) == 0xffff;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Deactivates the journal, then leaves its memory virgin.
+ *
+ * @param journal  The persistent address of the journal
+ *
+ * @return   1 Success
+ *          -1 Write error
+ *
+ *---------------------------------------------------------------------------*/
+static int16_t persistentJournalClose(uint32_t journal) {
+
+	if (persistentClear(journal + offsetof(persistentJournal, magic), 0xff, sizeof(uint16_t)) < 0)
+		return -1;
+
+	if (persistentClear(journal, 0xff, PERSISTENT_JOURNAL_SIZE) < 0)
+		return -1;
+
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Copies a cell down to a lower address and turns the memory it leaves
+ *  behind into a free cell. The source and destination may overlap.
+ *  Each chunk copied is at most the distance of the move, so it never
+ *  overwrites source bytes that are still to be copied. The progress is
+ *  journaled after every chunk, which makes the copy restartable.
+ *
+ * @param src   Header address of the cell
+ * @param dst   Header address to move it to, the free cell in front of it
+ * @param size  Size of the cell including its header
+ * @param done  Number of bytes already copied
+ * @param field The progress field holding done, the other one is written next
+ *
+ * @return   1 Success
+ *          -1 Write error
+ *
+ *---------------------------------------------------------------------------*/
+static int16_t persistentCompactMove(uint32_t src, uint32_t dst, uint16_t size,
+		                             uint16_t done, uint8_t field) {
+
+	uint32_t journal = persistentGetLayout()->journal;
+	uint16_t gap     = src - dst;
+	uint16_t step    = gap < PERSISTENT_COMPACT_CHUNK ? gap : PERSISTENT_COMPACT_CHUNK;
+
+	char chunk[PERSISTENT_COMPACT_CHUNK];
+	while (done < size) {
+		uint16_t n = (size - done < step) ? size - done : step;
+		persistentRead(src + done, chunk, n);
+		if (persistentStore(dst + done, chunk, n) < 0)
+			return -1;
+
+		done  += n;
+		field ^= 1;
+		if (persistentJournalStore(journal + offsetof(persistentJournal, done) +
+				                   field * sizeof(persistentJournalField), done) < 0)
+			return -1;
+	}
+
+	//
+	//  The gap is now behind the moved cell, make it a free cell
+	//
+	struct persistentAreaHeader header;
+	uint8_t free = persistentFreeHeaderSize();
+	header.next = gap;
+	header.data = 0xffff;
+	memset(header.name, 0xff, PERSISTENT_AREA_NAME_SIZE);
+	if (persistentStore(dst + size, (char*)&header, free) < 0)
+		return -1;
+
+	if (persistentClear(dst + size + free, 0xff, gap - free) < 0)
+		return -1;
+
+	return persistentJournalClose(journal);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Gives an area a new cell size, the journal of the resize is active.
+ *  First the memory behind the new end of the cell is made a free cell that
+ *  reads 0xff beyond its header, or virgin memory if the area ends the chain.
+ *  Then the next field of the area is written, the bytes it grew by are
+ *  cleared and its checksum is stored for the new size. All of it is
+ *  written again if the resize is completed after a power loss.
+ *
+ * @param header   Header address of the area
+ * @param cell     The new size of the cell including its header
+ * @param rest     Size of the free cell behind it, 0 if none, 0xffff if virgin
+ * @param old      The old size of the cell
+ * @param checked  True if the checksum of the area is updated
+ *
+ * @return   1 Success
+ *          -1 Write error
+ *
+ *---------------------------------------------------------------------------*/
+static int16_t persistentResizeCell(uint32_t header, uint16_t cell, uint16_t rest,
+		                            uint16_t old, bool checked) {
+
+	uint32_t journal = persistentGetLayout()->journal;
+	uint32_t endFree = EPR_END_FREE;
+	uint32_t end     = header + cell;
+
+	if (rest == 0xffff) {
+		if (end < endFree) {
+			uint16_t clear = (end + PERSISTENT_AREA_PREFIX_SIZE <= endFree)
+					       ? PERSISTENT_AREA_PREFIX_SIZE : endFree - end;
+			if (persistentClear(end, 0xff, clear) < 0)
+				return -1;
+		}
+	}
+	else if (rest) {
+		struct persistentAreaHeader free;
+		free.next = rest;
+		free.data = 0xffff;
+		memset(free.name, 0xff, PERSISTENT_AREA_NAME_SIZE);
+		if (persistentStore(end, (char*)&free, persistentFreeHeaderSize()) < 0)
+			return -1;
+
+		if (persistentClear(end + persistentFreeHeaderSize(), 0xff, rest - persistentFreeHeaderSize()) < 0)
+			return -1;
+	}
+
+	if (persistentStore(header, (char*)&cell, sizeof(cell)) < 0)
+		return -1;
+
+	//
+	//  A grown area reads 0xff in its new bytes, that held the header of
+	//  the free cell behind it
+	//
+	if (cell > old && persistentClear(header + old, 0xff, cell - old) < 0)
+		return -1;
+
+	if (checked) {
+		struct persistentAreaHeader area;
+		persistentRead(header, (char*)&area, PERSISTENT_CELL_LINK_SIZE);
+
+		uint8_t offset = PERSISTENT_DATA_OFFSET(area.data);
+		if (persistentUpdateChecksum(header, header + offset, cell - offset) < 0)
+			return -1;
+	}
+
+	return persistentJournalClose(journal);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Moves a cell down over the free memory in front of it, journaled so it is
+ *  completed after a power loss. The free memory then follows the cell as a
+ *  single free cell. With a size of 0 nothing is moved, which merges all the
+ *  free cells from dst up to src into one.
+ *
+ * @param src   Header address of the cell, or of the end of the free cells
+ * @param dst   Header address of the free cell in front of it
+ * @param size  Size of the cell including its header, 0 to only merge
+ *
+ * @return   1 Success
+ *          -1 Write error
+ *          -2 The store was not formatted, it has no journal
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentJournaledMove(uint32_t src, uint32_t dst, uint16_t size) {
+
+	uint32_t journal = persistentGetLayout()->journal;
+	uint16_t magic   = PERSISTENT_JOURNAL_MAGIC;
+
+	if (!journal)
+		return -2;
+
+	if (persistentJournalStore(journal + offsetof(persistentJournal, src),  src)  < 0 ||
+		persistentJournalStore(journal + offsetof(persistentJournal, dst),  dst)  < 0 ||
+		persistentJournalStore(journal + offsetof(persistentJournal, size), size) < 0 ||
+		persistentJournalStore(journal + offsetof(persistentJournal, done), 0)    < 0 ||
+		persistentJournalStore(journal + offsetof(persistentJournal, done) +
+				               sizeof(persistentJournalField), 0)             < 0 ||
+		persistentStore(journal + offsetof(persistentJournal, magic), (char*)&magic, sizeof(magic)) < 0)
+		return -1;
+
+	return persistentCompactMove(src, dst, size, 0, 0);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Changes the size of the cell of an area in place, journaled so it is
+ *  completed after a power loss. A partly written next field would break
+ *  the chain, see persistentCoalesce(). The data of the area stays where
+ *  it is.
+ *
+ * @param header   Header address of the area
+ * @param cell     The new size of the cell including its header
+ * @param rest     Size of the free cell split off behind it, 0 if none,
+ *                 0xffff if the area ends the chain
+ * @param old      The old size of the cell
+ * @param checked  True if the checksum of the area is updated, it was
+ *                 written and verified
+ *
+ * @return   1 Success
+ *          -1 Write error
+ *          -2 The store was not formatted, it has no journal
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentJournaledResize(uint32_t header, uint16_t cell, uint16_t rest,
+		                          uint16_t old, bool checked) {
+
+	uint32_t journal = persistentGetLayout()->journal;
+	uint16_t magic   = PERSISTENT_JOURNAL_RESIZE;
+
+	if (!journal)
+		return -2;
+
+	if (persistentJournalStore(journal + offsetof(persistentJournal, src),  header)  < 0 ||
+		persistentJournalStore(journal + offsetof(persistentJournal, dst),  old)     < 0 ||
+		persistentJournalStore(journal + offsetof(persistentJournal, size), cell)    < 0 ||
+		persistentJournalStore(journal + offsetof(persistentJournal, done), rest)    < 0 ||
+		persistentJournalStore(journal + offsetof(persistentJournal, done) +
+				               sizeof(persistentJournalField), checked) < 0 ||
+		persistentStore(journal + offsetof(persistentJournal, magic), (char*)&magic, sizeof(magic)) < 0)
+		return -1;
+
+	return persistentResizeCell(header, cell, rest, old, checked);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Completes a relocation, the data of the area is in its new cell. The
+ *  header of the new cell is written as a copy of the old one, then the old
+ *  cell is freed, its data field first. Once that field is 0xffff the new
+ *  header is complete, so after a power loss the header is only written
+ *  again while the old one is still allocated. Merging the old cell with
+ *  its neighbours is left to the caller.
+ *
+ * @param journal  The persistent address of the journal
+ * @param src      Header address of the area
+ * @param dst      Header address of its new cell
+ * @param cell     The size of the new cell including its header
+ * @param data     The data field of the area
+ *
+ * @return   1 Success
+ *          -1 Write error
+ *
+ *---------------------------------------------------------------------------*/
+static int16_t persistentRelocateFinish(uint32_t journal, uint32_t src, uint32_t dst,
+		                                uint16_t cell, uint16_t data) {
+
+	struct persistentAreaHeader old;
+	persistentRead(src, (char*)&old, PERSISTENT_CELL_LINK_SIZE);
+
+	if (old.data != 0xffff) {
+		char    raw[PERSISTENT_COMPACT_PREFIX_SIZE + PERSISTENT_AREA_NAME_SIZE];
+		uint8_t size = persistentHeaderSize(src);
+		if (size > sizeof(raw))
+			size = sizeof(raw);
+
+		persistentRead(src, raw, size);
+		memcpy(raw, &cell, sizeof(cell));
+		memcpy(raw + sizeof(cell), &data, sizeof(data));
+		if (persistentStore(dst, raw, size) < 0)
+			return -1;
+
+		if (persistentClear(src + sizeof(cell), 0xff, sizeof(data)) < 0)
+			return -1;
+	}
+
+	//
+	//  The rest of a free cell reads 0xff
+	//
+	if (persistentClear(src + PERSISTENT_CELL_LINK_SIZE, 0xff, old.next - PERSISTENT_CELL_LINK_SIZE) < 0)
+		return -1;
+
+	return persistentJournalClose(journal);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Starts relocating an area to a cell that is not part of the chain yet,
+ *  a freed cell or the end of the chain. Until persistentRelocateCommit()
+ *  the caller prepares that cell and copies the data into it. A power loss
+ *  before the commit leaves the area where it was, the bytes copied into a
+ *  freed cell are cleared again. After that the relocation is completed.
+ *
+ * @param src   Header address of the area
+ * @param dst   Header address of its new cell
+ * @param cell  The size of the new cell including its header
+ * @param data  The data field of the area
+ *
+ * @return   1 Success
+ *          -1 Write error
+ *          -2 The store was not formatted, it has no journal
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentRelocateBegin(uint32_t src, uint32_t dst, uint16_t cell, uint16_t data) {
+
+	uint32_t journal = persistentGetLayout()->journal;
+	uint16_t magic   = PERSISTENT_JOURNAL_RELOCATE;
+
+	if (!journal)
+		return -2;
+
+	if (persistentJournalStore(journal + offsetof(persistentJournal, src),  src)  < 0 ||
+		persistentJournalStore(journal + offsetof(persistentJournal, dst),  dst)  < 0 ||
+		persistentJournalStore(journal + offsetof(persistentJournal, size), cell) < 0 ||
+		persistentJournalStore(journal + offsetof(persistentJournal, done), data) < 0 ||
+		persistentJournalStore(journal + offsetof(persistentJournal, done) +
+				               sizeof(persistentJournalField), 0)            < 0 ||
+		persistentStore(journal + offsetof(persistentJournal, magic), (char*)&magic, sizeof(magic)) < 0)
+		return -1;
+
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Completes the relocation started by persistentRelocateBegin(), once the
+ *  new cell holds the data. The area then moves to the new cell and its old
+ *  cell is freed.
+ *
+ * @param src   Header address of the area
+ * @param dst   Header address of its new cell
+ * @param cell  The size of the new cell including its header
+ * @param data  The data field of the area
+ *
+ * @return   1 Success
+ *          -1 Write error
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentRelocateCommit(uint32_t src, uint32_t dst, uint16_t cell, uint16_t data) {
+
+	uint32_t journal = persistentGetLayout()->journal;
+
+	if (persistentJournalStore(journal + offsetof(persistentJournal, done) +
+			                   sizeof(persistentJournalField), 1) < 0)
+		return -1;
+
+	return persistentRelocateFinish(journal, src, dst, cell, data);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Commits an upgrade, see persistentUpgrade(). The copies are linked in
+ *  behind the chain, the memory from PERSISTENT_FORMAT_START up to the first
+ *  header kept becomes a free cell and the superblock is written. All of it
+ *  is written again if the commit is completed after a power loss.
+ *
+ * @param journal  The persistent address of the journal
+ * @param keep     The first header the formatted chain keeps
+ * @param to       Header address of the copies
+ * @param first    The next field of the first copy, 0xffff if none
+ * @param areas    The number of areas
+ *
+ * @return   1 Success
+ *          -1 Write error
+ *
+ *---------------------------------------------------------------------------*/
+static int16_t persistentUpgradeFinish(uint32_t journal, uint32_t keep, uint32_t to,
+		                               uint16_t first, uint16_t areas) {
+
+	uint32_t startFree = PERSISTENT_FORMAT_START;
+
+	if (persistentStore(to, (char*)&first, sizeof(first)) < 0)
+		return -1;
+
+	if (keep > startFree) {
+		uint16_t next = keep - startFree;
+		if (persistentClear(startFree, 0xff, next) < 0 ||
+			persistentStore(startFree, (char*)&next, sizeof(next)) < 0)
+			return -1;
+	}
+
+	if (persistentStoreSuperblock(0, areas) < 0)
+		return -1;
+
+	if (persistentJournalClose(journal) < 0)
+		return -1;
+
+	//
+	//  The allocatable memory has moved, this also resets the index
+	//
+	persistentLoadLayout();
+
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Journals and commits an upgrade. The journal is where a formatted store
+ *  keeps it, beyond the end of the chain.
+ *
+ * @param keep   The first header the formatted chain keeps
+ * @param to     Header address of the copies, the end of the chain
+ * @param first  The next field of the first copy, 0xffff if none
+ * @param areas  The number of areas
+ *
+ * @return   1 Success
+ *          -1 Write error
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentJournaledUpgrade(uint32_t keep, uint32_t to, uint16_t first, uint16_t areas) {
+
+	uint32_t journal = persistentGetLayout()->calibrY - PERSISTENT_JOURNAL_SIZE;
+	uint16_t magic   = PERSISTENT_JOURNAL_UPGRADE;
+
+	if (persistentJournalStore(journal + offsetof(persistentJournal, src),  keep)  < 0 ||
+		persistentJournalStore(journal + offsetof(persistentJournal, dst),  to)    < 0 ||
+		persistentJournalStore(journal + offsetof(persistentJournal, size), first) < 0 ||
+		persistentJournalStore(journal + offsetof(persistentJournal, done), areas) < 0 ||
+		persistentJournalStore(journal + offsetof(persistentJournal, done) +
+				               sizeof(persistentJournalField), 0)              < 0 ||
+		persistentStore(journal + offsetof(persistentJournal, magic), (char*)&magic, sizeof(magic)) < 0)
+		return -1;
+
+	return persistentUpgradeFinish(journal, keep, to, first, areas);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns true if the cells from a header up to an end are a valid chain.
+ *
+ * @param addr    The first header
+ * @param end     Where the chain must end
+ * @param virgin  True if the chain may end early at a virgin header
+ *
+ *---------------------------------------------------------------------------*/
+static bool persistentUpgradeChain(uint32_t addr, uint32_t end, bool virgin) {
+
+	struct persistentAreaHeader header;
+	for (; addr < end; addr += header.next) {
+		persistentRead(addr, (char*)&header, PERSISTENT_CELL_LINK_SIZE);
+		if (virgin && header.next == 0xffff)
+			return true;
+
+		if (header.next < PERSISTENT_CELL_LINK_SIZE || addr + header.next > end)
+			return false;
+	}
+
+	return true;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Completes the commit of an upgrade on a store that is not formatted.
+ *  Where the journal would be the store may hold area data, so the record
+ *  is only trusted if the chain it describes is valid and ends in front of
+ *  it.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentUpgradeRecover() {
+
+	const struct persistentLayout* layout = persistentGetLayout();
+	uint32_t startFree = PERSISTENT_FORMAT_START;
+
+	if (layout->calibrY < startFree + PERSISTENT_AREA_PREFIX_SIZE + PERSISTENT_JOURNAL_SIZE)
+		return;
+
+	uint32_t journal = layout->calibrY - PERSISTENT_JOURNAL_SIZE;
+	struct persistentJournal record;
+	persistentRead(journal, (char*)&record, sizeof(record));
+
+	if (record.magic != PERSISTENT_JOURNAL_UPGRADE ||
+		!persistentJournalValid(&record.src)       ||
+		!persistentJournalValid(&record.dst)       ||
+		!persistentJournalValid(&record.size)      ||
+		!persistentJournalValid(&record.done[0]))
+		return;
+
+	uint16_t keep  = record.src.value;
+	uint16_t to    = record.dst.value;
+	uint16_t first = record.size.value;
+	if (keep < startFree || (keep != startFree && keep < startFree + PERSISTENT_AREA_PREFIX_SIZE) ||
+		to < keep || to > journal ||
+		(first != 0xffff && (first < PERSISTENT_CELL_LINK_SIZE || (uint32_t)to + first > journal)))
+		return;
+
+	if (!persistentUpgradeChain(keep, to, false) ||
+		(first != 0xffff && !persistentUpgradeChain(to + first, journal, true)))
+		return;
+
+	persistentUpgradeFinish(journal, keep, to, first, record.done[0].value);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Compacts persistent memory. The allocated areas are moved down over the
+ *  freed cells in chain order, so all free memory ends up as virgin memory
+ *  at the end of the chain. Each move is journaled, if the power fails
+ *  during a move it is completed on the next persistentLoadLayout().
+ *  The moves completed before stay, calling persistentCompact() again
+ *  continues where it left off.
+ *
+ *  Handles, including those of wear leveled areas, hold data addresses that
+ *  are no longer valid after their area moved. Use the callback to update
+ *  them with persistentMoveHandle(), or open them again afterwards.
+ *  Areas in the write-back cache are updated automatically.
+ *
+ * @param moved  Called after each area that was moved, may be 0
+ *
+ * @return  >= 0 The number of bytes moved
+ *            -1 Write error
+ *            -2 The store was not formatted, it has no journal, or the
+ *               chain is broken. See persistentUpgrade().
+ *
+ *---------------------------------------------------------------------------*/
+int32_t persistentCompact(persistentMoveCallback moved) {
+
+	uint32_t endFree = EPR_END_FREE;
+	struct persistentAreaHeader header;
+
+	if (!persistentGetLayout()->journal)
+		return -2;
+
+	//
+	//  The chain must end before the journal
+	//
+	uint32_t addr;
+	for (addr = EPR_START_FREE; addr < endFree; addr += header.next) {
+		persistentRead(addr, (char*)&header, PERSISTENT_CELL_LINK_SIZE);
+		if (header.next == 0xffff || header.next == 0)
+			break;
+	}
+
+	if (addr > endFree)
+		return -2;
+
+	//
+	//  The RAM index and free list are rebuilt afterwards
+	//
+	persistentIndexReset();
+
+	int32_t bytesMoved = 0;
+	for (addr = EPR_START_FREE; addr < endFree; ) {
+
+		persistentRead(addr, (char*)&header, PERSISTENT_CELL_LINK_SIZE);
+		if (header.next == 0xffff || header.next == 0)
+			break;
+
+		if (header.data != 0xffff) {
+			addr += header.next;
+			continue;
+		}
+
+		//
+		//  A free cell, find the allocated cell behind it and
+		//  any other free cells in between.
+		//
+		struct persistentAreaHeader area;
+		uint32_t src = addr + header.next;
+		for (;;) {
+			area.next = 0xffff;
+			if (src + PERSISTENT_CELL_LINK_SIZE <= endFree)
+				persistentRead(src, (char*)&area, PERSISTENT_CELL_LINK_SIZE);
+
+			if (area.next == 0xffff || area.data != 0xffff)
+				break;
+
+			src += area.next;
+		}
+
+		//
+		//  If only virgin memory follows, clearing the free cells
+		//  makes them part of it and compaction is done.
+		//
+		if (area.next == 0xffff) {
+			if (persistentClear(addr, 0xff, src - addr) < 0)
+				bytesMoved = -1;
+			break;
+		}
+
+		//
+		//  Otherwise move the allocated cell down over them
+		//
+		if (persistentJournaledMove(src, addr, area.next) < 0) {
+			bytesMoved = -1;
+			break;
+		}
+
+#if PERSISTENT_CACHE_SIZE > 0
+		persistentCacheMove(src, addr);
+#endif
+
+		bytesMoved += area.next;
+		if (moved) {
+			persistentLoadHeader(addr, &area);
+			moved(area.name, src + PERSISTENT_DATA_OFFSET(area.data),
+			      addr + PERSISTENT_DATA_OFFSET(area.data));
+		}
+
+		addr += area.next;
+	}
+
+	persistentIndexReset();
+	return bytesMoved;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Completes a move, a resize or an upgrade that was interrupted by a reset.
+ *  It is called by persistentLoadLayout(), so before the chain is used.
+ *
+ *---------------------------------------------------------------------------*/
+void persistentCompactRecover() {
+
+	uint32_t journal = persistentGetLayout()->journal;
+
+	//
+	//  On a store that was not formatted these bytes may be area data,
+	//  only the commit of an upgrade is completed
+	//
+	if (!journal) {
+		persistentUpgradeRecover();
+		return;
+	}
+
+	struct persistentJournal record;
+	persistentRead(journal, (char*)&record, sizeof(record));
+
+	//
+	//  The superblock of an upgrade was written, only the journal is left
+	//
+	if (record.magic == PERSISTENT_JOURNAL_UPGRADE) {
+		persistentJournalClose(journal);
+		return;
+	}
+
+	//
+	//  A resize is written again as a whole, if it makes sense
+	//
+	if (record.magic == PERSISTENT_JOURNAL_RESIZE) {
+		if (!persistentJournalValid(&record.src)     ||
+			!persistentJournalValid(&record.dst)     ||
+			!persistentJournalValid(&record.size)    ||
+			!persistentJournalValid(&record.done[0]) ||
+			!persistentJournalValid(&record.done[1]))
+			return;
+
+		uint16_t header = record.src.value;
+		uint16_t old    = record.dst.value;
+		uint16_t cell   = record.size.value;
+		uint16_t rest   = record.done[0].value;
+		if (header < EPR_START_FREE || cell < persistentFreeHeaderSize() ||
+			(uint32_t)header + cell + (rest == 0xffff ? 0 : rest) > journal)
+			return;
+
+		persistentResizeCell(header, cell, rest, old, record.done[1].value == 1);
+		persistentIndexReset();
+		return;
+	}
+
+	//
+	//  A relocation is completed once the data was copied, otherwise a
+	//  freed cell it was copied to is cleared again
+	//
+	if (record.magic == PERSISTENT_JOURNAL_RELOCATE) {
+		if (!persistentJournalValid(&record.src)  ||
+			!persistentJournalValid(&record.dst)  ||
+			!persistentJournalValid(&record.size) ||
+			!persistentJournalValid(&record.done[0]))
+			return;
+
+		uint16_t src  = record.src.value;
+		uint16_t dst  = record.dst.value;
+		uint16_t cell = record.size.value;
+		if (src < EPR_START_FREE || dst < EPR_START_FREE || src == dst ||
+			cell < persistentFreeHeaderSize() || (uint32_t)dst + cell > journal)
+			return;
+
+		if (persistentJournalValid(&record.done[1]) && record.done[1].value == 1) {
+			persistentRelocateFinish(journal, src, dst, cell, record.done[0].value);
+			persistentIndexReset();
+			return;
+		}
+
+		struct persistentAreaHeader target;
+		persistentRead(dst, (char*)&target, PERSISTENT_CELL_LINK_SIZE);
+		uint8_t free = persistentFreeHeaderSize();
+		if (target.data == 0xffff && target.next != 0xffff &&
+			target.next >= free && (uint32_t)dst + target.next <= journal)
+			persistentClear(dst + free, 0xff, target.next - free);
+
+		persistentJournalClose(journal);
+		return;
+	}
+
+	if (record.magic != PERSISTENT_JOURNAL_MAGIC ||
+		!persistentJournalValid(&record.src)     ||
+		!persistentJournalValid(&record.dst)     ||
+		!persistentJournalValid(&record.size))
+		return;
+
+	//
+	//  Continue after the most progress recorded
+	//
+	uint16_t done  = 0;
+	uint8_t  field = 0;
+	for (uint8_t i = 0; i < 2; i++)
+		if (persistentJournalValid(&record.done[i]) && record.done[i].value > done) {
+			done  = record.done[i].value;
+			field = i;
+		}
+
+	//
+	//  Only continue a move that makes sense
+	//
+	uint16_t src  = record.src.value;
+	uint16_t dst  = record.dst.value;
+	uint16_t size = record.size.value;
+	if (dst < EPR_START_FREE || src <= dst ||
+		(uint16_t)(src - dst) < persistentFreeHeaderSize() ||
+		done > size || (uint32_t)src + size > journal)
+		return;
+
+	persistentCompactMove(src, dst, size, done, field);
+	persistentIndexReset();
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Updates a handle for an area that was moved by persistentCompact().
+ *  A handle of another area is left as it is.
+ *
+ * @param handle   The handle to update
+ * @param oldData  The data address of the area before the move
+ * @param newData  The data address of the area after the move
+ *
+ *---------------------------------------------------------------------------*/
+void persistentMoveHandle(struct persistentAreaHandle* handle, uint32_t oldData, uint32_t newData) {
+
+	if (handle->header == 0 || handle->data != oldData)
+		return;
+
+	handle->header = newData - (oldData - handle->header);
+	handle->data   = newData;
+}
@@ -0,0 +1,460 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <PersistentCrc.cpp> - Checksums of persistent areas.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0014 - Initial release, area checksums
+ *  P0015 - Patch the checksum for ranged writes
+ *  P0019 - Checksum found in front of the data, for compact headers too
+ *  P0025 - Checksum stored from the data in persistent memory, for resizes
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+#include <Persistence.h>
+
+//
+//  Both checksums are reflected CRCs, so they share one kernel.
+//  CRC-16 is the CCITT polynomial as used by _crc_ccitt_update() of avr-libc,
+//  with 0xffff as initial value. CRC-32 is the one of IEEE 802.3 and zip.
+//
+#define PERSISTENT_CRC16_POLY  0x8408UL
+#define PERSISTENT_CRC32_POLY  0xedb88320UL
+
+#define PERSISTENT_CRC_CHUNK   32   // Bytes read per step when verifying persistent memory
+
+//
+//  PERSISTENT_CRC_SLICED selects the kernel. The sliced kernel processes 4 bytes
+//  per step using 8 KB of tables built in RAM on first use, so it is only the
+//  default on the host. Arduino builds process a nibble per step using two
+//  tables of 16 entries in flash.
+//
+#ifndef PERSISTENT_CRC_SLICED
+#if defined(ARDUINO)
+#define PERSISTENT_CRC_SLICED  0
+#else
+#define PERSISTENT_CRC_SLICED  1
+#endif
+#endif
+
+#if PERSISTENT_CRC_SLICED
+
+static uint32_t persistentCrcTables[2][4][256];
+static bool     persistentCrcTablesBuilt = false;
+
+/**----------------------------------------------------------------------------
+ *
+ *  Builds the slice tables of both polynomials. Table 0 holds the CRC of
+ *  every byte value, table k that of the byte followed by k zero bytes.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentCrcBuildTables() {
+
+	const uint32_t poly[2] = { PERSISTENT_CRC16_POLY, PERSISTENT_CRC32_POLY };
+
+	for (uint8_t p = 0; p < 2; p++) {
+		for (uint16_t i = 0; i < 256; i++) {
+			uint32_t crc = i;
+			for (uint8_t bit = 0; bit < 8; bit++)
+				crc = (crc >> 1) ^ ((crc & 1) ? poly[p] : 0);
+			persistentCrcTables[p][0][i] = crc;
+		}
+
+		for (uint16_t i = 0; i < 256; i++) {
+			for (uint8_t k = 1; k < 4; k++) {
+				uint32_t crc = persistentCrcTables[p][k - 1][i];
+				persistentCrcTables[p][k][i] = (crc >> 8) ^ persistentCrcTables[p][0][crc & 0xff];
+			}
+		}
+	}
+
+	persistentCrcTablesBuilt = true;
+}
+
+#else
+
+#ifndef PROGMEM
+#define PROGMEM
+#define pgm_read_dword(addr)  (*(const uint32_t*)(addr))
+#endif
+
+static const uint32_t persistentCrcNibbles[2][16] PROGMEM = {
+	{ 0x00000000UL, 0x00001081UL, 0x00002102UL, 0x00003183UL,
+	  0x00004204UL, 0x00005285UL, 0x00006306UL, 0x00007387UL,
+	  0x00008408UL, 0x00009489UL, 0x0000a50aUL, 0x0000b58bUL,
+	  0x0000c60cUL, 0x0000d68dUL, 0x0000e70eUL, 0x0000f78fUL },
+	{ 0x00000000UL, 0x1db71064UL, 0x3b6e20c8UL, 0x26d930acUL,
+	  0x76dc4190UL, 0x6b6b51f4UL, 0x4db26158UL, 0x5005713cUL,
+	  0xedb88320UL, 0xf00f9344UL, 0xd6d6a3e8UL, 0xcb61b38cUL,
+	  0x9b64c2b0UL, 0x86d3d2d4UL, 0xa00ae278UL, 0xbdbdf21cUL }
+};
+
+#endif
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the initial value of a checksum.
+ *
+ * @param check  PERSISTENT_CHECK_CRC16 or PERSISTENT_CHECK_CRC32
+ *
+ *---------------------------------------------------------------------------*/
+uint32_t persistentCrcInit(uint8_t check) {
+	return (check == PERSISTENT_CHECK_CRC32) ? 0xffffffffUL : 0xffffUL;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Adds a block of data to a checksum.
+ *
+ * @param crc    The checksum so far, starting with persistentCrcInit()
+ * @param data   The data
+ * @param size   The size of the data in bytes
+ * @param check  PERSISTENT_CHECK_CRC16 or PERSISTENT_CHECK_CRC32
+ *
+ * @return   The updated checksum, finish it with persistentCrcFinal()
+ *
+ *---------------------------------------------------------------------------*/
+uint32_t persistentCrcUpdate(uint32_t crc, const char* data, uint16_t size, uint8_t check) {
+
+	const uint8_t* bytes = (const uint8_t*)data;
+	uint8_t p = (check == PERSISTENT_CHECK_CRC32) ? 1 : 0;
+
+#if PERSISTENT_CRC_SLICED
+	if (!persistentCrcTablesBuilt)
+		persistentCrcBuildTables();
+
+	const uint32_t (*table)[256] = persistentCrcTables[p];
+
+	//
+	//  Four bytes at a time, the bytes are combined little endian
+	//  to match the reflected bit order.
+	//
+	for (; size >= 4; size -= 4, bytes += 4) {
+		crc ^= (uint32_t)bytes[0]         | ((uint32_t)bytes[1] << 8) |
+			   ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+		crc = table[3][crc & 0xff]         ^ table[2][(crc >> 8) & 0xff] ^
+			  table[1][(crc >> 16) & 0xff] ^ table[0][crc >> 24];
+	}
+
+	while (size--)
+		crc = (crc >> 8) ^ table[0][(crc ^ *bytes++) & 0xff];
+#else
+	const uint32_t* table = persistentCrcNibbles[p];
+
+	while (size--) {
+		crc ^= *bytes++;
+		crc = (crc >> 4) ^ pgm_read_dword(&table[crc & 0x0f]);
+		crc = (crc >> 4) ^ pgm_read_dword(&table[crc & 0x0f]);
+	}
+#endif
+
+	return crc;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Finishes a checksum.
+ *
+ * @param crc    The checksum from persistentCrcUpdate()
+ * @param check  PERSISTENT_CHECK_CRC16 or PERSISTENT_CHECK_CRC32
+ *
+ *---------------------------------------------------------------------------*/
+uint32_t persistentCrcFinal(uint32_t crc, uint8_t check) {
+	return (check == PERSISTENT_CHECK_CRC32) ? ~crc : crc;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the checksum of a block of data in RAM.
+ *
+ * @param data   The data
+ * @param size   The size of the data in bytes
+ * @param check  PERSISTENT_CHECK_CRC16 or PERSISTENT_CHECK_CRC32
+ *
+ *---------------------------------------------------------------------------*/
+uint32_t persistentChecksum(const char* data, uint16_t size, uint8_t check) {
+
+	uint32_t crc = persistentCrcUpdate(persistentCrcInit(check), data, size, check);
+	return persistentCrcFinal(crc, check);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Reads the checksum stored with an area. The checksum sits between the
+ *  header and the data, its size follows from the data offset.
+ *
+ * @param header  The header address of the area
+ * @param data    The data address of the area
+ * @param stored  Returns the stored checksum
+ *
+ * @return   The size of the checksum, PERSISTENT_CHECK_NONE if the area has
+ *           no checksum or it was never written.
+ *
+ *---------------------------------------------------------------------------*/
+static uint8_t persistentReadChecksum(uint32_t header, uint32_t data, uint32_t* stored) {
+
+	uint8_t check = persistentCheckSize(header, data);
+	if (check != PERSISTENT_CHECK_CRC16 && check != PERSISTENT_CHECK_CRC32)
+		return PERSISTENT_CHECK_NONE;
+
+	*stored = 0;
+	persistentRead(data - check, (char*)stored, check);
+
+	//
+	//  A checksum that is all ones was never written
+	//
+	if (*stored == (check == PERSISTENT_CHECK_CRC32 ? 0xffffffffUL : 0xffffUL))
+		return PERSISTENT_CHECK_NONE;
+
+	return check;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Calculates the checksum of data in persistent memory, a chunk at a time,
+ *  optionally with new bytes in place of a range of it.
+ *
+ * @param addr    The address of the data
+ * @param size    The size of the data
+ * @param offset  Offset of the range to replace
+ * @param data    The bytes replacing the range, 0 replaces nothing
+ * @param len     The size of the range
+ * @param check   PERSISTENT_CHECK_CRC16 or PERSISTENT_CHECK_CRC32
+ *
+ *---------------------------------------------------------------------------*/
+static uint32_t persistentChecksumData(uint32_t addr, uint16_t size, uint16_t offset,
+		                               const char* data, uint16_t len, uint8_t check) {
+
+	char     chunk[PERSISTENT_CRC_CHUNK];
+	uint32_t crc = persistentCrcInit(check);
+	for (uint16_t done = 0; done < size; ) {
+		uint16_t n = size - done;
+		if (n > sizeof(chunk))
+			n = sizeof(chunk);
+
+		persistentRead(addr + done, chunk, n);
+		for (uint16_t i = 0; data && i < n; i++) {
+			if (done + i >= offset && done + i < offset + len)
+				chunk[i] = data[done + i - offset];
+		}
+
+		crc = persistentCrcUpdate(crc, chunk, n, check);
+		done += n;
+	}
+
+	return persistentCrcFinal(crc, check);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Stores the checksum of the data of an area, after the data was written.
+ *
+ * @param header  The header address of the area
+ * @param addr    The data address of the area
+ * @param data    The data of the area in RAM
+ * @param size    The size of the data
+ *
+ * @return   > 0 The size of the checksum stored
+ *             0 The area has no checksum
+ *           < 0 Write error
+ *
+ *---------------------------------------------------------------------------*/
+int32_t persistentStoreChecksum(uint32_t header, uint32_t addr, const char* data, uint16_t size) {
+
+	uint8_t check = persistentCheckSize(header, addr);
+	if (check != PERSISTENT_CHECK_CRC16 && check != PERSISTENT_CHECK_CRC32)
+		return 0;
+
+	uint32_t crc = persistentChecksum(data, size, check);
+	return persistentStore(addr - check, (char*)&crc, check);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Stores the checksum of the data of an area as it is in persistent memory,
+ *  e.g. after the area was resized. The data is read a chunk at a time.
+ *
+ * @param header  The header address of the area
+ * @param addr    The data address of the area
+ * @param size    The size of the data
+ *
+ * @return   > 0 The size of the checksum stored
+ *             0 The area has no checksum
+ *           < 0 Write error
+ *
+ *---------------------------------------------------------------------------*/
+int32_t persistentUpdateChecksum(uint32_t header, uint32_t addr, uint16_t size) {
+	return persistentWriteChecksum(addr, size, persistentCheckSize(header, addr));
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Like persistentUpdateChecksum(), for data whose cell has no header yet,
+ *  e.g. the new cell of an area that is relocated.
+ *
+ * @param addr   The data address
+ * @param size   The size of the data
+ * @param check  The size of the checksum in front of the data
+ *
+ * @return   Same as persistentUpdateChecksum()
+ *
+ *---------------------------------------------------------------------------*/
+int32_t persistentWriteChecksum(uint32_t addr, uint16_t size, uint8_t check) {
+
+	if (check != PERSISTENT_CHECK_CRC16 && check != PERSISTENT_CHECK_CRC32)
+		return 0;
+
+	uint32_t crc = persistentChecksumData(addr, size, 0, 0, 0, check);
+	return persistentStore(addr - check, (char*)&crc, check);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Checks data of an area that was just read into RAM against the stored
+ *  checksum, which only takes reading the checksum itself.
+ *
+ * @param header  The header address of the area
+ * @param addr    The data address of the area
+ * @param data    The data of the area in RAM
+ * @param size    The size of the data
+ *
+ * @return   1 The data matches the checksum
+ *           0 The area has no checksum, or it was never written
+ *          -3 The data does not match the checksum
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentCheckData(uint32_t header, uint32_t addr, const char* data, uint16_t size) {
+
+	uint32_t stored;
+	uint8_t  check = persistentReadChecksum(header, addr, &stored);
+	if (check == PERSISTENT_CHECK_NONE)
+		return 0;
+
+	return (persistentChecksum(data, size, check) == stored) ? 1 : -3;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Verifies the data of an area in persistent memory against its checksum.
+ *  The data is read a chunk at a time, so no RAM buffer of its size is needed.
+ *
+ * @param handle  The handle of the area
+ *
+ * @return   1 The data matches the checksum
+ *           0 The area has no checksum, or it was never written
+ *          -1 The handle is not open
+ *          -3 The data does not match the checksum
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentVerifyArea(struct persistentAreaHandle* handle) {
+
+	if (handle->header == 0)
+		return -1;
+
+	uint32_t stored;
+	uint8_t  check = persistentReadChecksum(handle->header, handle->data, &stored);
+	if (check == PERSISTENT_CHECK_NONE)
+		return 0;
+
+	return (persistentChecksumData(handle->data, handle->size, 0, 0, 0, check) == stored) ? 1 : -3;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Calculates the checksum an area gets when a range of its data is written.
+ *  Call it before the range is written.
+ *
+ *  A CRC is linear, so the change of the CRC only depends on the bits that
+ *  change and on their distance to the end of the data. If the area has a
+ *  valid checksum, only the old bytes of the range are read. Otherwise all
+ *  data is read, with the new bytes in place of the range.
+ *
+ * @param header  The header address of the area
+ * @param addr    The data address of the area
+ * @param size    The size of the data of the area
+ * @param offset  Offset of the range in the data
+ * @param data    The new data of the range
+ * @param len     The size of the range
+ * @param crc     Returns the new checksum
+ *
+ * @return   The size of the checksum to store, PERSISTENT_CHECK_NONE if the
+ *           area has no checksum.
+ *
+ *---------------------------------------------------------------------------*/
+uint8_t persistentPatchChecksum(uint32_t header, uint32_t addr, uint16_t size,
+		                        uint16_t offset, const char* data, uint16_t len, uint32_t* crc) {
+
+	uint8_t check = persistentCheckSize(header, addr);
+	if (check != PERSISTENT_CHECK_CRC16 && check != PERSISTENT_CHECK_CRC32)
+		return PERSISTENT_CHECK_NONE;
+
+	uint32_t stored;
+	if (persistentReadChecksum(header, addr, &stored) == PERSISTENT_CHECK_NONE) {
+		*crc = persistentChecksumData(addr, size, offset, data, len, check);
+		return check;
+	}
+
+	//
+	//  The CRC of the changed bits, starting from 0 so the unchanged
+	//  bytes before the range add nothing, followed by the zeros of the
+	//  unchanged bytes after it.
+	//
+	char     chunk[PERSISTENT_CRC_CHUNK];
+	uint32_t delta = 0;
+	for (uint16_t done = 0; done < len; ) {
+		uint16_t n = len - done;
+		if (n > sizeof(chunk))
+			n = sizeof(chunk);
+
+		persistentRead(addr + offset + done, chunk, n);
+		for (uint16_t i = 0; i < n; i++)
+			chunk[i] ^= data[done + i];
+
+		delta = persistentCrcUpdate(delta, chunk, n, check);
+		done += n;
+	}
+
+	memset(chunk, 0, sizeof(chunk));
+	for (uint16_t left = size - offset - len; left; ) {
+		uint16_t n = (left > sizeof(chunk)) ? sizeof(chunk) : left;
+		delta = persistentCrcUpdate(delta, chunk, n, check);
+		left -= n;
+	}
+
+	*crc = stored ^ delta;
+	return check;
+}
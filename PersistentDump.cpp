@@ -0,0 +1,549 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <PersistentDump.cpp> - Area cursor, listing and dumps.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0024 - Initial release, area cursor and dumps
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+#include <Persistence.h>
+
+#if !defined(ARDUINO)
+#include <stdio.h>
+#endif
+
+//
+//  Output of the listing and the dumps. A line is built in RAM and then
+//  written in one go, to a Print on Arduino and to stdout on hosts.
+//
+struct persistentDumpSink {
+	void  (*write)(void* out, const char* text, uint8_t len);
+	void*   out;
+};
+
+struct persistentDumpText {
+	char    text[80];
+	uint8_t len;
+};
+
+#if defined(ARDUINO)
+/**----------------------------------------------------------------------------
+ *
+ *  Writes a line to a Print.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentDumpPrint(void* out, const char* text, uint8_t len) {
+	((Print*)out)->write((const uint8_t*)text, len);
+	((Print*)out)->println();
+}
+#else
+/**----------------------------------------------------------------------------
+ *
+ *  Writes a line to a stdio stream, stdout for the dump functions.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentDumpStdout(void* out, const char* text, uint8_t len) {
+	fwrite(text, 1, len, (FILE*)out);
+	fputc('\n', (FILE*)out);
+}
+#endif
+
+/**----------------------------------------------------------------------------
+ *
+ *  Appends text to a line, padded with spaces to width characters.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentDumpStr(struct persistentDumpText* line, const char* text, uint8_t width) {
+
+	while (*text && line->len < sizeof(line->text))
+		line->text[line->len++] = *text++;
+
+	while (width > 0 && line->len < width && line->len < sizeof(line->text))
+		line->text[line->len++] = ' ';
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Appends a value with the specified number of hex digits to a line.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentDumpHex(struct persistentDumpText* line, uint32_t value, uint8_t digits) {
+
+	while (digits-- > 0 && line->len < sizeof(line->text))
+		line->text[line->len++] = "0123456789abcdef"[(value >> (4 * digits)) & 0x0f];
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Appends a decimal value to a line, right aligned in width characters.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentDumpDec(struct persistentDumpText* line, uint32_t value, uint8_t width) {
+
+	char    digits[10];
+	uint8_t n = 0;
+	do {
+		digits[n++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+
+	while (width-- > n && line->len < sizeof(line->text))
+		line->text[line->len++] = ' ';
+	while (n > 0 && line->len < sizeof(line->text))
+		line->text[line->len++] = digits[--n];
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Writes a line to the sink and empties it.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentDumpFlush(const struct persistentDumpSink* sink, struct persistentDumpText* line) {
+	sink->write(sink->out, line->text, line->len);
+	line->len = 0;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Dumps bytes of persistent memory or RAM as hex and ASCII, reading them
+ *  PERSISTENT_DUMP_LINE bytes at a time.
+ *
+ * @param sink  Where to write the lines
+ * @param addr  The address of the first byte
+ * @param size  The number of bytes
+ * @param ram   True for RAM, false for persistent memory
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentDumpBytes(const struct persistentDumpSink* sink,
+		                        uint32_t addr, uint16_t size, bool ram) {
+
+	struct persistentDumpText line;
+	uint8_t chunk[PERSISTENT_DUMP_LINE];
+	uint8_t digits = ((uint32_t)addr + size > 0x10000UL) ? 8 : 4;
+	line.len = 0;
+
+	for (uint16_t done = 0; done < size; ) {
+		uint8_t n = (size - done < PERSISTENT_DUMP_LINE) ? size - done : PERSISTENT_DUMP_LINE;
+		if (ram)
+			memcpy(chunk, (const void*)(uintptr_t)(addr + done), n);
+		else
+			persistentRead(addr + done, (char*)chunk, n);
+
+		persistentDumpStr(&line, "0x", 0);
+		persistentDumpHex(&line, addr + done, digits);
+		persistentDumpStr(&line, " ", 0);
+		for (uint8_t i = 0; i < PERSISTENT_DUMP_LINE; i++) {
+			persistentDumpStr(&line, " ", 0);
+			if (i < n)
+				persistentDumpHex(&line, chunk[i], 2);
+			else
+				persistentDumpStr(&line, "  ", 0);
+		}
+		persistentDumpStr(&line, "  |", 0);
+		for (uint8_t i = 0; i < n; i++)
+			line.text[line.len++] = (chunk[i] >= 0x20 && chunk[i] < 0x7f) ? (char)chunk[i] : '.';
+		persistentDumpStr(&line, "|", 0);
+
+		persistentDumpFlush(sink, &line);
+		done += n;
+	}
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Loads the cell at an address into a cursor, reading its header with a
+ *  single read of the largest header the format has.
+ *
+ * @param cursor  The cursor
+ * @param addr    The header address of the cell
+ *
+ * @return  Same as persistentAreaNext(cursor)
+ *
+ *---------------------------------------------------------------------------*/
+static int16_t persistentAreaLoad(struct persistentAreaCursor* cursor, uint32_t addr) {
+
+	uint32_t endFree = EPR_END_FREE;
+	bool     compact = persistentIsCompact();
+	uint8_t  raw[PERSISTENT_COMPACT_PREFIX_SIZE + PERSISTENT_AREA_NAME_SIZE];
+	uint16_t next;
+	uint16_t data;
+
+	memset(cursor, 0, sizeof(*cursor));
+	cursor->header = addr;
+
+	if (addr + PERSISTENT_CELL_LINK_SIZE > endFree)
+		return 0;
+
+	uint8_t n = compact ? sizeof(raw) : PERSISTENT_AREA_PREFIX_SIZE;
+	if (addr + n > endFree)
+		n = (uint8_t)(endFree - addr);
+	persistentRead(addr, (char*)raw, n);
+
+	memcpy(&next, raw, sizeof(next));
+	memcpy(&data, raw + sizeof(next), sizeof(data));
+
+	//
+	//  Virgin memory marks the end of the chain
+	//
+	if (next == 0xffff)
+		return 0;
+
+	if (next < PERSISTENT_CELL_LINK_SIZE || addr + next > endFree)
+		return -1;
+
+	cursor->cellSize = next;
+	if (data == 0xffff) {
+		cursor->free = true;
+		return 1;
+	}
+
+	//
+	//  The name of a full header is padded with '\0', unless it is 16 long
+	//
+	uint8_t size;
+	if (compact) {
+		uint8_t len = raw[PERSISTENT_CELL_LINK_SIZE];
+		if (len > PERSISTENT_AREA_NAME_SIZE || PERSISTENT_COMPACT_PREFIX_SIZE + len > n)
+			return -1;
+		memcpy(cursor->name, raw + PERSISTENT_COMPACT_PREFIX_SIZE, len);
+		size = PERSISTENT_COMPACT_PREFIX_SIZE + len;
+	}
+	else {
+		memcpy(cursor->name, raw + PERSISTENT_CELL_LINK_SIZE, PERSISTENT_AREA_NAME_SIZE);
+		size = PERSISTENT_AREA_PREFIX_SIZE;
+	}
+
+	uint8_t offset = PERSISTENT_DATA_OFFSET(data);
+	if (offset < size || offset > next)
+		return -1;
+
+	cursor->data  = addr + offset;
+	cursor->size  = next - offset;
+	cursor->check = offset - size;
+	cursor->hash  = PERSISTENT_DATA_HASH(data);
+
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Positions a cursor on the first cell of the area chain.
+ *
+ * @param cursor  The cursor
+ *
+ * @return  Same as persistentAreaNext(cursor)
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentAreaFirst(struct persistentAreaCursor* cursor) {
+	return persistentAreaLoad(cursor, EPR_START_FREE);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Moves a cursor to the next cell of the area chain. Freed cells are
+ *  visited as well, with cursor->free set.
+ *
+ * @param cursor  The cursor
+ *
+ * @return   1 The cursor is on the next cell
+ *           0 The end of the chain, cursor->header is where it ends
+ *          -1 The header at cursor->header is bad
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentAreaNext(struct persistentAreaCursor* cursor) {
+
+	if (cursor->cellSize == 0)
+		return 0;
+
+	return persistentAreaLoad(cursor, cursor->header + cursor->cellSize);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Lists the cells of the area chain, one line each, followed by a line
+ *  with the end of the chain and the bytes that are left.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentDumpList(const struct persistentDumpSink* sink) {
+
+	struct persistentAreaCursor cursor;
+	struct persistentDumpText   line;
+	line.len = 0;
+
+	persistentDumpStr(&line, "Header Data     Size Check Name", 0);
+	persistentDumpFlush(sink, &line);
+
+	int16_t rv;
+	for (rv = persistentAreaFirst(&cursor); rv > 0; rv = persistentAreaNext(&cursor)) {
+		persistentDumpStr(&line, "0x", 0);
+		persistentDumpHex(&line, cursor.header, 4);
+		if (cursor.free) {
+			persistentDumpStr(&line, " free  ", 0);
+			persistentDumpDec(&line, cursor.cellSize, 6);
+		}
+		else {
+			persistentDumpStr(&line, " 0x", 0);
+			persistentDumpHex(&line, cursor.data, 4);
+			persistentDumpDec(&line, cursor.size, 6);
+			persistentDumpDec(&line, cursor.check, 6);
+			persistentDumpStr(&line, " ", 0);
+			persistentDumpStr(&line, cursor.name, 0);
+		}
+		persistentDumpFlush(sink, &line);
+	}
+
+	persistentDumpStr(&line, "0x", 0);
+	persistentDumpHex(&line, cursor.header, 4);
+	if (rv < 0)
+		persistentDumpStr(&line, " bad header", 0);
+	else {
+		persistentDumpStr(&line, " end   ", 0);
+		persistentDumpDec(&line, EPR_END_FREE - cursor.header, 6);
+		persistentDumpStr(&line, " bytes left", 0);
+	}
+	persistentDumpFlush(sink, &line);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Dumps the header of an area, decoded and as hex, including its checksum.
+ *
+ * @return   1 Success
+ *          -1 The area was not found, or its header is bad
+ *
+ *---------------------------------------------------------------------------*/
+static int16_t persistentDumpHeader(const struct persistentDumpSink* sink, char* name) {
+
+	struct persistentAreaCursor cursor;
+	struct persistentDumpText   line;
+	line.len = 0;
+
+	uint32_t addr = getPersistentHeaderAddress(name);
+	if (addr == 0 || persistentAreaLoad(&cursor, addr) <= 0 || cursor.free)
+		return -1;
+
+	persistentDumpStr(&line, "Area ", 0);
+	persistentDumpStr(&line, cursor.name, 0);
+	persistentDumpStr(&line, " header 0x", 0);
+	persistentDumpHex(&line, cursor.header, 4);
+	persistentDumpStr(&line, " data 0x", 0);
+	persistentDumpHex(&line, cursor.data, 4);
+	persistentDumpStr(&line, " size ", 0);
+	persistentDumpDec(&line, cursor.size, 0);
+	persistentDumpStr(&line, " check ", 0);
+	persistentDumpDec(&line, cursor.check, 0);
+	persistentDumpStr(&line, " hash 0x", 0);
+	persistentDumpHex(&line, cursor.hash, 2);
+	persistentDumpFlush(sink, &line);
+
+	persistentDumpBytes(sink, cursor.header, (uint16_t)(cursor.data - cursor.header), false);
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Dumps the data of the area whose data starts at addr.
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentDumpData(const struct persistentDumpSink* sink, uint32_t addr) {
+
+	struct persistentAreaCursor cursor;
+	for (int16_t rv = persistentAreaFirst(&cursor); rv > 0; rv = persistentAreaNext(&cursor)) {
+		if (!cursor.free && cursor.data == addr) {
+			persistentDumpBytes(sink, cursor.data, cursor.size, false);
+			return;
+		}
+	}
+
+	struct persistentDumpText line;
+	line.len = 0;
+	persistentDumpStr(&line, "No area at 0x", 0);
+	persistentDumpHex(&line, addr, 4);
+	persistentDumpFlush(sink, &line);
+}
+
+#if defined(ARDUINO)
+
+/**----------------------------------------------------------------------------
+ *
+ *  Lists all areas and freed cells of the area chain.
+ *
+ * @param out  Where to print the list, e.g. Serial
+ *
+ *---------------------------------------------------------------------------*/
+void listPersistentAreas(Print& out) {
+
+	struct persistentDumpSink sink = { persistentDumpPrint, &out };
+	persistentDumpList(&sink);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Dumps the header of an area.
+ *
+ * @param name  The name of the area
+ * @param out   Where to print the dump, e.g. Serial
+ *
+ * @return   1 Success
+ *          -1 The area was not found
+ *
+ *---------------------------------------------------------------------------*/
+int16_t dumpHeader(char* name, Print& out) {
+
+	struct persistentDumpSink sink = { persistentDumpPrint, &out };
+	return persistentDumpHeader(&sink, name);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Dumps the data of an area.
+ *
+ * @param addr  The data address of the area, see getPersistentAreaAddress()
+ * @param out   Where to print the dump, e.g. Serial
+ *
+ *---------------------------------------------------------------------------*/
+void dumpDataArea(uint32_t addr, Print& out) {
+
+	struct persistentDumpSink sink = { persistentDumpPrint, &out };
+	persistentDumpData(&sink, addr);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Dumps a range of persistent memory.
+ *
+ * @param addr  The persistent address of the first byte
+ * @param size  The number of bytes
+ * @param out   Where to print the dump, e.g. Serial
+ *
+ *---------------------------------------------------------------------------*/
+void persistentDump(uint32_t addr, uint16_t size, Print& out) {
+
+	struct persistentDumpSink sink = { persistentDumpPrint, &out };
+	persistentDumpBytes(&sink, addr, size, false);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Dumps a range of RAM. On a host the address must fit in 32 bits.
+ *
+ * @param addr  The RAM address of the first byte
+ * @param size  The number of bytes
+ * @param out   Where to print the dump, e.g. Serial
+ *
+ *---------------------------------------------------------------------------*/
+void persistentDumpRAM(uint32_t addr, uint16_t size, Print& out) {
+
+	struct persistentDumpSink sink = { persistentDumpPrint, &out };
+	persistentDumpBytes(&sink, addr, size, true);
+}
+
+#define PERSISTENT_DUMP_SINK  { persistentDumpPrint, &Serial }
+#else
+#define PERSISTENT_DUMP_SINK  { persistentDumpStdout, stdout }
+#endif
+
+/**----------------------------------------------------------------------------
+ *
+ *  Lists all areas and freed cells of the area chain on Serial, or stdout.
+ *
+ *---------------------------------------------------------------------------*/
+void listPersistentAreas() {
+
+	struct persistentDumpSink sink = PERSISTENT_DUMP_SINK;
+	persistentDumpList(&sink);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Dumps the header of an area on Serial, or stdout.
+ *
+ * @param name  The name of the area
+ *
+ * @return   1 Success
+ *          -1 The area was not found
+ *
+ *---------------------------------------------------------------------------*/
+int16_t dumpHeader(char* name) {
+
+	struct persistentDumpSink sink = PERSISTENT_DUMP_SINK;
+	return persistentDumpHeader(&sink, name);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Dumps the data of an area on Serial, or stdout.
+ *
+ * @param addr  The data address of the area, see getPersistentAreaAddress()
+ *
+ *---------------------------------------------------------------------------*/
+void dumpDataArea(uint32_t addr) {
+
+	struct persistentDumpSink sink = PERSISTENT_DUMP_SINK;
+	persistentDumpData(&sink, addr);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Dumps a range of persistent memory on Serial, or stdout.
+ *
+ * @param addr  The persistent address of the first byte
+ * @param size  The number of bytes
+ *
+ *---------------------------------------------------------------------------*/
+void persistentDump(uint32_t addr, uint16_t size) {
+
+	struct persistentDumpSink sink = PERSISTENT_DUMP_SINK;
+	persistentDumpBytes(&sink, addr, size, false);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Dumps a range of RAM on Serial, or stdout.
+ *  On a host the address must fit in 32 bits.
+ *
+ * @param addr  The RAM address of the first byte
+ * @param size  The number of bytes
+ *
+ *---------------------------------------------------------------------------*/
+void persistentDumpRAM(uint32_t addr, uint16_t size) {
+
+	struct persistentDumpSink sink = PERSISTENT_DUMP_SINK;
+	persistentDumpBytes(&sink, addr, size, true);
+}
@@ -0,0 +1,449 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <PersistentFormat.cpp> - Superblock and fast formatting of persistent memory.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0013 - Initial release, superblock and format
+ *  P0017 - PERSISTENT_FORMAT_START
+ *  P0019 - Format with compact area headers
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+#include <Persistence.h>
+
+//
+//  RAM copy of the superblock, read when the layout is loaded
+//
+static struct persistentSuperblock persistentSuper;
+static bool                        persistentSuperValid = false;
+
+#define PERSISTENT_SUPERBLOCK_CHECKED  14   // Bytes covered by the check field
+#define PERSISTENT_UPGRADE_CHUNK       32   // Bytes copied at a time by persistentUpgrade()
+
+/**----------------------------------------------------------------------------
+ *
+ *  Calculates the checksum of a superblock. A virgin superblock, all 0xff,
+ *  does not match its checksum.
+ *
+ * @param super  The superblock
+ *
+ *---------------------------------------------------------------------------*/
+static uint16_t persistentSuperCheck(const struct persistentSuperblock* super) {
+
+	const uint8_t* bytes = (const uint8_t*)super;
+	uint16_t check = 0x5342;
+
+	for (uint8_t i = 0; i < PERSISTENT_SUPERBLOCK_CHECKED; i++)
+		check = (uint16_t)((check << 1) | (check >> 15)) + bytes[i];
+
+	return check;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Reads the superblock and returns where the allocatable memory starts.
+ *  Called by persistentLoadLayout(), so it must not use the layout itself.
+ *
+ * @return   The start of the allocatable memory, EPR_SUPERBLOCK if the
+ *           persistent memory is not formatted.
+ *
+ *---------------------------------------------------------------------------*/
+uint32_t persistentLoadSuperblock() {
+
+	persistentRead(EPR_SUPERBLOCK, (char*)&persistentSuper, sizeof(persistentSuper));
+
+	persistentSuperValid =
+			persistentSuper.magic == PERSISTENT_SUPERBLOCK_MAGIC &&
+			persistentSuper.check == persistentSuperCheck(&persistentSuper) &&
+			persistentSuper.startFree >= EPR_SUPERBLOCK + sizeof(persistentSuper) &&
+			persistentSuper.startFree < EEPROM_SIZE;
+
+	if (!persistentSuperValid)
+		return EPR_SUPERBLOCK;
+
+	return persistentSuper.startFree;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns true if the persistent memory has been formatted with
+ *  persistentFormat(). Only the superblock is read, once.
+ *
+ *---------------------------------------------------------------------------*/
+bool persistentIsFormatted() {
+
+	persistentGetLayout();
+
+	return persistentSuperValid;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns true if the persistent memory was formatted with compact area
+ *  headers, see PERSISTENT_FEATURE_COMPACT.
+ *
+ *---------------------------------------------------------------------------*/
+bool persistentIsCompact() {
+
+	return persistentIsFormatted() && (persistentSuper.features & PERSISTENT_FEATURE_COMPACT);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Stores the area count in the superblock.
+ *
+ * @param areas  The number of allocated areas
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentStoreAreaCount(uint16_t areas) {
+
+	persistentSuper.areas      = areas;
+	persistentSuper.areasCheck = ~areas;
+
+	persistentStore(EPR_SUPERBLOCK + offsetof(struct persistentSuperblock, areas),
+			        (char*)&persistentSuper.areas, 2 * sizeof(uint16_t));
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Updates the area count of a formatted persistent memory, called when an
+ *  area is allocated or freed. A count that is not valid is left alone,
+ *  persistentAreaCount() recounts it.
+ *
+ * @param delta  1 for an allocated area, -1 for a freed area
+ *
+ *---------------------------------------------------------------------------*/
+void persistentCountArea(int8_t delta) {
+
+	if (!persistentIsFormatted() ||
+		persistentSuper.areasCheck != (uint16_t)~persistentSuper.areas)
+		return;
+
+	persistentStoreAreaCount(persistentSuper.areas + delta);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the number of allocated areas. A formatted persistent memory
+ *  keeps the count in its superblock, otherwise the area chain is walked.
+ *
+ * @return   The number of allocated areas
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentAreaCount() {
+
+	if (persistentIsFormatted() &&
+		persistentSuper.areasCheck == (uint16_t)~persistentSuper.areas)
+		return persistentSuper.areas;
+
+	//
+	//  Count the allocated cells in the chain
+	//
+	uint32_t endFree = EPR_END_FREE;
+	uint16_t areas   = 0;
+	struct persistentAreaHeader header;
+	for (uint32_t addr = EPR_START_FREE; addr < endFree; addr += header.next) {
+		persistentRead(addr, (char*)&header, PERSISTENT_CELL_LINK_SIZE);
+		if (header.next == 0xffff || header.next == 0)
+			break;
+
+		if (header.data != 0xffff)
+			areas++;
+	}
+
+	//
+	//  Repair the count of a formatted memory, it was only partly written
+	//
+	if (persistentSuperValid)
+		persistentStoreAreaCount(areas);
+
+	return areas;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Writes the superblock of a formatted store. The allocatable memory
+ *  starts at PERSISTENT_FORMAT_START.
+ *
+ * @param features  Format options, 0 or PERSISTENT_FEATURE_COMPACT
+ * @param areas     The number of allocated areas
+ *
+ * @return   1 Success
+ *          -1 Write error
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentStoreSuperblock(uint8_t features, uint16_t areas) {
+
+	struct persistentSuperblock super;
+	super.magic       = PERSISTENT_SUPERBLOCK_MAGIC;
+	super.version     = PERSISTENT_FORMAT_VERSION;
+	super.features    = features & PERSISTENT_FEATURE_COMPACT;
+	super.startFree   = PERSISTENT_FORMAT_START;
+	super.size        = EEPROM_SIZE;
+	super.journalSize = PERSISTENT_JOURNAL_SIZE;
+	super.check       = persistentSuperCheck(&super);
+	super.areas       = areas;
+	super.areasCheck  = ~areas;
+
+	if (persistentStore(EPR_SUPERBLOCK, (char*)&super, sizeof(super)) < 0)
+		return -1;
+
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Formats the persistent memory by writing a new superblock and cutting
+ *  the area chain off at its start. All areas are lost, but nothing else is
+ *  erased. The memory beyond the chain is made virgin a header at a time,
+ *  as areas are allocated at the end of the chain. The fixed size data and
+ *  the variable size data are left as they are.
+ *
+ *  If the power fails while formatting, format again.
+ *
+ *  With PERSISTENT_FEATURE_COMPACT the areas get compact headers, which
+ *  take the length of their name plus PERSISTENT_COMPACT_PREFIX_SIZE bytes.
+ *  The registry needs the full headers, it does not use such a store.
+ *
+ * @param features  Format options, 0 or PERSISTENT_FEATURE_COMPACT
+ *
+ * @return   1 Success
+ *          -1 Write error
+ *          -2 The persistent memory is too small
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentFormat(uint8_t features) {
+
+	const struct persistentLayout* layout = persistentGetLayout();
+	uint32_t startFree = PERSISTENT_FORMAT_START;
+
+	if (layout->calibrY < startFree + PERSISTENT_AREA_PREFIX_SIZE + PERSISTENT_JOURNAL_SIZE)
+		return -2;
+
+	//
+	//  First deactivate the journal, so no move is resumed into the new store.
+	//  A store that was not formatted before may have area data there.
+	//
+	uint32_t journal = layout->calibrY - PERSISTENT_JOURNAL_SIZE;
+	if (persistentClear(journal, 0xff, PERSISTENT_JOURNAL_SIZE) < 0)
+		return -1;
+
+	//
+	//  Then end the chain at its first header
+	//
+	if (persistentClear(startFree, 0xff, PERSISTENT_AREA_PREFIX_SIZE) < 0)
+		return -1;
+
+	//
+	//  And write the superblock
+	//
+	if (persistentStoreSuperblock(features, 0) < 0)
+		return -1;
+
+#if PERSISTENT_CACHE_SIZE > 0
+	persistentCacheReset();
+#endif
+
+	//
+	//  The allocatable memory has moved, this also resets the index
+	//
+	persistentLoadLayout();
+
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Formats the persistent memory with full area headers.
+ *
+ * @return   Same as persistentFormat(features)
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentFormat() {
+	return persistentFormat(0);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Upgrades a store that was not formatted to a formatted one, keeping its
+ *  areas. Such a store has no journal, so it cannot be compacted, its freed
+ *  cells are not merged and its areas are not resized. Formatting it would
+ *  lose every area.
+ *
+ *  The chain of such a store starts at EPR_SUPERBLOCK. The areas in front
+ *  of the first header at or beyond PERSISTENT_FORMAT_START are copied to
+ *  the end of the chain, the other areas stay where they are. The copies
+ *  are not linked into the chain yet, so until the upgrade is committed
+ *  the store is left as it was. The commit links them, turns the memory
+ *  from PERSISTENT_FORMAT_START up to the first area kept into a free cell
+ *  and writes the superblock. It is journaled where a formatted store keeps
+ *  its journal, so that memory must be beyond the end of the chain. If the
+ *  power fails during the commit it is completed on the next
+ *  persistentLoadLayout(), before that calling persistentUpgrade() again
+ *  starts over.
+ *
+ *  Dirty cached data is committed first. Handles of the areas that were
+ *  copied must be opened again afterwards, those areas are no longer
+ *  cached. The store keeps full area headers.
+ *
+ * @return   1 Success, also if the store was formatted already
+ *          -1 Write error
+ *          -2 The chain is broken
+ *          -3 No room, the chain runs into the memory of the journal or
+ *             the areas to copy do not fit in front of it. Freeing the last
+ *             areas of the chain makes room.
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentUpgrade() {
+
+	if (persistentIsFormatted())
+		return 1;
+
+	const struct persistentLayout* layout = persistentGetLayout();
+	uint32_t startFree = PERSISTENT_FORMAT_START;
+	uint32_t endFree   = layout->endFree;
+
+	if (layout->calibrY < startFree + PERSISTENT_AREA_PREFIX_SIZE + PERSISTENT_JOURNAL_SIZE)
+		return -3;
+
+	uint32_t journal = layout->calibrY - PERSISTENT_JOURNAL_SIZE;
+
+#if PERSISTENT_CACHE_SIZE > 0
+	if (persistentCommit() < 0)
+		return -1;
+#endif
+
+	//
+	//  Find the first header the formatted chain can keep, it is at the
+	//  start of the allocatable memory or leaves room for a free cell in
+	//  front of it. Count the bytes of the areas in front of it.
+	//
+	uint32_t keep  = 0;
+	uint32_t bytes = 0;
+	uint16_t first = 0xffff;
+	uint16_t areas = 0;
+	uint32_t addr;
+	struct persistentAreaHeader header;
+	for (addr = EPR_START_FREE; ; addr += header.next) {
+
+		if (!keep && (addr == startFree || addr >= startFree + PERSISTENT_AREA_PREFIX_SIZE))
+			keep = addr;
+
+		if (addr >= endFree)
+			break;
+
+		persistentRead(addr, (char*)&header, PERSISTENT_CELL_LINK_SIZE);
+		if (header.next == 0xffff)
+			break;
+
+		if (header.next < PERSISTENT_CELL_LINK_SIZE || addr + header.next > endFree)
+			return -2;
+
+		if (header.data == 0xffff)
+			continue;
+
+		areas++;
+		if (!keep) {
+			if (first == 0xffff)
+				first = header.next;
+			bytes += header.next;
+		}
+	}
+
+	uint32_t end = addr;
+	if (end > journal)
+		return -3;
+
+	//
+	//  A chain that ends in front of that header keeps none, the copies then
+	//  follow a free cell at the start of the allocatable memory. Without
+	//  copies the formatted chain is empty.
+	//
+	if (!keep)
+		keep = startFree + PERSISTENT_AREA_PREFIX_SIZE;
+
+	uint32_t to = (keep > end) ? keep : end;
+	if (!bytes && keep >= end) {
+		keep = startFree;
+		to   = startFree;
+	}
+
+	if (to + bytes > journal)
+		return -3;
+
+	//
+	//  Copy the areas beyond the end of the chain, all but the next field of
+	//  the first one, which links them in on commit
+	//
+	uint32_t dst = to;
+	char     chunk[PERSISTENT_UPGRADE_CHUNK];
+	for (addr = EPR_START_FREE; addr < keep && addr < end; addr += header.next) {
+
+		persistentRead(addr, (char*)&header, PERSISTENT_CELL_LINK_SIZE);
+		if (header.data == 0xffff)
+			continue;
+
+		for (uint16_t done = (dst == to) ? sizeof(header.next) : 0; done < header.next; ) {
+			uint16_t n = header.next - done;
+			if (n > sizeof(chunk))
+				n = sizeof(chunk);
+
+			persistentRead(addr + done, chunk, n);
+			if (persistentStore(dst + done, chunk, n) < 0)
+				return -1;
+			done += n;
+		}
+
+#if PERSISTENT_CACHE_SIZE > 0
+		persistentCacheDrop(addr);
+#endif
+		dst += header.next;
+	}
+
+	//
+	//  The header after the copies must be virgin
+	//
+	if (bytes && dst < journal) {
+		uint16_t clear = (dst + PERSISTENT_AREA_PREFIX_SIZE <= journal)
+				       ? PERSISTENT_AREA_PREFIX_SIZE : journal - dst;
+		if (persistentClear(dst, 0xff, clear) < 0)
+			return -1;
+	}
+
+	return persistentJournaledUpgrade(keep, to, first, areas);
+}
@@ -0,0 +1,597 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <PersistentKv.cpp> - Log structured key value stores.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0020 - Initial release, key value stores
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+#include <Persistence.h>
+
+//
+//  Layout of a key value store, which is an ordinary area split into
+//  two halves of the same size:
+//
+//          +---------------+- half address
+//          |  generation   |  16 bit generation of the half
+//          +---------------+
+//          |     check     |  generation ^ PERSISTENT_KV_MAGIC
+//          +---------------+
+//          |    record     |
+//          :               :
+//          |    record     |
+//          +---------------+- end of the log
+//          :    unused     :
+//          +---------------+- next half address
+//
+//  A record consists of:
+//
+//          key      16 bit key
+//          len       8 bit length of the value, 0 if the key was removed
+//          crc      CRC16 of the generation, key, len and value
+//          value    len bytes
+//
+//  The value of a record is written before its prefix, so an interrupted
+//  append leaves a record that does not match its CRC. The log ends at the
+//  first record that does not match. Records of an older generation, left
+//  behind in the half, never match because the generation is part of the CRC.
+//
+//  The half with the newest valid generation is the active one. Collecting
+//  copies the newest record of every key to the other half and only then
+//  writes its generation, so a reset while collecting leaves the active half
+//  as it was.
+//
+
+#define PERSISTENT_KV_MAGIC   0x4b56   // "KV"
+#define PERSISTENT_KV_CHUNK   16       // Bytes of a value copied or compared at a time
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the persistent address of a half of the store.
+ *
+ *---------------------------------------------------------------------------*/
+static uint32_t persistentKvHalf(struct persistentKvHandle* handle, uint8_t half) {
+	return handle->area.data + (uint32_t)half * handle->half;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Starts the CRC of a record with its generation, key and length.
+ *
+ *---------------------------------------------------------------------------*/
+static uint32_t persistentKvCrcStart(uint16_t generation, uint16_t key, uint8_t len) {
+
+	uint8_t bytes[5] = {
+		(uint8_t)generation, (uint8_t)(generation >> 8),
+		(uint8_t)key, (uint8_t)(key >> 8), len
+	};
+
+	return persistentCrcUpdate(persistentCrcInit(PERSISTENT_CHECK_CRC16),
+			                   (char*)bytes, sizeof(bytes), PERSISTENT_CHECK_CRC16);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the position of a key in the index, -1 if it is not there.
+ *
+ *---------------------------------------------------------------------------*/
+static int16_t persistentKvFind(struct persistentKvHandle* handle, uint16_t key) {
+
+	for (uint8_t i = 0; i < handle->keys; i++)
+		if (handle->index[i].key == key)
+			return i;
+
+	return -1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Makes a record the newest one of its key in the index. A record with
+ *  a value length of 0 removes the key.
+ *
+ * @param handle  The handle of the store
+ * @param key     The key of the record
+ * @param offset  The offset of the record in the active half
+ * @param len     The length of its value
+ *
+ * @return   1 Success
+ *          -3 The index is full
+ *
+ *---------------------------------------------------------------------------*/
+static int16_t persistentKvIndex(struct persistentKvHandle* handle, uint16_t key,
+		                         uint16_t offset, uint8_t len) {
+
+	int16_t i = persistentKvFind(handle, key);
+	if (i >= 0)
+		handle->live -= PERSISTENT_KV_RECORD_PREFIX + handle->index[i].len;
+
+	if (len == 0) {
+		if (i >= 0)
+			handle->index[i] = handle->index[--handle->keys];
+		return 1;
+	}
+
+	if (i < 0) {
+		if (handle->keys == PERSISTENT_KV_KEYS)
+			return -3;
+		i = handle->keys++;
+	}
+
+	handle->index[i].key    = key;
+	handle->index[i].offset = offset;
+	handle->index[i].len    = len;
+	handle->live += PERSISTENT_KV_RECORD_PREFIX + len;
+
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Reads the generation of a half.
+ *
+ * @return  True if the half has a valid generation
+ *
+ *---------------------------------------------------------------------------*/
+static bool persistentKvGeneration(struct persistentKvHandle* handle, uint8_t half,
+		                           uint16_t* generation) {
+
+	uint16_t segment[2];
+	persistentRead(persistentKvHalf(handle, half), (char*)segment, sizeof(segment));
+
+	*generation = segment[0];
+	return (uint16_t)(segment[0] ^ PERSISTENT_KV_MAGIC) == segment[1];
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Writes the generation of a half, which makes it the active half.
+ *
+ *---------------------------------------------------------------------------*/
+static int32_t persistentKvStoreGeneration(struct persistentKvHandle* handle, uint8_t half,
+		                                   uint16_t generation) {
+
+	uint16_t segment[2] = { generation, (uint16_t)(generation ^ PERSISTENT_KV_MAGIC) };
+	return persistentStore(persistentKvHalf(handle, half), (char*)segment, sizeof(segment));
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Reads the record at an offset in the active half and checks it.
+ *
+ * @param handle  The handle of the store
+ * @param offset  The offset of the record
+ * @param key     Returns the key of the record
+ * @param len     Returns the length of its value
+ *
+ * @return  True if there is a valid record at the offset
+ *
+ *---------------------------------------------------------------------------*/
+static bool persistentKvRecord(struct persistentKvHandle* handle, uint16_t offset,
+		                       uint16_t* key, uint8_t* len) {
+
+	if ((uint32_t)offset + PERSISTENT_KV_RECORD_PREFIX > handle->half)
+		return false;
+
+	uint32_t addr = persistentKvHalf(handle, handle->active) + offset;
+	uint8_t  prefix[PERSISTENT_KV_RECORD_PREFIX];
+	persistentRead(addr, (char*)prefix, sizeof(prefix));
+
+	*key = (uint16_t)prefix[0] | ((uint16_t)prefix[1] << 8);
+	*len = prefix[2];
+	if (*key == PERSISTENT_KV_NO_KEY ||
+		(uint32_t)offset + PERSISTENT_KV_RECORD_PREFIX + *len > handle->half)
+		return false;
+
+	uint32_t crc = persistentKvCrcStart(handle->generation, *key, *len);
+	char     chunk[PERSISTENT_KV_CHUNK];
+	for (uint8_t done = 0; done < *len; ) {
+		uint8_t n = (*len - done < PERSISTENT_KV_CHUNK) ? *len - done : PERSISTENT_KV_CHUNK;
+		persistentRead(addr + PERSISTENT_KV_RECORD_PREFIX + done, chunk, n);
+		crc = persistentCrcUpdate(crc, chunk, n, PERSISTENT_CHECK_CRC16);
+		done += n;
+	}
+
+	crc = persistentCrcFinal(crc, PERSISTENT_CHECK_CRC16);
+	return (uint16_t)crc == ((uint16_t)prefix[3] | ((uint16_t)prefix[4] << 8));
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Finds the active half and builds the index by reading its log.
+ *
+ * @param handle  The handle of the store
+ *
+ * @return   1 Success
+ *          -2 Neither half has a valid generation
+ *          -3 The store holds more keys than PERSISTENT_KV_KEYS
+ *
+ *---------------------------------------------------------------------------*/
+static int16_t persistentKvLoad(struct persistentKvHandle* handle) {
+
+	uint16_t generation[2];
+	bool     valid[2];
+	for (uint8_t half = 0; half < 2; half++)
+		valid[half] = persistentKvGeneration(handle, half, &generation[half]);
+
+	if (!valid[0] && !valid[1])
+		return -2;
+
+	handle->active = (!valid[0] ||
+			          (valid[1] && (int16_t)(generation[1] - generation[0]) > 0)) ? 1 : 0;
+	handle->generation = generation[handle->active];
+	handle->keys       = 0;
+	handle->live       = 0;
+
+	uint16_t offset = PERSISTENT_KV_SEGMENT_PREFIX;
+	uint16_t key;
+	uint8_t  len;
+	while (persistentKvRecord(handle, offset, &key, &len)) {
+		if (persistentKvIndex(handle, key, offset, len) < 0)
+			return -3;
+		offset += PERSISTENT_KV_RECORD_PREFIX + len;
+	}
+
+	handle->end = offset;
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Copies the newest record of every key to the other half, which then
+ *  becomes the active half with the next generation.
+ *
+ * @param handle  The handle of the store
+ *
+ * @return   1 Success
+ *          -1 Write error
+ *
+ *---------------------------------------------------------------------------*/
+static int16_t persistentKvMove(struct persistentKvHandle* handle) {
+
+	uint8_t  target     = handle->active ^ 1;
+	uint16_t generation = handle->generation + 1;
+	uint32_t src        = persistentKvHalf(handle, handle->active);
+	uint32_t dst        = persistentKvHalf(handle, target);
+	uint16_t offset     = PERSISTENT_KV_SEGMENT_PREFIX;
+
+	char chunk[PERSISTENT_KV_CHUNK];
+	for (uint8_t i = 0; i < handle->keys; i++) {
+
+		struct persistentKvEntry* entry = &handle->index[i];
+		uint32_t crc = persistentKvCrcStart(generation, entry->key, entry->len);
+
+		for (uint8_t done = 0; done < entry->len; ) {
+			uint8_t n = (entry->len - done < PERSISTENT_KV_CHUNK) ? entry->len - done : PERSISTENT_KV_CHUNK;
+			persistentRead(src + entry->offset + PERSISTENT_KV_RECORD_PREFIX + done, chunk, n);
+			crc = persistentCrcUpdate(crc, chunk, n, PERSISTENT_CHECK_CRC16);
+			if (persistentStore(dst + offset + PERSISTENT_KV_RECORD_PREFIX + done, chunk, n) < 0)
+				return -1;
+			done += n;
+		}
+
+		crc = persistentCrcFinal(crc, PERSISTENT_CHECK_CRC16);
+		uint8_t prefix[PERSISTENT_KV_RECORD_PREFIX] = {
+			(uint8_t)entry->key, (uint8_t)(entry->key >> 8), entry->len,
+			(uint8_t)crc, (uint8_t)(crc >> 8)
+		};
+		if (persistentStore(dst + offset, (char*)prefix, sizeof(prefix)) < 0)
+			return -1;
+
+		offset += PERSISTENT_KV_RECORD_PREFIX + entry->len;
+	}
+
+	if (persistentKvStoreGeneration(handle, target, generation) < 0)
+		return -1;
+
+	//
+	//  Only now the index moves along, in the order the records were copied
+	//
+	offset = PERSISTENT_KV_SEGMENT_PREFIX;
+	for (uint8_t i = 0; i < handle->keys; i++) {
+		handle->index[i].offset = offset;
+		offset += PERSISTENT_KV_RECORD_PREFIX + handle->index[i].len;
+	}
+
+	handle->active     = target;
+	handle->generation = generation;
+	handle->end        = offset;
+
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Appends a record to the log, collecting first if it does not fit.
+ *
+ * @param handle  The handle of the store
+ * @param key     The key
+ * @param value   The value
+ * @param len     The length of the value, 0 to remove the key
+ *
+ * @return   1 Success
+ *          -1 Write error
+ *          -2 The store is full
+ *
+ *---------------------------------------------------------------------------*/
+static int16_t persistentKvAppend(struct persistentKvHandle* handle, uint16_t key,
+		                          const char* value, uint8_t len) {
+
+	uint16_t size = PERSISTENT_KV_RECORD_PREFIX + len;
+	if ((uint32_t)handle->end + size > handle->half) {
+		if ((uint32_t)PERSISTENT_KV_SEGMENT_PREFIX + handle->live + size > handle->half)
+			return -2;
+
+		if (persistentKvMove(handle) < 0)
+			return -1;
+	}
+
+	uint32_t addr = persistentKvHalf(handle, handle->active) + handle->end;
+	uint32_t crc  = persistentKvCrcStart(handle->generation, key, len);
+	crc = persistentCrcFinal(persistentCrcUpdate(crc, value, len, PERSISTENT_CHECK_CRC16),
+			                 PERSISTENT_CHECK_CRC16);
+
+	//
+	//  The value first, the prefix makes the record valid
+	//
+	if (len && persistentStore(addr + PERSISTENT_KV_RECORD_PREFIX, (char*)value, len) < 0)
+		return -1;
+
+	uint8_t prefix[PERSISTENT_KV_RECORD_PREFIX] = {
+		(uint8_t)key, (uint8_t)(key >> 8), len, (uint8_t)crc, (uint8_t)(crc >> 8)
+	};
+	if (persistentStore(addr, (char*)prefix, sizeof(prefix)) < 0)
+		return -1;
+
+	persistentKvIndex(handle, key, handle->end, len);
+	handle->end += size;
+
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Allocates a new key value store and opens a handle on it.
+ *  Each half holds a log of size / 2 bytes, the live records must fit in one.
+ *
+ * @param name    Name of the area
+ * @param size    Size in bytes of the store
+ * @param handle  The handle to open on the new store
+ *
+ * @return      Same as newPersistentArea(name, dataSize), 0 is also returned
+ *              if the size is too small or the store could not be written
+ *
+ *---------------------------------------------------------------------------*/
+uint32_t newPersistentKvStore(char* name, uint16_t size, struct persistentKvHandle* handle) {
+
+	if (size / 2 < PERSISTENT_KV_SEGMENT_PREFIX + PERSISTENT_KV_RECORD_PREFIX + 1)
+		return 0;
+
+	//
+	//  The records are appended one at a time, each has its own CRC
+	//
+	uint32_t addr = newPersistentArea(name, size, &handle->area, PERSISTENT_CHECK_NONE);
+	if (addr == 0 || addr == (uint32_t)-1)
+		return addr;
+
+	handle->half       = size / 2;
+	handle->active     = 0;
+	handle->generation = 0;
+	handle->end        = PERSISTENT_KV_SEGMENT_PREFIX;
+	handle->live       = 0;
+	handle->keys       = 0;
+
+	//
+	//  Reused memory may hold old records, make the store virgin
+	//
+	if (persistentClear(addr, 0xff, size) < 0 ||
+		persistentKvStoreGeneration(handle, 0, 0) < 0) {
+		handle->area.header = 0;
+		return 0;
+	}
+
+	return addr;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Opens a handle on an existing key value store and builds its index.
+ *
+ * @param name    Name of the area
+ * @param handle  The handle to open
+ *
+ * @return   1 Success
+ *          -1 The area with the specified name was not found
+ *          -2 The area is not a key value store
+ *          -3 The store holds more keys than PERSISTENT_KV_KEYS
+ *
+ *---------------------------------------------------------------------------*/
+int16_t openPersistentKvStore(char* name, struct persistentKvHandle* handle) {
+
+	if (openPersistentArea(name, &handle->area) < 0)
+		return -1;
+
+	handle->half = handle->area.size / 2;
+
+	int16_t rv = -2;
+	if (handle->half >= PERSISTENT_KV_SEGMENT_PREFIX + PERSISTENT_KV_RECORD_PREFIX + 1)
+		rv = persistentKvLoad(handle);
+
+	if (rv < 0)
+		handle->area.header = 0;
+
+	return rv;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Reads the value of a key. No persistent memory is read other than
+ *  the value itself.
+ *
+ * @param handle  The handle of the store
+ * @param key     The key
+ * @param value   The buffer to read the value into
+ * @param size    The size of the buffer
+ *
+ * @return  > 0 The length of the value
+ *            0 The key is not in the store
+ *           -1 The handle is not open
+ *           -2 The buffer is smaller than the value
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentKvGet(struct persistentKvHandle* handle, uint16_t key, char* value, uint8_t size) {
+
+	if (handle->area.header == 0)
+		return -1;
+
+	int16_t i = persistentKvFind(handle, key);
+	if (i < 0)
+		return 0;
+
+	struct persistentKvEntry* entry = &handle->index[i];
+	if (size < entry->len)
+		return -2;
+
+	persistentRead(persistentKvHalf(handle, handle->active) + entry->offset +
+			       PERSISTENT_KV_RECORD_PREFIX, value, entry->len);
+	return entry->len;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Stores the value of a key by appending a record to the log. If the value
+ *  equals the stored value nothing is written at all. When the active half
+ *  is full, the live records are collected into the other half first.
+ *
+ * @param handle  The handle of the store
+ * @param key     The key, any value but PERSISTENT_KV_NO_KEY
+ * @param value   The value
+ * @param len     The length of the value, 1 - 255
+ *
+ * @return  > 0 The length of the value stored
+ *            0 Nothing is written, the handle is not open or the key or
+ *              length is invalid
+ *           -1 Write error
+ *           -2 The store is full, the live records and the new one do not
+ *              fit in a half
+ *           -3 The store already holds PERSISTENT_KV_KEYS keys
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentKvPut(struct persistentKvHandle* handle, uint16_t key,
+		                const char* value, uint8_t len) {
+
+	if (handle->area.header == 0 || key == PERSISTENT_KV_NO_KEY || len == 0)
+		return 0;
+
+	int16_t i = persistentKvFind(handle, key);
+	if (i < 0 && handle->keys == PERSISTENT_KV_KEYS)
+		return -3;
+
+	//
+	//  Compare with the stored value, a chunk at a time
+	//
+	if (i >= 0 && handle->index[i].len == len) {
+		uint32_t addr = persistentKvHalf(handle, handle->active) + handle->index[i].offset +
+				        PERSISTENT_KV_RECORD_PREFIX;
+		char    chunk[PERSISTENT_KV_CHUNK];
+		uint8_t done = 0;
+		while (done < len) {
+			uint8_t n = (len - done < PERSISTENT_KV_CHUNK) ? len - done : PERSISTENT_KV_CHUNK;
+			persistentRead(addr + done, chunk, n);
+			if (memcmp(chunk, value + done, n))
+				break;
+			done += n;
+		}
+		if (done == len)
+			return len;
+	}
+
+	int16_t rv = persistentKvAppend(handle, key, value, len);
+	return rv < 0 ? rv : len;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Removes a key from the store by appending a record without a value.
+ *
+ * @param handle  The handle of the store
+ * @param key     The key
+ *
+ * @return   1 The key was removed
+ *           0 The key is not in the store
+ *          -1 Write error, or the handle is not open
+ *          -2 The store is full
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentKvRemove(struct persistentKvHandle* handle, uint16_t key) {
+
+	if (handle->area.header == 0)
+		return -1;
+
+	if (persistentKvFind(handle, key) < 0)
+		return 0;
+
+	return persistentKvAppend(handle, key, 0, 0);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Collects the live records into the other half ahead of time, once the
+ *  active half is PERSISTENT_KV_COLLECT_LEVEL percent in use. Call it when
+ *  the application is idle, so persistentKvPut() seldom has to do it.
+ *
+ * @param handle  The handle of the store
+ *
+ * @return   1 The live records were collected
+ *           0 Nothing to do yet
+ *          -1 Write error, or the handle is not open
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentKvCollect(struct persistentKvHandle* handle) {
+
+	if (handle->area.header == 0)
+		return -1;
+
+	uint16_t used = handle->end - PERSISTENT_KV_SEGMENT_PREFIX;
+	if ((uint32_t)used * 100 < (uint32_t)(handle->half - PERSISTENT_KV_SEGMENT_PREFIX) *
+			                   PERSISTENT_KV_COLLECT_LEVEL ||
+		used == handle->live)
+		return 0;
+
+	return persistentKvMove(handle);
+}
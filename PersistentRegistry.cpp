@@ -0,0 +1,186 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <PersistentRegistry.cpp> - Compile time registry of persistent areas.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0017 - Initial release, compile time area registry
+ *  P0018 - Name hash in the expected header
+ *  P0019 - Not used with compact headers
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+#include <PersistentRegistry.h>
+
+//
+//  True once the registered areas match the persistent memory
+//
+static bool persistentRegistryValid = false;
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns true if persistentRegistryBegin() succeeded.
+ *
+ *---------------------------------------------------------------------------*/
+bool persistentRegistryReady() {
+	return persistentRegistryValid;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Tells if a header is one whose creation was cut by a power loss. The
+ *  header is written from its first byte on, so it holds the first bytes
+ *  of the expected header followed by virgin bytes.
+ *
+ * @param header  The header in persistent memory
+ * @param expect  The header as newPersistentHeader() writes it
+ *
+ *---------------------------------------------------------------------------*/
+static bool persistentRegistryTorn(const struct persistentAreaHeader* header,
+		                           const struct persistentAreaHeader* expect) {
+
+	const uint8_t* stored = (const uint8_t*)header;
+	const uint8_t* wanted = (const uint8_t*)expect;
+
+	uint8_t n = 0;
+	while (n < PERSISTENT_AREA_PREFIX_SIZE && stored[n] == wanted[n])
+		n++;
+	while (n < PERSISTENT_AREA_PREFIX_SIZE && stored[n] == 0xff)
+		n++;
+
+	return n == PERSISTENT_AREA_PREFIX_SIZE;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Checks the registered areas against the headers in persistent memory,
+ *  in a single pass over their headers. Areas at the end of the table that
+ *  are not in persistent memory yet are created, provided the area chain
+ *  ends there. So new areas must be added at the end of the table, before
+ *  any area is allocated dynamically.
+ *  An area whose creation was cut by a power loss is completed.
+ *
+ * @param table  The table of registered areas
+ * @param count  The number of areas, see PERSISTENT_REGISTRY_COUNT()
+ *
+ * @return   1 All areas matched
+ *           2 All areas matched, some were created
+ *          -1 The persistent memory is not formatted, see persistentFormat(),
+ *             or it is formatted with compact headers
+ *          -2 An area does not match its header, or another area is in its place
+ *          -3 An area could not be created, no memory left or write error
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentRegistryBegin(const struct persistentRegistryEntry* table, uint8_t count) {
+
+	persistentRegistryValid = false;
+
+	if (!persistentIsFormatted() || persistentIsCompact() ||
+		EPR_START_FREE != PERSISTENT_FORMAT_START)
+		return -1;
+
+	uint32_t endFree = EPR_END_FREE;
+	uint32_t addr    = PERSISTENT_FORMAT_START;
+	bool     created = false;
+
+	for (uint8_t i = 0; i < count; i++) {
+
+		const struct persistentRegistryEntry* entry = &table[i];
+		uint16_t cell = PERSISTENT_AREA_PREFIX_SIZE + entry->check + entry->size;
+
+		//
+		//  The header as newPersistentHeader() writes it
+		//
+		struct persistentAreaHeader expect;
+		expect.next = cell;
+		memset(expect.name, 0, PERSISTENT_AREA_NAME_SIZE);
+		for (uint8_t n = 0; n < PERSISTENT_AREA_NAME_SIZE && entry->name[n]; n++)
+			expect.name[n] = entry->name[n];
+		if (entry->version)
+			expect.name[PERSISTENT_AREA_NAME_SIZE - 1] = (char)entry->version;
+
+		struct persistentAreaHeader header;
+		persistentRead(addr, (char*)&header, PERSISTENT_AREA_PREFIX_SIZE);
+
+		//
+		//  A header written before the name hash existed has none
+		//
+		expect.data = PERSISTENT_AREA_PREFIX_SIZE + entry->check;
+		if (PERSISTENT_DATA_HASH(header.data))
+			expect.data |= (uint16_t)persistentHeaderHash(expect.name) << 8;
+
+		if (header.next == 0xffff) {
+
+			//
+			//  The chain ends here, create the area
+			//
+			if (addr + cell > endFree ||
+				newPersistentHeader((char*)entry->name, addr + PERSISTENT_AREA_PREFIX_SIZE,
+						            entry->size, entry->check, entry->version) != (int16_t)entry->size)
+				return -3;
+
+			persistentCountArea(1);
+			created = true;
+		}
+		else if (memcmp(&header, &expect, PERSISTENT_AREA_PREFIX_SIZE) != 0) {
+
+			//
+			//  Creating the area was cut, its checksum and the header after
+			//  it were cleared before, so only the header is completed
+			//
+			if (!persistentRegistryTorn(&header, &expect))
+				return -2;
+
+			if (persistentStore(addr, (char*)&expect, PERSISTENT_AREA_PREFIX_SIZE) < 0)
+				return -3;
+
+			persistentCountArea(1);
+			created = true;
+		}
+
+		addr += cell;
+	}
+
+	//
+	//  The index and free list do not know the created areas yet
+	//
+	if (created)
+		persistentIndexReset();
+
+	persistentRegistryValid = true;
+	return created ? 2 : 1;
+}
@@ -0,0 +1,179 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <PersistentRegistry.h> - Compile time registry of persistent areas.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0017 - Initial release, compile time area registry
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+#ifndef PERSISTENTREGISTRY_h
+#define PERSISTENTREGISTRY_h
+
+#include <Persistence.h>
+
+//
+//  Areas that are known at build time are declared in a table, e.g.
+//
+//    constexpr struct persistentRegistryEntry areas[] = {
+//        PERSISTENT_REGISTER        ("settings", struct settings),
+//        PERSISTENT_REGISTER_CHECKED("calib",    struct calib, PERSISTENT_CHECK_CRC16, 2),
+//    };
+//    enum { SETTINGS, CALIB };
+//
+//  The areas are laid out in table order from PERSISTENT_FORMAT_START, the
+//  start of the allocatable memory of a formatted store. They are ordinary
+//  areas at the start of the area chain, so all area functions work on them
+//  and dynamically allocated areas follow them. Their addresses are known
+//  at compile time, see persistentRegistryHeader() and PersistentFixedArea.
+//
+//  persistentRegistryBegin() checks the headers in persistent memory against
+//  the table, and creates the areas that were added at the end of the table.
+//  Registered areas must never be freed.
+//
+struct persistentRegistryEntry {
+	const char* name;      // Name of the area
+	uint16_t    size;      // Size of its data
+	uint8_t     check;     // Checksum, see PERSISTENT_CHECK_CRC16
+	uint8_t     version;   // Version of the data, 0 if none
+};
+
+//
+//  Fails to compile in a constant expression, called for an invalid entry
+//
+extern const char* persistentRegistryNameTooLong();
+
+constexpr uint16_t persistentRegistryNameLength(const char* name, uint16_t n = 0) {
+	return name[n] ? persistentRegistryNameLength(name, n + 1) : n;
+}
+
+//
+//  Returns the name if it fits in the header, next to the version if any.
+//  A version of 255 would read as virgin memory, so it is refused as well.
+//
+constexpr const char* persistentRegistryName(const char* name, uint8_t version) {
+	return persistentRegistryNameLength(name) <=
+		   (version ? PERSISTENT_AREA_NAME_SIZE - 2 : PERSISTENT_AREA_NAME_SIZE) && version != 0xff
+		   ? name : persistentRegistryNameTooLong();
+}
+
+#define PERSISTENT_REGISTER(name, type)                                       \
+		{ persistentRegistryName(name, 0), sizeof(type), PERSISTENT_AREA_CHECK, 0 }
+#define PERSISTENT_REGISTER_CHECKED(name, type, check, version)               \
+		{ persistentRegistryName(name, version), sizeof(type), check, version }
+
+#define PERSISTENT_REGISTRY_COUNT(table)  ((uint8_t)(sizeof(table) / sizeof((table)[0])))
+
+//
+//  Size of the cell of a registered area, including its header and checksum
+//
+constexpr uint32_t persistentRegistryCell(const struct persistentRegistryEntry* table, uint8_t index) {
+	return PERSISTENT_AREA_PREFIX_SIZE + table[index].check + table[index].size;
+}
+
+//
+//  Header address of a registered area
+//
+constexpr uint32_t persistentRegistryHeader(const struct persistentRegistryEntry* table, uint8_t index) {
+	return index == 0 ? PERSISTENT_FORMAT_START
+			          : persistentRegistryHeader(table, index - 1) + persistentRegistryCell(table, index - 1);
+}
+
+//
+//  Data address of a registered area
+//
+constexpr uint32_t persistentRegistryData(const struct persistentRegistryEntry* table, uint8_t index) {
+	return persistentRegistryHeader(table, index) + PERSISTENT_AREA_PREFIX_SIZE + table[index].check;
+}
+
+extern int16_t persistentRegistryBegin(const struct persistentRegistryEntry* table, uint8_t count);
+extern bool    persistentRegistryReady();
+
+//
+//  A registered area of type T at a constant address, e.g.
+//
+//    typedef PERSISTENT_FIXED_AREA(struct settings, areas, SETTINGS) Settings;
+//    Settings::load(s);
+//
+//  All accesses go through a handle made of constants, so no name is looked
+//  up and checksums and the write-back cache work as for any other area.
+//  Nothing is accessed until persistentRegistryBegin() succeeded.
+//
+#define PERSISTENT_FIXED_AREA(type, table, index)                             \
+		PersistentFixedArea<type, persistentRegistryHeader(table, index),     \
+		                    (table)[index].check, (table)[index].size>
+
+template <typename T, uint32_t Header, uint8_t Check, uint16_t Size>
+class PersistentFixedArea {
+
+	static_assert(sizeof(T) == Size, "T differs in size from the registered area");
+
+public:
+	static int16_t load(T& value) {
+		struct persistentAreaHandle area = handle();
+		return persistentRegistryReady() ? persistentReadArea(&area, sizeof(T), (char*)&value) : -1;
+	}
+
+	static int16_t store(const T& value) {
+		struct persistentAreaHandle area = handle();
+		return persistentRegistryReady() ? persistentWriteArea(&area, sizeof(T), (char*)&value) : 0;
+	}
+
+	//
+	//  Reads or writes a range of the data, see persistentReadAreaRange()
+	//
+	static int16_t read(uint16_t offset, uint16_t len, char* data) {
+		struct persistentAreaHandle area = handle();
+		return persistentRegistryReady() ? persistentReadAreaRange(&area, offset, len, data) : -1;
+	}
+
+	static int16_t write(uint16_t offset, uint16_t len, const char* data) {
+		struct persistentAreaHandle area = handle();
+		return persistentRegistryReady() ? persistentWriteAreaRange(&area, offset, len, (char*)data) : 0;
+	}
+
+	static struct persistentAreaHandle handle() {
+		struct persistentAreaHandle area;
+		area.header = Header;
+		area.data   = Header + PERSISTENT_AREA_PREFIX_SIZE + Check;
+		area.size   = Size;
+		return area;
+	}
+};
+
+#endif
@@ -0,0 +1,397 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <PersistentRing.cpp> - Ring buffer persistent areas.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0021 - Initial release, ring buffer areas
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+#include <Persistence.h>
+
+//
+//  Layout of a ring buffer area, which is an ordinary area holding
+//  "slots" consecutive slots:
+//
+//          +---------------+- slot address
+//          |   sequence    |  16 bit sequence number of the record
+//          +---------------+
+//          |     check     |  Check byte of the sequence number and record
+//          +---------------+
+//          |               |
+//          |    record     |  recordSize bytes
+//          |               |
+//          +---------------+- next slot address
+//
+//  Records are appended to the slots in turn, each with the next sequence
+//  number, so every slot is programmed equally often. The slot with the
+//  highest sequence number holds the newest record. The check byte tells a
+//  live record from a discarded one (inverted check) and from a slot that
+//  was interrupted by a power loss (no match at all).
+//
+//  Sequence number 0xffff is never used, it marks a virgin slot. A slot
+//  whose prefix is still erased is then never taken for a record, whatever
+//  the check byte of its record bytes would be.
+//
+//  The record is written before the sequence number. Since the check byte
+//  covers the record as well, an append that is interrupted while it
+//  overwrites the oldest record leaves that record behind as invalid,
+//  instead of half overwritten but still live.
+//
+
+#define PERSISTENT_RING_LIVE       1
+#define PERSISTENT_RING_DISCARDED  2
+
+#define PERSISTENT_RING_VIRGIN     0xffff   // Sequence number of a virgin slot
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the check byte of a slot, a CRC-16 over the sequence number and
+ *  the record folded into 8 bits. The record is read from the slot at addr
+ *  when no record buffer is passed.
+ *
+ *---------------------------------------------------------------------------*/
+static uint8_t persistentRingCheck(uint32_t addr, uint16_t sequence, uint16_t recordSize, char* record) {
+
+	char     chunk[16] = { (char)sequence, (char)(sequence >> 8) };
+	uint32_t crc       = persistentCrcUpdate(persistentCrcInit(PERSISTENT_CHECK_CRC16),
+			                                 chunk, 2, PERSISTENT_CHECK_CRC16);
+
+	if (record)
+		crc = persistentCrcUpdate(crc, record, recordSize, PERSISTENT_CHECK_CRC16);
+	else {
+		for (uint16_t done = 0; done < recordSize; ) {
+			uint16_t n = (recordSize - done < (uint16_t)sizeof(chunk)) ? recordSize - done : sizeof(chunk);
+			persistentRead(addr + PERSISTENT_RING_SLOT_PREFIX + done, chunk, n);
+			crc   = persistentCrcUpdate(crc, chunk, n, PERSISTENT_CHECK_CRC16);
+			done += n;
+		}
+	}
+
+	crc = persistentCrcFinal(crc, PERSISTENT_CHECK_CRC16);
+	return (uint8_t)(crc ^ (crc >> 8));
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the persistent address of a slot.
+ *
+ *---------------------------------------------------------------------------*/
+static uint32_t persistentRingSlot(struct persistentRingHandle* handle, uint16_t slot) {
+	return handle->area.data +
+		   (uint32_t)slot * (PERSISTENT_RING_SLOT_PREFIX + handle->recordSize);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the slot holding the record with the specified age,
+ *  0 being the oldest record.
+ *
+ *---------------------------------------------------------------------------*/
+static uint16_t persistentRingAge(struct persistentRingHandle* handle, uint16_t index) {
+	return ((uint32_t)handle->newest + handle->slots - handle->count + 1 + index) % handle->slots;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Finds the newest record and counts the live records by reading the slot
+ *  prefixes. The live records always form a run of slots ending at the
+ *  newest one, so counting them is enough.
+ *
+ * @param handle  The handle of the ring buffer area
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentRingScan(struct persistentRingHandle* handle) {
+
+	bool     found = false;
+	uint16_t first = 0;
+
+	handle->newest   = handle->slots - 1;
+	handle->sequence = PERSISTENT_RING_VIRGIN;
+	handle->count    = 0;
+
+	for (uint16_t slot = 0; slot < handle->slots; slot++) {
+		uint32_t addr = persistentRingSlot(handle, slot);
+		uint8_t  prefix[PERSISTENT_RING_SLOT_PREFIX];
+		persistentRead(addr, (char*)prefix, sizeof(prefix));
+
+		uint16_t sequence = (uint16_t)prefix[0] | ((uint16_t)prefix[1] << 8);
+		if (sequence == PERSISTENT_RING_VIRGIN)
+			continue;
+
+		uint8_t  check    = persistentRingCheck(addr, sequence, handle->recordSize, NULL);
+		uint8_t  state    = prefix[2] == check                   ? PERSISTENT_RING_LIVE      :
+				            prefix[2] == (uint8_t)(check ^ 0xff) ? PERSISTENT_RING_DISCARDED : 0;
+		if (state == 0)
+			continue;
+
+		if (state == PERSISTENT_RING_LIVE)
+			handle->count++;
+
+		//
+		//  All sequence numbers lie within "slots" of each other, which
+		//  makes the comparison safe when the sequence number wraps.
+		//
+		if (!found ||
+			(int16_t)(sequence - first) > (int16_t)(handle->sequence - first)) {
+			if (!found)
+				first = sequence;
+			found            = true;
+			handle->newest   = slot;
+			handle->sequence = sequence;
+		}
+	}
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Allocates a new ring buffer area and opens a handle on it.
+ *  It takes slots * (recordSize + PERSISTENT_RING_SLOT_PREFIX) bytes of data.
+ *
+ * @param name        Name of the area
+ * @param recordSize  Size in bytes of a record
+ * @param slots       Number of records the ring holds
+ * @param handle      The handle to open on the new area
+ *
+ * @return      Same as newPersistentArea(name, dataSize)
+ *
+ *---------------------------------------------------------------------------*/
+uint32_t newPersistentRingArea(char* name, uint16_t recordSize, uint16_t slots,
+		                       struct persistentRingHandle* handle) {
+
+	uint32_t size = (uint32_t)slots * (PERSISTENT_RING_SLOT_PREFIX + recordSize);
+	if (slots == 0 || slots > 0x7fff || recordSize == 0 || size > 0xffff)
+		return 0;
+
+	//
+	//  Records are appended one at a time, so a checksum of the whole area
+	//  would not hold. Each slot has its own check byte instead.
+	//
+	uint32_t addr = newPersistentArea(name, (uint16_t)size, &handle->area, PERSISTENT_CHECK_NONE);
+	if (addr == 0 || addr == (uint32_t)-1)
+		return addr;
+
+	handle->recordSize = recordSize;
+	handle->slots      = slots;
+
+	//
+	//  Reused memory may hold old slots, make their prefixes virgin
+	//
+	for (uint16_t slot = 0; slot < slots; slot++)
+		persistentClear(persistentRingSlot(handle, slot), 0xff, PERSISTENT_RING_SLOT_PREFIX);
+
+	persistentRingScan(handle);
+	return addr;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Opens a handle on an existing ring buffer area. The newest record is
+ *  found by reading the sequence numbers of all slots.
+ *
+ * @param name        Name of the area
+ * @param recordSize  Size in bytes of a record
+ * @param handle      The handle to open
+ *
+ * @return   1 Success
+ *          -1 The area with the specified name was not found
+ *          -2 The area size does not match a whole number of slots of recordSize
+ *
+ *---------------------------------------------------------------------------*/
+int16_t openPersistentRingArea(char* name, uint16_t recordSize,
+		                       struct persistentRingHandle* handle) {
+
+	if (openPersistentArea(name, &handle->area) < 0)
+		return -1;
+
+	uint16_t slotSize = PERSISTENT_RING_SLOT_PREFIX + recordSize;
+	uint16_t slots    = handle->area.size / slotSize;
+	if (recordSize == 0 || slots == 0 || slots > 0x7fff ||
+		(uint32_t)slots * slotSize != handle->area.size) {
+		handle->area.header = 0;
+		return -2;
+	}
+
+	handle->recordSize = recordSize;
+	handle->slots      = slots;
+	persistentRingScan(handle);
+
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Appends a record to a ring buffer area. When the ring is full the oldest
+ *  record is overwritten.
+ *
+ * @param handle      The handle of the area
+ * @param recordSize  The size of the record
+ * @param record      The address of the record
+ *
+ * @return  > 0 The amount of bytes that were successfully written.
+ *            0 Nothing is written, because it was the wrong data area.
+ *          < 0 Write error
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentRingAppend(struct persistentRingHandle* handle, uint16_t recordSize, char* record) {
+
+	if (handle->area.header == 0 || recordSize != handle->recordSize)
+		return 0;
+
+	uint16_t slot     = (handle->newest + 1) % handle->slots;
+	uint16_t sequence = handle->sequence + 1;
+	uint32_t addr     = persistentRingSlot(handle, slot);
+
+	if (sequence == PERSISTENT_RING_VIRGIN)
+		sequence = 0;
+
+	//
+	//  A full ring overwrites its oldest record
+	//
+	if (handle->count == handle->slots)
+		handle->count--;
+
+	//
+	//  Write the record first and the sequence number last,
+	//  so an interrupted append leaves the other records intact.
+	//
+	if (persistentStore(addr + PERSISTENT_RING_SLOT_PREFIX, record, recordSize) < 0)
+		return -1;
+
+	uint8_t prefix[PERSISTENT_RING_SLOT_PREFIX] = {
+		(uint8_t)sequence, (uint8_t)(sequence >> 8),
+		persistentRingCheck(addr, sequence, recordSize, record)
+	};
+	if (persistentStore(addr, (char*)prefix, sizeof(prefix)) < 0)
+		return -1;
+
+	handle->newest   = slot;
+	handle->sequence = sequence;
+	handle->count++;
+
+	return recordSize;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Reads a record from a ring buffer area. Index 0 is the oldest record and
+ *  persistentRingCount(handle) - 1 the newest, so looping over the indexes
+ *  iterates from the oldest to the newest record.
+ *
+ * @param handle      The handle of the area
+ * @param index       The age of the record, 0 being the oldest
+ * @param recordSize  The size of the record in bytes
+ * @param record      The buffer to read the record into
+ *
+ * @return   1 Success
+ *           0 There is no record with that index
+ *          -1 The handle is not open
+ *          -2 The requested record size differs from the area its record size
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentRingRead(struct persistentRingHandle* handle, uint16_t index,
+		                   uint16_t recordSize, char* record) {
+
+	if (handle->area.header == 0)
+		return -1;
+
+	if (recordSize != handle->recordSize)
+		return -2;
+
+	if (index >= handle->count)
+		return 0;
+
+	persistentRead(persistentRingSlot(handle, persistentRingAge(handle, index)) + PERSISTENT_RING_SLOT_PREFIX,
+			       record, recordSize);
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the number of records held by a ring buffer area.
+ *
+ * @param handle      The handle of the area
+ *
+ * @return  The number of records, 0 if the handle is not open
+ *
+ *---------------------------------------------------------------------------*/
+uint16_t persistentRingCount(struct persistentRingHandle* handle) {
+
+	if (handle->area.header == 0)
+		return 0;
+
+	return handle->count;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Discards the oldest records of a ring buffer area, for instance after
+ *  they have been uploaded. Only the check byte of each record is inverted,
+ *  the sequence numbers stay, so appending continues in the next slot.
+ *
+ * @param handle      The handle of the area
+ * @param count       The number of records to discard
+ *
+ * @return  >= 0 The number of records discarded
+ *            -1 The handle is not open
+ *            -2 Write error
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentRingDiscard(struct persistentRingHandle* handle, uint16_t count) {
+
+	if (handle->area.header == 0)
+		return -1;
+
+	if (count > handle->count)
+		count = handle->count;
+
+	//
+	//  Oldest first, so the live records keep forming a single run
+	//
+	for (uint16_t done = 0; done < count; done++) {
+		uint32_t addr = persistentRingSlot(handle, persistentRingAge(handle, 0)) + 2;
+		uint8_t  check;
+		persistentRead(addr, (char*)&check, 1);
+		check ^= 0xff;
+		if (persistentStore(addr, (char*)&check, 1) < 0)
+			return -2;
+		handle->count--;
+	}
+
+	return count;
+}
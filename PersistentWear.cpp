@@ -0,0 +1,302 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <PersistentWear.cpp> - Wear leveled persistent areas.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0010 - Initial release, wear leveled areas
+ *  P0014 - No area checksum, the slots have their own check
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <Persistence.h>
+
+//
+//  Layout of a wear leveled area, which is an ordinary area holding
+//  "slots" consecutive slots:
+//
+//          +---------------+- slot address
+//          |   sequence    |  32 bit sequence number of the data
+//          +---------------+
+//          |     check     |  Check byte of the sequence number
+//          +---------------+
+//          |               |
+//          |     data      |  dataSize bytes
+//          |               |
+//          +---------------+- next slot address
+//
+//  The data is written before the sequence number. A slot whose check byte
+//  does not match its sequence number, like a virgin slot or one that was
+//  interrupted by a power loss, is ignored. The slot with the highest valid
+//  sequence number holds the newest data.
+//
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the check byte of a sequence number.
+ *
+ *---------------------------------------------------------------------------*/
+static uint8_t persistentWearCheck(uint32_t sequence) {
+	return (uint8_t)(sequence ^ (sequence >> 8) ^ (sequence >> 16) ^ (sequence >> 24) ^ 0xa5);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the persistent address of a slot.
+ *
+ *---------------------------------------------------------------------------*/
+static uint32_t persistentWearSlot(struct persistentWearHandle* handle, uint8_t slot) {
+	return handle->area.data +
+		   (uint32_t)slot * (PERSISTENT_WEAR_SLOT_PREFIX + handle->recordSize);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Finds the slot holding the newest data by reading the slot prefixes.
+ *
+ * @param handle  The handle of the wear leveled area
+ *
+ *---------------------------------------------------------------------------*/
+static void persistentWearFindNewest(struct persistentWearHandle* handle) {
+
+	handle->empty    = true;
+	handle->newest   = handle->slots - 1;
+	handle->sequence = 0;
+
+	for (uint8_t slot = 0; slot < handle->slots; slot++) {
+		uint8_t prefix[PERSISTENT_WEAR_SLOT_PREFIX];
+		persistentRead(persistentWearSlot(handle, slot), (char*)prefix, sizeof(prefix));
+
+		uint32_t sequence =  (uint32_t)prefix[0]        | ((uint32_t)prefix[1] << 8) |
+				            ((uint32_t)prefix[2] << 16) | ((uint32_t)prefix[3] << 24);
+		if (prefix[4] != persistentWearCheck(sequence))
+			continue;
+
+		if (handle->empty || sequence > handle->sequence) {
+			handle->empty    = false;
+			handle->newest   = slot;
+			handle->sequence = sequence;
+		}
+	}
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Allocates a new wear leveled area and opens a handle on it.
+ *  It takes slots * (dataSize + PERSISTENT_WEAR_SLOT_PREFIX) bytes of data.
+ *
+ * @param name      Name of the area
+ * @param dataSize  Size in bytes of the data
+ * @param slots     Number of slots to spread the writes over, at least 2.
+ *                  A single slot would be overwritten in place, so a write
+ *                  interrupted by a power loss would lose the data.
+ * @param handle    The handle to open on the new area
+ *
+ * @return      Same as newPersistentArea(name, dataSize), 0 is also returned
+ *              if there are fewer than 2 slots
+ *
+ *---------------------------------------------------------------------------*/
+uint32_t newPersistentWearArea(char* name, uint16_t dataSize, uint8_t slots,
+		                       struct persistentWearHandle* handle) {
+
+	uint32_t size = (uint32_t)slots * (PERSISTENT_WEAR_SLOT_PREFIX + dataSize);
+	if (slots < 2 || size > 0xffff)
+		return 0;
+
+	//
+	//  The slots are written one at a time, so a checksum of the whole area
+	//  would not hold. Each slot has its own check byte instead.
+	//
+	uint32_t addr = newPersistentArea(name, (uint16_t)size, &handle->area, PERSISTENT_CHECK_NONE);
+	if (addr == 0 || addr == (uint32_t)-1)
+		return addr;
+
+	handle->recordSize = dataSize;
+	handle->slots      = slots;
+
+	//
+	//  Reused memory may hold old slots, make their prefixes virgin
+	//
+	for (uint8_t slot = 0; slot < slots; slot++)
+		persistentClear(persistentWearSlot(handle, slot), 0xff, PERSISTENT_WEAR_SLOT_PREFIX);
+
+	persistentWearFindNewest(handle);
+	return addr;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Opens a handle on an existing wear leveled area and finds its newest data.
+ *
+ * @param name      Name of the area
+ * @param dataSize  Size in bytes of the data
+ * @param handle    The handle to open
+ *
+ * @return   1 Success
+ *          -1 The area with the specified name was not found
+ *          -2 The area size does not match a whole number of slots of dataSize
+ *
+ *---------------------------------------------------------------------------*/
+int16_t openPersistentWearArea(char* name, uint16_t dataSize,
+		                       struct persistentWearHandle* handle) {
+
+	if (openPersistentArea(name, &handle->area) < 0)
+		return -1;
+
+	uint16_t slotSize = PERSISTENT_WEAR_SLOT_PREFIX + dataSize;
+	uint16_t slots    = handle->area.size / slotSize;
+	if (slots == 0 || slots > 0xff || slots * slotSize != handle->area.size) {
+		handle->area.header = 0;
+		return -2;
+	}
+
+	handle->recordSize = dataSize;
+	handle->slots      = (uint8_t)slots;
+	persistentWearFindNewest(handle);
+
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Reads the newest data of a wear leveled area.
+ *
+ * @param handle    The handle of the area
+ * @param dataSize  The size of the data in bytes
+ * @param data      The buffer to read the data into
+ *
+ * @return   1 Success
+ *           0 Nothing was written to the area yet
+ *          -1 The handle is not open
+ *          -2 The requested data size differs from the area its data size
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentReadWearArea(struct persistentWearHandle* handle, uint16_t dataSize, char* data) {
+
+	if (handle->area.header == 0)
+		return -1;
+
+	if (dataSize != handle->recordSize)
+		return -2;
+
+	if (handle->empty)
+		return 0;
+
+	persistentRead(persistentWearSlot(handle, handle->newest) + PERSISTENT_WEAR_SLOT_PREFIX,
+			       data, dataSize);
+	return 1;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Writes data to the next slot of a wear leveled area. If the data equals
+ *  the newest data nothing is written at all.
+ *
+ * @param handle    The handle of the area
+ * @param dataSize  The size of the data to be written
+ * @param data      The address of the data buffer
+ *
+ * @return  > 0 The amount of bytes that were successfully written.
+ *            0 Nothing is written, because it was the wrong data area.
+ *          < 0 Write error
+ *
+ *---------------------------------------------------------------------------*/
+int16_t persistentWriteWearArea(struct persistentWearHandle* handle, uint16_t dataSize, char* data) {
+
+	if (handle->area.header == 0 || dataSize != handle->recordSize)
+		return 0;
+
+	//
+	//  Compare with the newest data, a chunk at a time
+	//
+	if (!handle->empty) {
+		uint32_t addr = persistentWearSlot(handle, handle->newest) + PERSISTENT_WEAR_SLOT_PREFIX;
+		char     chunk[16];
+		uint16_t done = 0;
+		while (done < dataSize) {
+			uint16_t n = (dataSize - done < (uint16_t)sizeof(chunk)) ? dataSize - done : sizeof(chunk);
+			persistentRead(addr + done, chunk, n);
+			if (memcmp(chunk, data + done, n))
+				break;
+			done += n;
+		}
+		if (done == dataSize)
+			return dataSize;
+	}
+
+	//
+	//  Write the data first and the sequence number last,
+	//  so an interrupted write leaves the newest data intact.
+	//
+	uint8_t  slot     = handle->empty ? 0 : (handle->newest + 1) % handle->slots;
+	uint32_t sequence = handle->empty ? 0 : handle->sequence + 1;
+	uint32_t addr     = persistentWearSlot(handle, slot);
+
+	if (persistentStore(addr + PERSISTENT_WEAR_SLOT_PREFIX, data, dataSize) < 0)
+		return -1;
+
+	uint8_t prefix[PERSISTENT_WEAR_SLOT_PREFIX] = {
+		(uint8_t)sequence, (uint8_t)(sequence >> 8),
+		(uint8_t)(sequence >> 16), (uint8_t)(sequence >> 24),
+		persistentWearCheck(sequence)
+	};
+	if (persistentStore(addr, (char*)prefix, sizeof(prefix)) < 0)
+		return -1;
+
+	handle->empty    = false;
+	handle->newest   = slot;
+	handle->sequence = sequence;
+
+	return dataSize;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Estimates the number of times each slot has been programmed,
+ *  derived from the sequence number of the newest data.
+ *
+ * @param handle    The handle of the area
+ *
+ * @return  The estimated program cycles per slot
+ *
+ *---------------------------------------------------------------------------*/
+uint32_t persistentWearCycles(struct persistentWearHandle* handle) {
+
+	if (handle->area.header == 0 || handle->empty)
+		return 0;
+
+	return handle->sequence / handle->slots + 1;
+}
@@ -0,0 +1,142 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <BenchSupport.h> - Shared setup of the host benchmarks.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+#ifndef BENCHSUPPORT_h
+#define BENCHSUPPORT_h
+
+#include <Persistence.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+//  Stops the benchmark if the library does not do what it should, the
+//  numbers would mean nothing.
+//
+#define BENCH_CHECK(condition)                                              \
+	do {                                                                    \
+		if (!(condition)) {                                                 \
+			printf("%s:%d: BENCH_CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			exit(1);                                                        \
+		}                                                                   \
+	} while (0)
+
+#define BENCH_MAX_SIZE  65536
+
+//
+//  The simulated EEPROM the benchmarks run on, with the default timing
+//  of PersistentBackend.h.
+//
+static uint8_t  benchMemory[BENCH_MAX_SIZE];
+static uint32_t benchWear[BENCH_MAX_SIZE];
+
+static struct persistentBackend   benchBackend;
+static struct persistentSimDevice benchDevice;
+
+/**----------------------------------------------------------------------------
+ *
+ *  Selects a virgin simulated EEPROM of size bytes and formats it.
+ *
+ * @param size      The size of the EEPROM, at most BENCH_MAX_SIZE
+ * @param features  The features to format with
+ *
+ *---------------------------------------------------------------------------*/
+static inline void benchFormatted(uint32_t size, uint8_t features) {
+	memset(benchMemory, 0xff, size);
+	persistentInitSimBackend(&benchBackend, &benchDevice, benchMemory, benchWear, size,
+			                 PERSISTENT_SIM_READ_NS, PERSISTENT_SIM_PROGRAM_NS);
+	persistentSetBackend(&benchBackend);
+	persistentLoadLayout();
+	BENCH_CHECK(persistentFormat(features) == 1);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Starts a measurement, resets the statistics and wear counters of the
+ *  simulated EEPROM and the statistics of the write engine.
+ *
+ *---------------------------------------------------------------------------*/
+static inline void benchStart() {
+	persistentResetSimStats(&benchDevice);
+	persistentResetWriteStats();
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Ends a measurement of ops operations and prints a line of results:
+ *  - the simulated EEPROM time,
+ *  - operations per second of simulated time,
+ *  - bytes read and programmed,
+ *  - programmed bytes per logical byte, i.e. per byte the library asked
+ *    the write engine to write, "-" if it wrote nothing,
+ *  - the program cycles of the most worn cell during the measurement.
+ *
+ * @param label  What was measured
+ * @param ops    The number of operations
+ *
+ * @return  The simulated statistics
+ *
+ *---------------------------------------------------------------------------*/
+static inline struct persistentSimStats benchReport(const char* label, uint32_t ops) {
+	struct persistentSimStats  sim;
+	struct persistentWriteStats engine;
+
+	persistentGetSimStats(&benchDevice, &sim);
+	persistentGetWriteStats(&engine);
+
+	double ms = sim.timeNs / 1e6;
+	printf("  %-24s %10.1f ms %10.1f ops/s %8lu read %7lu programmed",
+		   label, ms, ms > 0 ? ops * 1000.0 / ms : 0.0,
+		   (unsigned long)sim.bytesRead, (unsigned long)sim.bytesProgrammed);
+
+	if (engine.compared)
+		printf(" %6.2f", (double)sim.bytesProgrammed / engine.compared);
+	else
+		printf(" %6s", "-");
+
+	printf(" per logical byte, max wear %lu\n", (unsigned long)sim.hottestWear);
+	return sim;
+}
+
+#endif
@@ -0,0 +1,131 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <benchAreas.cpp> - Benchmark of the basic area functions.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+//
+//  Allocates, writes, reads, looks up and frees areas on simulated EEPROMs
+//  of several sizes, with several numbers of areas. Each area is 16 to 47
+//  bytes. Every write round changes a 4 byte counter at the start of every
+//  area, as a logging or settings application would. Combinations that do
+//  not fit the EEPROM are skipped. The default name index holds 42 areas,
+//  so with 40 areas every lookup is served by it and with 48 lookups of the
+//  areas that did not fit walk the chain.
+//
+#include "BenchSupport.h"
+
+#define BENCH_ROUNDS  20
+
+static void benchAreas(uint32_t size, uint16_t count) {
+	char     name[PERSISTENT_AREA_NAME_SIZE + 1];
+	char     data[48];
+	uint16_t sizes[64];
+
+	benchFormatted(size, 0);
+	if (getFreeStorageAreaEnd() - getFreeStorageAreaStart() < count * (PERSISTENT_AREA_PREFIX_SIZE + 48UL))
+		return;
+
+	printf("%lu byte EEPROM, %u areas\n", (unsigned long)size, count);
+
+	benchStart();
+	for (uint16_t i = 0; i < count; i++) {
+		sizes[i] = 16 + (i * 7) % 32;
+		snprintf(name, sizeof(name), "area.%03u", i);
+		BENCH_CHECK(newPersistentArea(name, sizes[i]) > 0);
+	}
+	benchReport("newPersistentArea", count);
+
+	benchStart();
+	for (uint16_t round = 0; round < BENCH_ROUNDS; round++) {
+		for (uint16_t i = 0; i < count; i++) {
+			snprintf(name, sizeof(name), "area.%03u", i);
+			memset(data, (char)i, sizeof(data));
+			uint32_t counter = round;
+			memcpy(data, &counter, sizeof(counter));
+			BENCH_CHECK(persistentWriteArea(name, sizes[i], data) == sizes[i]);
+		}
+	}
+	benchReport("persistentWriteArea", count * BENCH_ROUNDS);
+
+	benchStart();
+	for (uint16_t round = 0; round < BENCH_ROUNDS; round++) {
+		for (uint16_t i = 0; i < count; i++) {
+			snprintf(name, sizeof(name), "area.%03u", i);
+			BENCH_CHECK(persistentReadArea(name, sizes[i], data) == 1);
+		}
+	}
+	benchReport("persistentReadArea", count * BENCH_ROUNDS);
+
+	benchStart();
+	for (uint16_t i = 0; i < count; i++) {
+		snprintf(name, sizeof(name), "area.%03u", i);
+		BENCH_CHECK(getPersistentHeaderAddress(name) != 0);
+		snprintf(name, sizeof(name), "missing.%03u", i);
+		BENCH_CHECK(getPersistentHeaderAddress(name) == 0);
+	}
+	benchReport("lookup, hit and miss", count * 2);
+
+	benchStart();
+	for (uint16_t i = 0; i < count; i += 2) {
+		snprintf(name, sizeof(name), "area.%03u", i);
+		BENCH_CHECK(freePersistentArea(name) > 0);
+	}
+	benchReport("freePersistentArea", (count + 1) / 2);
+
+	benchStart();
+	for (uint16_t i = 0; i < count; i += 2) {
+		snprintf(name, sizeof(name), "again.%03u", i);
+		BENCH_CHECK(newPersistentArea(name, sizes[i]) > 0);
+	}
+	benchReport("reallocate freed", (count + 1) / 2);
+}
+
+int main() {
+	static const uint32_t sizes[]  = { 1024, 4096, 16384 };
+	static const uint16_t counts[] = { 8, 24, 40, 48 };
+
+	for (uint8_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+		for (uint8_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+			benchAreas(sizes[s], counts[c]);
+
+	return 0;
+}
@@ -0,0 +1,93 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <benchBatch.cpp> - Benchmark of batched area allocation.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+
+//
+//  Allocates 30 areas of 16 to 23 bytes on a freshly formatted 4 KB EEPROM,
+//  one by one with newPersistentArea() and as one batch with
+//  newPersistentAreas(), with full and compact headers. Built without the
+//  name index the one by one path walks the chain for every name.
+//
+#include "BenchSupport.h"
+
+#define BENCH_AREAS  30
+
+static char benchNames[BENCH_AREAS][PERSISTENT_AREA_NAME_SIZE + 1];
+
+static void benchBatch(uint8_t features, bool batch) {
+	struct persistentAreaRequest areas[BENCH_AREAS];
+
+	benchFormatted(4096, features);
+	for (uint8_t i = 0; i < BENCH_AREAS; i++) {
+		areas[i].name  = benchNames[i];
+		areas[i].size  = 16 + i % 8;
+		areas[i].check = PERSISTENT_CHECK_NONE;
+	}
+
+	benchStart();
+	if (batch)
+		BENCH_CHECK(newPersistentAreas(areas, BENCH_AREAS) == BENCH_AREAS);
+	else
+		for (uint8_t i = 0; i < BENCH_AREAS; i++)
+			BENCH_CHECK(newPersistentArea(areas[i].name, areas[i].size) > 0);
+
+	struct persistentSimStats sim = benchReport(batch ? "newPersistentAreas" : "newPersistentArea", BENCH_AREAS);
+	printf("  %-24s %lu block reads\n", "", (unsigned long)sim.reads);
+
+	BENCH_CHECK(persistentAreaCount() == BENCH_AREAS);
+}
+
+int main() {
+	for (uint8_t i = 0; i < BENCH_AREAS; i++)
+		snprintf(benchNames[i], sizeof(benchNames[i]), "area.%02u", i);
+
+	printf("%u areas, index %s\n", BENCH_AREAS, PERSISTENT_INDEX_SIZE > 0 ? "enabled" : "disabled");
+	for (uint8_t features = 0; features <= PERSISTENT_FEATURE_COMPACT; features += PERSISTENT_FEATURE_COMPACT) {
+		printf("%s headers\n", features ? "compact" : "full");
+		benchBatch(features, false);
+		benchBatch(features, true);
+	}
+
+	return 0;
+}
@@ -0,0 +1,115 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <benchCompact.cpp> - Benchmark of compaction.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+
+//
+//  Compacts a fragmented 4 KB EEPROM. Up to 60 areas of 8 to 97 bytes are
+//  allocated until the memory is full, then every other one is freed and
+//  persistentCompact() moves the others down over the holes.
+//
+#include "BenchSupport.h"
+
+#define BENCH_AREAS  60
+
+static uint32_t benchMoves;
+
+static void benchMoved(char* name, uint32_t oldData, uint32_t newData) {
+	(void)name;
+	(void)oldData;
+	(void)newData;
+	benchMoves++;
+}
+
+static void benchCompact(uint8_t features) {
+	char     name[PERSISTENT_AREA_NAME_SIZE + 1];
+	char     data[128];
+	uint16_t sizes[BENCH_AREAS];
+	bool     live[BENCH_AREAS];
+
+	benchFormatted(4096, features);
+	printf("4096 byte EEPROM, %s headers\n", features ? "compact" : "full");
+
+	srand(3);
+	uint16_t areas = 0;
+	for (uint16_t i = 0; i < BENCH_AREAS; i++) {
+		sizes[i] = 8 + rand() % 90;
+		snprintf(name, sizeof(name), "n%u", i);
+		live[i] = newPersistentArea(name, sizes[i]) > 0;
+		if (live[i]) {
+			memset(data, i + 1, sizes[i]);
+			BENCH_CHECK(persistentWriteArea(name, sizes[i], data) == sizes[i]);
+			areas++;
+		}
+	}
+
+	for (uint16_t i = 0; i < BENCH_AREAS; i += 2) {
+		snprintf(name, sizeof(name), "n%u", i);
+		if (live[i])
+			BENCH_CHECK(freePersistentArea(name) > 0);
+		live[i] = false;
+	}
+
+	benchStart();
+	benchMoves = 0;
+	int32_t moved = persistentCompact(benchMoved);
+	BENCH_CHECK(moved > 0);
+	struct persistentSimStats sim = benchReport("persistentCompact", 1);
+	printf("  %u areas, %lu bytes moved in %lu moves, %lu block reads\n", areas,
+		   (unsigned long)moved, (unsigned long)benchMoves, (unsigned long)sim.reads);
+
+	for (uint16_t i = 0; i < BENCH_AREAS; i++) {
+		if (!live[i])
+			continue;
+		snprintf(name, sizeof(name), "n%u", i);
+		BENCH_CHECK(persistentReadArea(name, sizes[i], data) == 1);
+		for (uint16_t b = 0; b < sizes[i]; b++)
+			BENCH_CHECK(data[b] == (char)(i + 1));
+	}
+}
+
+int main() {
+	benchCompact(0);
+	benchCompact(PERSISTENT_FEATURE_COMPACT);
+	return 0;
+}
@@ -0,0 +1,106 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <benchNameHash.cpp> - Benchmark of name hashes in area headers.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+
+//
+//  Looks up 30 areas named like "sensor.channel07", and 30 names that are
+//  not allocated, and reports the bytes read per lookup. First with the
+//  name hash in the headers, then with headers as older releases wrote
+//  them, without it, and again after persistentMigrateHeaders(). Built
+//  without the name index every lookup walks the chain.
+//
+#include "BenchSupport.h"
+
+#define BENCH_AREAS  30
+
+static char benchNames[BENCH_AREAS][PERSISTENT_AREA_NAME_SIZE + 1];
+
+static double benchLookups(bool miss) {
+	char name[PERSISTENT_AREA_NAME_SIZE + 1];
+
+	benchStart();
+	for (uint8_t i = 0; i < BENCH_AREAS; i++) {
+		snprintf(name, sizeof(name), "missing%02u", i);
+		uint32_t addr = getPersistentHeaderAddress(miss ? name : benchNames[i]);
+		BENCH_CHECK(miss ? addr == 0 : addr != 0);
+	}
+
+	struct persistentSimStats sim;
+	persistentGetSimStats(&benchDevice, &sim);
+	return (double)sim.bytesRead / BENCH_AREAS;
+}
+
+static void benchPrint(const char* label) {
+	double hit  = benchLookups(false);
+	double miss = benchLookups(true);
+	printf("  %-24s %8.1f bytes per hit %8.1f bytes per miss\n", label, hit, miss);
+}
+
+int main() {
+	benchFormatted(4096, 0);
+	printf("%u areas, index %s\n", BENCH_AREAS, PERSISTENT_INDEX_SIZE > 0 ? "enabled" : "disabled");
+
+	for (uint8_t i = 0; i < BENCH_AREAS; i++) {
+		snprintf(benchNames[i], sizeof(benchNames[i]), "sensor.channel%02u", i);
+		BENCH_CHECK(newPersistentArea(benchNames[i], 8) > 0);
+	}
+	benchPrint("hashed headers");
+
+	//
+	//  Clear the hash byte of every header, as older releases left it
+	//
+	uint32_t addr = getFreeStorageAreaStart();
+	for (uint8_t i = 0; i < BENCH_AREAS; i++) {
+		benchMemory[addr + 3] = 0;
+		addr += benchMemory[addr] | benchMemory[addr + 1] << 8;
+	}
+	persistentIndexReset();
+	benchPrint("headers without hash");
+
+	BENCH_CHECK(persistentMigrateHeaders() == BENCH_AREAS);
+	BENCH_CHECK(persistentMigrateHeaders() == 0);
+	benchPrint("migrated headers");
+
+	return 0;
+}
@@ -0,0 +1,122 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <benchRead.cpp> - Benchmark of block reads.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+
+//
+//  Reads a 4 KB image and a 256 byte area one byte per backend call, as
+//  the library did before reads were passed on as blocks, and as blocks.
+//  The simulated EEPROM charges its latency per byte, so its time is the
+//  same for both. What differs is the number of backend calls, which on
+//  an AVR each cost an EEPROM.read() call, and the host time per read.
+//
+#include "BenchSupport.h"
+#include <time.h>
+
+#define BENCH_REPEAT  2000
+
+static double benchHostNs() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static void benchByteLoop(uint32_t addr, char* data, uint16_t size) {
+	for (uint16_t i = 0; i < size; i++)
+		persistentRead(addr + i, data + i, 1);
+}
+
+static void benchRead(const char* label, uint32_t addr, uint16_t size, bool bytes) {
+	static char data[4096];
+
+	benchStart();
+	double start = benchHostNs();
+	for (uint16_t r = 0; r < BENCH_REPEAT; r++) {
+		if (bytes)
+			benchByteLoop(addr, data, size);
+		else
+			persistentRead(addr, data, size);
+	}
+	double ns = (benchHostNs() - start) / BENCH_REPEAT;
+
+	struct persistentSimStats sim;
+	persistentGetSimStats(&benchDevice, &sim);
+	printf("  %-24s %6lu calls %10.1f ms simulated %10.0f ns host per pass\n", label,
+		   (unsigned long)(sim.reads / BENCH_REPEAT), sim.timeNs / 1e6 / BENCH_REPEAT, ns);
+}
+
+int main() {
+	benchFormatted(4096, 0);
+	struct persistentAreaHandle handle;
+	BENCH_CHECK(newPersistentArea((char*)"area", 256, &handle, PERSISTENT_CHECK_NONE) > 0);
+	uint32_t area = handle.data;
+
+	printf("4096 byte image\n");
+	benchRead("byte loop", 0, 4096, true);
+	benchRead("block read", 0, 4096, false);
+
+	printf("256 byte area\n");
+	benchRead("byte loop", area, 256, true);
+	benchRead("block read", area, 256, false);
+
+	//
+	//  The virgin scan reads PERSISTENT_SCAN_CHUNK bytes at a time
+	//
+	memset(benchMemory, 0xff, 4096);
+	persistentLoadLayout();
+	BENCH_CHECK(!persistentIsFormatted());
+
+	printf("isPersistentStorageVirgin\n");
+	benchStart();
+	double start = benchHostNs();
+	for (uint16_t r = 0; r < BENCH_REPEAT; r++)
+		BENCH_CHECK(isPersistentStorageVirgin());
+	double ns = (benchHostNs() - start) / BENCH_REPEAT;
+
+	struct persistentSimStats sim;
+	persistentGetSimStats(&benchDevice, &sim);
+	printf("  %-24s %6lu calls %10.1f ms simulated %10.0f ns host per scan\n", "chunked scan",
+		   (unsigned long)(sim.reads / BENCH_REPEAT), sim.timeNs / 1e6 / BENCH_REPEAT, ns);
+
+	return 0;
+}
@@ -0,0 +1,106 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <benchRing.cpp> - Benchmark of the ring buffer areas.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+//
+//  Appends 5000 records to a 2 KB ring buffer area, and for comparison to
+//  an array of records in a plain area with a head pointer in a second
+//  area. Then opens the ring, which reads every slot.
+//
+#include "BenchSupport.h"
+
+#define BENCH_APPENDS  5000
+#define BENCH_RING     2048
+
+static void benchRecord(char* record, uint16_t recordSize, uint16_t n) {
+	for (uint16_t i = 0; i < recordSize; i++)
+		record[i] = (char)(n * 7 + i * 13);
+}
+
+static void benchRing(uint16_t recordSize) {
+	struct persistentRingHandle ring;
+	struct persistentAreaHandle array;
+	char     record[16];
+	uint16_t slots = BENCH_RING / (PERSISTENT_RING_SLOT_PREFIX + recordSize);
+
+	printf("%u byte records, %u slots\n", recordSize, slots);
+
+	benchFormatted(4096, 0);
+	BENCH_CHECK(newPersistentRingArea((char*)"log", recordSize, slots, &ring) > 0);
+
+	benchStart();
+	BENCH_CHECK(openPersistentRingArea((char*)"log", recordSize, &ring) == 1);
+	benchReport("open empty ring", 1);
+
+	benchStart();
+	for (uint16_t n = 0; n < BENCH_APPENDS; n++) {
+		benchRecord(record, recordSize, n);
+		BENCH_CHECK(persistentRingAppend(&ring, recordSize, record) == recordSize);
+	}
+	benchReport("ring append", BENCH_APPENDS);
+
+	benchStart();
+	BENCH_CHECK(openPersistentRingArea((char*)"log", recordSize, &ring) == 1);
+	BENCH_CHECK(persistentRingCount(&ring) == slots);
+	benchReport("open full ring", 1);
+
+	benchFormatted(4096, 0);
+	BENCH_CHECK(newPersistentArea((char*)"log", slots * recordSize, &array, PERSISTENT_CHECK_NONE) > 0);
+	BENCH_CHECK(newPersistentArea((char*)"head", 2) > 0);
+
+	benchStart();
+	for (uint16_t n = 0; n < BENCH_APPENDS; n++) {
+		uint16_t head = (n + 1) % slots;
+		benchRecord(record, recordSize, n);
+		BENCH_CHECK(persistentWriteAreaRange(&array, (n % slots) * recordSize, recordSize, record) == recordSize);
+		BENCH_CHECK(persistentWriteArea((char*)"head", sizeof(head), (char*)&head) == sizeof(head));
+	}
+	benchReport("array and head pointer", BENCH_APPENDS);
+}
+
+int main() {
+	benchRing(4);
+	benchRing(8);
+	benchRing(16);
+	return 0;
+}
@@ -0,0 +1,240 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <TestSupport.h> - Shared setup of the host tests.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+#ifndef TESTSUPPORT_h
+#define TESTSUPPORT_h
+
+#include <Persistence.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern uint32_t getPersistentAreaAddress(char* name);
+
+//
+//  Fails the test, with the file and line, if the condition is false.
+//
+#define CHECK(condition)                                                    \
+	do {                                                                    \
+		if (!(condition)) {                                                 \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			exit(1);                                                        \
+		}                                                                   \
+	} while (0)
+
+#define TEST_SIZE   4096
+
+//
+//  The persistent memory of the tests. It is a simulated EEPROM, or the
+//  same memory behind a backend that cuts the power after a number of
+//  programmed bytes.
+//
+static uint8_t  testMemory[TEST_SIZE];
+static uint32_t testWear[TEST_SIZE];
+
+static struct persistentBackend   testSimBackend;
+static struct persistentSimDevice testSimDevice;
+
+//
+//  Bytes that can still be programmed before the power is cut, -1 for no
+//  power cut at all.
+//
+static long     testBudget = -1;
+
+static void testCutRead(void* device, uint32_t addr, char* data, uint16_t size) {
+	(void)device;
+	memcpy(data, testMemory + addr, size);
+}
+
+static void testCutWrite(void* device, uint32_t addr, const char* data, uint16_t size) {
+	(void)device;
+	for (uint16_t i = 0; i < size; i++) {
+		if (testBudget == 0)
+			return;
+		if (testBudget > 0)
+			testBudget--;
+		testMemory[addr + i] = data[i];
+	}
+}
+
+static uint32_t testCutSize(void* device) {
+	(void)device;
+	return TEST_SIZE;
+}
+
+static uint8_t testCutReady(void* device) {
+	(void)device;
+	return 1;
+}
+
+static const struct persistentBackend testCutBackend = {
+	testCutRead, testCutWrite, testCutSize, 0, 0, testCutReady
+};
+
+/**----------------------------------------------------------------------------
+ *
+ *  Selects a backend on a virgin memory of TEST_SIZE bytes and loads
+ *  the layout from it, like the first boot of a device.
+ *
+ * @param backend  The backend, 0 for the simulated EEPROM
+ *
+ *---------------------------------------------------------------------------*/
+static inline void testVirgin(const struct persistentBackend* backend) {
+	memset(testMemory, 0xff, sizeof(testMemory));
+	memset(testWear, 0, sizeof(testWear));
+	testBudget = -1;
+
+	if (!backend) {
+		persistentInitSimBackend(&testSimBackend, &testSimDevice, testMemory, testWear,
+				                 TEST_SIZE, PERSISTENT_SIM_READ_NS, PERSISTENT_SIM_PROGRAM_NS);
+		backend = &testSimBackend;
+	}
+
+	persistentSetBackend(backend);
+	persistentLoadLayout();
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Like testVirgin(), then formats the memory.
+ *
+ * @param backend   The backend, 0 for the simulated EEPROM
+ * @param features  The features to format with
+ *
+ *---------------------------------------------------------------------------*/
+static inline void testFormatted(const struct persistentBackend* backend, uint8_t features) {
+	testVirgin(backend);
+	CHECK(persistentFormat(features) == 1);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Simulates a reboot: every RAM structure of the library is dropped and
+ *  the layout is loaded again from the same memory.
+ *
+ *---------------------------------------------------------------------------*/
+static inline void testReboot() {
+	testBudget = -1;
+	persistentSetBackend(persistentGetBackend());
+#if PERSISTENT_CACHE_SIZE > 0
+	persistentCacheReset();
+#endif
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Walks the chain of headers in testMemory and checks that every cell
+ *  ends within the allocatable memory, that freed cells hold nothing but
+ *  0xff beyond their header and that the chain ends in virgin memory, or
+ *  at the end of the allocatable memory.
+ *
+ * @param freeCells  Returns the number of freed cells, 0 if not needed
+ *
+ * @return  The number of allocated areas
+ *
+ *---------------------------------------------------------------------------*/
+static inline int testWalk(int* freeCells) {
+	uint32_t addr  = getFreeStorageAreaStart();
+	uint32_t end   = getFreeStorageAreaEnd();
+	int      areas = 0;
+	int      cells = 0;
+
+	while (addr < end) {
+		uint16_t next = testMemory[addr]     | testMemory[addr + 1] << 8;
+		uint16_t data = testMemory[addr + 2] | testMemory[addr + 3] << 8;
+		if (next == 0xffff)
+			break;
+
+		CHECK(next != 0 && addr + next <= end);
+		if (data == 0xffff) {
+			for (uint32_t x = addr + persistentFreeHeaderSize(); x < addr + next; x++)
+				CHECK(testMemory[x] == 0xff);
+			cells++;
+		}
+		else
+			areas++;
+
+		addr += next;
+	}
+
+	if (freeCells)
+		*freeCells = cells;
+
+	return areas;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Fills an area with a pattern that starts at value and increments.
+ *
+ *---------------------------------------------------------------------------*/
+static inline void testFill(const char* name, uint16_t size, uint8_t value) {
+	char data[1024];
+
+	CHECK(size <= sizeof(data));
+	for (uint16_t i = 0; i < size; i++)
+		data[i] = (char)(value + i);
+
+	CHECK(persistentWriteArea((char*)name, size, data) == size);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Checks that an area holds size bytes, of which the first keep bytes
+ *  hold the pattern testFill() wrote and the others 0xff.
+ *
+ *---------------------------------------------------------------------------*/
+static inline void testCheckFill(const char* name, uint16_t size, uint8_t value, uint16_t keep) {
+	struct persistentAreaHandle handle;
+	char data[1024];
+
+	CHECK(openPersistentArea((char*)name, &handle) == 1);
+	CHECK(handle.size == size);
+	CHECK(persistentReadArea(&handle, size, data) == 1);
+
+	for (uint16_t i = 0; i < size; i++)
+		CHECK(data[i] == (i < keep ? (char)(value + i) : (char)0xff));
+}
+
+#endif
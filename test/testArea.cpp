@@ -0,0 +1,104 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <testArea.cpp> - Tests of the PersistentArea<T> template.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+#include "TestSupport.h"
+#include <PersistentArea.h>
+#include <stddef.h>
+
+struct testSettings {
+	uint8_t  volume;
+	uint16_t boots;
+	char     label[10];
+	uint32_t serial;
+};
+
+static PersistentArea<struct testSettings>                        settings("settings");
+static PersistentArea<struct testSettings, PERSISTENT_CHECK_CRC32> checked("checked");
+static PersistentArea<uint32_t>                                   other("settings");
+
+//
+//  Whole area access, and opening an area of another size.
+//
+static void testStore() {
+	struct testSettings value = { 3, 7, "hi", 1234 };
+	struct testSettings back;
+
+	CHECK(!settings.exists() && settings.load(back) == -1);
+	CHECK(settings.store(value) == sizeof(value));
+	CHECK(settings.exists());
+	CHECK(settings.load(back) == 1 && back.boots == 7 && back.serial == 1234);
+
+	CHECK(other.begin() == -2 && !other.exists());
+}
+
+//
+//  Members are read and written at their offset in the struct.
+//
+static void testMembers() {
+	uint16_t boots;
+	uint32_t serial;
+	struct testSettings back;
+
+	CHECK(settings.update(&testSettings::boots, 8) == 2);
+	CHECK(settings.read(&testSettings::boots, boots) == 1 && boots == 8);
+
+	CHECK(settings.update(&testSettings::serial, 99) == 4);
+	uint32_t data = getPersistentAreaAddress((char*)"settings");
+	CHECK(!memcmp(testMemory + data + offsetof(struct testSettings, serial), "\x63\0\0\0", 4));
+	CHECK(settings.read(&testSettings::serial, serial) == 1 && serial == 99);
+
+	CHECK(settings.load(back) == 1 && back.volume == 3 && back.boots == 8 && !strcmp(back.label, "hi"));
+
+	CHECK(checked.begin() == 2 && checked.begin() == 1);
+	CHECK(checked.update(&testSettings::volume, 9) == 1);
+	CHECK(persistentVerifyArea(checked.handle()) == 1);
+	CHECK(checked.remove() == 1 && !checked.exists());
+}
+
+int main() {
+	testFormatted(0, 0);
+	testStore();
+	testMembers();
+	return 0;
+}
@@ -0,0 +1,243 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <testAsync.cpp> - Tests of the asynchronous write queue.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+#include "TestSupport.h"
+
+//
+//  The simulated EEPROM, with its ready hook, behind a backend that logs
+//  the address of every programmed byte and can drop the byte at one
+//  address, like a worn cell.
+//
+static struct persistentBackend testAsyncBackend;
+static uint32_t testLog[1024];
+static uint16_t testLogged;
+static uint32_t testDropAddr;
+
+static void testAsyncWrite(void* device, uint32_t addr, const char* data, uint16_t size) {
+	for (uint16_t i = 0; i < size; i++) {
+		if (testLogged < sizeof(testLog) / sizeof(testLog[0]))
+			testLog[testLogged++] = addr + i;
+
+		if (addr + i != testDropAddr)
+			testSimBackend.write(device, addr + i, data + i, 1);
+	}
+}
+
+static struct persistentAreaHandle testA;
+static struct persistentAreaHandle testB;
+
+static void testSetup() {
+	//
+	//  The last byte of the previous test is verified on the next step,
+	//  before its memory is erased
+	//
+	persistentAsyncFlush();
+	testFormatted(0, 0);
+	testAsyncBackend       = testSimBackend;
+	testAsyncBackend.write = testAsyncWrite;
+	persistentSetBackend(&testAsyncBackend);
+	testLogged   = 0;
+	testDropAddr = 0xffffffff;
+
+	CHECK(newPersistentArea((char*)"a", 16, &testA, PERSISTENT_CHECK_CRC16) > 0);
+	CHECK(newPersistentArea((char*)"b", 16, &testB, PERSISTENT_CHECK_CRC16) > 0);
+	CHECK(persistentAsyncFlush() >= 0);
+	persistentResetAsyncStats();
+}
+
+//
+//  Runs the main loop, doing 1 ms of other work between polls, until the
+//  queue is drained.
+//
+static void testDrain() {
+	while (persistentPoll())
+		persistentSimAdvance(&testSimDevice, 1000000);
+}
+
+//
+//  A write that does not fit now returns -2, one that never fits -3.
+//  Neither queues anything.
+//
+static void testQueueFull() {
+	char data[40];
+	struct persistentAsyncStats stats;
+
+	testSetup();
+
+	memset(data, 1, 16);
+	CHECK(persistentWriteAreaAsync(&testA, 16, data) == 16);
+	CHECK(persistentAsyncPending() >= 17);
+
+	memset(data, 2, 16);
+	CHECK(persistentWriteAreaAsync(&testB, 16, data) == -2);
+	CHECK(persistentAsyncPending() >= 17);
+
+	testDrain();
+	CHECK(persistentWriteAreaAsync(&testB, 16, data) == 16);
+	testDrain();
+
+	struct persistentAreaHandle big;
+	CHECK(newPersistentArea((char*)"big", 40, &big, PERSISTENT_CHECK_NONE) > 0);
+	persistentResetAsyncStats();
+
+	memset(data, 3, 40);
+	CHECK(persistentWriteAreaAsync(&big, 40, data) == -3);
+	persistentGetAsyncStats(&stats);
+	CHECK(stats.queued == 0 && persistentAsyncPending() == 0);
+	CHECK(testMemory[big.data] == 0xff);
+	CHECK(persistentWriteAreaAsync(&big, 39, data) == 0);
+}
+
+//
+//  Synchronous writes and persistentAsyncFlush() program every queued byte
+//  before anything else, and the last write wins.
+//
+static void testOrdering() {
+	char data[16];
+	char back[16];
+
+	testSetup();
+
+	memset(data, 1, 16);
+	CHECK(persistentWriteAreaAsync(&testA, 16, data) == 16);
+	uint16_t queued = persistentAsyncPending();
+	CHECK(queued > 0);
+
+	testLogged = 0;
+	memset(data, 2, 16);
+	CHECK(persistentWriteArea(&testB, 16, data) == 16);
+	CHECK(persistentAsyncPending() == 0);
+
+	//
+	//  The queued data bytes of "a" and then its checksum, before any byte
+	//  of "b"
+	//
+	uint16_t i = 0;
+	while (i < testLogged && testLog[i] >= testA.data - 2 && testLog[i] < testA.data + 16)
+		i++;
+	CHECK(i == queued);
+	for (; i < testLogged; i++)
+		CHECK(testLog[i] >= testB.data - 2 && testLog[i] < testB.data + 16);
+
+	memset(data, 3, 16);
+	CHECK(persistentWriteAreaAsync(&testA, 16, data) == 16);
+	queued = persistentAsyncPending();
+	CHECK(queued > 0 && persistentAsyncFlush() == queued);
+	CHECK(persistentAsyncPending() == 0 && persistentAsyncFlush() == 0);
+	CHECK(!memcmp(testMemory + testA.data, data, 16));
+
+	memset(data, 4, 16);
+	CHECK(persistentWriteAreaAsync(&testA, 16, data) == 16);
+	memset(data, 5, 16);
+	CHECK(persistentWriteArea(&testA, 16, data) == 16);
+	CHECK(persistentReadArea(&testA, 16, back) == 1 && !memcmp(back, data, 16));
+	CHECK(persistentVerifyArea(&testA) == 1);
+}
+
+//
+//  Reads see the queued bytes before they are programmed.
+//
+static void testReadYourWrites() {
+	char data[16];
+	char back[16];
+	char second[16];
+
+	testSetup();
+
+	memset(data, 6, 16);
+	data[15] = 7;
+	CHECK(persistentWriteAreaAsync(&testA, 16, data) == 16);
+	CHECK(testMemory[testA.data + 15] == 0xff);
+
+	persistentAsyncRead(testA.data, back, 16);
+	CHECK(!memcmp(back, data, 16));
+	CHECK(persistentReadArea(&testA, 16, back) == 1 && !memcmp(back, data, 16));
+	CHECK(persistentVerifyArea(&testA) == 1);
+
+	//
+	//  More writes of the same bytes before the first is programmed
+	//
+	memcpy(second, data, 16);
+	second[15] = 8;
+	CHECK(persistentWriteAreaAsync(&testA, 16, second) == 16);
+	CHECK(persistentReadArea(&testA, 16, back) == 1 && !memcmp(back, second, 16));
+	CHECK(persistentWriteAreaAsync(&testA, 16, data) == 16);
+	CHECK(testMemory[testA.data + 15] == 0xff);
+	CHECK(persistentReadArea(&testA, 16, back) == 1 && !memcmp(back, data, 16));
+
+	testDrain();
+	CHECK(!memcmp(testMemory + testA.data, data, 16));
+	CHECK(persistentVerifyArea(&testA) == 1);
+}
+
+//
+//  A byte that does not read back as written is reported.
+//
+static void testVerifyFailure() {
+	char data[16];
+	struct persistentAsyncStats stats;
+
+	testSetup();
+
+	memset(data, 9, 16);
+	testDropAddr = testA.data + 7;
+	CHECK(persistentWriteAreaAsync(&testA, 16, data) == 16);
+	CHECK(persistentAsyncFlush() == -1);
+
+	persistentGetAsyncStats(&stats);
+	CHECK(stats.failed == 1 && stats.failedAddr == testDropAddr);
+	CHECK(stats.queued == 18 && stats.programmed == 18 && stats.pending == 0);
+	CHECK(persistentVerifyArea(&testA) == -3);
+
+	testDropAddr = 0xffffffff;
+	CHECK(persistentAsyncFlush() == 0);
+}
+
+int main() {
+	testQueueFull();
+	testOrdering();
+	testReadYourWrites();
+	testVerifyFailure();
+	return 0;
+}
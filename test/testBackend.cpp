@@ -0,0 +1,117 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <testBackend.cpp> - Tests of the simulated EEPROM backend.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+#include "TestSupport.h"
+
+//
+//  The latency, wear and ready model of the simulated EEPROM.
+//
+static void testSimModel() {
+	struct persistentSimStats stats;
+
+	testVirgin(0);
+	persistentResetSimStats(&testSimDevice);
+
+	testSimBackend.write(testSimBackend.device, 100, "abc", 3);
+	testSimBackend.write(testSimBackend.device, 101, "x", 1);
+
+	char data[5];
+	testSimBackend.read(testSimBackend.device, 99, data, 5);
+	CHECK(!memcmp(data + 1, "axc", 3) && data[0] == (char)0xff);
+
+	persistentGetSimStats(&testSimDevice, &stats);
+	CHECK(stats.writes == 2 && stats.bytesProgrammed == 4);
+	CHECK(stats.reads == 1 && stats.bytesRead == 5);
+	CHECK(stats.timeNs == 4 * PERSISTENT_SIM_PROGRAM_NS + 5 * PERSISTENT_SIM_READ_NS);
+	CHECK(stats.hottestCell == 101 && stats.hottestWear == 2);
+	CHECK(testWear[100] == 1 && testWear[102] == 1 && testWear[103] == 0);
+
+	//
+	//  The last byte is still being programmed until the caller's clock
+	//  has moved on by the program latency.
+	//
+	CHECK(!testSimBackend.ready(testSimBackend.device));
+	persistentSimAdvance(&testSimDevice, PERSISTENT_SIM_PROGRAM_NS);
+	CHECK(testSimBackend.ready(testSimBackend.device));
+
+	persistentResetSimStats(&testSimDevice);
+	persistentGetSimStats(&testSimDevice, &stats);
+	CHECK(stats.timeNs == 0 && stats.hottestWear == 0);
+}
+
+//
+//  Writing an area programs only the bytes that change, which the
+//  simulated wear shows.
+//
+static void testSimWrites() {
+	struct persistentSimStats   stats;
+	struct persistentWriteStats engine;
+	struct persistentAreaHandle handle;
+	uint32_t counter;
+
+	testFormatted(0, 0);
+	CHECK(newPersistentArea((char*)"counter", 8, &handle) > 0);
+
+	persistentResetSimStats(&testSimDevice);
+	persistentResetWriteStats();
+	for (counter = 0; counter < 100; counter++) {
+		char data[8];
+		memset(data, 0, sizeof(data));
+		memcpy(data, &counter, sizeof(counter));
+		CHECK(persistentWriteArea(&handle, sizeof(data), data) == sizeof(data));
+	}
+
+	persistentGetSimStats(&testSimDevice, &stats);
+	persistentGetWriteStats(&engine);
+	CHECK(engine.compared == 800);
+	CHECK(stats.bytesProgrammed == engine.programmed);
+	CHECK(stats.hottestCell == handle.data && stats.hottestWear == 100);
+	CHECK(testWear[handle.data + 4] == 1 && testWear[handle.data + 7] == 1);
+}
+
+int main() {
+	testSimModel();
+	testSimWrites();
+	return 0;
+}
@@ -0,0 +1,309 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <testCache.cpp> - Tests of the write-back cache.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+
+#include "TestSupport.h"
+
+#if PERSISTENT_CACHE_SIZE > 0
+
+#define TEST_DATA    24
+
+/**----------------------------------------------------------------------------
+ *
+ *  Returns the bytes programmed since the stats were reset.
+ *
+ *---------------------------------------------------------------------------*/
+static uint32_t testProgrammed() {
+	struct persistentSimStats stats;
+
+	persistentGetSimStats(&testSimDevice, &stats);
+	return stats.bytesProgrammed;
+}
+
+//
+//  Writing a cached area only changes RAM, until it is committed. Then
+//  just the changed bytes and the checksum are programmed. Data that was
+//  not committed is gone after a reset.
+//
+static void testWriteBack() {
+	struct persistentAreaHandle handle;
+	char data[TEST_DATA];
+	char read[TEST_DATA];
+
+	testFormatted(0, 0);
+	CHECK(newPersistentArea((char*)"a", TEST_DATA, &handle, PERSISTENT_CHECK_CRC16) > 0);
+	testFill("a", TEST_DATA, 1);
+	CHECK(persistentCacheArea(&handle) == 1);
+	CHECK(persistentCacheArea(&handle) == 1);
+
+	for (uint16_t i = 0; i < TEST_DATA; i++)
+		data[i] = (char)(1 + i);
+	data[2] = data[3] = data[4] = 'x';
+
+	persistentResetSimStats(&testSimDevice);
+	CHECK(persistentWriteArea(&handle, TEST_DATA, data) == TEST_DATA);
+	CHECK(persistentWriteArea(&handle, TEST_DATA, data) == TEST_DATA);
+	CHECK(testProgrammed() == 0);
+	CHECK(persistentDirtyBytes() == 3);
+	CHECK(persistentReadArea(&handle, TEST_DATA, read) == 1 && !memcmp(read, data, TEST_DATA));
+	CHECK(persistentReadAreaRange(&handle, 2, 3, read) == 1 && !memcmp(read, "xxx", 3));
+
+	CHECK(persistentCommit() == 3);
+	CHECK(testProgrammed() <= 3 + PERSISTENT_CHECK_CRC16);
+	CHECK(persistentDirtyBytes() == 0);
+	CHECK(persistentCommit() == 0);
+	CHECK(persistentVerifyArea(&handle) == 1);
+
+	CHECK(persistentWriteAreaRange(&handle, 10, 1, (char*)"y") == 1);
+	testReboot();
+	CHECK(openPersistentArea((char*)"a", &handle) == 1);
+	CHECK(persistentReadArea(&handle, TEST_DATA, read) == 1 && !memcmp(read, data, TEST_DATA));
+}
+
+//
+//  More changed runs than PERSISTENT_CACHE_RANGES are merged into the
+//  nearest range, and all of them are committed.
+//
+static void testRanges() {
+	struct persistentAreaHandle handle;
+	char read[TEST_DATA];
+
+	testFormatted(0, 0);
+	CHECK(newPersistentArea((char*)"a", TEST_DATA, &handle, PERSISTENT_CHECK_CRC32) > 0);
+	testFill("a", TEST_DATA, 1);
+	CHECK(persistentCacheArea(&handle) == 1);
+
+	for (uint16_t i = 0; i < 2 * PERSISTENT_CACHE_RANGES && 3 * i < TEST_DATA; i++)
+		CHECK(persistentWriteAreaRange(&handle, 3 * i, 1, (char*)"z") == 1);
+	CHECK(persistentDirtyBytes() >= PERSISTENT_CACHE_RANGES);
+	CHECK(persistentCommit() > 0);
+
+	testReboot();
+	CHECK(openPersistentArea((char*)"a", &handle) == 1);
+	CHECK(persistentReadArea(&handle, TEST_DATA, read) == 1);
+	for (uint16_t i = 0; i < TEST_DATA; i++) {
+		bool changed = i % 3 == 0 && i / 3 < 2 * PERSISTENT_CACHE_RANGES;
+		CHECK(read[i] == (changed ? 'z' : (char)(1 + i)));
+	}
+}
+
+//
+//  The cache commits itself once PERSISTENT_CACHE_DIRTY_MAX bytes are
+//  dirty, and when persistentCommitPoll() finds dirty data older than the
+//  commit interval.
+//
+static void testAutoCommit() {
+	struct persistentAreaHandle handle;
+	char data[PERSISTENT_CACHE_SIZE];
+
+	testFormatted(0, 0);
+	CHECK(newPersistentArea((char*)"a", PERSISTENT_CACHE_SIZE, &handle) > 0);
+	CHECK(persistentCacheArea(&handle) == 1);
+
+#if PERSISTENT_CACHE_DIRTY_MAX > 0 && PERSISTENT_CACHE_DIRTY_MAX <= PERSISTENT_CACHE_SIZE
+	memset(data, 1, PERSISTENT_CACHE_DIRTY_MAX);
+	CHECK(persistentWriteAreaRange(&handle, 0, PERSISTENT_CACHE_DIRTY_MAX, data) ==
+		  PERSISTENT_CACHE_DIRTY_MAX);
+	CHECK(persistentDirtyBytes() == 0);
+	CHECK(testMemory[handle.data] == 1);
+#else
+	(void)data;
+#endif
+
+	persistentSetCommitInterval(100);
+	CHECK(persistentWriteAreaRange(&handle, 0, 1, (char*)"p") == 1);
+	CHECK(persistentCommitPoll(1000) == 0);
+	CHECK(persistentCommitPoll(1099) == 0);
+	CHECK(testMemory[handle.data] != 'p');
+	CHECK(persistentCommitPoll(1100) == 1);
+	CHECK(testMemory[handle.data] == 'p');
+	CHECK(persistentCommitPoll(5000) == 0);
+	persistentSetCommitInterval(0);
+}
+
+//
+//  The pool and the number of cached areas are bounded. Uncaching commits
+//  an area, freeing discards its dirty data.
+//
+static void testLimits() {
+	struct persistentAreaHandle big, a, b, c;
+	char read[8];
+
+	testFormatted(0, 0);
+	CHECK(newPersistentArea((char*)"big", PERSISTENT_CACHE_SIZE + 1, &big) > 0);
+	CHECK(persistentCacheArea(&big) == -1);
+
+	a.header = 0;
+	CHECK(persistentCacheArea(&a) == -3);
+
+	CHECK(newPersistentArea((char*)"a", 8, &a) > 0);
+	CHECK(newPersistentArea((char*)"b", 8, &b) > 0);
+	CHECK(newPersistentArea((char*)"c", 8, &c) > 0);
+	CHECK(persistentCacheArea(&a) == 1);
+	CHECK(persistentCacheArea(&b) == 1);
+	if (PERSISTENT_CACHE_AREAS == 2)
+		CHECK(persistentCacheArea(&c) == -2);
+
+	CHECK(persistentWriteArea(&a, 8, (char*)"01234567") == 8);
+	CHECK(persistentUncacheArea(&a) == 8);
+	CHECK(persistentUncacheArea(&a) == 0);
+	CHECK(persistentDirtyBytes() == 0);
+	CHECK(!memcmp(testMemory + a.data, "01234567", 8));
+
+	CHECK(persistentWriteArea(&b, 8, (char*)"abcdefgh") == 8);
+	CHECK(freePersistentArea((char*)"b") > 0);
+	CHECK(persistentDirtyBytes() == 0);
+	CHECK(persistentCommit() == 0);
+
+	CHECK(persistentCacheArea(&c) == 1);
+	CHECK(persistentReadArea(&c, 8, read) == 1);
+}
+
+static struct persistentAreaHandle testCached;
+
+static void testMoved(char* name, uint32_t oldData, uint32_t newData) {
+	(void)name;
+	persistentMoveHandle(&testCached, oldData, newData);
+}
+
+//
+//  Dirty data of an area moved by compaction is committed to where the
+//  area was moved.
+//
+static void testCompaction() {
+	char read[TEST_DATA];
+
+	testFormatted(0, 0);
+	CHECK(newPersistentArea((char*)"x", 40) > 0);
+	CHECK(newPersistentArea((char*)"a", TEST_DATA, &testCached, PERSISTENT_CHECK_CRC16) > 0);
+	testFill("a", TEST_DATA, 1);
+	uint32_t before = testCached.data;
+
+	CHECK(persistentCacheArea(&testCached) == 1);
+	CHECK(persistentWriteAreaRange(&testCached, 0, 4, (char*)"move") == 4);
+	CHECK(freePersistentArea((char*)"x") > 0);
+	CHECK(persistentCompact(testMoved) > 0);
+	CHECK(testCached.data < before);
+
+	CHECK(persistentCommit() == 4);
+	testReboot();
+	CHECK(persistentReadArea((char*)"a", TEST_DATA, read) == 1);
+	CHECK(!memcmp(read, "move", 4) && read[4] == 5);
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Commits two dirty ranges of a cached area with a checksum, with the
+ *  power cut after budget programmed bytes. After a reboot the area must
+ *  read as the old or the new data, or as not matching its checksum.
+ *
+ * @return  The result of reading the area after the reboot
+ *
+ *---------------------------------------------------------------------------*/
+static int16_t testCacheRun(long budget) {
+	struct persistentAreaHandle handle;
+	char before[TEST_DATA];
+	char after[TEST_DATA];
+	char read[TEST_DATA];
+
+	testFormatted(&testCutBackend, 0);
+	CHECK(newPersistentArea((char*)"a", TEST_DATA, &handle, PERSISTENT_CHECK_CRC16) > 0);
+	for (uint16_t i = 0; i < TEST_DATA; i++)
+		before[i] = after[i] = (char)i;
+	CHECK(persistentWriteArea(&handle, TEST_DATA, before) == TEST_DATA);
+
+	memcpy(after + 2, "ab", 2);
+	memcpy(after + 20, "cd", 2);
+	CHECK(persistentCacheArea(&handle) == 1);
+	CHECK(persistentWriteArea(&handle, TEST_DATA, after) == TEST_DATA);
+
+	testBudget = budget;
+	persistentCommit();
+
+	testReboot();
+	CHECK(openPersistentArea((char*)"a", &handle) == 1);
+
+	int16_t rv = persistentReadArea(&handle, TEST_DATA, read);
+	CHECK(rv == -3 || (rv == 1 && (!memcmp(read, before, TEST_DATA) ||
+			                       !memcmp(read, after, TEST_DATA))));
+	return rv;
+}
+
+//
+//  A commit cut at any byte leaves the old data, the new data or data that
+//  does not match its checksum.
+//
+static void testPowerCut() {
+	int mismatches = 0;
+
+	for (long budget = 0; budget <= 4 + PERSISTENT_CHECK_CRC16; budget++)
+		mismatches += testCacheRun(budget) == -3;
+
+	CHECK(mismatches > 0);
+	CHECK(testCacheRun(-1) == 1);
+}
+
+int main() {
+	testWriteBack();
+	testRanges();
+	testAutoCommit();
+	testLimits();
+	testCompaction();
+	testPowerCut();
+	return 0;
+}
+
+#else
+
+int main() {
+	struct persistentAreaHandle handle;
+
+	testFormatted(0, 0);
+	CHECK(newPersistentArea((char*)"a", 8, &handle) > 0);
+	CHECK(persistentCacheArea(&handle) == -3);
+	CHECK(persistentCommit() == 0);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,386 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <testCompact.cpp> - Tests of compaction and its journal.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+
+#include "TestSupport.h"
+
+#define TEST_AREAS  40
+
+static char testName[TEST_AREAS][8];
+
+static uint16_t testAreaSize(int i) {
+	return 8 + (i * 37) % 90;
+}
+
+//
+//  Allocates TEST_AREAS areas of various sizes, each filled with its own
+//  pattern, and frees every other one.
+//
+static void testFragment() {
+	for (int i = 0; i < TEST_AREAS; i++) {
+		sprintf(testName[i], "c%02d", i);
+		CHECK(newPersistentArea(testName[i], testAreaSize(i)) > 0);
+		testFill(testName[i], testAreaSize(i), (uint8_t)(i * 11));
+	}
+
+	for (int i = 1; i < TEST_AREAS; i += 2)
+		CHECK(freePersistentArea(testName[i]) > 0);
+}
+
+static void testCheckKept() {
+	for (int i = 0; i < TEST_AREAS; i += 2)
+		testCheckFill(testName[i], testAreaSize(i), (uint8_t)(i * 11), testAreaSize(i));
+
+	for (int i = 1; i < TEST_AREAS; i += 2)
+		CHECK(getPersistentAreaAddress(testName[i]) == 0);
+}
+
+//
+//  A store that was never formatted has no journal, its chain may run up
+//  to the calibration data. Data where a formatted store keeps its journal
+//  must survive a reboot, even if it looks like an active move, and it
+//  must not be used to merge cells or resize in place.
+//
+static void testUnformatted() {
+	testVirgin(0);
+	CHECK(!persistentIsFormatted());
+	CHECK(getFreeStorageAreaEnd() == TEST_SIZE);
+
+	CHECK(newPersistentArea((char*)"a", 30) > 0);
+	CHECK(newPersistentArea((char*)"b", 30) > 0);
+	CHECK(newPersistentArea((char*)"x", 30) > 0);
+	uint32_t a = getPersistentHeaderAddress((char*)"a");
+	uint32_t b = getPersistentHeaderAddress((char*)"b");
+	uint32_t c = getPersistentHeaderAddress((char*)"x") + PERSISTENT_AREA_PREFIX_SIZE + 30;
+	CHECK(newPersistentArea((char*)"c", TEST_SIZE - c - PERSISTENT_AREA_PREFIX_SIZE) > 0);
+	testFill("a", 30, 1);
+	testFill("b", 30, 2);
+	testFill("x", 30, 3);
+
+	//
+	//  The last bytes of "c" read as a move of "b" over "a"
+	//
+	uint16_t journal[11] = {
+		(uint16_t)b, (uint16_t)~b, (uint16_t)a, (uint16_t)~a, 50, (uint16_t)~50,
+		50, (uint16_t)~50, 50, (uint16_t)~50, 0x4a43
+	};
+	CHECK(persistentStore(TEST_SIZE - sizeof(journal), (char*)journal, sizeof(journal)) > 0);
+
+	uint8_t image[TEST_SIZE];
+	memcpy(image, testMemory, sizeof(image));
+
+	testReboot();
+	CHECK(getFreeStorageAreaEnd() == TEST_SIZE);
+	CHECK(!memcmp(testMemory, image, sizeof(image)));
+	testCheckFill("a", 30, 1, 30);
+	testCheckFill("b", 30, 2, 30);
+
+	CHECK(persistentCompact(0) == -2);
+	CHECK(resizePersistentArea((char*)"a", 20) == -5);
+
+	memcpy(testMemory, image, sizeof(image));
+	testReboot();
+	CHECK(freePersistentArea((char*)"a") > 0);
+	CHECK(freePersistentArea((char*)"b") > 0);
+	CHECK(!memcmp(testMemory + c, image + c, TEST_SIZE - c));
+	testCheckFill("x", 30, 3, 30);
+
+	int freeCells;
+	CHECK(testWalk(&freeCells) == 2 && freeCells == 2);
+
+	//
+	//  Nor is the commit of an upgrade completed, "c" runs into the journal
+	//
+	uint32_t x = getPersistentHeaderAddress((char*)"x");
+	uint16_t upgrade[11] = {
+		(uint16_t)b, (uint16_t)~b, (uint16_t)x, (uint16_t)~x, 50, (uint16_t)~50,
+		3, (uint16_t)~3, 0, 0xffff, 0x4a55
+	};
+	memcpy(testMemory, image, sizeof(image));
+	CHECK(persistentStore(TEST_SIZE - sizeof(upgrade), (char*)upgrade, sizeof(upgrade)) > 0);
+	memcpy(image, testMemory, sizeof(image));
+
+	testReboot();
+	CHECK(!persistentIsFormatted());
+	CHECK(!memcmp(testMemory, image, sizeof(image)));
+
+	//
+	//  Formatting reserves the journal again
+	//
+	CHECK(persistentFormat() == 1);
+	CHECK(getFreeStorageAreaEnd() == TEST_SIZE - PERSISTENT_JOURNAL_SIZE);
+	for (uint32_t x = TEST_SIZE - PERSISTENT_JOURNAL_SIZE; x < TEST_SIZE; x++)
+		CHECK(testMemory[x] == 0xff);
+}
+
+//
+//  Compaction of a formatted store leaves a single chain of the kept areas.
+//
+static int testMoves;
+
+static void testMoved(char* name, uint32_t oldData, uint32_t newData) {
+	(void)name;
+	CHECK(newData < oldData);
+	testMoves++;
+}
+
+static void testCompact(uint8_t features) {
+	testFormatted(0, features);
+	testFragment();
+
+	testMoves = 0;
+	CHECK(persistentCompact(testMoved) > 0);
+	CHECK(testMoves == TEST_AREAS / 2 - 1);
+
+	int freeCells;
+	CHECK(testWalk(&freeCells) == TEST_AREAS / 2 && freeCells == 0);
+	testCheckKept();
+
+	CHECK(persistentCompact(0) == 0);
+}
+
+//
+//  Cuts the power after every number of bytes programmed by a compaction.
+//  After the reboot the chain is valid, the kept areas hold their data and
+//  compacting again completes the work.
+//
+static void testCompactPowerCut(uint8_t features) {
+	testFormatted(&testCutBackend, features);
+	testFragment();
+
+	uint8_t image[TEST_SIZE];
+	memcpy(image, testMemory, sizeof(image));
+
+	for (long budget = 0; ; budget++) {
+		memcpy(testMemory, image, sizeof(image));
+		testReboot();
+
+		testBudget = budget;
+		persistentCompact(0);
+		bool cut = (testBudget == 0);
+
+		testReboot();
+		CHECK(testWalk(0) == TEST_AREAS / 2);
+		testCheckKept();
+
+		CHECK(persistentCompact(0) >= 0);
+		int freeCells;
+		CHECK(testWalk(&freeCells) == TEST_AREAS / 2 && freeCells == 0);
+		testCheckKept();
+
+		if (!cut)
+			break;
+	}
+}
+
+//
+//  Builds a store that was not formatted from cells of the given data
+//  sizes, filled with their own pattern. The cells marked in freed are
+//  freed, in the middle of the chain they stay freed cells.
+//
+#define TEST_UPGRADE_CELLS  8
+
+static int      testCells;
+static uint16_t testCellSize[TEST_UPGRADE_CELLS];
+static bool     testCellFreed[TEST_UPGRADE_CELLS];
+
+static void testUnformattedStore(const struct persistentBackend* backend,
+		                         int cells, const uint16_t* sizes, const bool* freed) {
+	testVirgin(backend);
+	testCells = cells;
+	for (int i = 0; i < cells; i++) {
+		sprintf(testName[i], "u%02d", i);
+		testCellSize[i]  = sizes[i];
+		testCellFreed[i] = freed[i];
+		CHECK(newPersistentArea(testName[i], sizes[i]) > 0);
+		testFill(testName[i], sizes[i], (uint8_t)(i * 13));
+	}
+
+	for (int i = 0; i < cells; i++)
+		if (freed[i])
+			CHECK(freePersistentArea(testName[i]) > 0);
+}
+
+static void testCheckCells() {
+	int areas = 0;
+	for (int i = 0; i < testCells; i++) {
+		if (testCellFreed[i]) {
+			CHECK(getPersistentAreaAddress(testName[i]) == 0);
+			continue;
+		}
+		testCheckFill(testName[i], testCellSize[i], (uint8_t)(i * 13), testCellSize[i]);
+		areas++;
+	}
+
+	CHECK(testWalk(0) == areas);
+	CHECK(persistentAreaCount() == areas);
+}
+
+//
+//  Upgrading keeps every area, the areas in front of PERSISTENT_FORMAT_START
+//  are copied to the end of the chain. Afterwards the store has a journal
+//  and can be compacted.
+//
+static void testUpgrade(int cells, const uint16_t* sizes, const bool* freed) {
+	testUnformattedStore(0, cells, sizes, freed);
+	CHECK(!persistentIsFormatted());
+
+	CHECK(persistentUpgrade() == 1);
+	CHECK(persistentIsFormatted() && !persistentIsCompact());
+	CHECK(getFreeStorageAreaStart() == PERSISTENT_FORMAT_START);
+	CHECK(getFreeStorageAreaEnd() == TEST_SIZE - PERSISTENT_JOURNAL_SIZE);
+	testCheckCells();
+
+	testReboot();
+	testCheckCells();
+
+	CHECK(persistentUpgrade() == 1);
+	CHECK(persistentCompact(0) >= 0);
+	int freeCells;
+	testWalk(&freeCells);
+	CHECK(freeCells == 0);
+	testCheckCells();
+}
+
+//
+//  An upgrade that finds no room leaves the store as it was
+//
+static void testUpgradeNoRoom() {
+	uint8_t image[TEST_SIZE];
+
+	//
+	//  The last area runs into the memory of the journal
+	//
+	testVirgin(0);
+	CHECK(newPersistentArea((char*)"a", 30) > 0);
+	uint32_t end = getPersistentHeaderAddress((char*)"a") + PERSISTENT_AREA_PREFIX_SIZE + 30;
+	CHECK(newPersistentArea((char*)"b", TEST_SIZE - end - PERSISTENT_AREA_PREFIX_SIZE - 10) > 0);
+	memcpy(image, testMemory, sizeof(image));
+	CHECK(persistentUpgrade() == -3);
+	CHECK(!persistentIsFormatted());
+	CHECK(!memcmp(testMemory, image, sizeof(image)));
+
+	//
+	//  The first area does not fit in front of the journal
+	//
+	CHECK(freePersistentArea((char*)"b") > 0);
+	CHECK(newPersistentArea((char*)"b", TEST_SIZE - end - PERSISTENT_AREA_PREFIX_SIZE -
+			                            PERSISTENT_JOURNAL_SIZE - 40) > 0);
+	memcpy(image, testMemory, sizeof(image));
+	CHECK(persistentUpgrade() == -3);
+	CHECK(!memcmp(testMemory, image, sizeof(image)));
+
+	//
+	//  After freeing the last area it fits
+	//
+	CHECK(freePersistentArea((char*)"b") > 0);
+	CHECK(persistentUpgrade() == 1);
+	testCheckFill("a", 30, 0xff, 0);
+	CHECK(persistentCompact(0) > 0);
+	CHECK(getPersistentHeaderAddress((char*)"a") == PERSISTENT_FORMAT_START);
+}
+
+//
+//  Cuts the power after every number of bytes programmed by an upgrade.
+//  After the reboot every area is intact, in a store that is formatted or
+//  not, and upgrading again completes the work.
+//
+static void testUpgradePowerCut(int cells, const uint16_t* sizes, const bool* freed) {
+	testUnformattedStore(&testCutBackend, cells, sizes, freed);
+
+	uint8_t image[TEST_SIZE];
+	memcpy(image, testMemory, sizeof(image));
+
+	for (long budget = 0; ; budget++) {
+		memcpy(testMemory, image, sizeof(image));
+		testReboot();
+
+		testBudget = budget;
+		persistentUpgrade();
+		bool cut = (testBudget == 0);
+
+		testReboot();
+		testCheckCells();
+
+		CHECK(persistentUpgrade() == 1);
+		CHECK(getFreeStorageAreaStart() == PERSISTENT_FORMAT_START);
+		testCheckCells();
+
+		if (!cut)
+			break;
+	}
+}
+
+int main() {
+	//
+	//  A cell from EPR_SUPERBLOCK past PERSISTENT_FORMAT_START, one ending at
+	//  it, one ending too close behind it, a freed one in front of it, a
+	//  chain ending in front of it and a virgin store
+	//
+	static const uint16_t straddle[] = { 30, 40, 20, 8, 50 };
+	static const bool     kept[]     = { false, false, true, false, false };
+	static const uint16_t ending[]   = { 0, 12, 30 };
+	static const uint16_t close[]    = { 5, 12, 30 };
+	static const bool     none[]     = { false, false, false };
+	static const bool     front[]    = { true, false, false };
+	static const uint16_t tiny[]     = { 3 };
+
+	testUpgrade(5, straddle, kept);
+	testUpgrade(3, ending, none);
+	testUpgrade(3, close, none);
+	testUpgrade(3, close, front);
+	testUpgrade(1, tiny, none);
+	testUpgrade(0, 0, 0);
+	testUpgradeNoRoom();
+	testUpgradePowerCut(5, straddle, kept);
+	testUpgradePowerCut(3, close, front);
+	testUpgradePowerCut(1, tiny, none);
+
+	testUnformatted();
+	testCompact(0);
+	testCompact(PERSISTENT_FEATURE_COMPACT);
+	testCompactPowerCut(0);
+	testCompactPowerCut(PERSISTENT_FEATURE_COMPACT);
+	return 0;
+}
@@ -0,0 +1,179 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <testCrc.cpp> - Tests of the area checksums.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+
+#include "TestSupport.h"
+
+#define TEST_DATA    24
+
+//
+//  The checksums match the standard check values, also when the data is
+//  added in pieces that do not line up with the 4 byte steps.
+//
+static void testCheckValues() {
+	const char* digits = "123456789";
+
+	CHECK(persistentChecksum(digits, 9, PERSISTENT_CHECK_CRC16) == 0x6f91);
+	CHECK(persistentChecksum(digits, 9, PERSISTENT_CHECK_CRC32) == 0xcbf43926UL);
+
+	for (uint8_t check = PERSISTENT_CHECK_CRC16; check <= PERSISTENT_CHECK_CRC32; check += 2) {
+		for (uint16_t split = 0; split <= 9; split++) {
+			uint32_t crc = persistentCrcInit(check);
+			crc = persistentCrcUpdate(crc, digits, split, check);
+			crc = persistentCrcUpdate(crc, digits + split, 9 - split, check);
+			CHECK(persistentCrcFinal(crc, check) == persistentChecksum(digits, 9, check));
+		}
+	}
+}
+
+//
+//  A changed byte anywhere in the data is found after a reset, by reading
+//  the area, a range of it or verifying it. Written ranges keep the
+//  checksum valid.
+//
+static void testCorruption() {
+	struct persistentAreaHandle handle;
+	char data[TEST_DATA];
+
+	for (uint8_t check = PERSISTENT_CHECK_CRC16; check <= PERSISTENT_CHECK_CRC32; check += 2) {
+		testFormatted(0, 0);
+		CHECK(newPersistentArea((char*)"c", TEST_DATA, &handle, check) > 0);
+		CHECK(persistentVerifyArea(&handle) == 0);
+
+		testFill("c", TEST_DATA, 1);
+		CHECK(persistentWriteAreaRange(&handle, 5, 3, (char*)"abc") == 3);
+		CHECK(persistentVerifyArea(&handle) == 1);
+
+		for (uint16_t i = 0; i < TEST_DATA; i++) {
+			testMemory[handle.data + i] ^= 0x10;
+
+			testReboot();
+			CHECK(openPersistentArea((char*)"c", &handle) == 1);
+			CHECK(persistentVerifyArea(&handle) == -3);
+			CHECK(persistentReadAreaRange(&handle, 0, 1, data) == -3);
+			CHECK(persistentReadArea(&handle, TEST_DATA, data) == -3);
+
+			testMemory[handle.data + i] ^= 0x10;
+		}
+
+		testReboot();
+		CHECK(openPersistentArea((char*)"c", &handle) == 1);
+		CHECK(persistentReadArea(&handle, TEST_DATA, data) == 1);
+		CHECK(!memcmp(data + 5, "abc", 3));
+	}
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Writes new data over the data of an area with a checksum, all of it or
+ *  a range, with the power cut after budget programmed bytes. After a reboot
+ *  the area must read as the old or the new data, or as not matching its
+ *  checksum, never as a mix.
+ *
+ * @param check   The checksum of the area
+ * @param offset  Offset of the range to write, 0 writes all data
+ * @param len     Length of the range
+ * @param budget  Bytes programmed before the power is cut
+ *
+ * @return  The result of reading the area after the reboot
+ *
+ *---------------------------------------------------------------------------*/
+static int16_t testCrcRun(uint8_t check, uint16_t offset, uint16_t len, long budget) {
+	struct persistentAreaHandle handle;
+	char before[TEST_DATA];
+	char after[TEST_DATA];
+	char data[TEST_DATA];
+
+	testFormatted(&testCutBackend, 0);
+	CHECK(newPersistentArea((char*)"c", TEST_DATA, &handle, check) > 0);
+	for (uint16_t i = 0; i < TEST_DATA; i++) {
+		before[i] = (char)i;
+		after[i]  = (char)~i;
+	}
+	CHECK(persistentWriteArea(&handle, TEST_DATA, before) == TEST_DATA);
+	memcpy(after, before, offset);
+	memcpy(after + offset + len, before + offset + len, TEST_DATA - offset - len);
+
+	testBudget = budget;
+	if (offset || len < TEST_DATA)
+		persistentWriteAreaRange(&handle, offset, len, after + offset);
+	else
+		persistentWriteArea(&handle, TEST_DATA, after);
+
+	testReboot();
+	CHECK(openPersistentArea((char*)"c", &handle) == 1);
+
+	int16_t rv = persistentReadArea(&handle, TEST_DATA, data);
+	CHECK(rv == -3 || (rv == 1 && (!memcmp(data, before, TEST_DATA) ||
+			                       !memcmp(data, after, TEST_DATA))));
+	CHECK(persistentVerifyArea(&handle) == rv);
+
+	return rv;
+}
+
+//
+//  A write cut at any byte leaves the old data, the new data or data that
+//  does not match its checksum. The checksum is written after the data.
+//
+static void testPowerCut() {
+	for (uint8_t check = PERSISTENT_CHECK_CRC16; check <= PERSISTENT_CHECK_CRC32; check += 2) {
+		int mismatches = 0;
+
+		for (long budget = 0; budget <= TEST_DATA + check; budget++)
+			mismatches += testCrcRun(check, 0, TEST_DATA, budget) == -3;
+		for (long budget = 0; budget <= 5 + check; budget++)
+			mismatches += testCrcRun(check, 7, 5, budget) == -3;
+
+		CHECK(mismatches > 0);
+		CHECK(testCrcRun(check, 0, TEST_DATA, -1) == 1);
+		CHECK(testCrcRun(check, 7, 5, -1) == 1);
+	}
+}
+
+int main() {
+	testCheckValues();
+	testCorruption();
+	testPowerCut();
+	return 0;
+}
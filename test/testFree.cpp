@@ -0,0 +1,107 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <testFree.cpp> - Tests of freeing areas and merging freed cells.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+
+
+#include "TestSupport.h"
+
+//
+//  Allocates four areas of 30 bytes, each filled with its own pattern
+//
+static void testFour() {
+	static const char* names[] = { "a", "b", "c", "d" };
+
+	for (uint8_t i = 0; i < 4; i++) {
+		CHECK(newPersistentArea((char*)names[i], 30) > 0);
+		testFill(names[i], 30, (uint8_t)(i * 40));
+	}
+}
+
+//
+//  Freeing two neighbouring areas leaves a single free cell, an area that
+//  only fits in both of them is allocated there rather than at the end of
+//  the chain. Other free cells are not touched.
+//
+static void testMergeHole(int others) {
+	uint32_t b = getPersistentHeaderAddress((char*)"b");
+	CHECK(freePersistentArea((char*)"b") > 0);
+	CHECK(freePersistentArea((char*)"c") > 0);
+
+	int freeCells;
+	CHECK(testWalk(&freeCells) == 2 + others && freeCells == 1 + others);
+
+	CHECK(newPersistentArea((char*)"e", 40) > 0);
+	CHECK(getPersistentHeaderAddress((char*)"e") == b);
+	CHECK(testWalk(&freeCells) == 3 + others && freeCells == 1 + others);
+
+	testCheckFill("a", 30, 0, 30);
+	testCheckFill("d", 30, 120, 30);
+	testCheckFill("e", 40, 0, 0);
+}
+
+//
+//  A store that was not formatted merges its freed cells once upgraded.
+//  The upgrade copies "z" to the end of the chain, the memory it leaves
+//  is a free cell in front of "a".
+//
+static void testMergeUpgraded() {
+	testVirgin(0);
+	CHECK(newPersistentArea((char*)"z", 30) > 0);
+	testFour();
+	CHECK(persistentUpgrade() == 1);
+	testMergeHole(1);
+}
+
+int main() {
+	testFormatted(0, 0);
+	testFour();
+	testMergeHole(0);
+
+	testFormatted(0, PERSISTENT_FEATURE_COMPACT);
+	testFour();
+	testMergeHole(0);
+
+	testMergeUpgraded();
+	return 0;
+}
@@ -0,0 +1,152 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <testIndex.cpp> - Tests of the name index.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+#include "TestSupport.h"
+
+//
+//  Two names with the same 32 bit name hash.
+//
+#define TEST_NAME    "area657939"
+#define TEST_OTHER   "area1614562"
+
+//
+//  An area in the index must not be found under another name that has
+//  the same hash, nor stop that name from being allocated.
+//
+static void testCollision() {
+	testFormatted(0, 0);
+	CHECK(persistentNameHash((char*)TEST_NAME) == persistentNameHash((char*)TEST_OTHER));
+
+	CHECK(newPersistentArea((char*)TEST_NAME, 8) > 0);
+	uint32_t header = getPersistentHeaderAddress((char*)TEST_NAME);
+	CHECK(header != 0);
+
+	CHECK(getPersistentHeaderAddress((char*)TEST_OTHER) == 0);
+	CHECK(getPersistentAreaAddress((char*)TEST_OTHER) == 0);
+
+	struct persistentAreaHandle handle;
+	CHECK(openPersistentArea((char*)TEST_OTHER, &handle) != 1);
+
+	CHECK(newPersistentArea((char*)TEST_OTHER, 12) > 0);
+	uint32_t other = getPersistentHeaderAddress((char*)TEST_OTHER);
+	CHECK(other != 0 && other != header);
+	CHECK(getPersistentHeaderAddress((char*)TEST_NAME) == header);
+
+	testFill(TEST_NAME, 8, 1);
+	testFill(TEST_OTHER, 12, 2);
+	testCheckFill(TEST_NAME, 8, 1, 8);
+	testCheckFill(TEST_OTHER, 12, 2, 12);
+
+	CHECK(freePersistentArea((char*)TEST_NAME) > 0);
+	CHECK(getPersistentHeaderAddress((char*)TEST_NAME) == 0);
+	CHECK(getPersistentHeaderAddress((char*)TEST_OTHER) == other);
+	CHECK(testWalk(0) == 1);
+}
+
+//
+//  A hit reads the name of the header it found, a miss without another
+//  area of the same hash reads nothing.
+//
+static void testLookupReads() {
+	struct persistentSimStats stats;
+	char name[PERSISTENT_AREA_NAME_SIZE + 1];
+
+	testFormatted(0, 0);
+	for (uint8_t i = 0; i < 16; i++) {
+		snprintf(name, sizeof(name), "sensor.ch%02u", i);
+		CHECK(newPersistentArea(name, 8) > 0);
+	}
+
+	persistentResetSimStats(&testSimDevice);
+	for (uint8_t i = 0; i < 16; i++) {
+		snprintf(name, sizeof(name), "sensor.ch%02u", i);
+		CHECK(getPersistentAreaAddress(name) != 0);
+	}
+	persistentGetSimStats(&testSimDevice, &stats);
+	CHECK(stats.bytesRead > 0 && stats.bytesRead <= 16 * PERSISTENT_AREA_NAME_SIZE);
+
+	persistentResetSimStats(&testSimDevice);
+	CHECK(getPersistentAreaAddress((char*)"missing") == 0);
+	persistentGetSimStats(&testSimDevice, &stats);
+	CHECK(stats.bytesRead == 0);
+}
+
+//
+//  The default index holds 40 areas. Entries only keep a byte of the name
+//  hash, areas sharing it are told apart by their names in EEPROM, so every
+//  hit still reads about one name and no miss is taken for a hit.
+//
+static void testFortyAreas() {
+	struct persistentSimStats stats;
+	char name[PERSISTENT_AREA_NAME_SIZE + 1];
+
+	testFormatted(0, 0);
+	for (uint8_t i = 0; i < 40; i++) {
+		snprintf(name, sizeof(name), "sensor.ch%02u", i);
+		CHECK(newPersistentArea(name, 8) > 0);
+	}
+
+	persistentResetSimStats(&testSimDevice);
+	for (uint8_t i = 0; i < 40; i++) {
+		snprintf(name, sizeof(name), "sensor.ch%02u", i);
+		CHECK(getPersistentAreaAddress(name) != 0);
+	}
+	persistentGetSimStats(&testSimDevice, &stats);
+	CHECK(stats.bytesRead > 0 && stats.bytesRead <= 2 * 40 * PERSISTENT_AREA_NAME_SIZE);
+
+	persistentResetSimStats(&testSimDevice);
+	for (uint8_t i = 0; i < 40; i++) {
+		snprintf(name, sizeof(name), "sensor.ax%02u", i);
+		CHECK(getPersistentAreaAddress(name) == 0);
+	}
+	persistentGetSimStats(&testSimDevice, &stats);
+	CHECK(stats.bytesRead <= 40 * PERSISTENT_AREA_NAME_SIZE);
+}
+
+int main() {
+	testCollision();
+	testLookupReads();
+	testFortyAreas();
+	return 0;
+}
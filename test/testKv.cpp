@@ -0,0 +1,263 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <testKv.cpp> - Tests of the key value stores.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+
+#include "TestSupport.h"
+
+#define TEST_KEYS    4
+#define TEST_VALUE   8
+#define TEST_OPS     40
+
+//
+//  A half holds the largest value of every key and one more record,
+//  so no put finds the store full.
+//
+#define TEST_STORE   (2 * (PERSISTENT_KV_SEGMENT_PREFIX + \
+		                   (TEST_KEYS + 1) * (PERSISTENT_KV_RECORD_PREFIX + TEST_VALUE)))
+
+//
+//  The values of the keys of a store, a length of 0 if a key is not there.
+//
+struct testKvState {
+	uint8_t len[TEST_KEYS];
+	char    value[TEST_KEYS][TEST_VALUE];
+};
+
+/**----------------------------------------------------------------------------
+ *
+ *  Checks that a store holds exactly the values of a state.
+ *
+ * @return  True if it does
+ *
+ *---------------------------------------------------------------------------*/
+static bool testKvHolds(struct persistentKvHandle* kv, struct testKvState* state) {
+	char value[TEST_VALUE];
+
+	for (uint16_t key = 0; key < TEST_KEYS; key++) {
+		int16_t len = persistentKvGet(kv, key, value, sizeof(value));
+		if (len != state->len[key] || memcmp(value, state->value[key], len))
+			return false;
+	}
+
+	return true;
+}
+
+/**----------------------------------------------------------------------------
+ *
+ *  Runs a random sequence of puts, removes and collects on a new store,
+ *  with the power cut after budget programmed bytes, -1 for no cut. After
+ *  a reboot the store must hold what it held before the operation that was
+ *  cut, or what it held after it, and take new values.
+ *
+ * @param seed    Seed of the sequence
+ * @param budget  Bytes programmed before the power is cut
+ * @param moved   Counts the cuts during a collection, 0 if not needed.
+ *                The run without a cut must come first, it finds them.
+ *
+ * @return  The bytes the sequence programmed, if it was not cut
+ *
+ *---------------------------------------------------------------------------*/
+static long testKvRun(unsigned seed, long budget, int* moved) {
+	static struct testKvState states[TEST_OPS + 1];
+	static bool collects[TEST_OPS];
+	struct persistentKvHandle kv;
+
+	testFormatted(&testCutBackend, 0);
+	CHECK(newPersistentKvStore((char*)"kv", TEST_STORE, &kv) > 0);
+
+	//
+	//  Once the power is cut writes fail, only the state left behind counts
+	//
+	srand(seed);
+	memset(&states[0], 0, sizeof(states[0]));
+	testBudget = budget < 0 ? 1L << 30 : budget;
+
+	int cut = testBudget == 0 ? 0 : TEST_OPS;
+	for (int i = 0; i < TEST_OPS; i++) {
+		long     before     = testBudget;
+		uint16_t generation = kv.generation;
+		uint16_t key        = rand() % TEST_KEYS;
+		int      op         = rand() % 8;
+
+		states[i + 1] = states[i];
+		if (op == 0)
+			CHECK(persistentKvCollect(&kv) >= 0 || testBudget == 0);
+		else if (op == 1) {
+			CHECK(persistentKvRemove(&kv, key) == (states[i].len[key] ? 1 : 0) || testBudget == 0);
+			states[i + 1].len[key] = 0;
+		}
+		else {
+			char    value[TEST_VALUE];
+			uint8_t len = 1 + rand() % TEST_VALUE;
+			for (uint8_t n = 0; n < len; n++)
+				value[n] = (char)rand();
+
+			CHECK(persistentKvPut(&kv, key, value, len) == len || testBudget == 0);
+			states[i + 1].len[key] = len;
+			memcpy(states[i + 1].value[key], value, len);
+		}
+
+		if (budget < 0)
+			collects[i] = kv.generation != generation;
+
+		if (before > 0 && testBudget == 0) {
+			cut = i;
+			if (moved && collects[i])
+				(*moved)++;
+		}
+	}
+
+	long used = (1L << 30) - testBudget;
+
+	testReboot();
+	CHECK(openPersistentKvStore((char*)"kv", &kv) == 1);
+	CHECK(testKvHolds(&kv, &states[cut]) ||
+		  (cut < TEST_OPS && testKvHolds(&kv, &states[cut + 1])));
+
+	//
+	//  The store goes on after the cut, the log continues where it ended
+	//
+	for (uint16_t key = 0; key < TEST_KEYS; key++)
+		CHECK(persistentKvPut(&kv, key, (char*)&seed, sizeof(seed)) == sizeof(seed));
+
+	testReboot();
+	CHECK(openPersistentKvStore((char*)"kv", &kv) == 1);
+	for (uint16_t key = 0; key < TEST_KEYS; key++) {
+		unsigned value;
+		CHECK(persistentKvGet(&kv, key, (char*)&value, sizeof(value)) == sizeof(value));
+		CHECK(value == seed);
+	}
+
+	return used;
+}
+
+//
+//  Values are found under their key, also after the store is opened
+//  again, and a removed key is gone.
+//
+static void testPutGet() {
+	struct persistentKvHandle kv;
+	char value[16];
+
+	testFormatted(0, 0);
+	CHECK(newPersistentKvStore((char*)"kv", 64, &kv) > 0);
+	CHECK(persistentKvGet(&kv, 1, value, sizeof(value)) == 0);
+	CHECK(persistentKvPut(&kv, 1, "one", 3) == 3);
+	CHECK(persistentKvPut(&kv, 2, "two", 3) == 3);
+	CHECK(persistentKvPut(&kv, 1, "uno", 3) == 3);
+	CHECK(persistentKvPut(&kv, PERSISTENT_KV_NO_KEY, "no", 2) == 0);
+	CHECK(persistentKvGet(&kv, 1, value, 2) == -2);
+
+	CHECK(openPersistentKvStore((char*)"kv", &kv) == 1);
+	CHECK(persistentKvGet(&kv, 1, value, sizeof(value)) == 3 && !memcmp(value, "uno", 3));
+	CHECK(persistentKvGet(&kv, 2, value, sizeof(value)) == 3 && !memcmp(value, "two", 3));
+
+	CHECK(persistentKvRemove(&kv, 2) == 1);
+	CHECK(persistentKvRemove(&kv, 2) == 0);
+	CHECK(openPersistentKvStore((char*)"kv", &kv) == 1);
+	CHECK(persistentKvGet(&kv, 2, value, sizeof(value)) == 0);
+	CHECK(persistentKvGet(&kv, 1, value, sizeof(value)) == 3 && !memcmp(value, "uno", 3));
+
+	CHECK(openPersistentKvStore((char*)"none", &kv) == -1);
+	CHECK(persistentKvGet(&kv, 1, value, sizeof(value)) == -1);
+}
+
+//
+//  Putting the stored value writes nothing. When the active half is full
+//  the live records move to the other half, and a store whose live records
+//  do not fit a half refuses the put.
+//
+static void testCollect() {
+	struct persistentKvHandle kv;
+	struct persistentSimStats stats;
+	char value[16];
+
+	testFormatted(0, 0);
+	CHECK(newPersistentKvStore((char*)"kv", 64, &kv) > 0);
+	CHECK(persistentKvPut(&kv, 1, "abcd", 4) == 4);
+
+	persistentResetSimStats(&testSimDevice);
+	CHECK(persistentKvPut(&kv, 1, "abcd", 4) == 4);
+	persistentGetSimStats(&testSimDevice, &stats);
+	CHECK(stats.bytesProgrammed == 0);
+
+	for (uint8_t i = 0; i < 20; i++)
+		CHECK(persistentKvPut(&kv, 2, (char*)&i, 1) == 1);
+	CHECK(kv.generation > 0);
+
+	CHECK(openPersistentKvStore((char*)"kv", &kv) == 1);
+	CHECK(persistentKvGet(&kv, 1, value, sizeof(value)) == 4 && !memcmp(value, "abcd", 4));
+	CHECK(persistentKvGet(&kv, 2, value, sizeof(value)) == 1 && value[0] == 19);
+
+	CHECK(persistentKvPut(&kv, 3, "01234567", 8) == 8);
+	CHECK(persistentKvPut(&kv, 4, "x", 1) == -2);
+	CHECK(persistentKvGet(&kv, 4, value, sizeof(value)) == 0);
+}
+
+//
+//  A power cut at any byte of a sequence that collects several times
+//  leaves the store as it was before or after the operation that was cut.
+//  An append that was cut fails its CRC, a collection that was cut leaves
+//  the active half as it was.
+//
+static void testPowerCut() {
+	int moved = 0;
+
+	long total = testKvRun(1, -1, 0);
+	for (long budget = 0; budget <= total; budget++)
+		testKvRun(1, budget, &moved);
+	CHECK(moved > 0);
+
+	for (unsigned seed = 2; seed < 200; seed++) {
+		total = testKvRun(seed, -1, 0);
+		testKvRun(seed, rand() % (total + 1), 0);
+	}
+}
+
+int main() {
+	testPutGet();
+	testCollect();
+	testPowerCut();
+	return 0;
+}
@@ -0,0 +1,214 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <testMount.cpp> - Tests of mounting and checking the area chain.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+#include "TestSupport.h"
+
+#define TEST_AREAS  20
+
+//
+//  A mount counts the areas and freed cells and builds the index, so the
+//  lookups after it do not walk the chain.
+//
+static void testMountStats(uint8_t features) {
+	struct persistentMountStats stats;
+	char name[PERSISTENT_AREA_NAME_SIZE + 1];
+
+	testFormatted(0, features);
+	for (uint8_t i = 0; i < TEST_AREAS; i++) {
+		snprintf(name, sizeof(name), "sensor.ch%02u", i);
+		CHECK(newPersistentArea(name, 8 + i) > 0);
+	}
+	CHECK(freePersistentArea((char*)"sensor.ch03") > 0);
+	CHECK(freePersistentArea((char*)"sensor.ch10") > 0);
+
+	CHECK(persistentMount(&stats) == TEST_AREAS - 2);
+	CHECK(stats.areas == TEST_AREAS - 2 && stats.indexed == TEST_AREAS - 2);
+	CHECK(stats.freeCells == 2 && stats.badHeader == 0);
+
+	persistentResetSimStats(&testSimDevice);
+	for (uint8_t i = 0; i < TEST_AREAS; i++) {
+		snprintf(name, sizeof(name), "sensor.ch%02u", i);
+		CHECK((getPersistentAreaAddress(name) == 0) == (i == 3 || i == 10));
+	}
+
+	struct persistentSimStats sim;
+	persistentGetSimStats(&testSimDevice, &sim);
+	CHECK(sim.bytesRead <= (TEST_AREAS - 2) * PERSISTENT_AREA_NAME_SIZE);
+}
+
+//
+//  Bad headers stop the mount, the areas before them are still found.
+//
+static void testBadHeaders() {
+	struct persistentMountStats stats;
+	char name[PERSISTENT_AREA_NAME_SIZE + 1];
+
+	testFormatted(0, 0);
+	for (uint8_t i = 0; i < TEST_AREAS; i++) {
+		snprintf(name, sizeof(name), "sensor.ch%02u", i);
+		CHECK(newPersistentArea(name, 8 + i) > 0);
+	}
+
+	uint32_t header = getPersistentHeaderAddress((char*)"sensor.ch12");
+	uint8_t  saved[4];
+	memcpy(saved, testMemory + header, sizeof(saved));
+
+	testMemory[header] = 0;
+	testMemory[header + 1] = 0;
+	CHECK(persistentMount(&stats) == -2 && stats.badHeader == header && stats.areas == 12);
+	CHECK(getPersistentAreaAddress((char*)"sensor.ch05") != 0);
+
+	testMemory[header]     = 0xf0;
+	testMemory[header + 1] = 0x0f;
+	CHECK(persistentMount(&stats) == -1 && stats.badHeader == header);
+
+	memcpy(testMemory + header, saved, sizeof(saved));
+	testMemory[header + 2]++;
+	CHECK(persistentMount(&stats) == -3 && stats.badHeader == header);
+
+	memcpy(testMemory + header, saved, sizeof(saved));
+	CHECK(persistentMount(&stats) == TEST_AREAS);
+}
+
+//
+//  A corrupt next field can make the last cell run past the allocatable
+//  memory into the journal. Freeing the areas before it must then not
+//  merge them through the journal, nor may an area be resized in place,
+//  both would overwrite that cell.
+//
+static void testOverrun() {
+	struct persistentMountStats stats;
+
+	testFormatted(0, 0);
+
+	uint32_t endFree = getFreeStorageAreaEnd();
+	CHECK(newPersistentArea((char*)"a", 30) > 0);
+	CHECK(newPersistentArea((char*)"b", 30) > 0);
+	uint32_t c = getPersistentHeaderAddress((char*)"b") + PERSISTENT_AREA_PREFIX_SIZE + 30;
+	CHECK(newPersistentArea((char*)"c", endFree - c - PERSISTENT_AREA_PREFIX_SIZE) > 0);
+	CHECK(getPersistentHeaderAddress((char*)"c") == c);
+
+	//
+	//  Make "c" 10 bytes longer, into the journal
+	//
+	uint16_t next = testMemory[c] | testMemory[c + 1] << 8;
+	next += 10;
+	testMemory[c]     = (uint8_t)next;
+	testMemory[c + 1] = (uint8_t)(next >> 8);
+	for (uint32_t x = c + PERSISTENT_AREA_PREFIX_SIZE; x < c + next; x++)
+		testMemory[x] = (uint8_t)x;
+
+	uint8_t image[TEST_SIZE];
+	memcpy(image, testMemory, sizeof(image));
+
+	testReboot();
+	CHECK(persistentMount(&stats) == -1 && stats.badHeader == c);
+
+	CHECK(freePersistentArea((char*)"a") > 0);
+	CHECK(freePersistentArea((char*)"b") > 0);
+	CHECK(!memcmp(testMemory + c, image + c, next));
+
+	//
+	//  The same without a mount, the chain is walked on first use
+	//
+	memcpy(testMemory, image, sizeof(image));
+	testReboot();
+	CHECK(freePersistentArea((char*)"a") > 0);
+	CHECK(freePersistentArea((char*)"b") > 0);
+	CHECK(!memcmp(testMemory + c, image + c, next));
+
+	memcpy(testMemory, image, sizeof(image));
+	testReboot();
+	CHECK(resizePersistentArea((char*)"b", 20) != 1);
+	CHECK(freePersistentArea((char*)"a") > 0);
+	CHECK(resizePersistentArea((char*)"b", 40) != 1);
+	CHECK(!memcmp(testMemory + c, image + c, next));
+}
+
+//
+//  A batch walks the chain to check its names. A zero next field breaks
+//  the walk, the end of the chain is then not known and no area may be
+//  placed over the broken cell or the areas beyond it.
+//
+static void testBatchBroken() {
+	testFormatted(0, 0);
+	CHECK(newPersistentArea((char*)"a", 30) > 0);
+	CHECK(newPersistentArea((char*)"b", 30) > 0);
+	CHECK(newPersistentArea((char*)"c", 30) > 0);
+	testFill("c", 30, 0x40);
+
+	uint32_t b = getPersistentHeaderAddress((char*)"b");
+	uint8_t  saved[2];
+	memcpy(saved, testMemory + b, sizeof(saved));
+	testMemory[b]     = 0;
+	testMemory[b + 1] = 0;
+
+	uint8_t image[TEST_SIZE];
+	memcpy(image, testMemory, sizeof(image));
+	testReboot();
+
+	struct persistentAreaRequest areas[1];
+	memset(areas, 0, sizeof(areas));
+	areas[0].name = (char*)"x";
+	areas[0].size = 20;
+	newPersistentAreas(areas, 1);
+	CHECK(areas[0].handle.header != b);
+	CHECK(!memcmp(testMemory + b, image + b, 2 * (PERSISTENT_AREA_PREFIX_SIZE + 30)));
+
+	newPersistentArea((char*)"y", 20);
+	CHECK(!memcmp(testMemory + b, image + b, 2 * (PERSISTENT_AREA_PREFIX_SIZE + 30)));
+
+	memcpy(testMemory + b, saved, sizeof(saved));
+	persistentIndexReset();
+	testCheckFill("c", 30, 0x40, 30);
+}
+
+int main() {
+	testMountStats(0);
+	testMountStats(PERSISTENT_FEATURE_COMPACT);
+	testBadHeaders();
+	testOverrun();
+	testBatchBroken();
+	return 0;
+}
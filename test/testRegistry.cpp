@@ -0,0 +1,174 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <testRegistry.cpp> - Tests of the registered areas.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+
+#include "TestSupport.h"
+#include <PersistentRegistry.h>
+
+struct testSettings {
+	uint16_t volume;
+	uint8_t  mode;
+};
+
+struct testCalib {
+	int32_t offset[3];
+};
+
+constexpr struct persistentRegistryEntry testAreas[] = {
+	PERSISTENT_REGISTER        ("settings", struct testSettings),
+	PERSISTENT_REGISTER_CHECKED("calib",    struct testCalib, PERSISTENT_CHECK_CRC16, 2),
+	PERSISTENT_REGISTER        ("counter",  uint32_t),
+};
+enum { SETTINGS, CALIB, COUNTER };
+
+//
+//  The same table with the version of the calibration raised
+//
+constexpr struct persistentRegistryEntry testNewCalib[] = {
+	PERSISTENT_REGISTER        ("settings", struct testSettings),
+	PERSISTENT_REGISTER_CHECKED("calib",    struct testCalib, PERSISTENT_CHECK_CRC16, 3),
+	PERSISTENT_REGISTER        ("counter",  uint32_t),
+};
+
+typedef PERSISTENT_FIXED_AREA(struct testSettings, testAreas, SETTINGS) testSettingsArea;
+typedef PERSISTENT_FIXED_AREA(struct testCalib,    testAreas, CALIB)    testCalibArea;
+
+//
+//  Registered areas are created once at their constant addresses, hold
+//  their data over a reset and are found by name as well.
+//
+static void testBegin() {
+	struct testSettings settings = { 7, 1 };
+	struct testCalib    calib    = { { -1, 0, 1 } };
+
+	testVirgin(0);
+	CHECK(persistentRegistryBegin(testAreas, PERSISTENT_REGISTRY_COUNT(testAreas)) == -1);
+	CHECK(testSettingsArea::load(settings) == -1);
+	CHECK(testSettingsArea::store(settings) == 0);
+
+	testFormatted(0, PERSISTENT_FEATURE_COMPACT);
+	CHECK(persistentRegistryBegin(testAreas, PERSISTENT_REGISTRY_COUNT(testAreas)) == -1);
+
+	testFormatted(0, 0);
+	CHECK(persistentRegistryBegin(testAreas, 2) == 2);
+	CHECK(persistentRegistryBegin(testAreas, PERSISTENT_REGISTRY_COUNT(testAreas)) == 2);
+	CHECK(persistentRegistryReady());
+	CHECK(persistentAreaCount() == 3);
+	CHECK(testWalk(0) == 3);
+
+	for (uint8_t i = 0; i < PERSISTENT_REGISTRY_COUNT(testAreas); i++)
+		CHECK(getPersistentHeaderAddress((char*)testAreas[i].name) ==
+			  persistentRegistryHeader(testAreas, i));
+
+	CHECK(testSettingsArea::store(settings) == sizeof(settings));
+	CHECK(testCalibArea::store(calib) == sizeof(calib));
+	CHECK(newPersistentArea((char*)"dynamic", 8) > persistentRegistryData(testAreas, COUNTER));
+
+	testReboot();
+	memset(&settings, 0, sizeof(settings));
+	memset(&calib, 0, sizeof(calib));
+	CHECK(persistentRegistryBegin(testAreas, PERSISTENT_REGISTRY_COUNT(testAreas)) == 1);
+	CHECK(testSettingsArea::load(settings) == 1 && settings.volume == 7 && settings.mode == 1);
+	CHECK(testCalibArea::load(calib) == 1 && calib.offset[0] == -1 && calib.offset[2] == 1);
+	CHECK(persistentReadArea((char*)"settings", sizeof(settings), (char*)&settings) == 1);
+	CHECK(settings.volume == 7);
+}
+
+//
+//  A table that no longer matches persistent memory is refused: a changed
+//  version, an entry that is not at the end or an area appended after
+//  dynamic areas were allocated.
+//
+static void testMismatch() {
+	struct testSettings settings;
+
+	testFormatted(0, 0);
+	CHECK(persistentRegistryBegin(testAreas, PERSISTENT_REGISTRY_COUNT(testAreas)) == 2);
+
+	CHECK(persistentRegistryBegin(testNewCalib, PERSISTENT_REGISTRY_COUNT(testNewCalib)) == -2);
+	CHECK(!persistentRegistryReady());
+	CHECK(testSettingsArea::load(settings) == -1);
+
+	CHECK(persistentRegistryBegin(testAreas + 1, 2) == -2);
+
+	testFormatted(0, 0);
+	CHECK(persistentRegistryBegin(testAreas, 1) == 2);
+	CHECK(newPersistentArea((char*)"dynamic", 8) > 0);
+	CHECK(persistentRegistryBegin(testAreas, PERSISTENT_REGISTRY_COUNT(testAreas)) == -2);
+	CHECK(persistentRegistryBegin(testAreas, 1) == 1);
+}
+
+//
+//  Creating the areas cut at any byte leaves a store on which the
+//  registry starts after a reset, so the application never has to format.
+//  A header that was cut halfway is completed.
+//
+static void testPowerCut() {
+	struct testCalib calib = { { 1, 2, 3 } };
+
+	for (long budget = 0; ; budget++) {
+		testFormatted(&testCutBackend, 0);
+		testBudget = budget;
+		int16_t rv = persistentRegistryBegin(testAreas, PERSISTENT_REGISTRY_COUNT(testAreas));
+		bool    cut = testBudget == 0;
+
+		testReboot();
+		CHECK(persistentRegistryBegin(testAreas, PERSISTENT_REGISTRY_COUNT(testAreas)) > 0);
+		CHECK(testWalk(0) == 3);
+		CHECK(testCalibArea::store(calib) == sizeof(calib));
+		CHECK(testCalibArea::load(calib) == 1);
+
+		if (!cut) {
+			CHECK(rv == 2);
+			break;
+		}
+	}
+}
+
+int main() {
+	testBegin();
+	testMismatch();
+	testPowerCut();
+	return 0;
+}
@@ -0,0 +1,246 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <testResize.cpp> - Tests of resizing areas.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+
+#include "TestSupport.h"
+
+//
+//  Resizes in place at the end of the chain, into a free cell behind the
+//  area and by splitting one off, and relocates when there is no room.
+//
+static void testResize(uint8_t features) {
+	struct persistentAreaHandle handle;
+	int freeCells;
+
+	testFormatted(0, features);
+	CHECK(newPersistentArea((char*)"a", 40) > 0);
+	CHECK(newPersistentArea((char*)"b", 30) > 0);
+	CHECK(newPersistentArea((char*)"c", 50, &handle, PERSISTENT_CHECK_CRC16) > 0);
+	testFill("a", 40, 1);
+	testFill("b", 30, 2);
+	testFill("c", 50, 3);
+
+	CHECK(resizePersistentArea((char*)"c", 80) == 1);
+	testCheckFill("c", 80, 3, 50);
+	CHECK(resizePersistentArea((char*)"c", 20) == 1);
+	testCheckFill("c", 20, 3, 20);
+	CHECK(testWalk(&freeCells) == 3 && freeCells == 0);
+
+	CHECK(resizePersistentArea((char*)"a", 10) == 1);
+	testCheckFill("a", 10, 1, 10);
+	CHECK(testWalk(&freeCells) == 3 && freeCells == 1);
+	CHECK(resizePersistentArea((char*)"a", 15) == 1);
+	CHECK(resizePersistentArea((char*)"a", 40) == 1);
+	testCheckFill("a", 40, 1, 10);
+	CHECK(testWalk(&freeCells) == 3 && freeCells == 0);
+	testFill("a", 40, 1);
+
+	//
+	//  Too little room behind "b" for a free cell, it is relocated
+	//
+	CHECK(openPersistentArea((char*)"b", &handle) == 1);
+	uint32_t old = handle.data;
+	CHECK(resizePersistentArea(&handle, 29) == 2);
+	CHECK(handle.data != old && handle.size == 29);
+	CHECK(getPersistentAreaAddress((char*)"b") == handle.data);
+	testCheckFill("b", 29, 2, 29);
+	CHECK(testWalk(&freeCells) == 3 && freeCells == 1);
+
+	CHECK(resizePersistentArea((char*)"a", 100) == 2);
+	testCheckFill("a", 100, 1, 40);
+	CHECK(testWalk(0) == 3);
+	CHECK(persistentAreaCount() == 3);
+
+	testReboot();
+	testCheckFill("a", 100, 1, 40);
+	testCheckFill("b", 29, 2, 29);
+	testCheckFill("c", 20, 3, 20);
+
+	CHECK(resizePersistentArea((char*)"a", 5000) == -2);
+	CHECK(resizePersistentArea((char*)"zz", 5) == -1);
+
+	//
+	//  A checksum that does not match refuses the resize
+	//
+	CHECK(openPersistentArea((char*)"c", &handle) == 1);
+	testMemory[handle.data] ^= 1;
+	CHECK(resizePersistentArea(&handle, 30) == -3);
+	testMemory[handle.data] ^= 1;
+	CHECK(resizePersistentArea(&handle, 30) > 0);
+	testCheckFill("c", 30, 3, 20);
+	CHECK(persistentVerifyArea(&handle) == 1);
+}
+
+//
+//  The cases of testPowerCut(): the area resized, its old and new size,
+//  and the areas freed before.
+//
+struct testResizeCase {
+	const char* name;
+	uint16_t    oldSize;
+	uint16_t    newSize;
+	const char* freed;
+	int         result;
+};
+
+static const struct testResizeCase testCases[] = {
+	{ "a", 40, 60, "b", 1 },   // Grow into the free cell behind it
+	{ "a", 40, 20, "b", 1 },   // Shrink, merging with the free cell behind it
+	{ "e", 50, 90, 0,   1 },   // Grow at the end of the chain
+	{ "e", 50, 10, 0,   1 },   // Shrink at the end of the chain
+	{ "b", 30, 29, 0,   2 },   // Relocate to the end of the chain
+	{ "a", 40, 60, "d", 2 },   // Relocate to a freed cell, splitting it
+	{ "c", 20, 23, 0,   2 },   // Relocate an area with a checksum
+};
+
+//
+//  The same on an upgraded store. The upgrade copies "a" behind "e", the
+//  memory it leaves is a free cell too small for the areas relocated.
+//
+static const struct testResizeCase testUpgradeCases[] = {
+	{ "a", 40, 60, 0,   1 },   // Grow at the end of the chain
+	{ "b", 30, 10, 0,   1 },   // Shrink, splitting a free cell off
+	{ "e", 50, 10, "d", 1 },   // Shrink in front of the copy of "a"
+	{ "b", 30, 29, 0,   2 },   // Relocate to the end of the chain
+	{ "c", 20, 23, 0,   2 },   // Relocate an area with a checksum
+	{ "b", 30, 60, "d", 2 },   // Relocate to a freed cell, splitting it
+};
+
+//
+//  Cuts the power after every number of bytes programmed by a resize.
+//  After the reboot the area has its old or its new size, it keeps its
+//  data and checksum, it is in the chain once and freed cells read 0xff.
+//  An upgraded store is upgraded from one that was not formatted, after
+//  the areas were allocated.
+//
+static void testPowerCut(uint8_t features, bool upgraded, const struct testResizeCase* test) {
+	struct persistentAreaHandle handle;
+
+	for (long budget = 0; ; budget++) {
+		if (upgraded)
+			testVirgin(&testCutBackend);
+		else
+			testFormatted(&testCutBackend, features);
+		CHECK(newPersistentArea((char*)"a", 40) > 0);
+		CHECK(newPersistentArea((char*)"b", 30) > 0);
+		CHECK(newPersistentArea((char*)"c", 20, &handle, PERSISTENT_CHECK_CRC16) > 0);
+		CHECK(newPersistentArea((char*)"d", 100) > 0);
+		CHECK(newPersistentArea((char*)"e", 50) > 0);
+		testFill("a", 40, 1);
+		testFill("b", 30, 2);
+		testFill("c", 20, 3);
+		testFill("e", 50, 5);
+		if (upgraded)
+			CHECK(persistentUpgrade() == 1);
+		if (test->freed)
+			CHECK(freePersistentArea((char*)test->freed) > 0);
+
+		int areas = test->freed ? 4 : 5;
+		uint8_t value = (uint8_t)(test->name[0] - 'a' + 1);
+
+		testBudget = budget;
+		int16_t rc = resizePersistentArea((char*)test->name, test->newSize);
+		bool cut = (testBudget == 0);
+
+		testReboot();
+		CHECK(testWalk(0) == areas);
+		CHECK(persistentAreaCount() == areas);
+
+		CHECK(openPersistentArea((char*)test->name, &handle) == 1);
+		CHECK(handle.size == test->oldSize || handle.size == test->newSize);
+		uint16_t keep = test->oldSize < test->newSize ? test->oldSize : test->newSize;
+		testCheckFill(test->name, handle.size, value, handle.size == test->oldSize ? test->oldSize : keep);
+		CHECK(persistentVerifyArea(&handle) >= 0);
+
+		if (!cut) {
+			CHECK(rc == test->result && handle.size == test->newSize);
+			break;
+		}
+	}
+}
+
+//
+//  A store that was not formatted has no journal, it cannot resize until
+//  it is upgraded
+//
+static void testUnformatted() {
+	struct persistentAreaHandle handle;
+
+	testVirgin(0);
+	CHECK(newPersistentArea((char*)"a", 40) > 0);
+	CHECK(newPersistentArea((char*)"b", 30) > 0);
+	CHECK(newPersistentArea((char*)"c", 20, &handle, PERSISTENT_CHECK_CRC16) > 0);
+	testFill("a", 40, 1);
+	testFill("b", 30, 2);
+	testFill("c", 20, 3);
+	CHECK(resizePersistentArea((char*)"a", 20) == -5);
+	CHECK(resizePersistentArea((char*)"a", 40) == 1);
+
+	CHECK(persistentUpgrade() == 1);
+	CHECK(resizePersistentArea((char*)"a", 80) == 1);
+	CHECK(resizePersistentArea((char*)"b", 29) == 2);
+	CHECK(resizePersistentArea((char*)"c", 30) == 2);
+
+	testReboot();
+	testCheckFill("a", 80, 1, 40);
+	testCheckFill("b", 29, 2, 29);
+	testCheckFill("c", 30, 3, 20);
+	CHECK(openPersistentArea((char*)"c", &handle) == 1);
+	CHECK(persistentVerifyArea(&handle) == 1);
+	CHECK(testWalk(0) == 3);
+	CHECK(persistentAreaCount() == 3);
+}
+
+int main() {
+	for (uint8_t features = 0; features <= PERSISTENT_FEATURE_COMPACT; features += PERSISTENT_FEATURE_COMPACT) {
+		testResize(features);
+		for (uint8_t i = 0; i < sizeof(testCases) / sizeof(testCases[0]); i++)
+			testPowerCut(features, false, &testCases[i]);
+	}
+
+	testUnformatted();
+	for (uint8_t i = 0; i < sizeof(testUpgradeCases) / sizeof(testUpgradeCases[0]); i++)
+		testPowerCut(0, true, &testUpgradeCases[i]);
+	return 0;
+}
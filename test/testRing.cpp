@@ -0,0 +1,140 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <testRing.cpp> - Tests of the ring buffer areas.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+#include "TestSupport.h"
+
+//
+//  A new ring holds no records, on an erased device for every record size
+//  and on memory that held other data before.
+//
+static void testFreshRings() {
+	struct persistentRingHandle ring;
+
+	for (uint16_t recordSize = 1; recordSize <= 1200; recordSize++) {
+		testFormatted(0, 0);
+		CHECK(newPersistentRingArea((char*)"log", recordSize, 2, &ring) > 0);
+		CHECK(persistentRingCount(&ring) == 0);
+		CHECK(openPersistentRingArea((char*)"log", recordSize, &ring) == 1);
+		CHECK(persistentRingCount(&ring) == 0);
+	}
+
+	srand(20);
+	testFormatted(0, 0);
+	for (uint16_t n = 0; n < 500; n++) {
+		uint16_t recordSize = 1 + rand() % 40;
+		uint16_t slots      = 1 + rand() % 8;
+		uint16_t size       = slots * (PERSISTENT_RING_SLOT_PREFIX + recordSize);
+		char     junk[400];
+
+		for (uint16_t i = 0; i < size; i++)
+			junk[i] = (char)rand();
+
+		CHECK(newPersistentArea((char*)"junk", size) > 0);
+		CHECK(persistentWriteArea((char*)"junk", size, junk) == size);
+		CHECK(freePersistentArea((char*)"junk") > 0);
+
+		CHECK(newPersistentRingArea((char*)"log", recordSize, slots, &ring) > 0);
+		CHECK(persistentRingCount(&ring) == 0);
+		CHECK(freePersistentArea((char*)"log") > 0);
+	}
+}
+
+//
+//  Appends go on in order when the sequence number wraps, also after the
+//  ring is opened again.
+//
+static void testWrap() {
+	struct persistentRingHandle ring;
+	uint32_t value;
+
+	testFormatted(0, 0);
+	CHECK(newPersistentRingArea((char*)"log", sizeof(value), 3, &ring) > 0);
+
+	for (value = 0; value < 0x10000 + 10; value++) {
+		CHECK(persistentRingAppend(&ring, sizeof(value), (char*)&value) == sizeof(value));
+
+		if (value % 1000 == 0 || value >= 0xfffc) {
+			CHECK(openPersistentRingArea((char*)"log", sizeof(value), &ring) == 1);
+
+			uint16_t count = persistentRingCount(&ring);
+			CHECK(count == (value < 2 ? value + 1 : 3));
+			for (uint16_t i = 0; i < count; i++) {
+				uint32_t record;
+				CHECK(persistentRingRead(&ring, i, sizeof(record), (char*)&record) == 1);
+				CHECK(record == value - count + 1 + i);
+			}
+		}
+	}
+}
+
+//
+//  Discarded records stay discarded and appending continues after them.
+//
+static void testDiscard() {
+	struct persistentRingHandle ring;
+	uint16_t value;
+
+	testFormatted(0, 0);
+	CHECK(newPersistentRingArea((char*)"log", sizeof(value), 4, &ring) > 0);
+	for (value = 1; value <= 3; value++)
+		CHECK(persistentRingAppend(&ring, sizeof(value), (char*)&value) == sizeof(value));
+
+	CHECK(persistentRingDiscard(&ring, 2) == 2);
+	CHECK(openPersistentRingArea((char*)"log", sizeof(value), &ring) == 1);
+	CHECK(persistentRingCount(&ring) == 1);
+
+	value = 4;
+	CHECK(persistentRingAppend(&ring, sizeof(value), (char*)&value) == sizeof(value));
+	CHECK(openPersistentRingArea((char*)"log", sizeof(value), &ring) == 1);
+	CHECK(persistentRingCount(&ring) == 2);
+	CHECK(persistentRingRead(&ring, 0, sizeof(value), (char*)&value) == 1 && value == 3);
+	CHECK(persistentRingRead(&ring, 1, sizeof(value), (char*)&value) == 1 && value == 4);
+}
+
+int main() {
+	testFreshRings();
+	testWrap();
+	testDiscard();
+	return 0;
+}
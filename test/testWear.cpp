@@ -0,0 +1,197 @@
+/*-------------------------------------------------------------------------------------------------
+
+
+       /////// ////// //////  //////   /////     /////    ////  //    //
+         //   //     //   // //   // //   //    //  //  //   // // //
+        //   ////   //////  //////  ///////    /////   //   //   //
+       //   //     //  //  // //   //   //    //   // //   //  // //
+      //   ////// //   // //   // //   //    //////    ////  //   //
+
+     
+               A R D U I N O   E E P R O M   M A N A G E M E N T
+
+
+                 (C) 2024, C. Hofman - cor.hofman@terrabox.nl
+
+    <testWear.cpp> - Tests of the wear leveled areas.
+                               16 Oct 2026
+                       Released into the public domain
+              as GitHub project: TerraboxNL/TerraBox_Persistence
+                   under the GNU General public license V3.0
+                          
+      This program is free software: you can redistribute it and/or modify
+      it under the terms of the GNU General Public License as published by
+      the Free Software Foundation, either version 3 of the License, or
+      (at your option) any later version.
+
+      This program is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+      GNU General Public License for more details.
+
+      You should have received a copy of the GNU General Public License
+      along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ *---------------------------------------------------------------------------*
+ *
+ *  C H A N G E  L O G :
+ *  ==========================================================================
+ *  P0001 - Initial release 
+ *  ==========================================================================
+ *
+ *--------------------------------------------------------------------------*/
+
+
+
+#include "TestSupport.h"
+
+#define TEST_DATA    6
+#define TEST_WRITES  24
+
+/**----------------------------------------------------------------------------
+ *
+ *  Writes a random sequence of data to a new wear leveled area, with the
+ *  power cut after budget programmed bytes, -1 for no cut. After a reboot
+ *  the area must hold the data from before the write that was cut, or the
+ *  data from after it, and take new data.
+ *
+ * @param slots   Slots of the area
+ * @param seed    Seed of the sequence
+ * @param budget  Bytes programmed before the power is cut
+ *
+ * @return  The bytes the sequence programmed, if it was not cut
+ *
+ *---------------------------------------------------------------------------*/
+static long testWearRun(uint8_t slots, unsigned seed, long budget) {
+	static char written[TEST_WRITES + 1][TEST_DATA];
+	struct persistentWearHandle wear;
+	char data[TEST_DATA];
+
+	testFormatted(&testCutBackend, 0);
+	CHECK(newPersistentWearArea((char*)"wear", TEST_DATA, slots, &wear) > 0);
+	memset(written[0], 0x11, TEST_DATA);
+	CHECK(persistentWriteWearArea(&wear, TEST_DATA, written[0]) == TEST_DATA);
+
+	//
+	//  Once the power is cut writes fail, only the data left behind counts
+	//
+	srand(seed);
+	testBudget = budget < 0 ? 1L << 30 : budget;
+
+	int cut = testBudget == 0 ? 0 : TEST_WRITES;
+	for (int i = 0; i < TEST_WRITES; i++) {
+		long before = testBudget;
+
+		for (uint8_t n = 0; n < TEST_DATA; n++)
+			written[i + 1][n] = (char)rand();
+		CHECK(persistentWriteWearArea(&wear, TEST_DATA, written[i + 1]) == TEST_DATA ||
+			  testBudget == 0);
+
+		if (before > 0 && testBudget == 0)
+			cut = i;
+	}
+
+	long used = (1L << 30) - testBudget;
+
+	testReboot();
+	CHECK(openPersistentWearArea((char*)"wear", TEST_DATA, &wear) == 1);
+	CHECK(persistentReadWearArea(&wear, TEST_DATA, data) == 1);
+	CHECK(!memcmp(data, written[cut], TEST_DATA) ||
+		  (cut < TEST_WRITES && !memcmp(data, written[cut + 1], TEST_DATA)));
+
+	//
+	//  The area goes on after the cut with the next slot
+	//
+	CHECK(persistentWriteWearArea(&wear, sizeof(seed), (char*)&seed) == 0);
+	memset(data, (char)seed, TEST_DATA);
+	CHECK(persistentWriteWearArea(&wear, TEST_DATA, data) == TEST_DATA);
+
+	testReboot();
+	CHECK(openPersistentWearArea((char*)"wear", TEST_DATA, &wear) == 1);
+	CHECK(persistentReadWearArea(&wear, TEST_DATA, written[0]) == 1);
+	CHECK(!memcmp(data, written[0], TEST_DATA));
+
+	return used;
+}
+
+//
+//  A new area needs two slots and holds no data. Writes go round robin over
+//  the slots and the newest data is found again when the area is opened.
+//
+static void testWrite() {
+	struct persistentWearHandle wear;
+	struct persistentSimStats stats;
+	uint32_t value;
+
+	testFormatted(0, 0);
+	CHECK(newPersistentWearArea((char*)"wear", sizeof(value), 1, &wear) == 0);
+	CHECK(newPersistentWearArea((char*)"wear", sizeof(value), 4, &wear) > 0);
+	CHECK(persistentReadWearArea(&wear, sizeof(value), (char*)&value) == 0);
+	CHECK(persistentReadWearArea(&wear, 2, (char*)&value) == -2);
+	CHECK(persistentWearCycles(&wear) == 0);
+
+	for (value = 0; value < 100; value++) {
+		CHECK(persistentWriteWearArea(&wear, sizeof(value), (char*)&value) == sizeof(value));
+		CHECK(wear.newest == value % 4);
+	}
+	CHECK(persistentWearCycles(&wear) == 99 / 4 + 1);
+
+	persistentResetSimStats(&testSimDevice);
+	value = 99;
+	CHECK(persistentWriteWearArea(&wear, sizeof(value), (char*)&value) == sizeof(value));
+	persistentGetSimStats(&testSimDevice, &stats);
+	CHECK(stats.bytesProgrammed == 0);
+
+	CHECK(openPersistentWearArea((char*)"wear", sizeof(value), &wear) == 1);
+	CHECK(persistentReadWearArea(&wear, sizeof(value), (char*)&value) == 1 && value == 99);
+	CHECK(wear.newest == 3 && wear.sequence == 99);
+
+	CHECK(openPersistentWearArea((char*)"wear", 3, &wear) == -2);
+	CHECK(openPersistentWearArea((char*)"none", sizeof(value), &wear) == -1);
+	CHECK(persistentReadWearArea(&wear, sizeof(value), (char*)&value) == -1);
+}
+
+//
+//  Memory of a freed area does not show up as data of a new area.
+//
+static void testReuse() {
+	struct persistentWearHandle wear;
+	char junk[3 * (PERSISTENT_WEAR_SLOT_PREFIX + TEST_DATA)];
+
+	testFormatted(0, 0);
+	CHECK(newPersistentWearArea((char*)"old", TEST_DATA, 3, &wear) > 0);
+	for (uint8_t i = 0; i < 5; i++) {
+		memset(junk, i, TEST_DATA);
+		CHECK(persistentWriteWearArea(&wear, TEST_DATA, junk) == TEST_DATA);
+	}
+	CHECK(freePersistentArea((char*)"old") > 0);
+
+	CHECK(newPersistentWearArea((char*)"new", TEST_DATA, 3, &wear) > 0);
+	CHECK(persistentReadWearArea(&wear, TEST_DATA, junk) == 0);
+}
+
+//
+//  A power cut at any byte of a sequence of writes leaves the data from
+//  before or after the write that was cut. The data is written before the
+//  sequence number, a slot that was cut does not match its check byte.
+//  The slot written holds older data, so it takes two slots.
+//
+static void testPowerCut() {
+	for (uint8_t slots = 2; slots <= 4; slots++) {
+		long total = testWearRun(slots, slots, -1);
+		for (long budget = 0; budget <= total; budget++)
+			testWearRun(slots, slots, budget);
+
+		for (unsigned seed = 10; seed < 100; seed++) {
+			total = testWearRun(slots, seed, -1);
+			testWearRun(slots, seed, rand() % (total + 1));
+		}
+	}
+}
+
+int main() {
+	testWrite();
+	testReuse();
+	testPowerCut();
+	return 0;
+}